@@ -0,0 +1,89 @@
+#include "crc16.hpp"
+#include <cstdint>
+#include <cstring>
+#include <stmepic.hpp>
+
+using namespace stmepic::algorithm;
+using namespace stmepic;
+
+constinit const CRC16::Tables CRC16::crc16_tables = CRC16::make_tables();
+
+CRC16::CRC16() {
+#if defined(HAL_CRC_MODULE_ENABLED) && defined(CRC_POLYLENGTH_16B)
+  hcrc       = nullptr;
+  hcrc_mutex = nullptr;
+#endif
+}
+
+CRC16 &CRC16::get_instance() {
+  static CRC16 instance;
+  return instance;
+}
+
+#if defined(HAL_CRC_MODULE_ENABLED) && defined(CRC_POLYLENGTH_16B)
+Status CRC16::init(CRC_HandleTypeDef &hcrc) {
+  if(hcrc_mutex == nullptr)
+    hcrc_mutex = xSemaphoreCreateMutex();
+  if(hcrc_mutex == nullptr)
+    return Status::OutOfMemory("Failed to create the CRC peripheral mutex");
+
+  hcrc.Init.DefaultPolynomialUse    = DEFAULT_POLYNOMIAL_DISABLE;
+  hcrc.Init.DefaultInitValueUse     = DEFAULT_INIT_VALUE_DISABLE;
+  hcrc.Init.GeneratingPolynomial    = CRC16_POLYNOMIAL;
+  hcrc.Init.CRCLength               = CRC_POLYLENGTH_16B;
+  hcrc.Init.InitValue               = CRC16_INIT;
+  hcrc.Init.InputDataInversionMode  = CRC_INPUTDATA_INVERSION_NONE;
+  hcrc.Init.OutputDataInversionMode = CRC_OUTPUTDATA_INVERSION_DISABLE;
+  hcrc.InputDataFormat              = CRC_INPUTDATA_FORMAT_BYTES;
+  if(HAL_CRC_Init(&hcrc) != HAL_OK) {
+    this->hcrc = nullptr;
+    return Status::HalError("Failed to initialize CRC peripheral");
+  }
+  this->hcrc = &hcrc;
+  return Status::OK();
+}
+#endif
+
+Status CRC16::init() {
+  return Status::OK();
+}
+
+uint16_t CRC16::crc16(const void *data, size_t len, uint16_t crc) {
+#if defined(HAL_CRC_MODULE_ENABLED) && defined(CRC_POLYLENGTH_16B)
+  // the peripheral is used only when it is free, the other callers don't wait for it
+  if(hcrc != nullptr && xSemaphoreTake(hcrc_mutex, 0) == pdTRUE) {
+    __HAL_CRC_INITIALCRCVALUE_CONFIG(hcrc, crc);
+    crc = (uint16_t)HAL_CRC_Calculate(hcrc, (uint32_t *)data, (uint32_t)len);
+    xSemaphoreGive(hcrc_mutex);
+    return crc;
+  }
+#endif
+  return crc16_software(data, len, crc);
+}
+
+uint16_t CRC16::crc16_software(const void *data, size_t len, uint16_t crc) {
+  const uint8_t *bytes = (const uint8_t *)data;
+  while(len >= 4) {
+    crc = crc16_tables[3][bytes[0] ^ (crc >> 8)] ^ crc16_tables[2][bytes[1] ^ (crc & 0xFF)] ^
+          crc16_tables[1][bytes[2]] ^ crc16_tables[0][bytes[3]];
+    bytes += 4;
+    len -= 4;
+  }
+  while(len-- > 0)
+    crc = (uint16_t)(crc << 8) ^ crc16_tables[0][*bytes++ ^ (crc >> 8)];
+  return crc;
+}
+
+uint16_t CRC16::crc16_bitwise(const void *data, size_t len, uint16_t crc) {
+  const uint8_t *bytes = (const uint8_t *)data;
+  for(size_t i = 0; i < len; i++) {
+    crc ^= (uint16_t)bytes[i] << 8;
+    for(int b = 0; b < 8; ++b) {
+      if(crc & 0x8000)
+        crc = (crc << 1) ^ CRC16_POLYNOMIAL;
+      else
+        crc <<= 1;
+    }
+  }
+  return crc;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "stmepic.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+
+/**
+ * @file crc16.hpp
+ * @brief CRC-16/CCITT (polynomial 0x1021, initial value 0xFFFF) with the table driven software
+ * version and the STM32 CRC peripheral backend.
+ */
+
+/**
+ * @defgroup Hash
+ * @brief Hashing algorithms like SHA256 etc.
+ *
+ * @{
+ */
+
+namespace stmepic::algorithm {
+
+/// @brief Generate CRC-16/CCITT (CCITT-FALSE: no reflection, no final xor) from provided data
+///
+/// With Hardware acceleration if available. The software version uses slice-by-4 tables,
+/// 4 bytes per step with 4 table lookups instead of 8 shifts per byte of the bitwise version.
+class CRC16 {
+public:
+  /// @brief Generate CRC-16/CCITT from provided data
+  ///
+  /// With Hardware acceleration if available
+  CRC16();
+
+  /// @brief The polynomial of the CRC
+  static const uint16_t CRC16_POLYNOMIAL = 0x1021;
+
+  /// @brief The initial value of the CRC
+  static const uint16_t CRC16_INIT = 0xFFFF;
+
+  static CRC16 &get_instance();
+
+#if defined(HAL_CRC_MODULE_ENABLED) && defined(CRC_POLYLENGTH_16B)
+  /// @brief Use the CRC peripheral, the peripheral is configured for the CRC16_POLYNOMIAL.
+  /// Only the peripherals with the programmable polynomial are supported (F0, F3, F7, G0, G4, H7, L4...).
+  Status init(CRC_HandleTypeDef &hcrc);
+#endif
+
+  Status init();
+
+  /// @brief Generate the CRC from provided data, with the CRC peripheral if it was initialized
+  /// and it is not used by the other task at the moment, otherwise in software.
+  /// @param data the data
+  /// @param len the size of the data
+  /// @param crc the initial value, the CRC of the previous part of the data to continue the calculation
+  /// @return the CRC of the data
+  uint16_t crc16(const void *data, size_t len, uint16_t crc = CRC16_INIT);
+
+  /// @brief Generate the CRC in software with the slice-by-4 tables
+  static uint16_t crc16_software(const void *data, size_t len, uint16_t crc = CRC16_INIT);
+
+  /// @brief Generate the CRC bit by bit, the reference implementation
+  static uint16_t crc16_bitwise(const void *data, size_t len, uint16_t crc = CRC16_INIT);
+
+private:
+  /// @brief table[k][b] is the CRC of the byte b followed by k zero bytes
+  using Tables = std::array<std::array<uint16_t, 256>, 4>;
+
+  static constexpr Tables make_tables() {
+    Tables tables{};
+    for(uint32_t b = 0; b < 256; b++) {
+      uint16_t crc = (uint16_t)(b << 8);
+      for(int i = 0; i < 8; i++)
+        crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ CRC16_POLYNOMIAL) : (uint16_t)(crc << 1);
+      tables[0][b] = crc;
+    }
+    for(size_t k = 1; k < tables.size(); k++)
+      for(uint32_t b = 0; b < 256; b++)
+        tables[k][b] = (uint16_t)(tables[k - 1][b] << 8) ^ tables[0][tables[k - 1][b] >> 8];
+    return tables;
+  }
+
+  static const Tables crc16_tables;
+
+#if defined(HAL_CRC_MODULE_ENABLED) && defined(CRC_POLYLENGTH_16B)
+  CRC_HandleTypeDef *hcrc;
+  SemaphoreHandle_t hcrc_mutex;
+#endif
+};
+
+} // namespace stmepic::algorithm
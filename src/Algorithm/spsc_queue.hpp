@@ -0,0 +1,90 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+
+/**
+ * @file spsc_queue.hpp
+ * @brief Lock-free single producer single consumer queue.
+ */
+
+namespace stmepic::algorithm {
+
+/**
+ * @class SpscQueue
+ * @brief Fixed size lock-free ring buffer for one producer and one consumer.
+ *
+ * push() can be called from one task (or ISR) and pop() / peek() from another without any
+ * critical sections. Head is written only by the consumer and tail only by the producer,
+ * the acquire/release ordering makes the element written before the index update visible
+ * on the other side.
+ *
+ * @tparam T type of the elements, has to be copy assignable
+ * @tparam N capacity of the queue, has to be a power of 2
+ */
+template <typename T, size_t N> class SpscQueue {
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "SpscQueue<T, N> requires N to be a power of 2");
+
+public:
+  SpscQueue() : head(0), tail(0) {
+  }
+
+  /// @brief Capacity of the queue
+  static constexpr size_t capacity() {
+    return N;
+  }
+
+  /// @brief Add element at the end of the queue, producer side only.
+  /// @return false if the queue is full
+  bool push(const T &item) {
+    const size_t t = tail.load(std::memory_order_relaxed);
+    if(t - head.load(std::memory_order_acquire) >= N)
+      return false;
+    buffer[t & (N - 1)] = item;
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// @brief Remove the first element of the queue, consumer side only.
+  /// @return false if the queue is empty
+  bool pop(T &item) {
+    const size_t h = head.load(std::memory_order_relaxed);
+    if(h == tail.load(std::memory_order_acquire))
+      return false;
+    item = buffer[h & (N - 1)];
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// @brief Access the element at index from the front without removing it, consumer side only.
+  /// @return nullptr if there are not enough elements in the queue
+  const T *peek(size_t index = 0) const {
+    const size_t h = head.load(std::memory_order_relaxed);
+    if(tail.load(std::memory_order_acquire) - h <= index)
+      return nullptr;
+    return &buffer[(h + index) & (N - 1)];
+  }
+
+  /// @brief Remove all elements, consumer side only.
+  void clear() {
+    head.store(tail.load(std::memory_order_acquire), std::memory_order_release);
+  }
+
+  /// @brief Number of elements in the queue, exact only from the producer or the consumer side.
+  size_t size() const {
+    return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+  }
+
+  bool empty() const {
+    return size() == 0;
+  }
+
+private:
+  std::array<T, N> buffer;
+  std::atomic<size_t> head;
+  std::atomic<size_t> tail;
+};
+
+} // namespace stmepic::algorithm
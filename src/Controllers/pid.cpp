@@ -32,6 +32,11 @@ void Pid::init() {
   lastOutput = 0;
   setpoint   = 0;
   firstRun   = true;
+
+  iTerm               = 0;
+  dTerm               = 0;
+  lastDerivativeInput = 0;
+  lastTimeUs          = 0;
 }
 
 //**********************************
@@ -125,6 +130,10 @@ void Pid::setConfig(const PidConfig &cfg) {
   setOutputRampRate(cfg.outputRampRate);
   setOutputFilter(cfg.outputFilter);
   setSetpointRange(cfg.setpointRange);
+  setDerivativeFilter(cfg.derivativeFilter);
+  setAntiWindupGain(cfg.antiWindupGain);
+  setSetpointWeights(cfg.setpointWeightP, cfg.setpointWeightD);
+  setTimeScaledGains(cfg.timeScaledGains);
 }
 
 const PidConfig &Pid::getConfig() const {
@@ -251,12 +260,108 @@ double Pid::getOutput(double actual) {
   return getOutput(actual, setpoint);
 }
 
+/** Calculate the PID value with explicit time step.
+ * Unlike getOutput(actual, setpoint) the I and D terms are scaled by dt so the
+ * controller behaves the same when the loop period jitters or changes.
+ * @param actual The monitored value
+ * @param setpoint The target value
+ * @param dt time since the previous call in seconds
+ * @return calculated output value for driving the actual to the target
+ */
+double Pid::getOutput(double actual, double setpoint, double dt) {
+  this->setpoint = setpoint;
+  if(!(dt > 0))
+    dt = 0;
+
+  if(conf.setpointRange != 0) {
+    setpoint = clamp(setpoint, actual - conf.setpointRange, actual + conf.setpointRange);
+  }
+
+  double error           = setpoint - actual;
+  double derivativeInput = conf.setpointWeightD * setpoint - actual;
+  double Foutput         = conf.f * setpoint;
+  double Poutput         = conf.p * (conf.setpointWeightP * setpoint - actual);
+
+  if(firstRun) {
+    lastActual          = actual;
+    lastDerivativeInput = derivativeInput;
+    lastOutput          = Poutput + Foutput;
+    dTerm               = 0;
+    firstRun            = false;
+  }
+
+  // the per-step gains are the time scaled gains with the step of 1
+  const double gainDt = conf.timeScaledGains ? dt : (dt > 0 ? 1.0 : 0.0);
+
+  // D term, derivative of the weighted error passed through first-order low-pass filter
+  if(dt > 0) {
+    double rawD = conf.d * (derivativeInput - lastDerivativeInput) / gainDt;
+    if(conf.derivativeFilter > 0) {
+      dTerm += dt / (conf.derivativeFilter + dt) * (rawD - dTerm);
+    } else {
+      dTerm = rawD;
+    }
+  }
+  lastDerivativeInput = derivativeInput;
+  lastActual          = actual;
+
+  double unsaturated = Foutput + Poutput + iTerm + dTerm;
+  double output      = unsaturated;
+
+  if(conf.outputRampRate != 0) {
+    output = clamp(output, lastOutput - conf.outputRampRate, lastOutput + conf.outputRampRate);
+  }
+  if(conf.minOutput != conf.maxOutput) {
+    output = clamp(output, conf.minOutput, conf.maxOutput);
+  }
+
+  // I term is kept in output units, so changing the I gain doesn't bump the output.
+  // Back-calculation bleeds off the integral while the output is saturated.
+  iTerm += (conf.i * error + conf.antiWindupGain * (output - unsaturated)) * gainDt;
+  if(conf.maxIOutput != 0) {
+    iTerm = clamp(iTerm, -conf.maxIOutput, conf.maxIOutput);
+  }
+
+  if(conf.outputFilter != 0) {
+    output = lastOutput * conf.outputFilter + output * (1 - conf.outputFilter);
+  }
+
+  lastOutput = output;
+  return output;
+}
+
+PidConfig Pid::timeScaled(const PidConfig &config, double period_s) {
+  PidConfig scaled = config;
+  if(config.timeScaledGains || !(period_s > 0))
+    return scaled;
+  scaled.i               = config.i / period_s;
+  scaled.antiWindupGain  = config.antiWindupGain / period_s;
+  scaled.d               = config.d * period_s;
+  scaled.timeScaledGains = true;
+  return scaled;
+}
+
+/**
+ * Calculates the PID value with dt measured by the global Ticker since the previous call.
+ * @param actual The monitored value
+ * @param setpoint The target value
+ * @return calculated output value for driving the actual to the target
+ */
+double Pid::getOutputTimed(double actual, double setpoint) {
+  uint32_t now = Ticker::get_instance().get_micros();
+  double dt    = firstRun ? 0.0 : (double)(uint32_t)(now - lastTimeUs) * 0.000001;
+  lastTimeUs   = now;
+  return getOutput(actual, setpoint, dt);
+}
+
 /**
  * Resets the controller. this->erases the I term buildup, and removes D gain on the next loop.
  */
 void Pid::reset() {
   firstRun = true;
   errorSum = 0;
+  iTerm    = 0;
+  dTerm    = 0;
 }
 
 /**Set the maximum rate the output can increase per cycle.
@@ -283,6 +388,23 @@ void Pid::setOutputFilter(double strength) {
   }
 }
 
+void Pid::setTimeScaledGains(bool time_scaled) {
+  conf.timeScaledGains = time_scaled;
+}
+
+void Pid::setDerivativeFilter(double time_constant) {
+  conf.derivativeFilter = time_constant > 0 ? time_constant : 0;
+}
+
+void Pid::setAntiWindupGain(double gain) {
+  conf.antiWindupGain = gain < 0 ? -gain : gain;
+}
+
+void Pid::setSetpointWeights(double weight_p, double weight_d) {
+  conf.setpointWeightP = weight_p;
+  conf.setpointWeightD = weight_d;
+}
+
 //**************************************
 // Helper functions
 //**************************************
@@ -30,6 +30,13 @@ struct PidConfig {
   double outputRampRate = 0.0;
   double outputFilter   = 0.0;
   double setpointRange  = 0.0;
+
+  // used only by the time-aware getOutput(actual, setpoint, dt)
+  double derivativeFilter = 0.0;   // time constant of the derivative low-pass filter [s], 0 disables it
+  double antiWindupGain   = 0.0;   // back-calculation tracking gain, per step or [1/s] with timeScaledGains
+  double setpointWeightP  = 1.0;   // setpoint weight of the P term
+  double setpointWeightD  = 0.0;   // setpoint weight of the D term, 0 means derivative on measurement
+  bool timeScaledGains    = false; // gains per second instead of per step, see Pid::timeScaled()
 };
 
 class Pid {
@@ -132,12 +139,79 @@ public:
 
   void setOutputFilter(double);
 
+  /**
+   * @brief Select the units of the I, D and anti-windup gains of getOutput(actual, setpoint, dt).
+   * @param time_scaled true for the gains per second (I integrated and D differentiated over dt),
+   * false for the per-step gains of getOutput(actual, setpoint)
+   */
+  void setTimeScaledGains(bool time_scaled);
+
+  /**
+   * @brief Set the time constant of the first-order low-pass filter on the derivative term.
+   * Used only by the time-aware getOutput(actual, setpoint, dt).
+   * @param time_constant filter time constant in seconds, 0 disables the filter
+   */
+  void setDerivativeFilter(double time_constant);
+
+  /**
+   * @brief Set the back-calculation anti-windup gain.
+   * Used only by the time-aware getOutput(actual, setpoint, dt). When the output is saturated
+   * the I term is driven back by <b>gain*(saturated_output-unsaturated_output)</b> each step
+   * (multiplied by dt with the time scaled gains). Good starting value is i/p.
+   * @param gain tracking gain per step or in 1/s with the time scaled gains, 0 disables back-calculation
+   */
+  void setAntiWindupGain(double gain);
+
+  /**
+   * @brief Set the setpoint weights of the P and D terms.
+   * Used only by the time-aware getOutput(actual, setpoint, dt).
+   * P term is calculated from <b>weight_p*setpoint-actual</b> and D term from
+   * <b>weight_d*setpoint-actual</b>, the I term always uses the full error.
+   * @param weight_p setpoint weight of the P term, 1 is the classic PID
+   * @param weight_d setpoint weight of the D term, 0 is derivative on measurement
+   */
+  void setSetpointWeights(double weight_p, double weight_d);
+
   double getOutput();
 
   double getOutput(double);
 
   double getOutput(double, double);
 
+  /**
+   * @brief Time-aware PID step for controllers running with variable period.
+   * The D term has optional low-pass filter with the time constant in seconds, windup is handled
+   * with back-calculation and the P and D terms use setpoint weights.
+   * By default the gains keep the per-step meaning of getOutput(actual, setpoint), so the existing
+   * tunings work unchanged. With PidConfig::timeScaledGains the I term is integrated over dt and
+   * the D term is a derivative over dt, so the jitter of the period doesn't change the output,
+   * use timeScaled() to convert the per-step tuning. The outputRampRate is always the maximum
+   * change of the output per step.
+   * @param actual the monitored value
+   * @param setpoint the target value
+   * @param dt time since the previous step in seconds, if dt <= 0 the I and D terms are not updated
+   * @return calculated output value for driving the actual to the target
+   */
+  double getOutput(double actual, double setpoint, double dt);
+
+  /**
+   * @brief Convert the per-step gains tuned at the given period to the time scaled gains.
+   * The I and anti-windup gains are divided by the period and the D gain is multiplied by it,
+   * so the controller running at that period gives the same output.
+   * @param config the configuration with the per-step gains
+   * @param period_s the period the gains were tuned at in seconds
+   * @return the configuration with PidConfig::timeScaledGains set
+   */
+  static PidConfig timeScaled(const PidConfig &config, double period_s);
+
+  /**
+   * @brief Time-aware PID step that measures dt with the global Ticker.
+   * @param actual the monitored value
+   * @param setpoint the target value
+   * @return calculated output value for driving the actual to the target
+   */
+  double getOutputTimed(double actual, double setpoint);
+
 private:
   double clamp(double, double, double);
   bool bounded(double, double, double);
@@ -151,6 +225,12 @@ private:
   double lastOutput;
   double setpoint;
   bool firstRun;
+
+  // runtime states of the time-aware PID
+  double iTerm;
+  double dTerm;
+  double lastDerivativeInput;
+  uint32_t lastTimeUs;
 };
 
 } // namespace stmepic::controller
\ No newline at end of file
@@ -0,0 +1,294 @@
+#pragma once
+#include "pid.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+
+/**
+ * @file pid_bank.hpp
+ * @brief Bank of N independent PID controllers stepped together.
+ */
+
+
+/**
+ * @defgroup Controllers
+ * @{
+ */
+
+namespace stmepic::controller {
+
+/**
+ * @class PidBank
+ * @brief N independent PID controllers stored in structure-of-arrays layout.
+ *
+ * Every gain and state variable is kept in its own contiguous, aligned array so a single
+ * call to getOutput() steps all N axes in one loop. The loop body has no data dependent
+ * branches (all limits are applied through selects), which lets the compiler vectorize it
+ * on the host (SSE/NEON) and keeps the arrays directly usable with CMSIS-DSP style vector
+ * functions on target.
+ *
+ * The math is the same as in Pid::getOutput, operation for operation, so for the same
+ * configuration and inputs every axis returns bit-identical results to a scalar Pid.
+ *
+ * @tparam N number of axes in the bank
+ */
+template <size_t N> class PidBank {
+  static_assert(N > 0, "PidBank needs at least one axis");
+
+public:
+  using array_type = std::array<double, N>;
+
+  PidBank() {
+    for(size_t a = 0; a < N; a++)
+      init(a);
+  }
+
+  /// @brief Number of axes in the bank.
+  static constexpr size_t size() {
+    return N;
+  }
+
+  /**
+   * @brief Configure single axis, same semantics as Pid::setConfig.
+   * @param axis index of the axis [0, N)
+   * @param cfg configuration of the axis
+   */
+  void setConfig(size_t axis, const PidConfig &cfg) {
+    if(axis >= N)
+      return;
+    setP(axis, cfg.p);
+    setI(axis, cfg.i);
+    setD(axis, cfg.d);
+    setF(axis, cfg.f);
+    max_i_output[axis] = cfg.maxIOutput;
+    setOutputLimits(axis, cfg.minOutput, cfg.maxOutput);
+    reversed[axis]         = cfg.reversed;
+    output_ramp_rate[axis] = cfg.outputRampRate;
+    if(cfg.outputFilter == 0 || bounded(cfg.outputFilter, 0, 1))
+      output_filter[axis] = cfg.outputFilter;
+    setpoint_range[axis] = cfg.setpointRange;
+  }
+
+  /// @brief Configure all axes with the same configuration.
+  void setConfig(const PidConfig &cfg) {
+    for(size_t a = 0; a < N; a++)
+      setConfig(a, cfg);
+  }
+
+  /// @brief Get the effective configuration of the axis.
+  PidConfig getConfig(size_t axis) const {
+    PidConfig cfg;
+    if(axis >= N)
+      return cfg;
+    cfg.p              = p[axis];
+    cfg.i              = i[axis];
+    cfg.d              = d[axis];
+    cfg.f              = f[axis];
+    cfg.maxIOutput     = max_i_output[axis];
+    cfg.maxOutput      = max_output[axis];
+    cfg.minOutput      = min_output[axis];
+    cfg.reversed       = reversed[axis];
+    cfg.outputRampRate = output_ramp_rate[axis];
+    cfg.outputFilter   = output_filter[axis];
+    cfg.setpointRange  = setpoint_range[axis];
+    return cfg;
+  }
+
+  /// @brief Set the target of the single axis used by getOutput(actual, output).
+  void setSetpoint(size_t axis, double value) {
+    if(axis < N)
+      setpoint[axis] = value;
+  }
+
+  /// @brief Erases the I term buildup and removes D gain on the next step for single axis.
+  void reset(size_t axis) {
+    if(axis >= N)
+      return;
+    first_run[axis] = 1;
+    error_sum[axis] = 0;
+  }
+
+  /// @brief Resets all axes.
+  void reset() {
+    for(size_t a = 0; a < N; a++)
+      reset(a);
+  }
+
+  /**
+   * @brief Step all axes at once.
+   * @param actual current values of all axes
+   * @param target setpoints of all axes, they are stored as the new setpoints
+   * @param output calculated outputs of all axes
+   */
+  void getOutput(const double *actual, const double *target, double *output) {
+    for(size_t a = 0; a < N; a++) {
+      const double act = actual[a];
+      setpoint[a]      = target[a];
+
+      // Ramp the setpoint used for calculations if user has opted to do so
+      const double range = setpoint_range[a];
+      const double sp = (range != 0) ? clamp(target[a], act - range, act + range) : target[a];
+
+      const double error    = sp - act;
+      const double f_output = f[a] * sp;
+      const double p_output = p[a] * error;
+
+      // first run assumes sensor was exactly where it is now and output was P + F
+      const bool first   = first_run[a] != 0;
+      const double l_act = first ? act : last_actual[a];
+      const double l_out = first ? (p_output + f_output) : last_output[a];
+      first_run[a]       = 0;
+
+      const double d_output = -d[a] * (act - l_act);
+      last_actual[a]        = act;
+
+      const double max_i = max_i_output[a];
+      const double e_sum = error_sum[a];
+      double i_output    = i[a] * e_sum;
+      i_output           = (max_i != 0) ? clamp(i_output, -max_i, max_i) : i_output;
+
+      double out = f_output + p_output + i_output + d_output;
+
+      // windup handling, same precedence as in Pid::getOutput
+      const double min_o       = min_output[a];
+      const double max_o       = max_output[a];
+      const double ramp        = output_ramp_rate[a];
+      const bool limits        = min_o != max_o;
+      const bool ramped        = ramp != 0;
+      const bool out_of_limits = limits && !bounded(out, min_o, max_o);
+      const bool out_of_ramp   = ramped && !bounded(out, l_out - ramp, l_out + ramp);
+      const double max_error   = (i[a] != 0) ? (max_i / i[a]) : 0.0;
+      const double e_limited   = clamp(e_sum + error, -max_error, max_error);
+      const double e_free      = e_sum + error;
+      error_sum[a]             = (out_of_limits || out_of_ramp) ? error : ((max_i != 0) ? e_limited : e_free);
+
+      // Restrict output to our specified output and ramp limits
+      out = ramped ? clamp(out, l_out - ramp, l_out + ramp) : out;
+      out = limits ? clamp(out, min_o, max_o) : out;
+
+      const double filter = output_filter[a];
+      out = (filter != 0) ? (l_out * filter + out * (1 - filter)) : out;
+
+      last_output[a] = out;
+      output[a]      = out;
+    }
+  }
+
+  /**
+   * @brief Step all axes using the last provided setpoints.
+   * @param actual current values of all axes
+   * @param output calculated outputs of all axes
+   */
+  void getOutput(const double *actual, double *output) {
+    alignas(16) array_type target = setpoint;
+    getOutput(actual, target.data(), output);
+  }
+
+  /// @brief Step all axes, std::array version.
+  void getOutput(const array_type &actual, const array_type &target, array_type &output) {
+    getOutput(actual.data(), target.data(), output.data());
+  }
+
+  /// @brief Contiguous array of the last outputs, usable directly by vector math routines.
+  const array_type &getLastOutputs() const {
+    return last_output;
+  }
+
+private:
+  alignas(16) array_type p;
+  alignas(16) array_type i;
+  alignas(16) array_type d;
+  alignas(16) array_type f;
+  alignas(16) array_type max_i_output;
+  alignas(16) array_type max_output;
+  alignas(16) array_type min_output;
+  alignas(16) array_type output_ramp_rate;
+  alignas(16) array_type output_filter;
+  alignas(16) array_type setpoint_range;
+
+  // runtime states
+  alignas(16) array_type error_sum;
+  alignas(16) array_type last_actual;
+  alignas(16) array_type last_output;
+  alignas(16) array_type setpoint;
+  std::array<uint8_t, N> first_run;
+  std::array<bool, N> reversed;
+
+  void init(size_t a) {
+    const PidConfig def{};
+    p[a]                = def.p;
+    i[a]                = def.i;
+    d[a]                = def.d;
+    f[a]                = def.f;
+    max_i_output[a]     = def.maxIOutput;
+    max_output[a]       = def.maxOutput;
+    min_output[a]       = def.minOutput;
+    output_ramp_rate[a] = def.outputRampRate;
+    output_filter[a]    = def.outputFilter;
+    setpoint_range[a]   = def.setpointRange;
+    reversed[a]         = def.reversed;
+    error_sum[a]        = 0;
+    last_actual[a]      = 0;
+    last_output[a]      = 0;
+    setpoint[a]         = 0;
+    first_run[a]        = 1;
+  }
+
+  void setP(size_t a, double value) {
+    p[a] = value;
+    checkSigns(a);
+  }
+
+  void setI(size_t a, double value) {
+    // scale accumulated error so the I term output stays the same, see Pid::setI
+    if(i[a] != 0)
+      error_sum[a] = error_sum[a] * i[a] / value;
+    i[a] = value;
+    checkSigns(a);
+  }
+
+  void setD(size_t a, double value) {
+    d[a] = value;
+    checkSigns(a);
+  }
+
+  void setF(size_t a, double value) {
+    f[a] = value;
+    checkSigns(a);
+  }
+
+  void setOutputLimits(size_t a, double minimum, double maximum) {
+    if(maximum < minimum)
+      return;
+    max_output[a] = maximum;
+    min_output[a] = minimum;
+    if(max_i_output[a] == 0 || max_i_output[a] > (maximum - minimum))
+      max_i_output[a] = maximum - minimum;
+  }
+
+  void checkSigns(size_t a) {
+    const double sign = reversed[a] ? -1.0 : 1.0;
+    if(p[a] * sign < 0)
+      p[a] *= -1;
+    if(i[a] * sign < 0)
+      i[a] *= -1;
+    if(d[a] * sign < 0)
+      d[a] *= -1;
+    if(f[a] * sign < 0)
+      f[a] *= -1;
+  }
+
+  /// @brief Same comparison order as Pid::clamp so results stay bit-identical.
+  static inline double clamp(double value, double min, double max) {
+    return value > max ? max : (value < min ? min : value);
+  }
+
+  static inline bool bounded(double value, double min, double max) {
+    return (min < value) && (value < max);
+  }
+};
+
+} // namespace stmepic::controller
+
+/** @} */
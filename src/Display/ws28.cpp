@@ -1,4 +1,5 @@
 #include "ws28.hpp"
+#include "timer_config.hpp"
 
 WS28Base::WS28Base(TIM_HandleTypeDef &htim, unsigned int timer_channel)
 : htim(htim), timer_channel(timer_channel) {
@@ -25,17 +26,20 @@ WS28Base::WS28Base(TIM_HandleTypeDef &htim, unsigned int timer_channel)
   reset_cycles_number = 0;
 }
 
-void WS28Base::setup_timer() {
-  const uint32_t pwmFreq = 1 / ((t0h_ns + t0l_ns) * 1e-9f);
-  const uint32_t period  = HAL_RCC_GetSysClockFreq() / (pwmFreq)-1;
+Status WS28Base::setup_timer() {
+  const double pwmFreq = 1e9 / (double)(t0h_ns + t0l_ns);
+  // smallest prescaler gives the best resolution of the bit timings
+  STMEPIC_ASSING_OR_RETURN(config, timer_config_solve(htim, pwmFreq));
+  const uint32_t period = config.period;
 
-  __HAL_TIM_SET_PRESCALER(&htim, 0);
-  __HAL_TIM_SET_AUTORELOAD(&htim, period);
-  HAL_TIM_PWM_Init(&htim);
+  STMEPIC_RETURN_ON_ERROR(timer_config_apply(htim, config));
+  if(HAL_TIM_PWM_Init(&htim) != HAL_OK)
+    return Status::HalError("Failed to init PWM");
 
   pwm_bit_0 = (uint16_t)std::round((float)t0h_ns / ((float)t0h_ns + (float)t0l_ns) * (float)(period + 1));
   pwm_bit_1 = (uint16_t)std::round((float)t1h_ns / ((float)t0h_ns + (float)t0l_ns) * (float)(period + 1));
   reset_cycles_number = (float)reset_time_ns / (float)(t0h_ns + t0l_ns) + 1;
+  return Status::OK();
 }
 
 void WS28Base::fill_ledColors(const std::vector<Color> &pixels) {
@@ -107,7 +111,7 @@ Status WS28Base::device_set_settings(const DeviceSettings &_settings) {
 }
 
 Status WS28Base::do_device_task_start() {
-  setup_timer();
+  STMEPIC_RETURN_ON_ERROR(setup_timer());
   pwm_buffor_fill();
   if(HAL_TIM_PWM_Start_DMA(&htim, timer_channel, (uint32_t *)pwm_buffor.get(),
                            24 * settings.pixelCount + reset_cycles_number) != HAL_OK) {
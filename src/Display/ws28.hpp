@@ -69,7 +69,7 @@ private:
   // zmienić na uniqe pointer
   std::unique_ptr<uint16_t[]> pwm_buffor;
 
-  void setup_timer(); // sets prescaler, period, pwm_bit_0, pwm_bit_1 and inits PWM
+  Status setup_timer(); // sets prescaler, period, pwm_bit_0, pwm_bit_1 and inits PWM
   void fill_ledColors(const std::vector<Color> &pixels); // fills ledColors vector
   void pwm_buffor_fill();                                // fills buffor based on ledColors vector
 };
@@ -0,0 +1,245 @@
+#include "can.hpp"
+#ifndef STMEPIC_POSIX
+#include "Timing.hpp"
+#else
+#include <chrono>
+#endif
+
+using namespace stmepic;
+using namespace stmepic::internall;
+
+namespace {
+// above the RX tasks of the drivers (1) and the periodic SimpleTask users (tskIDLE_PRIORITY + 3)
+constexpr UBaseType_t CAN_HIGH_TASK_PRIORITY = tskIDLE_PRIORITY + 4;
+
+// the frames made by the user are FD frames when the library is built for the FDCAN controller
+#ifdef STMEPIC_FDCAN
+constexpr bool CAN_DEFAULT_FDCAN_FRAME = true;
+#else
+constexpr bool CAN_DEFAULT_FDCAN_FRAME = false;
+#endif
+} // namespace
+
+CanDataFrame::CanDataFrame()
+: frame_id(0), remote_request(false), extended_id(false), fdcan_frame(CAN_DEFAULT_FDCAN_FRAME), data_size(0),
+  timestamp_us(0), release_us(0) {
+  std::memset(data, 0, sizeof(data));
+}
+
+uint64_t stmepic::internall::can_default_clock() {
+#ifndef STMEPIC_POSIX
+  return Ticker::get_instance().get_micros64();
+#else
+  const auto now = std::chrono::steady_clock::now().time_since_epoch();
+  return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+#endif
+}
+
+CanTxHoldList::CanTxHoldList() : count(0) {
+}
+
+bool CanTxHoldList::hold(const CanQueueItem &item, uint64_t now_us) {
+  const uint64_t release_us = item.frame.release_us;
+  if(release_us <= now_us || release_us - now_us > CAN_TX_MAX_RELEASE_DELAY_US || count == items.size())
+    return false;
+  // the frames with the same release time are sent in the order of the writes
+  size_t position = 0;
+  while(position < count && items[position].frame.release_us > release_us)
+    position++;
+  for(size_t i = count; i > position; i--)
+    items[i] = items[i - 1];
+  items[position] = item;
+  count++;
+  return true;
+}
+
+bool CanTxHoldList::take_released(CanQueueItem &item, uint64_t now_us) {
+  if(count == 0 || items[count - 1].frame.release_us > now_us)
+    return false;
+  item = items[--count];
+  return true;
+}
+
+const CanQueueItem *CanTxHoldList::peek() const {
+  return count == 0 ? nullptr : &items[count - 1];
+}
+
+void CanTxHoldList::pop() {
+  if(count > 0)
+    count--;
+}
+
+TickType_t CanTxHoldList::wait_ticks(TickType_t max_ticks, uint64_t now_us) const {
+  if(count == 0)
+    return max_ticks;
+  const uint64_t release_us = items[count - 1].frame.release_us;
+  if(release_us <= now_us)
+    return 0;
+  // the wait can end up to a tick early, the task then waits for one more tick
+  const uint64_t tick_us = 1000000 / configTICK_RATE_HZ;
+  const uint64_t ticks   = (release_us - now_us + tick_us - 1) / tick_us;
+  return ticks < max_ticks ? (TickType_t)ticks : max_ticks;
+}
+
+void CanTxHoldList::clear() {
+  count = 0;
+}
+
+CanCallbackDispatcher::CanCallbackDispatcher(CanStatisticsCollector &_statistics, CanClock _clock)
+: statistics(_statistics), clock(_clock), default_callback_task_data{ nullptr, default_callback_function },
+  can(nullptr), high_callbacks(0), high_queue_handle(nullptr), high_task_handle(nullptr) {
+}
+
+CanCallbackDispatcher::~CanCallbackDispatcher() {
+  stop();
+  if(high_queue_handle != nullptr)
+    vQueueDelete(high_queue_handle);
+}
+
+Status CanCallbackDispatcher::add(uint32_t frame_id,
+                                  CanCallbackPriority priority,
+                                  hardware_can_function_pointer callback,
+                                  void *args) {
+  if(callback == nullptr)
+    return Status::Invalid("Callback function is null");
+
+  if(frame_id == 0) {
+    if(priority != CanCallbackPriority::BACKGROUND)
+      return Status::Invalid("Default callback can run only in the background");
+    internall::CanCallbackTask dc = { args, callback };
+    vPortEnterCritical();
+    default_callback_task_data = dc;
+    vPortExitCritical();
+    return Status::OK();
+  }
+
+  CanCallbackEntry entry = { { args, callback }, priority };
+  vPortEnterCritical();
+  if(callbacks.find(frame_id) != callbacks.end()) {
+    vPortExitCritical();
+    return Status::AlreadyExists("Callback for can mgs already exists");
+  }
+  callbacks[frame_id] = entry;
+  if(priority == CanCallbackPriority::HIGH)
+    high_callbacks++;
+  vPortExitCritical();
+
+  // the interface is already running, the worker is started with the first HIGH callback
+  if(priority == CanCallbackPriority::HIGH && can != nullptr)
+    return start_high_worker();
+  return Status::OK();
+}
+
+Status CanCallbackDispatcher::remove(uint32_t frame_id) {
+  if(frame_id == 0) {
+    vPortEnterCritical();
+    default_callback_task_data = { nullptr, default_callback_function };
+    vPortExitCritical();
+    return Status::OK();
+  }
+
+  vPortEnterCritical();
+  auto it = callbacks.find(frame_id);
+  if(it == callbacks.end()) {
+    vPortExitCritical();
+    return Status::KeyError("Callback for can mgs does not exists");
+  }
+  if(it->second.priority == CanCallbackPriority::HIGH)
+    high_callbacks--;
+  callbacks.erase(it);
+  vPortExitCritical();
+  return Status::OK();
+}
+
+Status CanCallbackDispatcher::start(CanBase &_can) {
+  can = &_can;
+  if(high_callbacks == 0)
+    return Status::OK();
+  return start_high_worker();
+}
+
+void CanCallbackDispatcher::stop() {
+  can = nullptr;
+  if(high_task_handle != nullptr) {
+    vTaskDelete(high_task_handle);
+    high_task_handle = nullptr;
+  }
+  if(high_queue_handle != nullptr)
+    xQueueReset(high_queue_handle);
+}
+
+Status CanCallbackDispatcher::start_high_worker() {
+  if(high_task_handle != nullptr)
+    return Status::OK();
+  if(high_queue_handle == nullptr) {
+    high_queue_handle = xQueueCreate(CAN_HIGH_QUEUE_SIZE, sizeof(CanQueueItem));
+    if(high_queue_handle == nullptr)
+      return Status::OutOfMemory("Can't allocate the queue of the high priority CAN RX worker");
+  }
+  if(xTaskCreate(task_high, "CAN_RX_HIGH", 1024, this, CAN_HIGH_TASK_PRIORITY, &high_task_handle) != pdPASS) {
+    high_task_handle = nullptr;
+    return Status::OutOfMemory("Can't create the high priority CAN RX worker");
+  }
+  return Status::OK();
+}
+
+bool CanCallbackDispatcher::dispatch_from_isr(CanBase &_can, CanQueueItem &item, BaseType_t *hptw) {
+  // tasks modify the callbacks only with the interrupts disabled
+  auto it = callbacks.find(item.frame.frame_id);
+  if(it == callbacks.end() || it->second.priority == CanCallbackPriority::BACKGROUND)
+    return false;
+
+  if(it->second.priority == CanCallbackPriority::ISR) {
+    statistics.rx_frame(item.frame, 0);
+    it->second.task.callback(_can, item.frame, it->second.task.args);
+    return true;
+  }
+
+  // the worker is not running (the interface is stopping), leave the frame to the RX task
+  if(high_task_handle == nullptr)
+    return false;
+  bool dropped;
+  if(hptw != nullptr) {
+    dropped = xQueueSendFromISR(high_queue_handle, &item, hptw) != pdTRUE;
+    statistics.rx_isr(uxQueueMessagesWaitingFromISR(high_queue_handle), dropped);
+  } else {
+    dropped = xQueueSend(high_queue_handle, &item, 0) != pdTRUE;
+    statistics.rx_isr(uxQueueMessagesWaiting(high_queue_handle), dropped);
+  }
+  return true;
+}
+
+void CanCallbackDispatcher::dispatch(CanBase &_can, CanQueueItem &item) {
+  CanCallbackTask *task = nullptr;
+  vPortEnterCritical();
+  auto mayby_task = callbacks.find(item.frame.frame_id);
+  if(mayby_task != callbacks.end()) {
+    task = &mayby_task->second.task;
+  } else {
+    task = &default_callback_task_data;
+  }
+  // the RX task and the high priority worker share the statistics
+  statistics.rx_frame(item.frame, (uint32_t)clock() - item.timestamp_us);
+  vPortExitCritical();
+
+  // call the callback on a message
+  task->callback(_can, item.frame, task->args);
+}
+
+void CanCallbackDispatcher::task_high(void *arg) {
+  auto dispatcher              = static_cast<CanCallbackDispatcher *>(arg);
+  internall::CanQueueItem item = {};
+  while(true) {
+    if(xQueueReceive(dispatcher->high_queue_handle, &item, portMAX_DELAY) != pdTRUE)
+      continue;
+    CanBase *can = dispatcher->can;
+    if(can != nullptr)
+      dispatcher->dispatch(*can, item);
+  }
+}
+
+void CanCallbackDispatcher::default_callback_function(CanBase &can, CanDataFrame &msg, void *args) {
+  (void)can;
+  (void)args;
+  (void)msg;
+}
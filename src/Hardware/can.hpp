@@ -3,7 +3,13 @@
 #include "stmepic.hpp"
 #include "hardware.hpp"
 #include "device.hpp"
+#include "can_recovery.hpp"
+#include "can_statistics.hpp"
+#include "FreeRTOS.h"
+#include "queue.h"
+#include "task.h"
 #include <unordered_map>
+#include <array>
 #include <cstring>
 #include <functional>
 
@@ -46,12 +52,26 @@ public:
   /// @brief size of the data
   uint8_t data_size;
 
+  /// @brief time of the reception in the clock of the interface [us] (Ticker::get_micros64 on the hardware
+  /// drivers), 0 for the user made frames
+  /// @note FDCAN with the hardware timestamp enabled reports the start of the frame on the bus,
+  /// otherwise it's the time of the RX interrupt. Ignored by write().
+  uint64_t timestamp_us;
+
+  /// @brief time the written frame is sent at in the clock of the interface [us],
+  /// 0 or a time in the past sends the frame immediately, 0 for the received frames
+  /// @note The TX task holds the frame with the resolution of the RTOS tick (the frame is sent on the first
+  /// tick after this time) and meanwhile sends the frames written later. Times more than
+  /// CAN_TX_MAX_RELEASE_DELAY_US ahead are ignored.
+  uint64_t release_us;
+
   std::string to_string() const {
     std::string str = "\"can\":{ \"id\": \"" + std::to_string(frame_id) + "\", ";
     str += "\"remote_request\": \"" + std::to_string(remote_request) + "\", ";
     str += "\"extended_id\": \"" + std::to_string(extended_id) + "\", ";
     str += "\"fdcan_frame\": \"" + std::to_string(fdcan_frame) + "\", ";
     str += "\"data_size\": \"" + std::to_string(data_size) + "\", ";
+    str += "\"timestamp_us\": \"" + std::to_string(timestamp_us) + "\", ";
     str += "\"data\": [";
     for(int i = 0; i < data_size; i++) {
       str += std::to_string(data[i]) + " ";
@@ -61,6 +81,35 @@ public:
   }
 };
 
+/**
+ * @brief Round the data size up to the nearest length a CAN FD DLC can encode.
+ * Valid lengths are 0-8, 12, 16, 20, 24, 32, 48 and 64 bytes.
+ */
+inline uint8_t can_fd_round_data_size(uint8_t size) {
+  if(size <= 8)
+    return size;
+  if(size <= 24)
+    return (uint8_t)((size + 3) & ~3u);
+  if(size <= 32)
+    return 32;
+  if(size <= 48)
+    return 48;
+  return 64;
+}
+
+/// @brief Microsecond clock the CAN interface stamps the frames and counts the statistics with [us].
+using CanClock = uint64_t (*)();
+
+/// @brief Class of the RX callback, selects the context the callback runs in.
+enum class CanCallbackPriority : uint8_t {
+  /// @brief run straight from the RX interrupt, only for tiny handlers that never block
+  /// (no mutexes, no waiting, only the FromISR FreeRTOS API)
+  ISR,
+  /// @brief run by the high priority RX worker of the interface, it has its own queue
+  HIGH,
+  /// @brief run by the RX task of the interface together with the default callback
+  BACKGROUND,
+};
 
 namespace internall {
 /// @brief Callback function for the CAN interface
@@ -72,6 +121,127 @@ struct CanCallbackTask {
   void *args;
   hardware_can_function_pointer callback;
 };
+
+/// @brief Default clock of the CAN interfaces, the Ticker::get_micros64 (the monotonic clock of the host
+/// on the FreeRTOS POSIX port builds, STMEPIC_POSIX).
+uint64_t can_default_clock();
+
+/// @brief Longest time a written frame is held until its release time, later times are ignored [us].
+constexpr uint32_t CAN_TX_MAX_RELEASE_DELAY_US = 100000;
+
+/// @brief Number of the written frames the TX task can hold until their release time.
+constexpr size_t CAN_TX_HOLD_SIZE = 8;
+
+/// @brief Item of the RX and TX queues of the CAN drivers.
+struct CanQueueItem {
+  CanDataFrame frame;
+  /// @brief time the frame was put into the queue [us]
+  uint32_t timestamp_us;
+};
+
+/**
+ * @class CanTxHoldList
+ * @brief Written frames waiting for their release time (CanDataFrame::release_us) in the TX task.
+ *
+ * The frames are sorted by the release time. The TX task waits for the next written frame at most
+ * until the earliest release, so the held frames don't block the frames written after them
+ * and the task never waits actively. Used only by the TX task, not thread safe.
+ */
+class CanTxHoldList {
+public:
+  CanTxHoldList();
+
+  /// @brief Hold the written frame until its release time.
+  /// @param now_us current time in the clock of the interface
+  /// @return false if the frame has to be sent now: it has no release time, the time passed,
+  /// it's more than CAN_TX_MAX_RELEASE_DELAY_US ahead or the list is full
+  bool hold(const CanQueueItem &item, uint64_t now_us);
+
+  /// @brief Take the earliest held frame if its release time passed.
+  bool take_released(CanQueueItem &item, uint64_t now_us);
+
+  /// @brief The earliest held frame, nullptr if the list is empty.
+  const CanQueueItem *peek() const;
+
+  /// @brief Remove the earliest held frame.
+  void pop();
+
+  /// @brief Ticks the TX task can wait for the new frame, the earliest release rounded up to whole ticks.
+  /// @param max_ticks the wait when no frame is held
+  TickType_t wait_ticks(TickType_t max_ticks, uint64_t now_us) const;
+
+  void clear();
+
+private:
+  /// @brief sorted from the latest release, the earliest frame is the last one
+  std::array<CanQueueItem, CAN_TX_HOLD_SIZE> items;
+  size_t count;
+};
+
+struct CanCallbackEntry {
+  CanCallbackTask task;
+  CanCallbackPriority priority;
+};
+
+/**
+ * @class CanCallbackDispatcher
+ * @brief Callbacks of the frame ids of the CAN interface and the high priority RX worker.
+ *
+ * The driver passes each received frame to dispatch_from_isr() in the RX interrupt, frames of the
+ * ISR callbacks are handled right there, frames of the HIGH callbacks go to the queue of the high
+ * priority worker, the rest is left to the driver that puts them to its RX queue and its RX task
+ * runs them with dispatch(). A slow background callback then delays only the background frames.
+ * The worker and its queue are created only when a HIGH callback is registered.
+ */
+class CanCallbackDispatcher {
+public:
+  CanCallbackDispatcher(CanStatisticsCollector &statistics, CanClock clock);
+  ~CanCallbackDispatcher();
+  CanCallbackDispatcher(const CanCallbackDispatcher &)            = delete;
+  CanCallbackDispatcher &operator=(const CanCallbackDispatcher &) = delete;
+
+  /// @brief Add the callback, frame_id 0 replaces the default callback (only BACKGROUND).
+  Status
+  add(uint32_t frame_id, CanCallbackPriority priority, hardware_can_function_pointer callback, void *args);
+
+  /// @brief Remove the callback, frame_id 0 restores the default callback that does nothing.
+  Status remove(uint32_t frame_id);
+
+  /// @brief Start the high priority worker if any HIGH callback is registered, run by hardware_start().
+  Status start(CanBase &can);
+
+  /// @brief Stop the high priority worker, run by hardware_stop().
+  void stop();
+
+  /**
+   * @brief Handle the frame of the ISR and HIGH callbacks, run from the RX interrupt.
+   * @param hptw higher priority task woken flag of the interrupt, nullptr when run from a task
+   * @return true if the frame was handled (or dropped by the full worker queue), false if the frame
+   * belongs to the RX task of the driver
+   */
+  bool dispatch_from_isr(CanBase &can, CanQueueItem &item, BaseType_t *hptw);
+
+  /// @brief Count the frame in the statistics and run its callback, run from the RX tasks.
+  void dispatch(CanBase &can, CanQueueItem &item);
+
+private:
+  CanStatisticsCollector &statistics;
+  CanClock clock;
+  std::unordered_map<uint32_t, CanCallbackEntry> callbacks;
+  CanCallbackTask default_callback_task_data;
+  CanBase *can;
+  uint32_t high_callbacks;
+  QueueHandle_t high_queue_handle;
+  TaskHandle_t high_task_handle;
+  static const uint32_t CAN_HIGH_QUEUE_SIZE = 16;
+
+  Status start_high_worker();
+
+  /// @brief task of the HIGH callbacks
+  static void task_high(void *arg);
+
+  static void default_callback_function(CanBase &can, CanDataFrame &frame, void *args);
+};
 } // namespace internall
 
 
@@ -83,7 +253,8 @@ struct CanCallbackTask {
 class CanBase : public HardwareInterface {
 
 public:
-  CanBase(){};
+  /// @param clock clock of the time stamps and the statistics of the interface
+  explicit CanBase(CanClock clock = internall::can_default_clock) : dispatcher(statistics, clock){};
   virtual ~CanBase(){};
   CanBase(const CanBase &) = delete;
 
@@ -105,7 +276,29 @@ public:
    * @return Status OK if the callback was added successfully
    */
   virtual Status
-  add_callback(uint32_t frame_id, internall::hardware_can_function_pointer callback, void *args = nullptr) = 0;
+  add_callback(uint32_t frame_id, internall::hardware_can_function_pointer callback, void *args = nullptr) {
+    return dispatcher.add(frame_id, CanCallbackPriority::BACKGROUND, callback, args);
+  }
+
+  /**
+   * @brief Add a callback function with the priority class for specific frame id.
+   * ISR callbacks run in the RX interrupt and have to be tiny, HIGH callbacks run in the high
+   * priority RX worker with its own queue so they are not delayed by the slow BACKGROUND callbacks.
+   * @param frame_id the ID of the CAN data frame, 0 (the default callback) only with BACKGROUND
+   * @param priority class of the callback
+   * @param callback the callback function that will be called when the frame_id is received
+   * @param args the arguments that will be passed to the callback function
+   * @return Status OK if the callback was added successfully,
+   * AlreadyExists if the frame_id already has a callback
+   */
+  Status add_callback(uint32_t frame_id,
+                      CanCallbackPriority priority,
+                      internall::hardware_can_function_pointer callback,
+                      void *args = nullptr) {
+    if(priority == CanCallbackPriority::BACKGROUND)
+      return add_callback(frame_id, callback, args);
+    return dispatcher.add(frame_id, priority, callback, args);
+  }
 
   /**
    * @brief Remove the callback function for the specific frame id
@@ -113,7 +306,62 @@ public:
    * @param frame_id the ID of the CAN data frame on which the callback will be removed
    * @return Status OK if the callback was removed successfully
    */
-  virtual Status remove_callback(uint32_t frame_id) = 0;
+  virtual Status remove_callback(uint32_t frame_id) {
+    return dispatcher.remove(frame_id);
+  }
+
+  /**
+   * @brief Get the traffic statistics of the interface.
+   * Rates are updated once per second by the RX task of the interface.
+   * @return statistics of the interface
+   */
+  [[nodiscard]] const CanStatistics &get_statistics() const {
+    return statistics.get();
+  }
+
+  /// @brief Reset all statistics of the interface.
+  void reset_statistics() {
+    statistics.reset();
+  }
+
+  /// @brief Set the bitrate of the bus used to calculate the bus load of the statistics.
+  /// @param bitrate nominal bitrate of the bus in bits per second
+  void set_bus_bitrate(uint32_t bitrate) {
+    statistics.set_bus_bitrate(bitrate);
+  }
+
+  /// @brief Periodically dump the statistics to the global logger with the INFO level.
+  /// @param period_ms period of the dump, 0 disables it
+  void set_statistics_log_period(uint32_t period_ms) {
+    statistics.set_log_period(period_ms);
+  }
+
+  /// @brief Get the fault confinement state of the interface.
+  [[nodiscard]] CanBusState get_bus_state() const {
+    return recovery.get_state();
+  }
+
+  /// @brief Get the counters of the error states and bus-off recoveries.
+  [[nodiscard]] const CanRecoveryStatistics &get_recovery_statistics() const {
+    return recovery.get_statistics();
+  }
+
+  /**
+   * @brief Set the back-off of the bus-off recovery.
+   * After bus-off the peripheral is re-initialized after initial_ms, each consecutive bus-off
+   * doubles the delay up to max_ms. Registered callbacks and queued TX frames are kept.
+   * @param initial_ms delay of the first re-initialization after bus-off
+   * @param max_ms max delay of the re-initialization
+   * @param stable_ms time without errors after which the delay returns to initial_ms
+   */
+  void set_recovery_backoff(uint32_t initial_ms, uint32_t max_ms, uint32_t stable_ms) {
+    recovery.set_backoff(initial_ms, max_ms, stable_ms);
+  }
+
+protected:
+  internall::CanStatisticsCollector statistics;
+  internall::CanRecovery recovery;
+  internall::CanCallbackDispatcher dispatcher;
 };
 
 
@@ -5,6 +5,8 @@
 #include "can2.0.hpp"
 
 #define CAN_SEND_RETRY_COUNT 20
+#define CAN_RX_NOTIFICATIONS (CAN_IT_RX_FIFO0_MSG_PENDING | CAN_IT_RX_FIFO1_MSG_PENDING)
+#define CAN_ERROR_NOTIFICATIONS (CAN_IT_ERROR_WARNING | CAN_IT_ERROR_PASSIVE | CAN_IT_BUSOFF | CAN_IT_ERROR)
 
 using namespace stmepic;
 
@@ -28,12 +30,11 @@ void HAL_CAN_TxMailbox2CompleteCallback(CAN_HandleTypeDef *hcan) {
   CAN::run_tx_callbacks_from_irq(hcan);
 }
 
-
-CanDataFrame::CanDataFrame()
-: frame_id(0), remote_request(false), extended_id(false), data_size(0), fdcan_frame(false) {
-  std::memset(data, 0, sizeof(data));
+void HAL_CAN_ErrorCallback(CAN_HandleTypeDef *hcan) {
+  CAN::run_error_callbacks_from_irq(hcan);
 }
 
+
 std::vector<std::shared_ptr<CAN>> CAN::can_instances;
 
 Result<std::shared_ptr<CAN>>
@@ -58,6 +59,15 @@ void CAN::run_tx_callbacks_from_irq(CAN_HandleTypeDef *hcan) {
   }
 }
 
+void CAN::run_error_callbacks_from_irq(CAN_HandleTypeDef *hcan) {
+  for(auto &can : can_instances) {
+    if(can->_hcan->Instance == hcan->Instance) {
+      can->error_callback(hcan);
+      break;
+    }
+  }
+}
+
 void CAN::run_rx_callbacks_from_irq(CAN_HandleTypeDef *hcan) {
   for(auto &can : can_instances) {
     if(can->_hcan->Instance == hcan->Instance) {
@@ -70,17 +80,18 @@ void CAN::run_rx_callbacks_from_irq(CAN_HandleTypeDef *hcan) {
 CAN::CAN(CAN_HandleTypeDef &hcan, const CAN_FilterTypeDef &_filter, GpioPin *tx_led, GpioPin *rx_led)
 : is_initiated(false), _hcan(&hcan), last_tx_mailbox(0), can_fifo(_filter.FilterFIFOAssignment),
   filter(_filter), _gpio_tx_led(tx_led), _gpio_rx_led(rx_led), task_handle_tx(nullptr),
-  task_handle_rx(nullptr), tx_queue_handle(nullptr), rx_queue_handle(nullptr) {
-  tx_queue_handle = xQueueCreate(CAN_QUEUE_SIZE, sizeof(CanDataFrame));
-  rx_queue_handle = xQueueCreate(CAN_QUEUE_SIZE, sizeof(CanDataFrame));
-  can_fifo        = filter.FilterFIFOAssignment;
-  add_callback(0, default_callback_function, nullptr);
+  task_handle_rx(nullptr), tx_queue_handle(nullptr), rx_queue_handle(nullptr), peripheral_mutex(nullptr) {
+  tx_queue_handle  = xQueueCreate(CAN_QUEUE_SIZE, sizeof(internall::CanQueueItem));
+  rx_queue_handle  = xQueueCreate(CAN_QUEUE_SIZE, sizeof(internall::CanQueueItem));
+  peripheral_mutex = xSemaphoreCreateMutex();
+  can_fifo         = filter.FilterFIFOAssignment;
 };
 
 CAN::~CAN() {
   (void)hardware_stop();
   vQueueDelete(tx_queue_handle);
   vQueueDelete(rx_queue_handle);
+  vSemaphoreDelete(peripheral_mutex);
 }
 
 Status CAN::hardware_reset() {
@@ -93,6 +104,10 @@ Status CAN::hardware_stop() {
     return Status::OK();
   }
 
+  dispatcher.stop();
+
+  // neither task can be deleted while it holds the peripheral mutex
+  xSemaphoreTake(peripheral_mutex, portMAX_DELAY);
   if(task_handle_rx != nullptr) {
     vTaskDelete(task_handle_rx);
     task_handle_rx = nullptr;
@@ -104,14 +119,13 @@ Status CAN::hardware_stop() {
   while(eTaskGetState(task_handle_rx) != eDeleted || eTaskGetState(task_handle_tx) != eDeleted) {
     vTaskDelay(pdMS_TO_TICKS(10));
   }
+  xSemaphoreGive(peripheral_mutex);
   task_handle_rx = nullptr;
   task_handle_tx = nullptr;
   xQueueReset(tx_queue_handle);
   xQueueReset(rx_queue_handle);
-  STMEPIC_RETURN_ON_ERROR(
-  Status(HAL_CAN_DeactivateNotification(_hcan, CAN_IT_RX_FIFO0_MSG_PENDING | CAN_IT_RX_FIFO1_MSG_PENDING)));
-  STMEPIC_RETURN_ON_ERROR(Status(HAL_CAN_Stop(_hcan)));
-  STMEPIC_RETURN_ON_ERROR(Status(HAL_CAN_DeInit(_hcan)));
+  tx_hold.clear();
+  STMEPIC_RETURN_ON_ERROR(peripheral_stop());
   is_initiated = false;
   return Status::OK();
 }
@@ -120,11 +134,9 @@ Status CAN::hardware_start() {
   if(is_initiated == true) {
     return Status::OK();
   }
-  STMEPIC_RETURN_ON_ERROR(Status(HAL_CAN_Init(_hcan)));
-  STMEPIC_RETURN_ON_ERROR(Status(HAL_CAN_ConfigFilter(_hcan, &filter)));
-  STMEPIC_RETURN_ON_ERROR(Status(HAL_CAN_Start(_hcan)));
-  STMEPIC_RETURN_ON_ERROR(
-  Status(HAL_CAN_ActivateNotification(_hcan, CAN_IT_RX_FIFO0_MSG_PENDING | CAN_IT_RX_FIFO1_MSG_PENDING)));
+  recovery.reset();
+  STMEPIC_RETURN_ON_ERROR(dispatcher.start(*this));
+  STMEPIC_RETURN_ON_ERROR(peripheral_start());
   if(task_handle_rx == nullptr)
     xTaskCreate(CAN::task_rx, "CAN_RX", 1024, this, 1, &task_handle_rx);
   if(task_handle_tx == nullptr)
@@ -133,83 +145,60 @@ Status CAN::hardware_start() {
   return Status::OK();
 }
 
-Status CAN::add_callback(uint32_t frame_id, internall::hardware_can_function_pointer callback, void *args) {
-  if(callback == nullptr)
-    return Status::Invalid("Callback function is null");
-
-  if(frame_id == 0) {
-    internall::CanCallbackTask dc = { args, callback };
-    default_callback_task_data    = dc;
-    return Status::OK();
-  }
-
-  vPortEnterCritical();
-  if(callbacks.find(frame_id) != callbacks.end())
-    return Status::AlreadyExists("Callback for can mgs already exists");
-  internall::CanCallbackTask calldata;
-  calldata.callback   = callback;
-  calldata.args       = args;
-  callbacks[frame_id] = calldata;
-  vPortExitCritical();
-  return Status::OK();
+Status CAN::peripheral_start() {
+  STMEPIC_RETURN_ON_ERROR(Status(HAL_CAN_Init(_hcan)));
+  STMEPIC_RETURN_ON_ERROR(Status(HAL_CAN_ConfigFilter(_hcan, &filter)));
+  STMEPIC_RETURN_ON_ERROR(Status(HAL_CAN_Start(_hcan)));
+  return Status(HAL_CAN_ActivateNotification(_hcan, CAN_RX_NOTIFICATIONS | CAN_ERROR_NOTIFICATIONS));
 }
 
-Status CAN::remove_callback(uint32_t frame_id) {
-  if(frame_id == 0) {
-    default_callback_task_data = { nullptr, default_callback_function };
-    return Status::OK();
-  }
-
-  vPortEnterCritical();
-  if(callbacks.find(frame_id) == callbacks.end())
-    return Status::KeyError("Callback for can mgs does not exists");
-  callbacks.erase(frame_id);
-  vPortExitCritical();
-  return Status::OK();
+Status CAN::peripheral_stop() {
+  STMEPIC_RETURN_ON_ERROR(
+  Status(HAL_CAN_DeactivateNotification(_hcan, CAN_RX_NOTIFICATIONS | CAN_ERROR_NOTIFICATIONS)));
+  STMEPIC_RETURN_ON_ERROR(Status(HAL_CAN_Stop(_hcan)));
+  return Status(HAL_CAN_DeInit(_hcan));
 }
 
 void CAN::task_rx(void *arg) {
-  auto can                                  = static_cast<CAN *>(arg);
-  CanDataFrame msg                          = {};
-  stmepic::internall::CanCallbackTask *task = nullptr;
+  auto can                     = static_cast<CAN *>(arg);
+  internall::CanQueueItem item = {};
   while(true) {
-    if(xQueueReceive(can->rx_queue_handle, &msg, 100) != pdTRUE)
+    can->update_statistics();
+    can->update_bus_state();
+    if(xQueueReceive(can->rx_queue_handle, &item, 100) != pdTRUE)
       continue;
 
-    vPortEnterCritical();
-    auto mayby_task = can->callbacks.find(msg.frame_id);
-    if(mayby_task != can->callbacks.end()) {
-      task = &mayby_task->second;
-    } else {
-      task = &can->default_callback_task_data;
-    }
-    vPortExitCritical();
-
     if(can->_gpio_rx_led)
       can->_gpio_rx_led->write(0);
-    // call the callback on a message
-    task->callback(*can, msg, task->args);
+    can->dispatcher.dispatch(*can, item);
   }
 }
 
 void CAN::task_tx(void *arg) {
-  auto can         = static_cast<CAN *>(arg);
-  CanDataFrame msg = {};
+  auto can                     = static_cast<CAN *>(arg);
+  internall::CanQueueItem item = {};
+  CanDataFrame &msg            = item.frame;
   while(true) {
-    if(xQueueReceive(can->tx_queue_handle, &msg, 100) != pdTRUE) {
-      if(can->_gpio_tx_led)
-        can->_gpio_tx_led->write(0);
-      continue;
+    const uint64_t now_us = Ticker::get_instance().get_micros64();
+    if(!can->tx_hold.take_released(item, now_us)) {
+      if(xQueueReceive(can->tx_queue_handle, &item, can->tx_hold.wait_ticks(100, now_us)) != pdTRUE) {
+        if(can->_gpio_tx_led)
+          can->_gpio_tx_led->write(0);
+        continue;
+      }
+      // the frames with the release time wait in the hold list, the frames written later aren't blocked
+      if(can->tx_hold.hold(item, Ticker::get_instance().get_micros64()))
+        continue;
+    }
+    // hold the frame while the interface recovers from bus-off
+    while(!can->recovery.tx_allowed()) {
+      vTaskDelay(pdMS_TO_TICKS(5));
     }
     uint8_t retrys_count = 0;
     while(HAL_CAN_GetTxMailboxesFreeLevel(can->_hcan) == 0 && retrys_count <= CAN_SEND_RETRY_COUNT) {
       vTaskDelay(5);
+      retrys_count++;
     }
-    // if we are not able to send the message after somany retries then it won't be sent until kingdom come.
-    if(CAN_SEND_RETRY_COUNT == retrys_count) {
-      HAL_CAN_AbortTxRequest(can->_hcan, CAN_TX_MAILBOX0 | CAN_TX_MAILBOX1 | CAN_TX_MAILBOX2);
-    }
-
     CAN_TxHeaderTypeDef header;
     if(msg.extended_id) {
       header.ExtId = msg.frame_id;
@@ -221,7 +210,18 @@ void CAN::task_tx(void *arg) {
     header.DLC                = msg.data_size;
     header.RTR                = msg.remote_request ? CAN_RTR_REMOTE : CAN_RTR_DATA;
     header.TransmitGlobalTime = DISABLE;
-    HAL_CAN_AddTxMessage(can->_hcan, &header, msg.data, &can->last_tx_mailbox);
+    // the RX task re-initializes the peripheral after bus-off under the same mutex
+    xSemaphoreTake(can->peripheral_mutex, portMAX_DELAY);
+    // if we are not able to send the message after somany retries then it won't be sent until kingdom come.
+    if(retrys_count > CAN_SEND_RETRY_COUNT) {
+      HAL_CAN_AbortTxRequest(can->_hcan, CAN_TX_MAILBOX0 | CAN_TX_MAILBOX1 | CAN_TX_MAILBOX2);
+    }
+    const bool sent = HAL_CAN_AddTxMessage(can->_hcan, &header, msg.data, &can->last_tx_mailbox) == HAL_OK;
+    xSemaphoreGive(can->peripheral_mutex);
+    if(sent)
+      can->statistics.tx_frame(msg, Ticker::get_instance().get_micros() - item.timestamp_us);
+    else
+      can->statistics.tx_dropped();
     if(can->_gpio_tx_led)
       can->_gpio_tx_led->write(1);
   }
@@ -232,7 +232,11 @@ Status CAN::write(const CanDataFrame &msg) {
   // if(msg_s == nullptr)
   //   return Status::OutOfMemory("Can't allocate memory for CanDataFrame");
   // *msg_s = msg;
-  if(xQueueSend(tx_queue_handle, &msg, pdMS_TO_TICKS(10)) != pdTRUE) {
+  internall::CanQueueItem item;
+  item.frame        = msg;
+  item.timestamp_us = Ticker::get_instance().get_micros();
+  if(xQueueSend(tx_queue_handle, &item, pdMS_TO_TICKS(10)) != pdTRUE) {
+    statistics.tx_dropped();
     return Status::CapacityError("Queue is full, can't send message");
   }
   return Status::OK();
@@ -248,7 +252,10 @@ void CAN::tx_callback(CAN_HandleTypeDef *hcan) {
 void CAN::rx_callback(CAN_HandleTypeDef *hcan) {
   if(hcan->Instance != _hcan->Instance || !is_initiated)
     return;
-  CanDataFrame msg = {};
+  internall::CanQueueItem item = {};
+  CanDataFrame &msg            = item.frame;
+  msg.timestamp_us             = Ticker::get_instance().get_micros64_from_isr();
+  item.timestamp_us            = (uint32_t)msg.timestamp_us;
   CAN_RxHeaderTypeDef header;
   if(HAL_CAN_GetRxMessage(hcan, can_fifo, &header, msg.data) != HAL_OK)
     return;
@@ -265,12 +272,45 @@ void CAN::rx_callback(CAN_HandleTypeDef *hcan) {
   msg.data_size      = header.DLC;
   msg.remote_request = header.RTR == CAN_RTR_REMOTE ? true : false;
   BaseType_t hptw    = pdFALSE;
-  xQueueSendFromISR(rx_queue_handle, &msg, &hptw);
+  if(!dispatcher.dispatch_from_isr(*this, item, &hptw)) {
+    bool dropped = xQueueSendFromISR(rx_queue_handle, &item, &hptw) != pdTRUE;
+    statistics.rx_isr(uxQueueMessagesWaitingFromISR(rx_queue_handle), dropped);
+  }
   portYIELD_FROM_ISR(hptw);
 }
 
-void CAN::default_callback_function(CanBase &can, CanDataFrame &msg, void *args) {
-  (void)can;
-  (void)args;
-  (void)msg;
-}
\ No newline at end of file
+void CAN::error_callback(CAN_HandleTypeDef *hcan) {
+  if(hcan->Instance != _hcan->Instance || !is_initiated)
+    return;
+  recovery.error_isr(read_error_flags());
+}
+
+CanErrorFlags CAN::read_error_flags() const {
+  const uint32_t esr = _hcan->Instance->ESR;
+  CanErrorFlags flags;
+  flags.warning = (esr & CAN_ESR_EWGF) != 0;
+  flags.passive = (esr & CAN_ESR_EPVF) != 0;
+  flags.bus_off = (esr & CAN_ESR_BOFF) != 0;
+  return flags;
+}
+
+void CAN::update_bus_state() {
+  const uint32_t now = Ticker::get_instance().get_micros();
+  if(!recovery.update(now, read_error_flags()))
+    return;
+  // re-initialize only the peripheral, tasks, queues and callbacks stay as they are,
+  // the TX task can't be inside the HAL TX calls meanwhile
+  xSemaphoreTake(peripheral_mutex, portMAX_DELAY);
+  (void)peripheral_stop();
+  const bool ok = peripheral_start().ok();
+  xSemaphoreGive(peripheral_mutex);
+  recovery.recovery_done(Ticker::get_instance().get_micros(), ok);
+}
+
+void CAN::update_statistics() {
+  const uint32_t esr = _hcan->Instance->ESR;
+  const uint32_t tec = (esr >> CAN_ESR_TEC_Pos) & 0xffu;
+  const uint32_t rec = (esr >> CAN_ESR_REC_Pos) & 0xffu;
+  statistics.set_error_state(HAL_CAN_GetError(_hcan), tec, rec);
+  statistics.periodic(Ticker::get_instance().get_micros(), "CAN");
+}
@@ -30,6 +30,12 @@ namespace stmepic {
  * @brief Class for controlling the CAN interface
  * automatically by allowing to add callbacks for specific frame ids.
  * as well as writing to interface from any task in a non blocking / thread safe fashion.
+ *
+ * @note The driver defines the HAL callbacks HAL_CAN_RxFifo0MsgPendingCallback,
+ * HAL_CAN_RxFifo1MsgPendingCallback, HAL_CAN_TxMailbox0CompleteCallback, HAL_CAN_TxMailbox1CompleteCallback,
+ * HAL_CAN_TxMailbox2CompleteCallback and HAL_CAN_ErrorCallback, the application can't define them again
+ * (multiple definition at link time). The events of the CAN peripherals without the CAN interface can be
+ * handled with the HAL register callbacks (USE_HAL_CAN_REGISTER_CALLBACKS) set on their handles.
  */
 class CAN : public CanBase {
 
@@ -74,26 +80,6 @@ public:
    */
   Status write(const CanDataFrame &msg) override;
 
-  /**
-   * @brief Add a callback function to the CAN interface for specific frame id
-   * The callback is run in a RX task there fore it don't have to bo super fast but it shouldn't be too slow either.
-   * @note The CAN have default callback that runs for all IDs that don't have a registered callback.
-   * You CAN change the default callback by adding your custom callback with the frame_id = 0
-   * @param frame_id the ID of the CAN data frame on which the callback will be called
-   * @param callback the callback function that will be called when the frame_id is received
-   * @param args the arguments that will be passed to the callback function
-   * @return Status OK if the callback was added successfully
-   */
-  Status add_callback(uint32_t frame_id, internall::hardware_can_function_pointer callback, void *args = nullptr) override;
-
-  /**
-   * @brief Remove the callback function for the specific frame id
-   *
-   * @param frame_id the ID of the CAN data frame on which the callback will be removed
-   * @return Status OK if the callback was removed successfully
-   */
-  Status remove_callback(uint32_t frame_id) override;
-
   /**
    * @brief Run this in  TX callbacks from the IT or DMA interrupt like HAL_CAN_TxMailboxXCompleteCallback
    * @param hi2c the CAN handle that triggered the interrupt
@@ -108,6 +94,13 @@ public:
    */
   static void run_rx_callbacks_from_irq(CAN_HandleTypeDef *hcan);
 
+  /**
+   * @brief Run the error callbacks from the interrupt, HAL_CAN_ErrorCallback is already defined by the driver
+   * @param hcan the CAN handle that triggered the interrupt
+   * @note This function runs over all CAN initialized interfaces
+   */
+  static void run_error_callbacks_from_irq(CAN_HandleTypeDef *hcan);
+
 private:
   CAN(CAN_HandleTypeDef &hcan, const CAN_FilterTypeDef &filter, GpioPin *tx_led, GpioPin *rx_led);
   CAN(const CAN &)            = delete;
@@ -124,8 +117,10 @@ private:
   TaskHandle_t task_handle_rx;
   QueueHandle_t tx_queue_handle;
   QueueHandle_t rx_queue_handle;
-  std::unordered_map<uint32_t, internall::CanCallbackTask> callbacks;
-  internall::CanCallbackTask default_callback_task_data;
+  /// @brief held by the TX task around the HAL TX calls and by the RX task during the bus-off re-init
+  SemaphoreHandle_t peripheral_mutex;
+  /// @brief written frames waiting for their release time, used only by the TX task
+  internall::CanTxHoldList tx_hold;
   static std::vector<std::shared_ptr<CAN>> can_instances;
   static const uint32_t CAN_QUEUE_SIZE = 64;
 
@@ -135,18 +130,29 @@ private:
   /// @brief Task for handling the RX traffic for specific CAN interface
   void rx_callback(CAN_HandleTypeDef *hcan);
 
+  /// @brief Error status interrupt, passes the error flags to the recovery state machine
+  void error_callback(CAN_HandleTypeDef *hcan);
+
+  /// @brief Read the error state of the peripheral and update the statistics rates, run by the RX task
+  void update_statistics();
+
+  /// @brief Run the recovery state machine and re-initialize the peripheral when requested, run by RX task
+  void update_bus_state();
+
+  /// @brief Read the error warning, error passive and bus-off flags of the peripheral
+  CanErrorFlags read_error_flags() const;
+
+  /// @brief Init and start the peripheral with the filter and the notifications
+  Status peripheral_start();
+
+  /// @brief Stop and deinit the peripheral
+  Status peripheral_stop();
+
   /// @brief task that handles the TX traffic
   static void task_tx(void *arg);
 
   /// @brief task that handles the RX traffic
   static void task_rx(void *arg);
-
-  /**
-   * @brief Default callback function for the CAN interface. Doesn't do anything
-   * @param frame the data frame that was received
-   * @param args the arguments that will be passed to the callback function
-   */
-  static void default_callback_function(CanBase &can, CanDataFrame &frame, void *args);
 };
 
 
@@ -5,6 +5,11 @@
 #include "fdcan.hpp"
 
 #define CAN_SEND_RETRY_COUNT 20
+#define FDCAN_ERROR_NOTIFICATIONS (FDCAN_IT_BUS_OFF | FDCAN_IT_ERROR_WARNING | FDCAN_IT_ERROR_PASSIVE)
+// max frames read by one RX interrupt, the largest RX FIFO of the FDCAN peripherals
+#define FDCAN_RX_DRAIN_LIMIT 64
+#define FDCAN_RX_WATERMARK_MAX 64
+#define FDCAN_RX_TIMEOUT_MAX 0xFFFF
 
 
 // some FDCAN stm32 have up to 32 tx buffers
@@ -146,6 +151,41 @@ FDCAN_TX_BUFFER27 | FDCAN_TX_BUFFER28 | FDCAN_TX_BUFFER29 | FDCAN_TX_BUFFER30 |
 
 using namespace stmepic;
 
+namespace {
+// HAL data length codes of the FDCAN_DLC_BYTES_x sizes, the value of the codes differs between HAL versions
+constexpr uint32_t FDCAN_DLC_CODES[16] = {
+  FDCAN_DLC_BYTES_0,  FDCAN_DLC_BYTES_1,  FDCAN_DLC_BYTES_2,  FDCAN_DLC_BYTES_3,
+  FDCAN_DLC_BYTES_4,  FDCAN_DLC_BYTES_5,  FDCAN_DLC_BYTES_6,  FDCAN_DLC_BYTES_7,
+  FDCAN_DLC_BYTES_8,  FDCAN_DLC_BYTES_12, FDCAN_DLC_BYTES_16, FDCAN_DLC_BYTES_20,
+  FDCAN_DLC_BYTES_24, FDCAN_DLC_BYTES_32, FDCAN_DLC_BYTES_48, FDCAN_DLC_BYTES_64,
+};
+constexpr uint8_t FDCAN_DLC_SIZES[16] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64 };
+
+uint32_t fdcan_dlc_code(uint8_t data_size) {
+  const uint8_t size = can_fd_round_data_size(data_size);
+  for(uint8_t i = 0; i < 16; i++) {
+    if(FDCAN_DLC_SIZES[i] == size)
+      return FDCAN_DLC_CODES[i];
+  }
+  return FDCAN_DLC_BYTES_64;
+}
+
+uint8_t fdcan_dlc_size(uint32_t dlc_code) {
+  for(uint8_t i = 0; i < 16; i++) {
+    if(FDCAN_DLC_CODES[i] == dlc_code)
+      return FDCAN_DLC_SIZES[i];
+  }
+  return 0;
+}
+
+constexpr uint32_t FDCAN_TIMESTAMP_PRESCALERS[16] = {
+  FDCAN_TIMESTAMP_PRESC_1,  FDCAN_TIMESTAMP_PRESC_2,  FDCAN_TIMESTAMP_PRESC_3,  FDCAN_TIMESTAMP_PRESC_4,
+  FDCAN_TIMESTAMP_PRESC_5,  FDCAN_TIMESTAMP_PRESC_6,  FDCAN_TIMESTAMP_PRESC_7,  FDCAN_TIMESTAMP_PRESC_8,
+  FDCAN_TIMESTAMP_PRESC_9,  FDCAN_TIMESTAMP_PRESC_10, FDCAN_TIMESTAMP_PRESC_11, FDCAN_TIMESTAMP_PRESC_12,
+  FDCAN_TIMESTAMP_PRESC_13, FDCAN_TIMESTAMP_PRESC_14, FDCAN_TIMESTAMP_PRESC_15, FDCAN_TIMESTAMP_PRESC_16
+};
+} // namespace
+
 void HAL_FDCAN_RxFifo0Callback(FDCAN_HandleTypeDef *hcan, uint32_t RxFifo0ITs) {
   FDCAN::run_rx_callbacks_from_irq(hcan, RxFifo0ITs);
 }
@@ -154,13 +194,16 @@ void HAL_FDCAN_RxFifo1Callback(FDCAN_HandleTypeDef *hcan, uint32_t RxFifo1ITs) {
   FDCAN::run_rx_callbacks_from_irq(hcan, RxFifo1ITs);
 }
 
+void HAL_FDCAN_TimeoutOccurredCallback(FDCAN_HandleTypeDef *hcan) {
+  FDCAN::run_rx_callbacks_from_irq(hcan, 0);
+}
+
 void HAL_FDCAN_TxBufferCompleteCallback(FDCAN_HandleTypeDef *hcan, uint32_t BufferIndexes) {
   FDCAN::run_tx_callbacks_from_irq(hcan, BufferIndexes);
 }
 
-CanDataFrame::CanDataFrame()
-: frame_id(0), remote_request(false), extended_id(false), data_size(0), fdcan_frame(true) {
-  std::memset(data, 0, sizeof(data));
+void HAL_FDCAN_ErrorStatusCallback(FDCAN_HandleTypeDef *hcan, uint32_t ErrorStatusITs) {
+  FDCAN::run_error_callbacks_from_irq(hcan, ErrorStatusITs);
 }
 
 std::vector<std::shared_ptr<FDCAN>> FDCAN::can_instances;
@@ -192,6 +235,15 @@ void FDCAN::run_tx_callbacks_from_irq(FDCAN_HandleTypeDef *hcan, uint32_t Buffer
   }
 }
 
+void FDCAN::run_error_callbacks_from_irq(FDCAN_HandleTypeDef *hcan, uint32_t ErrorStatusITs) {
+  for(auto &can : can_instances) {
+    if(can->_hcan->Instance == hcan->Instance) {
+      can->error_callback(hcan, ErrorStatusITs);
+      break;
+    }
+  }
+}
+
 void FDCAN::run_rx_callbacks_from_irq(FDCAN_HandleTypeDef *hcan, uint32_t RxFifo0ITs) {
   for(auto &can : can_instances) {
     if(can->_hcan->Instance == hcan->Instance) {
@@ -203,11 +255,14 @@ void FDCAN::run_rx_callbacks_from_irq(FDCAN_HandleTypeDef *hcan, uint32_t RxFifo
 
 FDCAN::FDCAN(FDCAN_HandleTypeDef &hcan, const FDcanFilterConfig &_filter, GpioPin *tx_led, GpioPin *rx_led)
 : is_initiated(false), _hcan(&hcan), last_tx_mailbox(0), filter(_filter), _gpio_tx_led(tx_led), _gpio_rx_led(rx_led),
-  task_handle_tx(nullptr), task_handle_rx(nullptr), tx_queue_handle(nullptr), rx_queue_handle(nullptr) {
-  tx_queue_handle                 = xQueueCreate(CAN_QUEUE_SIZE, sizeof(CanDataFrame));
-  rx_queue_handle                 = xQueueCreate(CAN_QUEUE_SIZE, sizeof(CanDataFrame));
+  task_handle_tx(nullptr), task_handle_rx(nullptr), tx_queue_handle(nullptr), rx_queue_handle(nullptr),
+  timestamp_prescaler(0), timestamp_tick_ns(0), hardware_timestamp(false), rx_watermark(0),
+  rx_timeout_ticks(0), peripheral_mutex(nullptr) {
+  tx_queue_handle                 = xQueueCreate(CAN_QUEUE_SIZE, sizeof(internall::CanQueueItem));
+  rx_queue_handle                 = xQueueCreate(CAN_QUEUE_SIZE, sizeof(internall::CanQueueItem));
+  peripheral_mutex                = xSemaphoreCreateMutex();
   fdcan_in_fd_mode                = hcan.Init.FrameFormat == FDCAN_FRAME_CLASSIC ? false : true;
-  fdcan_in_bitrate_switching_mode = false;
+  fdcan_in_bitrate_switching_mode = hcan.Init.FrameFormat == FDCAN_FRAME_FD_BRS;
 
   switch(filter.fifo_number) {
   case FDCAN_FIFO::FDCAN_FIFO0: can_fifo = FDCAN_RX_FIFO0; break;
@@ -215,13 +270,13 @@ FDCAN::FDCAN(FDCAN_HandleTypeDef &hcan, const FDcanFilterConfig &_filter, GpioPi
   default: can_fifo = FDCAN_RX_FIFO0; break;
   }
 
-  add_callback(0, default_callback_function, nullptr);
 };
 
 FDCAN::~FDCAN() {
   (void)hardware_stop();
   vQueueDelete(tx_queue_handle);
   vQueueDelete(rx_queue_handle);
+  vSemaphoreDelete(peripheral_mutex);
 }
 
 Status FDCAN::hardware_reset() {
@@ -234,6 +289,10 @@ Status FDCAN::hardware_stop() {
     return Status::OK();
   }
 
+  dispatcher.stop();
+
+  // neither task can be deleted while it holds the peripheral mutex
+  xSemaphoreTake(peripheral_mutex, portMAX_DELAY);
   if(task_handle_rx != nullptr) {
     vTaskDelete(task_handle_rx);
     task_handle_rx = nullptr;
@@ -245,6 +304,7 @@ Status FDCAN::hardware_stop() {
   while(eTaskGetState(task_handle_rx) != eDeleted || eTaskGetState(task_handle_tx) != eDeleted) {
     vTaskDelay(pdMS_TO_TICKS(10));
   }
+  xSemaphoreGive(peripheral_mutex);
 
   if(_gpio_tx_led)
     _gpio_tx_led->write(0);
@@ -256,9 +316,8 @@ Status FDCAN::hardware_stop() {
   task_handle_tx = nullptr;
   xQueueReset(tx_queue_handle);
   xQueueReset(rx_queue_handle);
-  STMEPIC_RETURN_ON_ERROR(Status(HAL_FDCAN_DeactivateNotification(_hcan, FDCAN_IT_RX_FIFO0_NEW_MESSAGE))); //| FDCAN_IT_RX_FIFO1_NEW_MESSAGE
-  STMEPIC_RETURN_ON_ERROR(Status(HAL_FDCAN_Stop(_hcan)));
-  STMEPIC_RETURN_ON_ERROR(Status(HAL_FDCAN_DeInit(_hcan)));
+  tx_hold.clear();
+  STMEPIC_RETURN_ON_ERROR(peripheral_stop());
   is_initiated = false;
   return Status::OK();
 }
@@ -267,6 +326,18 @@ Status FDCAN::hardware_start() {
   if(is_initiated == true) {
     return Status::OK();
   }
+  recovery.reset();
+  STMEPIC_RETURN_ON_ERROR(dispatcher.start(*this));
+  STMEPIC_RETURN_ON_ERROR(peripheral_start());
+  if(task_handle_rx == nullptr)
+    xTaskCreate(FDCAN::task_rx, "FDCAN_RX", 1024, this, 1, &task_handle_rx);
+  if(task_handle_tx == nullptr)
+    xTaskCreate(FDCAN::task_tx, "FDCAN_TX", 1024, this, 1, &task_handle_tx);
+  is_initiated = true;
+  return Status::OK();
+}
+
+Status FDCAN::peripheral_start() {
   STMEPIC_RETURN_ON_ERROR(Status(HAL_FDCAN_Init(_hcan)));
   for(auto &&fil : filter.filters) {
     STMEPIC_RETURN_ON_ERROR(Status(HAL_FDCAN_ConfigFilter(_hcan, &fil)));
@@ -276,119 +347,164 @@ Status FDCAN::hardware_start() {
   HAL_FDCAN_ConfigGlobalFilter(_hcan, filter.globalFilter_NonMatchingStd, filter.globalFilter_NonMatchingExt,
                                filter.globalFilter_RejectRemoteExt, filter.globalFilter_RejectRemoteStd)));
 
-  // FDCAN_IT_RX_FIFO1_NEW_MESSAGE
-  STMEPIC_RETURN_ON_ERROR(Status(HAL_FDCAN_Start(_hcan)));
+  hardware_timestamp = false;
+  if(timestamp_prescaler != 0) {
+    STMEPIC_RETURN_ON_ERROR(Status(
+    HAL_FDCAN_ConfigTimestampCounter(_hcan, FDCAN_TIMESTAMP_PRESCALERS[timestamp_prescaler - 1])));
+    STMEPIC_RETURN_ON_ERROR(Status(HAL_FDCAN_EnableTimestampCounter(_hcan, FDCAN_TIMESTAMP_INTERNAL)));
+    hardware_timestamp = true;
+  }
 
-  uint32_t active_it;
-  if(filter.fifo_number == FDCAN_FIFO::FDCAN_FIFO0) {
-    active_it = FDCAN_IT_RX_FIFO0_NEW_MESSAGE;
-  } else {
-    active_it = FDCAN_IT_RX_FIFO1_NEW_MESSAGE;
+  const bool fifo0 = filter.fifo_number == FDCAN_FIFO::FDCAN_FIFO0;
+#ifdef FDCAN_IT_RX_FIFO0_WATERMARK
+  if(rx_watermark != 0) {
+    STMEPIC_RETURN_ON_ERROR(Status(
+    HAL_FDCAN_ConfigFifoWatermark(_hcan, fifo0 ? FDCAN_CFG_RX_FIFO0 : FDCAN_CFG_RX_FIFO1, rx_watermark)));
+  }
+#endif
+  if(rx_timeout_ticks != 0) {
+    STMEPIC_RETURN_ON_ERROR(Status(HAL_FDCAN_ConfigTimeoutCounter(
+    _hcan, fifo0 ? FDCAN_TIMEOUT_RX_FIFO0 : FDCAN_TIMEOUT_RX_FIFO1, rx_timeout_ticks)));
+    STMEPIC_RETURN_ON_ERROR(Status(HAL_FDCAN_EnableTimeoutCounter(_hcan)));
   }
 
-  STMEPIC_RETURN_ON_ERROR(Status(HAL_FDCAN_ActivateNotification(_hcan, active_it, 0)));
-  if(task_handle_rx == nullptr)
-    xTaskCreate(FDCAN::task_rx, "FDCAN_RX", 1024, this, 1, &task_handle_rx);
-  if(task_handle_tx == nullptr)
-    xTaskCreate(FDCAN::task_tx, "FDCAN_TX", 1024, this, 1, &task_handle_tx);
-  is_initiated = true;
-  return Status::OK();
+  // FDCAN_IT_RX_FIFO1_NEW_MESSAGE
+  STMEPIC_RETURN_ON_ERROR(Status(HAL_FDCAN_Start(_hcan)));
+  return Status(HAL_FDCAN_ActivateNotification(_hcan, rx_notifications() | FDCAN_ERROR_NOTIFICATIONS, 0));
 }
 
-Status FDCAN::add_callback(uint32_t frame_id, internall::hardware_can_function_pointer callback, void *args) {
-  if(callback == nullptr)
-    return Status::Invalid("Callback function is null");
-
-  internall::CanCallbackTask calldata;
-  calldata.callback = callback;
-  calldata.args     = args;
-
-  if(frame_id == 0) {
-    default_callback_task_data = calldata;
-    return Status::OK();
-  }
+Status FDCAN::peripheral_stop() {
+  STMEPIC_RETURN_ON_ERROR(
+  Status(HAL_FDCAN_DeactivateNotification(_hcan, rx_notifications() | FDCAN_ERROR_NOTIFICATIONS)));
+  STMEPIC_RETURN_ON_ERROR(Status(HAL_FDCAN_Stop(_hcan)));
+  return Status(HAL_FDCAN_DeInit(_hcan));
+}
 
-  vPortEnterCritical();
-  if(callbacks.find(frame_id) != callbacks.end())
-    return Status::AlreadyExists("Callback for can mgs already exists");
-  callbacks[frame_id] = calldata;
-  vPortExitCritical();
+Status FDCAN::enable_hardware_timestamp(uint32_t bitrate, uint32_t prescaler) {
+  if(bitrate == 0)
+    return Status::Invalid("FDCAN: bitrate can't be 0");
+  if(prescaler == 0 || prescaler > 16)
+    return Status::Invalid("FDCAN: timestamp prescaler has to be 1-16");
+  timestamp_tick_ns   = (uint32_t)((uint64_t)prescaler * 1000000000ULL / bitrate);
+  timestamp_prescaler = prescaler;
   return Status::OK();
 }
 
-Status FDCAN::remove_callback(uint32_t frame_id) {
-  if(frame_id == 0) {
-    default_callback_task_data = { nullptr, default_callback_function };
-    return Status::OK();
-  }
+void FDCAN::disable_hardware_timestamp() {
+  timestamp_prescaler = 0;
+}
 
-  vPortEnterCritical();
-  if(callbacks.find(frame_id) == callbacks.end())
-    return Status::KeyError("Callback for can mgs does not exists");
-  callbacks.erase(frame_id);
-  vPortExitCritical();
+Status FDCAN::set_rx_interrupt_coalescing(uint32_t watermark, uint32_t timeout_ticks) {
+  if(timeout_ticks > FDCAN_RX_TIMEOUT_MAX)
+    return Status::Invalid("FDCAN: RX timeout has to be at most 65535 ticks");
+#ifdef FDCAN_IT_RX_FIFO0_WATERMARK
+  if(watermark > FDCAN_RX_WATERMARK_MAX)
+    return Status::Invalid("FDCAN: RX FIFO watermark has to be at most 64");
+  if(watermark != 0 && timeout_ticks == 0)
+    return Status::Invalid("FDCAN: RX FIFO watermark requires the timeout to flush the last frames");
+#else
+  if(watermark != 0)
+    return Status::Invalid("FDCAN: the peripheral doesn't have the RX FIFO watermark");
+#endif
+  rx_watermark     = watermark;
+  rx_timeout_ticks = timeout_ticks;
   return Status::OK();
 }
 
+uint32_t FDCAN::rx_notifications() const {
+  const bool fifo0       = filter.fifo_number == FDCAN_FIFO::FDCAN_FIFO0;
+  uint32_t notifications = fifo0 ? FDCAN_IT_RX_FIFO0_NEW_MESSAGE : FDCAN_IT_RX_FIFO1_NEW_MESSAGE;
+#ifdef FDCAN_IT_RX_FIFO0_WATERMARK
+  if(rx_watermark != 0)
+    notifications = fifo0 ? FDCAN_IT_RX_FIFO0_WATERMARK : FDCAN_IT_RX_FIFO1_WATERMARK;
+#endif
+  if(rx_timeout_ticks != 0)
+    notifications |= FDCAN_IT_TIMEOUT_OCCURRED;
+  return notifications;
+}
+
 void FDCAN::task_rx(void *arg) {
-  auto can = static_cast<FDCAN *>(arg);
-  CanDataFrame msg;
-  stmepic::internall::CanCallbackTask *task = nullptr;
+  auto can                     = static_cast<FDCAN *>(arg);
+  internall::CanQueueItem item = {};
   while(true) {
-    if(xQueueReceive(can->rx_queue_handle, &msg, 100) != pdTRUE)
+    can->update_statistics();
+    can->update_bus_state();
+    if(xQueueReceive(can->rx_queue_handle, &item, 100) != pdTRUE)
       continue;
-
-    vPortEnterCritical();
-    auto mayby_task = can->callbacks.find(msg.frame_id);
-    if(mayby_task != can->callbacks.end()) {
-      task = &mayby_task->second;
-    } else {
-      task = &can->default_callback_task_data;
-    }
-    vPortExitCritical();
     if(can->_gpio_rx_led)
       can->_gpio_rx_led->write(0);
-    // call the callback on a message
-    task->callback(*can, msg, task->args);
+    can->dispatcher.dispatch(*can, item);
   }
 }
 
 void FDCAN::task_tx(void *arg) {
-  auto can         = static_cast<FDCAN *>(arg);
-  CanDataFrame msg = {};
+  auto can                     = static_cast<FDCAN *>(arg);
+  internall::CanQueueItem item = {};
+  CanDataFrame &msg            = item.frame;
   while(true) {
-    if(xQueueReceive(can->tx_queue_handle, &msg, 100) != pdTRUE) {
-      if(can->_gpio_tx_led)
-        can->_gpio_tx_led->write(0);
-      continue;
+    const uint64_t now_us = Ticker::get_instance().get_micros64();
+    if(!can->tx_hold.take_released(item, now_us)) {
+      if(xQueueReceive(can->tx_queue_handle, &item, can->tx_hold.wait_ticks(100, now_us)) != pdTRUE) {
+        if(can->_gpio_tx_led)
+          can->_gpio_tx_led->write(0);
+        continue;
+      }
+      // the frames with the release time wait in the hold list, the frames written later aren't blocked
+      if(can->tx_hold.hold(item, Ticker::get_instance().get_micros64()))
+        continue;
+    }
+    // hold the frame while the interface recovers from bus-off
+    while(!can->recovery.tx_allowed()) {
+      vTaskDelay(pdMS_TO_TICKS(5));
     }
     uint8_t retrys_count = 0;
     while(HAL_FDCAN_GetTxFifoFreeLevel(can->_hcan) == 0 && retrys_count <= CAN_SEND_RETRY_COUNT) {
       vTaskDelay(5);
+      retrys_count++;
     }
-    // if we are not able to send the message after somany retries then it won't be sent until kingdom come.
-    if(CAN_SEND_RETRY_COUNT == retrys_count) {
-      HAL_FDCAN_AbortTxRequest(can->_hcan, CAN_ALL_TX_BUFFERS);
-    }
+    // classic frames on the FD bus are allowed, their data is limited to 8 bytes
+    const bool fd_frame       = can->fdcan_in_fd_mode && msg.fdcan_frame;
+    const bool bitrate_switch = can->fdcan_in_bitrate_switching_mode;
+    const uint8_t max_size    = fd_frame ? 64 : 8;
+    if(msg.data_size > max_size)
+      msg.data_size = max_size;
+    // the peripheral sends the whole DLC length, pad the rounded up part with zeros
+    const uint8_t dlc_size = can_fd_round_data_size(msg.data_size);
+    std::memset(&msg.data[msg.data_size], 0, dlc_size - msg.data_size);
 
     FDCAN_TxHeaderTypeDef header;
     header.Identifier          = msg.frame_id;
     header.IdType              = msg.extended_id ? FDCAN_EXTENDED_ID : FDCAN_STANDARD_ID;
     header.TxFrameType         = msg.remote_request ? FDCAN_REMOTE_FRAME : FDCAN_DATA_FRAME;
-    header.DataLength          = msg.data_size;
+    header.DataLength          = fdcan_dlc_code(msg.data_size);
     header.ErrorStateIndicator = FDCAN_ESI_ACTIVE;
-    header.BitRateSwitch       = can->fdcan_in_bitrate_switching_mode ? FDCAN_BRS_ON : FDCAN_BRS_OFF;
-    header.FDFormat            = can->fdcan_in_fd_mode ? FDCAN_FD_CAN : FDCAN_CLASSIC_CAN;
+    header.BitRateSwitch       = fd_frame && bitrate_switch ? FDCAN_BRS_ON : FDCAN_BRS_OFF;
+    header.FDFormat            = fd_frame ? FDCAN_FD_CAN : FDCAN_CLASSIC_CAN;
     header.TxEventFifoControl  = FDCAN_NO_TX_EVENTS;
     header.MessageMarker       = 0;
-    HAL_FDCAN_AddMessageToTxFifoQ(can->_hcan, &header, msg.data);
+    // the RX task re-initializes the peripheral after bus-off under the same mutex
+    xSemaphoreTake(can->peripheral_mutex, portMAX_DELAY);
+    // if we are not able to send the message after somany retries then it won't be sent until kingdom come.
+    if(retrys_count > CAN_SEND_RETRY_COUNT) {
+      HAL_FDCAN_AbortTxRequest(can->_hcan, CAN_ALL_TX_BUFFERS);
+    }
+    const bool sent = HAL_FDCAN_AddMessageToTxFifoQ(can->_hcan, &header, msg.data) == HAL_OK;
+    xSemaphoreGive(can->peripheral_mutex);
+    if(sent)
+      can->statistics.tx_frame(msg, Ticker::get_instance().get_micros() - item.timestamp_us);
+    else
+      can->statistics.tx_dropped();
     if(can->_gpio_tx_led)
       can->_gpio_tx_led->write(1);
   }
 }
 
 Status FDCAN::write(const CanDataFrame &msg) {
-  if(xQueueSend(tx_queue_handle, &msg, pdMS_TO_TICKS(10)) != pdTRUE) {
+  internall::CanQueueItem item;
+  item.frame        = msg;
+  item.timestamp_us = Ticker::get_instance().get_micros();
+  if(xQueueSend(tx_queue_handle, &item, pdMS_TO_TICKS(10)) != pdTRUE) {
+    statistics.tx_dropped();
     return Status::CapacityError("Queue is full, can't send message");
   }
   return Status::OK();
@@ -402,34 +518,94 @@ void FDCAN::tx_callback(FDCAN_HandleTypeDef *hcan, uint32_t BufferIndexes) {
 }
 
 void FDCAN::rx_callback(FDCAN_HandleTypeDef *hcan, uint32_t RxFifo0ITs) {
+  (void)RxFifo0ITs;
   if(hcan->Instance != _hcan->Instance || !is_initiated)
     return;
-  CanDataFrame msg = {};
+  // one interrupt drains the whole FIFO (new message, watermark or timeout)
+  BaseType_t hptw  = pdFALSE;
+  uint32_t drained = 0;
+  while(drained < FDCAN_RX_DRAIN_LIMIT && HAL_FDCAN_GetRxFifoFillLevel(hcan, can_fifo) > 0) {
+    if(!rx_read_message(hcan, hptw))
+      break;
+    drained++;
+  }
+  statistics.rx_interrupt(drained);
+  portYIELD_FROM_ISR(hptw);
+}
+
+bool FDCAN::rx_read_message(FDCAN_HandleTypeDef *hcan, BaseType_t &hptw) {
+  internall::CanQueueItem item = {};
+  CanDataFrame &msg            = item.frame;
   FDCAN_RxHeaderTypeDef header;
   if(HAL_FDCAN_GetRxMessage(hcan, can_fifo, &header, msg.data) != HAL_OK)
-    return;
+    return false;
+  // the time and the counter are read after the frame is taken from the FIFO, a frame stored while
+  // the FIFO is drained can't be newer than them
+  const uint64_t now_us = Ticker::get_instance().get_micros64_from_isr();
+  msg.timestamp_us      = now_us;
+  item.timestamp_us     = (uint32_t)now_us;
+  if(hardware_timestamp) {
+    // the counter is captured at the start of the frame, the difference is the age of the frame
+    // modulo the 16 bit wrap of the counter
+    const uint16_t ts_count  = HAL_FDCAN_GetTimestampCounter(hcan);
+    const uint16_t age_ticks = (uint16_t)(ts_count - header.RxTimestamp);
+    const uint64_t age_us    = (uint64_t)age_ticks * timestamp_tick_ns / 1000;
+    msg.timestamp_us         = age_us < now_us ? now_us - age_us : 0;
+  }
   if(_gpio_rx_led)
     _gpio_rx_led->write(1);
 
   msg.frame_id       = header.Identifier;
   msg.extended_id    = header.IdType == FDCAN_EXTENDED_ID ? true : false;
   msg.remote_request = header.RxFrameType == FDCAN_REMOTE_FRAME ? true : false;
-  msg.data_size      = header.DataLength;
+  msg.data_size      = fdcan_dlc_size(header.DataLength);
   // we ignore:
   // header.ErrorStateIndicator since we don't use it
   // header.BitRateSwitch since we don't use it
   msg.fdcan_frame = header.FDFormat == FDCAN_FD_CAN ? true : false;
   // also we ignore the
-  // header.RxTimestamp
   // header.FilterIndex
   // header.IsFilterMatchingFrame
-  BaseType_t hptw = pdFALSE;
-  xQueueSendFromISR(rx_queue_handle, &msg, &hptw);
-  portYIELD_FROM_ISR(hptw);
+  if(dispatcher.dispatch_from_isr(*this, item, &hptw))
+    return true;
+  bool dropped = xQueueSendFromISR(rx_queue_handle, &item, &hptw) != pdTRUE;
+  statistics.rx_isr(uxQueueMessagesWaitingFromISR(rx_queue_handle), dropped);
+  return true;
 }
 
-void FDCAN::default_callback_function(CanBase &can, CanDataFrame &msg, void *args) {
-  (void)can;
-  (void)args;
-  (void)msg;
-}
\ No newline at end of file
+void FDCAN::error_callback(FDCAN_HandleTypeDef *hcan, uint32_t ErrorStatusITs) {
+  (void)ErrorStatusITs;
+  if(hcan->Instance != _hcan->Instance || !is_initiated)
+    return;
+  recovery.error_isr(read_error_flags());
+}
+
+CanErrorFlags FDCAN::read_error_flags() const {
+  FDCAN_ProtocolStatusTypeDef protocol = {};
+  (void)HAL_FDCAN_GetProtocolStatus(_hcan, &protocol);
+  CanErrorFlags flags;
+  flags.warning = protocol.Warning != 0;
+  flags.passive = protocol.ErrorPassive != 0;
+  flags.bus_off = protocol.BusOff != 0;
+  return flags;
+}
+
+void FDCAN::update_bus_state() {
+  const uint32_t now = Ticker::get_instance().get_micros();
+  if(!recovery.update(now, read_error_flags()))
+    return;
+  // re-initialize only the peripheral, tasks, queues and callbacks stay as they are,
+  // the TX task can't be inside the HAL TX calls meanwhile
+  xSemaphoreTake(peripheral_mutex, portMAX_DELAY);
+  (void)peripheral_stop();
+  const bool ok = peripheral_start().ok();
+  xSemaphoreGive(peripheral_mutex);
+  recovery.recovery_done(Ticker::get_instance().get_micros(), ok);
+}
+
+void FDCAN::update_statistics() {
+  FDCAN_ErrorCountersTypeDef counters = {};
+  (void)HAL_FDCAN_GetErrorCounters(_hcan, &counters);
+  statistics.set_error_state(HAL_FDCAN_GetError(_hcan), counters.TxErrorCnt, counters.RxErrorCnt);
+  statistics.periodic(Ticker::get_instance().get_micros(), "FDCAN");
+}
@@ -62,6 +62,11 @@ struct FDcanFilterConfig {
  * as well as writing to interface from any task in a non blocking / thread safe fashion.
  *
  * @note The FDCAN interface does not support the BUFFER mode only FIFO mode.
+ * @note The driver defines the HAL callbacks HAL_FDCAN_RxFifo0Callback, HAL_FDCAN_RxFifo1Callback,
+ * HAL_FDCAN_TxBufferCompleteCallback, HAL_FDCAN_TimeoutOccurredCallback and HAL_FDCAN_ErrorStatusCallback,
+ * the application can't define them again (multiple definition at link time). The events of the FDCAN
+ * peripherals without the FDCAN interface can be handled with the HAL register callbacks
+ * (USE_HAL_FDCAN_REGISTER_CALLBACKS) set on their handles.
  */
 class FDCAN : public CanBase {
 
@@ -107,24 +112,34 @@ public:
   Status write(const CanDataFrame &msg);
 
   /**
-   * @brief Add a callback function to the FDCAN interface for specific frame id
-   * The callback is run in a RX task there fore it don't have to bo super fast but it shouldn't be too slow either.
-   * @note The FDCAN have default callback that runs for all IDs that don't have a registered callback.
-   * You FDCAN change the default callback by adding your custom callback with the frame_id = 0
-   * @param frame_id the ID of the FDCAN data frame on which the callback will be called
-   * @param callback the callback function that will be called when the frame_id is received
-   * @param args the arguments that will be passed to the callback function
-   * @return Status OK if the callback was added successfully
+   * @brief Timestamp the received frames with the timestamp unit of the peripheral instead of the time
+   * of the RX interrupt, removes the interrupt latency and the time the frame waited in the RX FIFO.
+   * The unit counts the nominal bit times, the age of the frame at the interrupt is subtracted from the
+   * Ticker time so CanDataFrame::timestamp_us stays in the Ticker::get_micros64 time base.
+   * Takes effect with the next hardware_start() / hardware_reset().
+   * @param bitrate nominal bitrate of the bus [bit/s]
+   * @param prescaler bit times per tick of the timestamp counter 1-16, the 16 bit counter wraps
+   * after 65536 * prescaler bit times, frames older than that get wrong timestamp
+   * @return Status::Invalid if the bitrate is 0 or the prescaler is out of range
    */
-  Status add_callback(uint32_t frame_id, internall::hardware_can_function_pointer callback, void *args = nullptr);
+  Status enable_hardware_timestamp(uint32_t bitrate, uint32_t prescaler = 1);
+
+  /// @brief Go back to the timestamps taken in the RX interrupt, takes effect with the next hardware_start().
+  void disable_hardware_timestamp();
 
   /**
-   * @brief Remove the callback function for the specific frame id
-   *
-   * @param frame_id the ID of the FDCAN data frame on which the callback will be removed
-   * @return Status OK if the callback was removed successfully
+   * @brief Trade the RX latency for fewer interrupts under heavy load.
+   * Every RX interrupt drains the whole FIFO, by default the interrupt comes with every new frame.
+   * With the watermark the interrupt comes when the FIFO holds watermark frames and the timeout
+   * counter flushes the frames below the watermark after timeout_ticks since the first frame.
+   * Takes effect with the next hardware_start() / hardware_reset().
+   * @param watermark FIFO fill level of the interrupt 1-64, 0 = interrupt on every new frame,
+   * only on the peripherals with the watermark interrupt (STM32H7)
+   * @param timeout_ticks timeout of the RX FIFO in the ticks of the timestamp counter (nominal bit
+   * times * timestamp prescaler) 1-65535, 0 = no timeout, required with the watermark
+   * @return Status::Invalid if the values are out of range or the watermark is not supported
    */
-  Status remove_callback(uint32_t frame_id);
+  Status set_rx_interrupt_coalescing(uint32_t watermark, uint32_t timeout_ticks);
 
   /**
    * @brief Run this in  TX callbacks from the IT or DMA interrupt like HAL_CAN_TxMailboxXCompleteCallback
@@ -140,6 +155,14 @@ public:
    */
   static void run_rx_callbacks_from_irq(FDCAN_HandleTypeDef *hcan, uint32_t BufferIndexes);
 
+  /**
+   * @brief Run the error callbacks from the interrupt, HAL_FDCAN_ErrorStatusCallback is already defined by the driver
+   * @param hcan the FDCAN handle that triggered the interrupt
+   * @param ErrorStatusITs error status interrupts that triggered the callback
+   * @note This function runs over all FDCAN initialized interfaces
+   */
+  static void run_error_callbacks_from_irq(FDCAN_HandleTypeDef *hcan, uint32_t ErrorStatusITs);
+
 private:
   FDCAN(FDCAN_HandleTypeDef &hcan, const FDcanFilterConfig &filter, GpioPin *tx_led, GpioPin *rx_led);
   FDCAN(const FDCAN &)            = delete;
@@ -157,32 +180,62 @@ private:
   TaskHandle_t task_handle_rx;
   QueueHandle_t tx_queue_handle;
   QueueHandle_t rx_queue_handle;
+  /// @brief written frames waiting for their release time, used only by the TX task
+  internall::CanTxHoldList tx_hold;
   bool fdcan_in_fd_mode;
   bool fdcan_in_bitrate_switching_mode;
+  /// @brief prescaler of the timestamp counter, 0 = hardware timestamps disabled
+  uint32_t timestamp_prescaler;
+  /// @brief duration of one tick of the timestamp counter [ns]
+  uint32_t timestamp_tick_ns;
+  /// @brief timestamp counter is running, set by peripheral_start
+  bool hardware_timestamp;
+  /// @brief RX FIFO fill level of the watermark interrupt, 0 = new message interrupt
+  uint32_t rx_watermark;
+  /// @brief RX FIFO timeout in the timestamp counter ticks, 0 = disabled
+  uint32_t rx_timeout_ticks;
+  /// @brief held by the TX task around the HAL TX calls and by the RX task during the bus-off re-init
+  SemaphoreHandle_t peripheral_mutex;
 
-  std::unordered_map<uint32_t, internall::CanCallbackTask> callbacks;
-  internall::CanCallbackTask default_callback_task_data;
   static std::vector<std::shared_ptr<FDCAN>> can_instances;
   static const uint32_t CAN_QUEUE_SIZE = 64;
 
   /// @brief Task for handling the TX traffic for specific FDCAN interface
   void tx_callback(FDCAN_HandleTypeDef *hcan, uint32_t BufferIndexes);
 
-  /// @brief Task for handling the RX traffic for specific FDCAN interface
+  /// @brief Task for handling the RX traffic for specific FDCAN interface, drains the whole RX FIFO
   void rx_callback(FDCAN_HandleTypeDef *hcan, uint32_t RxFifo0ITs);
 
+  /// @brief Read one frame from the RX FIFO to the RX queue, run from rx_callback
+  /// @return false if HAL didn't return the frame
+  bool rx_read_message(FDCAN_HandleTypeDef *hcan, BaseType_t &hptw);
+
+  /// @brief Error status interrupt, passes the error flags to the recovery state machine
+  void error_callback(FDCAN_HandleTypeDef *hcan, uint32_t ErrorStatusITs);
+
+  /// @brief Read the error state of the peripheral and update the statistics rates, run by the RX task
+  void update_statistics();
+
+  /// @brief Run the recovery state machine and re-initialize the peripheral when requested, run by RX task
+  void update_bus_state();
+
+  /// @brief Read the error warning, error passive and bus-off flags of the peripheral
+  CanErrorFlags read_error_flags() const;
+
+  /// @brief Init and start the peripheral with the filters and the notifications
+  Status peripheral_start();
+
+  /// @brief Stop and deinit the peripheral
+  Status peripheral_stop();
+
+  /// @brief RX notifications of the FIFO selected by the filter configuration
+  uint32_t rx_notifications() const;
+
   /// @brief task that handles the TX traffic
   static void task_tx(void *arg);
 
   /// @brief task that handles the RX traffic
   static void task_rx(void *arg);
-
-  /**
-   * @brief Default callback function for the FDCAN interface. Doesn't do anything
-   * @param frame the data frame that was received
-   * @param args the arguments that will be passed to the callback function
-   */
-  static void default_callback_function(CanBase &can, CanDataFrame &frame, void *args);
 };
 
 
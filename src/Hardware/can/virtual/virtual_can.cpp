@@ -0,0 +1,345 @@
+#include "virtual_can.hpp"
+#include <algorithm>
+
+using namespace stmepic;
+
+namespace {
+// bits of the base id, SRR/RTR, IDE and the id extension in the arbitration field
+constexpr uint32_t ARBITRATION_BASE_SHIFT = 21;
+constexpr uint32_t ARBITRATION_SRR_BIT    = 1u << 20;
+constexpr uint32_t ARBITRATION_IDE_BIT    = 1u << 19;
+constexpr uint32_t ARBITRATION_EXT_SHIFT  = 1;
+} // namespace
+
+Result<std::shared_ptr<VirtualCanBus>> VirtualCanBus::Make(const VirtualCanBusConfig &config) {
+  if(config.bitrate == 0)
+    return Status::Invalid("VirtualCanBus: bitrate can't be 0");
+  if(config.clock == nullptr)
+    return Status::Invalid("VirtualCanBus: clock is nullptr");
+  auto bus = std::shared_ptr<VirtualCanBus>(new VirtualCanBus(config));
+  if(bus->nodes_mutex == nullptr)
+    return Status::OutOfMemory("VirtualCanBus: can't create the mutex");
+  return Result<decltype(bus)>::OK(std::move(bus));
+}
+
+VirtualCanBus::VirtualCanBus(const VirtualCanBusConfig &_config)
+: config(_config), nodes_mutex(nullptr), task_handle(nullptr), bus_time_us(0), window_start_us(0),
+  window_busy_ns(0), busy_ns_remainder(0) {
+  statistics  = VirtualCanBusStatistics{};
+  nodes_mutex = xSemaphoreCreateMutex();
+}
+
+VirtualCanBus::~VirtualCanBus() {
+  (void)stop();
+  if(nodes_mutex != nullptr)
+    vSemaphoreDelete(nodes_mutex);
+}
+
+Status VirtualCanBus::start() {
+  if(task_handle != nullptr)
+    return Status::OK();
+  window_start_us = (uint32_t)config.clock();
+  bus_time_us     = window_start_us;
+  if(xTaskCreate(VirtualCanBus::task_bus, "VCAN_BUS", 1024, this, 2, &task_handle) != pdPASS) {
+    task_handle = nullptr;
+    return Status::OutOfMemory("VirtualCanBus: can't create the bus task");
+  }
+  return Status::OK();
+}
+
+Status VirtualCanBus::stop() {
+  if(task_handle == nullptr)
+    return Status::OK();
+  // the task holds the mutex only while transmitting, don't delete it in the middle of the frame
+  xSemaphoreTake(nodes_mutex, portMAX_DELAY);
+  vTaskDelete(task_handle);
+  task_handle = nullptr;
+  xSemaphoreGive(nodes_mutex);
+  return Status::OK();
+}
+
+uint32_t VirtualCanBus::frame_time_ns(const CanDataFrame &frame) const {
+  const uint64_t bits = can_frame_bits(frame);
+  if(!frame.fdcan_frame || config.data_bitrate == 0 || config.data_bitrate == config.bitrate)
+    return (uint32_t)(bits * 1000000000ull / config.bitrate);
+  // with the bitrate switching the data and the CRC run at the data bitrate
+  const uint64_t nominal_bits = can_frame_bits(frame.extended_id, true, frame.remote_request, 0);
+  const uint64_t data_bits    = bits - nominal_bits;
+  return (uint32_t)(nominal_bits * 1000000000ull / config.bitrate +
+                    data_bits * 1000000000ull / config.data_bitrate);
+}
+
+uint32_t VirtualCanBus::get_node_count() const {
+  return (uint32_t)nodes.size();
+}
+
+const VirtualCanBusStatistics &VirtualCanBus::get_statistics() const {
+  return statistics;
+}
+
+void VirtualCanBus::reset_statistics() {
+  xSemaphoreTake(nodes_mutex, portMAX_DELAY);
+  statistics      = VirtualCanBusStatistics{};
+  window_busy_ns  = 0;
+  window_start_us = (uint32_t)config.clock();
+  xSemaphoreGive(nodes_mutex);
+}
+
+const VirtualCanBusConfig &VirtualCanBus::get_config() const {
+  return config;
+}
+
+uint32_t VirtualCanBus::arbitration_field(const CanDataFrame &frame) {
+  const uint32_t rtr = frame.remote_request ? 1 : 0;
+  if(!frame.extended_id)
+    return ((frame.frame_id & 0x7FF) << ARBITRATION_BASE_SHIFT) | (rtr << 20);
+  // SRR and IDE of the extended frame are recessive, standard frame with the same base id wins
+  const uint32_t base      = (frame.frame_id >> 18) & 0x7FF;
+  const uint32_t extension = frame.frame_id & 0x3FFFF;
+  return (base << ARBITRATION_BASE_SHIFT) | ARBITRATION_SRR_BIT | ARBITRATION_IDE_BIT |
+         (extension << ARBITRATION_EXT_SHIFT) | rtr;
+}
+
+Status VirtualCanBus::attach(VirtualCan *node) {
+  xSemaphoreTake(nodes_mutex, portMAX_DELAY);
+  if(std::find(nodes.begin(), nodes.end(), node) != nodes.end()) {
+    xSemaphoreGive(nodes_mutex);
+    return Status::AlreadyExists("VirtualCanBus: node is already connected");
+  }
+  nodes.push_back(node);
+  xSemaphoreGive(nodes_mutex);
+  notify();
+  return Status::OK();
+}
+
+void VirtualCanBus::detach(VirtualCan *node) {
+  xSemaphoreTake(nodes_mutex, portMAX_DELAY);
+  auto it = std::find(nodes.begin(), nodes.end(), node);
+  if(it != nodes.end())
+    nodes.erase(it);
+  xSemaphoreGive(nodes_mutex);
+}
+
+void VirtualCanBus::notify() {
+  if(task_handle != nullptr)
+    xTaskNotifyGive(task_handle);
+}
+
+bool VirtualCanBus::transmit_next() {
+  xSemaphoreTake(nodes_mutex, portMAX_DELAY);
+  VirtualCan *winner    = nullptr;
+  uint32_t winner_field = 0;
+  bool winner_held      = false;
+  uint32_t pending      = 0;
+  VirtualCan *held      = nullptr;
+  uint64_t held_release = 0;
+  internall::CanQueueItem item;
+  // the frames held until their release time don't take part in the arbitration,
+  // when all pending frames are held the bus stays idle until the earliest release
+  const uint64_t now_us64 = config.clock();
+  const int32_t busy_us   = (int32_t)(bus_time_us - (uint32_t)now_us64);
+  const uint64_t free_us  = now_us64 + (busy_us > 0 ? (uint32_t)busy_us : 0);
+  for(auto node : nodes) {
+    // the frames with the release time wait in the hold list of the node like in the TX task
+    // of the hardware drivers, the frames written later aren't blocked
+    while(xQueuePeek(node->tx_queue_handle, &item, 0) == pdTRUE && node->tx_hold.hold(item, free_us))
+      xQueueReceive(node->tx_queue_handle, &item, 0);
+
+    const internall::CanQueueItem *candidate = node->tx_hold.peek();
+    const bool released = candidate != nullptr && candidate->frame.release_us <= free_us;
+    if(!released) {
+      if(candidate != nullptr && (held == nullptr || candidate->frame.release_us < held_release)) {
+        held         = node;
+        held_release = candidate->frame.release_us;
+      }
+      candidate = xQueuePeek(node->tx_queue_handle, &item, 0) == pdTRUE ? &item : nullptr;
+    }
+    if(candidate == nullptr)
+      continue;
+    pending++;
+    const uint32_t field = arbitration_field(candidate->frame);
+    if(winner != nullptr && field == winner_field)
+      statistics.id_collisions++;
+    if(winner == nullptr || field < winner_field) {
+      winner       = node;
+      winner_field = field;
+      winner_held  = released;
+    }
+  }
+  if(winner == nullptr && held == nullptr) {
+    xSemaphoreGive(nodes_mutex);
+    return false;
+  }
+  uint32_t release_delay_us = 0;
+  if(winner == nullptr) {
+    winner           = held;
+    winner_held      = true;
+    pending          = 1;
+    release_delay_us = (uint32_t)(held_release - free_us);
+  }
+  if(winner_held) {
+    item = *winner->tx_hold.peek();
+    winner->tx_hold.pop();
+  } else {
+    xQueueReceive(winner->tx_queue_handle, &item, 0);
+  }
+  statistics.arbitration_losses += pending - 1;
+
+  // the frame is received by the other nodes at the end of its transmission
+  const uint32_t duration_ns = frame_time_ns(item.frame);
+  pace(duration_ns, release_delay_us);
+  const uint64_t now_us = config.clock();
+  statistics.frames++;
+  statistics.bits += can_frame_bits(item.frame);
+  window_busy_ns += duration_ns;
+  winner->statistics.tx_frame(item.frame, (uint32_t)now_us - item.timestamp_us);
+  for(auto node : nodes) {
+    if(node == winner)
+      continue;
+    if(!node->deliver(item.frame, now_us))
+      statistics.rx_dropped++;
+  }
+  xSemaphoreGive(nodes_mutex);
+  return true;
+}
+
+void VirtualCanBus::pace(uint32_t duration_ns, uint32_t release_delay_us) {
+  const uint32_t now_us = (uint32_t)config.clock();
+  // bus was idle, the frame starts now or at its release time
+  if((int32_t)(now_us - bus_time_us) > 0)
+    bus_time_us = now_us;
+  bus_time_us += release_delay_us;
+  busy_ns_remainder += duration_ns;
+  bus_time_us += busy_ns_remainder / 1000;
+  statistics.busy_time_us += busy_ns_remainder / 1000;
+  busy_ns_remainder %= 1000;
+  if(!config.real_time)
+    return;
+  // sleep the whole milliseconds the bus is ahead of the wall clock, the rest is caught up later,
+  // the held frame is never received before its release time, like from the hardware drivers
+  const int32_t ahead_us = (int32_t)(bus_time_us - now_us);
+  if(release_delay_us > 0 && ahead_us > 0)
+    vTaskDelay(pdMS_TO_TICKS((ahead_us + 999) / 1000));
+  else if(ahead_us >= 1000)
+    vTaskDelay(pdMS_TO_TICKS(ahead_us / 1000));
+}
+
+void VirtualCanBus::update_load() {
+  const uint32_t now_us    = (uint32_t)config.clock();
+  const uint32_t window_us = now_us - window_start_us;
+  if(window_us < 1000000)
+    return;
+  statistics.bus_load = (float)window_busy_ns / 1000.0f / (float)window_us;
+  window_busy_ns      = 0;
+  window_start_us     = now_us;
+}
+
+void VirtualCanBus::task_bus(void *arg) {
+  auto bus = static_cast<VirtualCanBus *>(arg);
+  while(true) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+    while(bus->transmit_next()) {
+      bus->update_load();
+    }
+    bus->update_load();
+  }
+}
+
+Result<std::shared_ptr<VirtualCan>> VirtualCan::Make(std::shared_ptr<VirtualCanBus> bus, const char *name) {
+  if(bus == nullptr)
+    return Status::Invalid("VirtualCan: bus is nullptr");
+  auto can = std::shared_ptr<VirtualCan>(new VirtualCan(bus, name));
+  if(can->tx_queue_handle == nullptr || can->rx_queue_handle == nullptr)
+    return Status::OutOfMemory("VirtualCan: can't create the queues");
+  return Result<decltype(can)>::OK(std::move(can));
+}
+
+VirtualCan::VirtualCan(std::shared_ptr<VirtualCanBus> _bus, const char *_name)
+: CanBase(_bus->get_config().clock), is_initiated(false), bus(_bus), name(_name), task_handle_rx(nullptr),
+  tx_queue_handle(nullptr), rx_queue_handle(nullptr) {
+  tx_queue_handle = xQueueCreate(CAN_QUEUE_SIZE, sizeof(internall::CanQueueItem));
+  rx_queue_handle = xQueueCreate(CAN_QUEUE_SIZE, sizeof(internall::CanQueueItem));
+  statistics.set_bus_bitrate(bus->get_config().bitrate);
+}
+
+VirtualCan::~VirtualCan() {
+  (void)hardware_stop();
+  if(tx_queue_handle != nullptr)
+    vQueueDelete(tx_queue_handle);
+  if(rx_queue_handle != nullptr)
+    vQueueDelete(rx_queue_handle);
+}
+
+Status VirtualCan::hardware_reset() {
+  STMEPIC_RETURN_ON_ERROR(hardware_stop());
+  return hardware_start();
+}
+
+Status VirtualCan::hardware_start() {
+  if(is_initiated == true)
+    return Status::OK();
+  recovery.reset();
+  if(task_handle_rx == nullptr &&
+     xTaskCreate(VirtualCan::task_rx, "VCAN_RX", 1024, this, 1, &task_handle_rx) != pdPASS) {
+    task_handle_rx = nullptr;
+    return Status::OutOfMemory("VirtualCan: can't create the RX task");
+  }
+  STMEPIC_RETURN_ON_ERROR(dispatcher.start(*this));
+  STMEPIC_RETURN_ON_ERROR(bus->attach(this));
+  is_initiated = true;
+  return Status::OK();
+}
+
+Status VirtualCan::hardware_stop() {
+  if(is_initiated == false)
+    return Status::OK();
+  bus->detach(this);
+  dispatcher.stop();
+  if(task_handle_rx != nullptr) {
+    vTaskDelete(task_handle_rx);
+    task_handle_rx = nullptr;
+  }
+  xQueueReset(tx_queue_handle);
+  xQueueReset(rx_queue_handle);
+  tx_hold.clear();
+  is_initiated = false;
+  return Status::OK();
+}
+
+Status VirtualCan::write(const CanDataFrame &msg) {
+  internall::CanQueueItem item;
+  item.frame        = msg;
+  item.timestamp_us = (uint32_t)bus->config.clock();
+  if(xQueueSend(tx_queue_handle, &item, pdMS_TO_TICKS(10)) != pdTRUE) {
+    statistics.tx_dropped();
+    return Status::CapacityError("Queue is full, can't send message");
+  }
+  bus->notify();
+  return Status::OK();
+}
+
+bool VirtualCan::deliver(const CanDataFrame &frame, uint64_t timestamp_us) {
+  internall::CanQueueItem item;
+  item.frame              = frame;
+  item.frame.timestamp_us = timestamp_us;
+  item.frame.release_us   = 0;
+  item.timestamp_us       = (uint32_t)timestamp_us;
+  // ISR callbacks run in the bus task, the equivalent of the RX interrupt
+  if(dispatcher.dispatch_from_isr(*this, item, nullptr))
+    return true;
+  const bool dropped = xQueueSend(rx_queue_handle, &item, 0) != pdTRUE;
+  statistics.rx_isr(uxQueueMessagesWaiting(rx_queue_handle), dropped);
+  return !dropped;
+}
+
+void VirtualCan::task_rx(void *arg) {
+  auto can                     = static_cast<VirtualCan *>(arg);
+  internall::CanQueueItem item = {};
+  while(true) {
+    can->statistics.periodic((uint32_t)can->bus->config.clock(), can->name);
+    if(xQueueReceive(can->rx_queue_handle, &item, 100) != pdTRUE)
+      continue;
+
+    can->dispatcher.dispatch(*can, item);
+  }
+}
@@ -0,0 +1,212 @@
+#pragma once
+#include "hardware.hpp"
+#include "can.hpp"
+#include "FreeRTOS.h"
+#include "queue.h"
+#include "semphr.h"
+#include "task.h"
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @defgroup hardware Hardware
+ * @{
+ */
+
+/**
+ * @defgroup can_hardware CAN
+ * @brief Virtual CAN bus connecting multiple CanBase nodes in one process
+ * @{
+ */
+
+/**
+ * @file virtual_can.hpp
+ * @brief Virtual CAN interfaces and the bus that connects them, used to run the CanBase consumers
+ * (motors, ISO-TP, signal packers, ...) without the physical bus.
+ * @note The bus doesn't use any CAN peripheral nor the HAL. Besides the target it builds on the FreeRTOS
+ * POSIX port with STMEPIC_POSIX defined (no main.h needed) together with can.cpp, can_statistics.cpp,
+ * can_recovery.cpp and the Logger. Enabled by the STMEPIC_VIRTUAL_CAN option.
+ */
+
+namespace stmepic {
+
+class VirtualCan;
+
+/// @brief Settings of the virtual bus.
+struct VirtualCanBusConfig {
+  /// @brief nominal bitrate of the bus [bit/s]
+  uint32_t bitrate;
+  /// @brief bitrate of the data phase of the CAN FD frames [bit/s], 0 = no bitrate switching
+  uint32_t data_bitrate;
+  /// @brief pace the frames with their duration on the bus, otherwise the frames are passed as fast
+  /// as possible and only the bus time is counted
+  bool real_time;
+  /// @brief clock of the bus and its nodes [us], used for the time stamps, the release times and the
+  /// statistics, the real time pacing expects it to run with the RTOS ticks
+  CanClock clock;
+
+  VirtualCanBusConfig()
+  : bitrate(1000000), data_bitrate(0), real_time(true), clock(internall::can_default_clock) {
+  }
+};
+
+/// @brief Statistics of the virtual bus.
+struct VirtualCanBusStatistics {
+  /// @brief frames transmitted on the bus
+  uint32_t frames;
+  /// @brief bits transmitted on the bus at the nominal bitrate, estimated with the worst case stuffing
+  uint64_t bits;
+  /// @brief number of times a pending frame lost the arbitration
+  uint32_t arbitration_losses;
+  /// @brief frames sent by multiple nodes with the same id at the same time (error on the real bus)
+  uint32_t id_collisions;
+  /// @brief frames that didn't fit in the RX queue of some node
+  uint32_t rx_dropped;
+  /// @brief time the bus was busy [us]
+  uint64_t busy_time_us;
+  /// @brief busy time / elapsed time over the last second, can exceed 1 when not in real time
+  float bus_load;
+};
+
+/**
+ * @class VirtualCanBus
+ * @brief Bus that connects the VirtualCan nodes.
+ *
+ * The bus task takes the frames from the TX queues of the nodes, the pending frame with the lowest
+ * arbitration field wins (standard before extended with the same base id, data before remote),
+ * the others wait for the next round exactly like on the real bus. Each frame takes its bit time
+ * (worst case bit stuffing, data phase at data_bitrate for FD frames) and is delivered to the RX
+ * queues of all other nodes, from where the RX task of the node runs the callbacks.
+ */
+class VirtualCanBus {
+public:
+  /// @brief Make new virtual bus.
+  static Result<std::shared_ptr<VirtualCanBus>>
+  Make(const VirtualCanBusConfig &config = VirtualCanBusConfig());
+
+  ~VirtualCanBus();
+  VirtualCanBus(const VirtualCanBus &)            = delete;
+  VirtualCanBus &operator=(const VirtualCanBus &) = delete;
+
+  /// @brief Start the bus task, nodes can be started before or after the bus.
+  Status start();
+
+  /// @brief Stop the bus task, the frames stay in the TX queues of the nodes.
+  Status stop();
+
+  /// @brief Time the frame takes on the bus in nanoseconds.
+  [[nodiscard]] uint32_t frame_time_ns(const CanDataFrame &frame) const;
+
+  /// @brief Number of the started nodes connected to the bus.
+  [[nodiscard]] uint32_t get_node_count() const;
+
+  [[nodiscard]] const VirtualCanBusStatistics &get_statistics() const;
+
+  /// @brief Reset all statistics of the bus.
+  void reset_statistics();
+
+  [[nodiscard]] const VirtualCanBusConfig &get_config() const;
+
+  /**
+   * @brief Arbitration field of the frame, lower value wins the arbitration.
+   * Layout follows the order of the bits on the bus: base id, RTR/SRR, IDE, id extension, RTR.
+   */
+  static uint32_t arbitration_field(const CanDataFrame &frame);
+
+private:
+  friend class VirtualCan;
+
+  explicit VirtualCanBus(const VirtualCanBusConfig &config);
+
+  VirtualCanBusConfig config;
+  std::vector<VirtualCan *> nodes;
+  SemaphoreHandle_t nodes_mutex;
+  TaskHandle_t task_handle;
+  VirtualCanBusStatistics statistics;
+  uint32_t bus_time_us;
+  uint32_t window_start_us;
+  uint64_t window_busy_ns;
+  uint32_t busy_ns_remainder;
+
+  /// @brief Connect the node, called when the node is started.
+  Status attach(VirtualCan *node);
+
+  /// @brief Disconnect the node, called when the node is stopped.
+  void detach(VirtualCan *node);
+
+  /// @brief Wake up the bus task, new frame is pending.
+  void notify();
+
+  /// @brief Arbitrate the pending frames and transmit the winner.
+  /// @return false if no node had a pending frame
+  bool transmit_next();
+
+  /// @brief Wait until the wall clock catches up with the bus time.
+  /// @param duration_ns duration of the frame
+  /// @param release_delay_us time the bus stays idle until the release time of the frame
+  void pace(uint32_t duration_ns, uint32_t release_delay_us);
+
+  void update_load();
+
+  static void task_bus(void *arg);
+};
+
+/**
+ * @class VirtualCan
+ * @brief CanBase node of the VirtualCanBus.
+ *
+ * Works the same way as the hardware drivers: write() puts the frame to the TX queue, the bus
+ * puts the received frames to the RX queue and the RX task runs the callbacks of the frame ids
+ * (or the default callback) and updates the statistics.
+ * The node doesn't receive its own frames. The node never goes bus-off.
+ */
+class VirtualCan : public CanBase {
+public:
+  ~VirtualCan() override;
+
+  /**
+   * @brief Make new virtual node, the node is connected to the bus by hardware_start().
+   * @param bus the bus the node is connected to
+   * @param name name of the node used in the statistics log
+   */
+  static Result<std::shared_ptr<VirtualCan>>
+  Make(std::shared_ptr<VirtualCanBus> bus, const char *name = "VCAN");
+
+  Status hardware_reset() override;
+
+  /// @brief Connect the node to the bus and start the RX task.
+  Status hardware_start() override;
+
+  /// @brief Disconnect the node from the bus and stop the RX task.
+  Status hardware_stop() override;
+
+  Status write(const CanDataFrame &msg) override;
+
+private:
+  friend class VirtualCanBus;
+
+  VirtualCan(std::shared_ptr<VirtualCanBus> bus, const char *name);
+  VirtualCan(const VirtualCan &)            = delete;
+  VirtualCan &operator=(const VirtualCan &) = delete;
+
+  bool is_initiated;
+  std::shared_ptr<VirtualCanBus> bus;
+  const char *name;
+  TaskHandle_t task_handle_rx;
+  QueueHandle_t tx_queue_handle;
+  QueueHandle_t rx_queue_handle;
+  /// @brief written frames waiting for their release time, used by the bus task with the nodes mutex
+  internall::CanTxHoldList tx_hold;
+  static const uint32_t CAN_QUEUE_SIZE = 64;
+
+  /// @brief Frame received from the bus, the equivalent of the RX interrupt of the hardware drivers.
+  /// @param timestamp_us end of the frame on the bus in the clock of the bus
+  /// @return false if the RX queue was full
+  bool deliver(const CanDataFrame &frame, uint64_t timestamp_us);
+
+  /// @brief task that handles the RX traffic
+  static void task_rx(void *arg);
+};
+
+} // namespace stmepic
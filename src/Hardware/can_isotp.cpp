@@ -0,0 +1,359 @@
+#include "can_isotp.hpp"
+#include "Timing.hpp"
+#include "task.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace stmepic;
+
+namespace {
+// protocol control information, high nibble of the first byte
+constexpr uint8_t ISOTP_SINGLE_FRAME      = 0x00;
+constexpr uint8_t ISOTP_FIRST_FRAME       = 0x10;
+constexpr uint8_t ISOTP_CONSECUTIVE_FRAME = 0x20;
+constexpr uint8_t ISOTP_FLOW_CONTROL      = 0x30;
+
+// flow status of the flow control frame
+constexpr uint8_t ISOTP_FC_CONTINUE = 0x00;
+constexpr uint8_t ISOTP_FC_WAIT     = 0x01;
+constexpr uint8_t ISOTP_FC_OVERFLOW = 0x02;
+
+// longest message that fits the 12 bit length of the first frame, longer use the 32 bit escape
+constexpr size_t ISOTP_FF_SHORT_MAX_LENGTH = 4095;
+// longest single frame without the escape byte
+constexpr size_t ISOTP_SF_SHORT_MAX_LENGTH = 7;
+// STmin used for the reserved values
+constexpr uint32_t ISOTP_ST_MIN_RESERVED_US = 127000;
+} // namespace
+
+Result<std::shared_ptr<CanIsoTp>> CanIsoTp::Make(std::shared_ptr<CanBase> can, const CanIsoTpConfig &config) {
+  if(can == nullptr)
+    return Status::Invalid("CAN is nullptr");
+  if(config.tx_id == config.rx_id)
+    return Status::Invalid("ISO-TP tx_id and rx_id have to be different");
+  if(config.tx_data_length < 8 || can_fd_round_data_size(config.tx_data_length) != config.tx_data_length)
+    return Status::Invalid("ISO-TP tx_data_length has to be 8 or valid CAN FD length");
+
+  auto isotp = std::shared_ptr<CanIsoTp>(new CanIsoTp(can, config));
+  if(isotp->tx_mutex == nullptr || isotp->fc_semaphore == nullptr)
+    return Status::OutOfMemory("Can't create ISO-TP semaphores");
+  STMEPIC_RETURN_ON_ERROR(can->add_callback(config.rx_id, can_callback, isotp.get()));
+  return Result<decltype(isotp)>::OK(std::move(isotp));
+}
+
+CanIsoTp::CanIsoTp(std::shared_ptr<CanBase> _can, const CanIsoTpConfig &_config)
+: can(_can), config(_config), tx_waiting_fc(false), fc_status(0), fc_block_size(0), fc_st_min(0),
+  rx_buffer(nullptr), rx_buffer_size(0), receive_callback(nullptr), receive_args(nullptr),
+  rx_state(RxState::IDLE), rx_size(0), rx_offset(0), rx_sequence(0), rx_block_size(0), rx_block_count(0),
+  rx_last_us(0), received_count(0), rx_error_count(0) {
+  tx_mutex     = xSemaphoreCreateMutex();
+  fc_semaphore = xSemaphoreCreateBinary();
+}
+
+CanIsoTp::~CanIsoTp() {
+  (void)can->remove_callback(config.rx_id);
+  if(tx_mutex != nullptr)
+    vSemaphoreDelete(tx_mutex);
+  if(fc_semaphore != nullptr)
+    vSemaphoreDelete(fc_semaphore);
+}
+
+void CanIsoTp::set_rx_buffer(uint8_t *buffer, size_t size) {
+  rx_buffer      = buffer;
+  rx_buffer_size = buffer == nullptr ? 0 : size;
+  rx_state       = RxState::IDLE;
+}
+
+void CanIsoTp::set_receive_callback(can_isotp_receive_callback callback, void *args) {
+  receive_callback = callback;
+  receive_args     = args;
+}
+
+void CanIsoTp::set_flow_control(uint8_t block_size, uint32_t st_min_us) {
+  config.block_size = block_size;
+  config.st_min_us  = st_min_us;
+}
+
+uint32_t CanIsoTp::get_received_count() const {
+  return received_count;
+}
+
+uint32_t CanIsoTp::get_rx_error_count() const {
+  return rx_error_count;
+}
+
+uint8_t CanIsoTp::encode_st_min(uint32_t st_min_us) {
+  if(st_min_us == 0)
+    return 0;
+  if(st_min_us <= 900)
+    return (uint8_t)(0xF0 + (st_min_us + 99) / 100);
+  const uint32_t ms = (st_min_us + 999) / 1000;
+  return (uint8_t)std::min<uint32_t>(ms, 0x7F);
+}
+
+uint32_t CanIsoTp::decode_st_min(uint8_t st_min) {
+  if(st_min <= 0x7F)
+    return (uint32_t)st_min * 1000;
+  if(st_min >= 0xF1 && st_min <= 0xF9)
+    return (uint32_t)(st_min - 0xF0) * 100;
+  return ISOTP_ST_MIN_RESERVED_US;
+}
+
+Status CanIsoTp::send(const uint8_t *data, size_t size) {
+  if(data == nullptr || size == 0)
+    return Status::Invalid("ISO-TP message is empty");
+  if((uint64_t)size > UINT32_MAX)
+    return Status::Invalid("ISO-TP message is too long");
+  if(xSemaphoreTake(tx_mutex, pdMS_TO_TICKS(config.timeout_ms)) != pdTRUE)
+    return Status::TimeOut("ISO-TP link is busy");
+  Status status = send_message(data, size);
+  tx_waiting_fc = false;
+  xSemaphoreGive(tx_mutex);
+  return status;
+}
+
+Status CanIsoTp::send_message(const uint8_t *data, size_t size) {
+  CanDataFrame frame = make_frame();
+
+  if(size <= single_frame_capacity()) {
+    if(size <= ISOTP_SF_SHORT_MAX_LENGTH) {
+      frame.data[0] = ISOTP_SINGLE_FRAME | (uint8_t)size;
+      std::memcpy(&frame.data[1], data, size);
+      return write_frame(frame, (uint8_t)(size + 1));
+    }
+    frame.data[0] = ISOTP_SINGLE_FRAME;
+    frame.data[1] = (uint8_t)size;
+    std::memcpy(&frame.data[2], data, size);
+    return write_frame(frame, (uint8_t)(size + 2));
+  }
+
+  size_t header = 2;
+  if(size <= ISOTP_FF_SHORT_MAX_LENGTH) {
+    frame.data[0] = ISOTP_FIRST_FRAME | (uint8_t)(size >> 8);
+    frame.data[1] = (uint8_t)size;
+  } else {
+    frame.data[0] = ISOTP_FIRST_FRAME;
+    frame.data[1] = 0;
+    frame.data[2] = (uint8_t)(size >> 24);
+    frame.data[3] = (uint8_t)(size >> 16);
+    frame.data[4] = (uint8_t)(size >> 8);
+    frame.data[5] = (uint8_t)size;
+    header        = 6;
+  }
+  const size_t frame_length = config.tx_data_length;
+  size_t offset             = frame_length - header;
+  std::memcpy(&frame.data[header], data, offset);
+
+  // flow control from the previous transfer that came too late
+  xSemaphoreTake(fc_semaphore, 0);
+  tx_waiting_fc = true;
+  STMEPIC_RETURN_ON_ERROR(write_frame(frame, (uint8_t)frame_length));
+
+  uint8_t sequence = 1;
+  while(offset < size) {
+    uint8_t block_size = 0;
+    uint32_t st_min_us = 0;
+    STMEPIC_RETURN_ON_ERROR(wait_flow_control(block_size, st_min_us));
+
+    // first consecutive frame of the block goes right after the flow control
+    uint32_t last_us = Ticker::get_instance().get_micros() - st_min_us;
+    for(uint32_t sent = 0; offset < size && (block_size == 0 || sent < block_size); sent++) {
+      wait_st_min(last_us, st_min_us);
+      last_us            = Ticker::get_instance().get_micros();
+      const size_t chunk = std::min(size - offset, frame_length - 1);
+      frame.data[0]      = ISOTP_CONSECUTIVE_FRAME | (sequence & 0x0F);
+      std::memcpy(&frame.data[1], data + offset, chunk);
+      STMEPIC_RETURN_ON_ERROR(write_frame(frame, (uint8_t)(chunk + 1)));
+      offset += chunk;
+      sequence++;
+    }
+  }
+  return Status::OK();
+}
+
+size_t CanIsoTp::single_frame_capacity() const {
+  // CAN FD single frames longer than 7 bytes use the escape byte with the length
+  if(config.tx_data_length > 8)
+    return config.tx_data_length - 2;
+  return ISOTP_SF_SHORT_MAX_LENGTH;
+}
+
+CanDataFrame CanIsoTp::make_frame() const {
+  CanDataFrame frame;
+  frame.frame_id       = config.tx_id;
+  frame.extended_id    = config.extended_id;
+  frame.fdcan_frame    = config.tx_data_length > 8;
+  frame.remote_request = false;
+  return frame;
+}
+
+Status CanIsoTp::write_frame(CanDataFrame &frame, uint8_t size) {
+  // pad to the length the DLC can encode, at least to the classic 8 bytes
+  const uint8_t length = size < 8 ? 8 : can_fd_round_data_size(size);
+  std::memset(&frame.data[size], config.padding, length - size);
+  frame.data_size = length;
+  return can->write(frame);
+}
+
+Status CanIsoTp::send_flow_control(uint8_t status) {
+  CanDataFrame frame = make_frame();
+  frame.data[0]      = ISOTP_FLOW_CONTROL | status;
+  frame.data[1]      = config.block_size;
+  frame.data[2]      = encode_st_min(config.st_min_us);
+  return write_frame(frame, 3);
+}
+
+Status CanIsoTp::wait_flow_control(uint8_t &block_size, uint32_t &st_min_us) {
+  uint8_t waits = 0;
+  while(true) {
+    if(xSemaphoreTake(fc_semaphore, pdMS_TO_TICKS(config.timeout_ms)) != pdTRUE)
+      return Status::TimeOut("ISO-TP flow control timeout");
+    switch(fc_status) {
+    case ISOTP_FC_CONTINUE:
+      block_size = fc_block_size;
+      st_min_us  = decode_st_min(fc_st_min);
+      return Status::OK();
+    case ISOTP_FC_WAIT:
+      if(++waits > config.max_wait_frames)
+        return Status::TimeOut("ISO-TP receiver sent too many wait frames");
+      break;
+    case ISOTP_FC_OVERFLOW: return Status::CapacityError("ISO-TP message is too long for the receiver");
+    default: return Status::Invalid("ISO-TP invalid flow status");
+    }
+  }
+}
+
+void CanIsoTp::wait_st_min(uint32_t last_us, uint32_t st_min_us) {
+  // sleep whole ticks rounded up instead of busy waiting the sub tick part, ISO-TP allows longer STmin,
+  // vTaskDelay ends on the next tick so it can be shorter than asked, checked again by the loop
+  const uint32_t tick_us = 1000000 / configTICK_RATE_HZ;
+  while(true) {
+    const uint32_t elapsed = Ticker::get_instance().get_micros() - last_us;
+    if(elapsed >= st_min_us)
+      return;
+    vTaskDelay((TickType_t)((st_min_us - elapsed + tick_us - 1) / tick_us));
+  }
+}
+
+void CanIsoTp::rx_frame(const CanDataFrame &frame) {
+  if(frame.data_size == 0 || frame.remote_request)
+    return;
+  switch(frame.data[0] & 0xF0) {
+  case ISOTP_SINGLE_FRAME: rx_single_frame(frame); break;
+  case ISOTP_FIRST_FRAME: rx_first_frame(frame); break;
+  case ISOTP_CONSECUTIVE_FRAME: rx_consecutive_frame(frame); break;
+  case ISOTP_FLOW_CONTROL: rx_flow_control(frame); break;
+  default: break;
+  }
+}
+
+void CanIsoTp::rx_single_frame(const CanDataFrame &frame) {
+  size_t length = frame.data[0] & 0x0F;
+  size_t header = 1;
+  if(length == 0 && frame.data_size > 8) {
+    length = frame.data[1];
+    header = 2;
+  }
+  if(length == 0 || header + length > frame.data_size)
+    return;
+
+  // new message aborts the one being received
+  if(rx_state == RxState::RECEIVING)
+    rx_error_count++;
+  rx_state = RxState::IDLE;
+  if(length > rx_buffer_size) {
+    rx_error_count++;
+    return;
+  }
+  std::memcpy(rx_buffer, &frame.data[header], length);
+  rx_size = length;
+  rx_complete();
+}
+
+void CanIsoTp::rx_first_frame(const CanDataFrame &frame) {
+  if(frame.data_size < 8)
+    return;
+  size_t length = ((size_t)(frame.data[0] & 0x0F) << 8) | frame.data[1];
+  size_t header = 2;
+  if(length == 0) {
+    length = ((size_t)frame.data[2] << 24) | ((size_t)frame.data[3] << 16) | ((size_t)frame.data[4] << 8) |
+             (size_t)frame.data[5];
+    header = 6;
+  }
+  const size_t chunk = frame.data_size - header;
+  if(length <= chunk)
+    return;
+
+  if(rx_state == RxState::RECEIVING)
+    rx_error_count++;
+  rx_state = RxState::IDLE;
+  if(length > rx_buffer_size) {
+    rx_error_count++;
+    (void)send_flow_control(ISOTP_FC_OVERFLOW);
+    return;
+  }
+
+  std::memcpy(rx_buffer, &frame.data[header], chunk);
+  rx_size        = length;
+  rx_offset      = chunk;
+  rx_sequence    = 1;
+  rx_block_size  = config.block_size;
+  rx_block_count = 0;
+  rx_last_us     = Ticker::get_instance().get_micros();
+  if(!send_flow_control(ISOTP_FC_CONTINUE).ok()) {
+    rx_error_count++;
+    return;
+  }
+  rx_state = RxState::RECEIVING;
+}
+
+void CanIsoTp::rx_consecutive_frame(const CanDataFrame &frame) {
+  if(rx_state != RxState::RECEIVING || frame.data_size < 2)
+    return;
+  const uint32_t now_us = Ticker::get_instance().get_micros();
+  if(now_us - rx_last_us > config.timeout_ms * 1000 || (frame.data[0] & 0x0F) != rx_sequence) {
+    rx_error_count++;
+    rx_state = RxState::IDLE;
+    return;
+  }
+
+  const size_t chunk = std::min(rx_size - rx_offset, (size_t)frame.data_size - 1);
+  std::memcpy(rx_buffer + rx_offset, &frame.data[1], chunk);
+  rx_offset += chunk;
+  rx_sequence = (rx_sequence + 1) & 0x0F;
+  rx_last_us  = now_us;
+
+  if(rx_offset >= rx_size) {
+    rx_state = RxState::IDLE;
+    rx_complete();
+    return;
+  }
+  if(rx_block_size != 0 && ++rx_block_count >= rx_block_size) {
+    rx_block_count = 0;
+    if(!send_flow_control(ISOTP_FC_CONTINUE).ok()) {
+      rx_error_count++;
+      rx_state = RxState::IDLE;
+    }
+  }
+}
+
+void CanIsoTp::rx_flow_control(const CanDataFrame &frame) {
+  if(!tx_waiting_fc || frame.data_size < 3)
+    return;
+  fc_status     = frame.data[0] & 0x0F;
+  fc_block_size = frame.data[1];
+  fc_st_min     = frame.data[2];
+  xSemaphoreGive(fc_semaphore);
+}
+
+void CanIsoTp::rx_complete() {
+  received_count++;
+  if(receive_callback)
+    receive_callback(*this, rx_buffer, rx_size, receive_args);
+}
+
+void CanIsoTp::can_callback(CanBase &can, CanDataFrame &frame, void *args) {
+  (void)can;
+  auto isotp = static_cast<CanIsoTp *>(args);
+  isotp->rx_frame(frame);
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#include "stmepic.hpp"
+#include "can.hpp"
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include <functional>
+#include <memory>
+
+/**
+ * @defgroup hardware Hardware
+ * @{
+ */
+
+/**
+ * @file can_isotp.hpp
+ * @brief ISO-TP (ISO 15765-2) transport protocol on top of the CanBase interface.
+ */
+
+namespace stmepic {
+
+class CanIsoTp;
+
+/// @brief Callback of the received ISO-TP message.
+/// @param CanIsoTp the transport that received the message
+/// @param const uint8_t* message, points into the RX buffer set by the user
+/// @param size_t size of the message
+/// @param void* args provided by the user
+using can_isotp_receive_callback = std::function<void(CanIsoTp &, const uint8_t *, size_t, void *)>;
+
+/// @brief Settings of the ISO-TP link.
+struct CanIsoTpConfig {
+  /// @brief id of the frames sent by this node
+  uint32_t tx_id;
+  /// @brief id of the frames received by this node
+  uint32_t rx_id;
+  /// @brief send extended id frames
+  bool extended_id;
+  /// @brief length of the sent frames: 8 for classic CAN, 12-64 for CAN FD frames
+  uint8_t tx_data_length;
+  /// @brief block size announced to the sender, number of consecutive frames between flow controls, 0 =
+  /// no more flow controls
+  uint8_t block_size;
+  /// @brief min separation time of the consecutive frames announced to the sender [us]
+  /// @note Encoded as 100-900 us or 1-127 ms, rounded up.
+  uint32_t st_min_us;
+  /// @brief byte used to pad the frames
+  uint8_t padding;
+  /// @brief timeout of the flow control (N_Bs) and of the consecutive frames (N_Cr) [ms]
+  uint32_t timeout_ms;
+  /// @brief max number of consecutive WAIT flow controls accepted by the sender
+  uint8_t max_wait_frames;
+
+  CanIsoTpConfig()
+  : tx_id(0), rx_id(0), extended_id(false), tx_data_length(8), block_size(0), st_min_us(0), padding(0xCC),
+    timeout_ms(1000), max_wait_frames(10) {
+  }
+};
+
+/**
+ * @class CanIsoTp
+ * @brief Segmented transfer of messages up to 4 GB over the CAN interface using ISO-TP.
+ *
+ * Received frames are handled by the callback registered for rx_id, which runs in the RX task of the
+ * CAN interface. The payload of the frames is copied directly into the RX buffer provided by the user,
+ * there is no intermediate buffer, and the receive callback gets the pointer into that buffer.
+ * The buffer is reused for the next message as soon as the receive callback returns.
+ *
+ * send() blocks the calling task for the whole transfer and reads the data directly from the caller
+ * buffer. With block_size 0 and STmin 0 of the receiver the consecutive frames are written back to back
+ * and the transfer is limited only by the TX queue of the interface and the bus.
+ * @note send() can't be called from the RX task of the interface (from the CAN callbacks),
+ * flow control frames are received by that task.
+ * @note STmin is kept between the frames written to the TX queue of the interface, rounded up to
+ * whole RTOS ticks (the sending task sleeps, sub millisecond STmin ends up as 1-2 ticks).
+ */
+class CanIsoTp {
+public:
+  /**
+   * @brief Make new ISO-TP link and register its callback for the rx_id on the CAN interface.
+   * @param can CAN interface used by the link
+   * @param config settings of the link
+   * @return Invalid if the config is wrong, error of add_callback if rx_id already has a callback
+   */
+  static Result<std::shared_ptr<CanIsoTp>> Make(std::shared_ptr<CanBase> can, const CanIsoTpConfig &config);
+
+  ~CanIsoTp();
+  CanIsoTp(const CanIsoTp &)            = delete;
+  CanIsoTp &operator=(const CanIsoTp &) = delete;
+
+  /**
+   * @brief Set the buffer the received messages are assembled in.
+   * Messages bigger than the buffer are rejected with the overflow flow control.
+   * @param buffer buffer owned by the user, has to live as long as the link
+   * @param size size of the buffer
+   */
+  void set_rx_buffer(uint8_t *buffer, size_t size);
+
+  /// @brief Set the callback called with each received message, runs in the RX task of the interface.
+  void set_receive_callback(can_isotp_receive_callback callback, void *args = nullptr);
+
+  /// @brief Set the block size and STmin announced to the sender, used from the next received message.
+  void set_flow_control(uint8_t block_size, uint32_t st_min_us);
+
+  /**
+   * @brief Send the message, blocks until the last frame is written to the interface.
+   * @param data message, read directly during the transfer
+   * @param size size of the message
+   * @return TimeOut if the receiver didn't send the flow control, CapacityError if the receiver
+   * has too small buffer, error of CanBase::write if the frame couldn't be written
+   */
+  Status send(const uint8_t *data, size_t size);
+
+  /// @brief Number of messages received completely.
+  [[nodiscard]] uint32_t get_received_count() const;
+
+  /// @brief Number of messages dropped by the receiver: timeouts, lost frames, too small buffer.
+  [[nodiscard]] uint32_t get_rx_error_count() const;
+
+  /// @brief Encode the separation time to the STmin byte of the flow control, rounded up.
+  static uint8_t encode_st_min(uint32_t st_min_us);
+
+  /// @brief Decode the STmin byte of the flow control to microseconds.
+  static uint32_t decode_st_min(uint8_t st_min);
+
+private:
+  enum class RxState : uint8_t { IDLE, RECEIVING };
+
+  CanIsoTp(std::shared_ptr<CanBase> can, const CanIsoTpConfig &config);
+
+  std::shared_ptr<CanBase> can;
+  CanIsoTpConfig config;
+  SemaphoreHandle_t tx_mutex;
+  SemaphoreHandle_t fc_semaphore;
+
+  // sender side, flow control written by the RX task
+  volatile bool tx_waiting_fc;
+  volatile uint8_t fc_status;
+  volatile uint8_t fc_block_size;
+  volatile uint8_t fc_st_min;
+
+  // receiver side, used only by the RX task
+  uint8_t *rx_buffer;
+  size_t rx_buffer_size;
+  can_isotp_receive_callback receive_callback;
+  void *receive_args;
+  RxState rx_state;
+  size_t rx_size;
+  size_t rx_offset;
+  uint8_t rx_sequence;
+  uint8_t rx_block_size;
+  uint8_t rx_block_count;
+  uint32_t rx_last_us;
+  uint32_t received_count;
+  uint32_t rx_error_count;
+
+  /// @brief Max payload of the single frame with the current tx_data_length.
+  [[nodiscard]] size_t single_frame_capacity() const;
+  Status send_message(const uint8_t *data, size_t size);
+  CanDataFrame make_frame() const;
+  Status write_frame(CanDataFrame &frame, uint8_t size);
+  Status send_flow_control(uint8_t status);
+  Status wait_flow_control(uint8_t &block_size, uint32_t &st_min_us);
+  static void wait_st_min(uint32_t last_us, uint32_t st_min_us);
+
+  void rx_frame(const CanDataFrame &frame);
+  void rx_single_frame(const CanDataFrame &frame);
+  void rx_first_frame(const CanDataFrame &frame);
+  void rx_consecutive_frame(const CanDataFrame &frame);
+  void rx_flow_control(const CanDataFrame &frame);
+  void rx_complete();
+  static void can_callback(CanBase &can, CanDataFrame &frame, void *args);
+};
+
+} // namespace stmepic
@@ -0,0 +1,132 @@
+#include "can_recovery.hpp"
+
+using namespace stmepic;
+using namespace stmepic::internall;
+
+namespace {
+// time the recovering peripheral has to rejoin the bus before the re-initialization is repeated
+constexpr uint32_t CAN_RECOVERY_REJOIN_TIMEOUT_US = 1000000;
+} // namespace
+
+CanRecovery::CanRecovery()
+: initial_backoff_ms(10), max_backoff_ms(2000), stable_us(5000000), bus_off_time_us(0), recovery_time_us(0),
+  active_since_us(0), backoff_armed(false) {
+  statistics = CanRecoveryStatistics{};
+  reset();
+}
+
+void CanRecovery::set_backoff(uint32_t initial_ms, uint32_t max_ms, uint32_t stable_ms) {
+  initial_backoff_ms    = initial_ms;
+  max_backoff_ms        = max_ms < initial_ms ? initial_ms : max_ms;
+  stable_us             = stable_ms * 1000;
+  statistics.backoff_ms = initial_backoff_ms;
+}
+
+void CanRecovery::error_isr(const CanErrorFlags &flags) {
+  // bus-off can be left by the hardware before the task sees it, so remember it
+  if(flags.bus_off)
+    isr_bus_off = true;
+}
+
+bool CanRecovery::update(uint32_t now_us, const CanErrorFlags &flags) {
+  const bool bus_off = flags.bus_off || isr_bus_off;
+  isr_bus_off        = false;
+
+  switch(state) {
+  case CanBusState::BUS_OFF:
+    if(now_us - bus_off_time_us < statistics.backoff_ms * 1000)
+      return false;
+    state            = CanBusState::RECOVERING;
+    recovery_time_us = now_us;
+    statistics.recovery_attempts++;
+    return true;
+
+  case CanBusState::RECOVERING:
+    if(!flags.bus_off) {
+      state                            = CanBusState::ERROR_ACTIVE;
+      active_since_us                  = now_us;
+      backoff_armed                    = true;
+      statistics.last_recovery_time_us = now_us - bus_off_time_us;
+      statistics.recoveries++;
+    } else if(now_us - recovery_time_us >= CAN_RECOVERY_REJOIN_TIMEOUT_US) {
+      // didn't rejoin the bus, try again with longer delay
+      state           = CanBusState::BUS_OFF;
+      bus_off_time_us = now_us;
+      increase_backoff();
+    }
+    return false;
+
+  default: break;
+  }
+
+  if(bus_off) {
+    enter_bus_off(now_us);
+    return false;
+  }
+
+  CanBusState next = CanBusState::ERROR_ACTIVE;
+  if(flags.passive)
+    next = CanBusState::ERROR_PASSIVE;
+  else if(flags.warning)
+    next = CanBusState::ERROR_WARNING;
+
+  if(next == CanBusState::ERROR_PASSIVE && state != CanBusState::ERROR_PASSIVE)
+    statistics.error_passive_count++;
+  if(next == CanBusState::ERROR_WARNING && state == CanBusState::ERROR_ACTIVE)
+    statistics.error_warning_count++;
+  if(next == CanBusState::ERROR_ACTIVE && state != CanBusState::ERROR_ACTIVE)
+    active_since_us = now_us;
+  state = next;
+
+  // bus stayed error active long enough, the next bus-off starts with the initial delay again
+  if(backoff_armed && state == CanBusState::ERROR_ACTIVE && now_us - active_since_us >= stable_us) {
+    backoff_armed         = false;
+    statistics.backoff_ms = initial_backoff_ms;
+  }
+  return false;
+}
+
+void CanRecovery::recovery_done(uint32_t now_us, bool ok) {
+  if(ok)
+    return;
+  statistics.recovery_failures++;
+  state           = CanBusState::BUS_OFF;
+  bus_off_time_us = now_us;
+  increase_backoff();
+}
+
+void CanRecovery::reset() {
+  state                 = CanBusState::ERROR_ACTIVE;
+  isr_bus_off           = false;
+  backoff_armed         = false;
+  statistics.backoff_ms = initial_backoff_ms;
+}
+
+bool CanRecovery::tx_allowed() const {
+  return state != CanBusState::BUS_OFF && state != CanBusState::RECOVERING;
+}
+
+CanBusState CanRecovery::get_state() const {
+  return state;
+}
+
+const CanRecoveryStatistics &CanRecovery::get_statistics() const {
+  return statistics;
+}
+
+void CanRecovery::enter_bus_off(uint32_t now_us) {
+  statistics.bus_off_count++;
+  // consecutive bus-off before the bus was stable doubles the delay
+  if(backoff_armed)
+    increase_backoff();
+  else
+    statistics.backoff_ms = initial_backoff_ms;
+  state           = CanBusState::BUS_OFF;
+  bus_off_time_us = now_us;
+}
+
+void CanRecovery::increase_backoff() {
+  backoff_armed          = true;
+  const uint32_t doubled = statistics.backoff_ms * 2;
+  statistics.backoff_ms  = doubled > max_backoff_ms ? max_backoff_ms : doubled;
+}
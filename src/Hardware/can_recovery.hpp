@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * @defgroup hardware Hardware
+ * @{
+ */
+
+/**
+ * @file can_recovery.hpp
+ * @brief Bus-off and error-passive recovery state machine of the CAN interfaces.
+ */
+
+namespace stmepic {
+
+/// @brief Fault confinement state of the CAN interface.
+enum class CanBusState : uint8_t {
+  /// @brief normal operation
+  ERROR_ACTIVE,
+  /// @brief one of the error counters reached the warning level (96)
+  ERROR_WARNING,
+  /// @brief one of the error counters exceeded 127, the node sends only passive error flags
+  ERROR_PASSIVE,
+  /// @brief transmit error counter exceeded 255, the node is disconnected from the bus
+  BUS_OFF,
+  /// @brief the peripheral was re-initialized and waits to rejoin the bus
+  RECOVERING,
+};
+
+/// @brief Counters of the error states and recoveries.
+struct CanRecoveryStatistics {
+  uint32_t error_warning_count;
+  uint32_t error_passive_count;
+  uint32_t bus_off_count;
+  /// @brief number of the re-initializations of the peripheral
+  uint32_t recovery_attempts;
+  /// @brief re-initializations that failed in HAL
+  uint32_t recovery_failures;
+  /// @brief number of times the interface got back to the error active state after bus-off
+  uint32_t recoveries;
+  /// @brief time from the last bus-off to the error active state [us]
+  uint32_t last_recovery_time_us;
+  /// @brief current back-off delay before the next re-initialization [ms]
+  uint32_t backoff_ms;
+};
+
+/// @brief Error flags read from the peripheral.
+struct CanErrorFlags {
+  bool warning;
+  bool passive;
+  bool bus_off;
+};
+
+namespace internall {
+
+/**
+ * @class CanRecovery
+ * @brief Recovery state machine of the CAN interface, independent of HAL.
+ *
+ * The driver feeds it the error flags of the peripheral from the error interrupt and from
+ * its task, the state machine tells the driver when to re-initialize the peripheral.
+ * After bus-off the peripheral is re-initialized after the back-off delay, each consecutive
+ * bus-off (without the bus being stable for the stable time in between) doubles the delay up
+ * to the maximum. While the interface is bus-off or recovering the TX task holds the frames in
+ * the queue, so no frames are lost by the recovery as long as the queue doesn't overflow.
+ */
+class CanRecovery {
+public:
+  CanRecovery();
+
+  /// @brief Set the back-off of the re-initialization.
+  /// @param initial_ms delay between bus-off and the first re-initialization
+  /// @param max_ms max delay, the delay doubles with each consecutive bus-off
+  /// @param stable_ms time in the error active state after which the delay returns to initial_ms
+  void set_backoff(uint32_t initial_ms, uint32_t max_ms, uint32_t stable_ms);
+
+  /// @brief Error interrupt, only records the flags, the state is changed by update().
+  void error_isr(const CanErrorFlags &flags);
+
+  /**
+   * @brief Advance the state machine, run periodically from the driver task.
+   * @param now_us current time from the Ticker
+   * @param flags current error flags of the peripheral
+   * @return true if the driver should re-initialize the peripheral now and report the result
+   * with recovery_done()
+   */
+  bool update(uint32_t now_us, const CanErrorFlags &flags);
+
+  /// @brief Report the result of the re-initialization requested by update().
+  void recovery_done(uint32_t now_us, bool ok);
+
+  /// @brief Reset the state machine to the error active state, used when the interface is restarted.
+  void reset();
+
+  /// @brief True if the frames can be handed to the peripheral.
+  [[nodiscard]] bool tx_allowed() const;
+
+  [[nodiscard]] CanBusState get_state() const;
+
+  [[nodiscard]] const CanRecoveryStatistics &get_statistics() const;
+
+private:
+  volatile CanBusState state;
+  volatile bool isr_bus_off;
+  CanRecoveryStatistics statistics;
+  uint32_t initial_backoff_ms;
+  uint32_t max_backoff_ms;
+  uint32_t stable_us;
+  uint32_t bus_off_time_us;
+  uint32_t recovery_time_us;
+  uint32_t active_since_us;
+  bool backoff_armed;
+
+  void enter_bus_off(uint32_t now_us);
+  void increase_backoff();
+};
+
+} // namespace internall
+
+} // namespace stmepic
@@ -0,0 +1,372 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+/**
+ * @defgroup hardware Hardware
+ * @{
+ */
+
+/**
+ * @file can_signal.hpp
+ * @brief Constexpr description of the signals in the CAN frames (DBC style) with the pack and unpack code.
+ *
+ * The signal is described once with its start bit, length, byte order, sign, scale and offset:
+ * @code
+ * constexpr CanSignal VESC_ERPM = { 7, 32, CanByteOrder::BIG_ENDIAN_ORDER, true, 1.0f, 0.0f };
+ * float erpm = can_signal_decode<VESC_ERPM>(frame.data);
+ * can_signal_encode<VESC_ERPM>(frame.data, 1500.0f);
+ * @endcode
+ * The template versions take the signal as the template parameter, so all the shifts and masks are
+ * known at compile time and the loops unroll to the same code as the hand-written helpers.
+ * The member functions work with the signals known only at run time (tables, configs).
+ * tools/dbc2signals.py generates the signal definitions from the DBC file.
+ */
+
+namespace stmepic {
+
+/// @brief Byte order of the signal, names follow the DBC files.
+enum class CanByteOrder : uint8_t {
+  /// @brief Intel, start bit is the least significant bit of the signal
+  LITTLE_ENDIAN_ORDER,
+  /// @brief Motorola, start bit is the most significant bit of the signal (DBC bit numbering)
+  BIG_ENDIAN_ORDER,
+};
+
+/**
+ * @brief Description of a single signal in the frame data.
+ * physical value = raw * scale + offset
+ */
+struct CanSignal {
+  /// @brief bit position of the signal, bit n is bit n % 8 of the byte n / 8
+  uint16_t start_bit;
+  /// @brief length of the signal in bits 1-64
+  uint8_t length;
+  CanByteOrder byte_order;
+  /// @brief raw value is two's complement signed
+  bool is_signed;
+  float scale;
+  float offset;
+
+  /// @brief Number of the bytes the frame needs to hold the signal.
+  [[nodiscard]] constexpr uint8_t min_size() const {
+    if(byte_order == CanByteOrder::LITTLE_ENDIAN_ORDER)
+      return (uint8_t)((start_bit + length + 7) / 8);
+    const uint16_t msb_bits = start_bit % 8 + 1;
+    if(length <= msb_bits)
+      return (uint8_t)(start_bit / 8 + 1);
+    return (uint8_t)(start_bit / 8 + 1 + (length - msb_bits + 7) / 8);
+  }
+
+  /// @brief Raw bits of the signal, zero extended.
+  [[nodiscard]] constexpr uint64_t extract(const uint8_t *data) const {
+    // 32 bit accumulator is much cheaper on the 32 bit cores
+    if(length <= 32)
+      return extract_bits<uint32_t>(data);
+    return extract_bits<uint64_t>(data);
+  }
+
+  /// @brief Write the raw bits of the signal, the other bits of the data are kept.
+  constexpr void insert(uint8_t *data, uint64_t raw) const {
+    if(length <= 32)
+      insert_bits<uint32_t>(data, (uint32_t)raw);
+    else
+      insert_bits<uint64_t>(data, raw);
+  }
+
+  /// @brief Raw value of the signal, sign extended for the signed signals.
+  [[nodiscard]] constexpr int64_t decode_raw(const uint8_t *data) const {
+    const uint64_t raw = extract(data);
+    if(is_signed && length < 64 && (raw >> (length - 1)) != 0)
+      return (int64_t)(raw | ~raw_mask());
+    return (int64_t)raw;
+  }
+
+  /// @brief Physical value of the signal.
+  [[nodiscard]] constexpr float decode(const uint8_t *data) const {
+    if(length <= 32) {
+      // sign extension by the arithmetic shift, keeps the whole decode in 32 bits
+      const uint8_t unused = (uint8_t)(32 - length);
+      const uint32_t raw   = extract_bits<uint32_t>(data) << unused;
+      if(!is_signed)
+        return (float)(raw >> unused) * scale + offset;
+      return (float)((int32_t)raw >> unused) * scale + offset;
+    }
+    return (float)decode_raw(data) * scale + offset;
+  }
+
+  /// @brief Write the raw value, saturated to the range of the signal.
+  constexpr void encode_raw(uint8_t *data, int64_t raw) const {
+    if(raw < raw_min())
+      raw = raw_min();
+    if(raw > raw_max())
+      raw = raw_max();
+    insert(data, (uint64_t)raw & raw_mask());
+  }
+
+  /// @brief Write the physical value, rounded to the nearest raw value and saturated to the range
+  /// of the signal.
+  constexpr void encode(uint8_t *data, float value) const {
+    const float raw     = (value - offset) / scale;
+    const float rounded = raw < 0.0f ? raw - 0.5f : raw + 0.5f;
+    // saturate in float first, the conversion of the out of range float is undefined
+    if(rounded <= (float)raw_min()) {
+      encode_raw(data, raw_min());
+      return;
+    }
+    if(rounded >= (float)raw_max()) {
+      encode_raw(data, raw_max());
+      return;
+    }
+    if(length <= 32) {
+      insert_bits<uint32_t>(data, is_signed ? (uint32_t)(int32_t)rounded : (uint32_t)rounded);
+      return;
+    }
+    insert(data, (uint64_t)(int64_t)rounded);
+  }
+
+  /// @brief Smallest raw value of the signal.
+  [[nodiscard]] constexpr int64_t raw_min() const {
+    if(!is_signed)
+      return 0;
+    return length >= 64 ? INT64_MIN : -((int64_t)1 << (length - 1));
+  }
+
+  /// @brief Largest raw value of the signal.
+  [[nodiscard]] constexpr int64_t raw_max() const {
+    if(length >= 64)
+      return INT64_MAX;
+    if(is_signed)
+      return ((int64_t)1 << (length - 1)) - 1;
+    return length >= 63 ? INT64_MAX : ((int64_t)1 << length) - 1;
+  }
+
+private:
+  template <typename T> [[nodiscard]] constexpr T extract_bits(const uint8_t *data) const {
+    T raw             = 0;
+    uint8_t remaining = length;
+    uint16_t byte     = start_bit / 8;
+    if(byte_order == CanByteOrder::LITTLE_ENDIAN_ORDER) {
+      uint8_t shift = start_bit % 8;
+      uint8_t done  = 0;
+      while(remaining > 0) {
+        const uint8_t take = remaining < 8 - shift ? remaining : (uint8_t)(8 - shift);
+        raw |= (T)((data[byte] >> shift) & bit_mask(take)) << done;
+        done += take;
+        remaining -= take;
+        shift = 0;
+        byte++;
+      }
+      return raw;
+    }
+    // big endian goes from the most significant bit down, then to bit 7 of the next byte
+    uint8_t msb = start_bit % 8;
+    while(remaining > 0) {
+      const uint8_t take = remaining < msb + 1 ? remaining : (uint8_t)(msb + 1);
+      raw                = (T)(raw << take) | (T)((data[byte] >> (msb + 1 - take)) & bit_mask(take));
+      remaining -= take;
+      msb = 7;
+      byte++;
+    }
+    return raw;
+  }
+
+  template <typename T> constexpr void insert_bits(uint8_t *data, T raw) const {
+    uint8_t remaining = length;
+    uint16_t byte     = start_bit / 8;
+    if(byte_order == CanByteOrder::LITTLE_ENDIAN_ORDER) {
+      uint8_t shift = start_bit % 8;
+      while(remaining > 0) {
+        const uint8_t take = remaining < 8 - shift ? remaining : (uint8_t)(8 - shift);
+        const uint8_t mask = (uint8_t)(bit_mask(take) << shift);
+        data[byte]         = (uint8_t)((data[byte] & ~mask) | (((uint8_t)raw << shift) & mask));
+        raw                = (T)(raw >> take);
+        remaining -= take;
+        shift = 0;
+        byte++;
+      }
+      return;
+    }
+    uint8_t msb = start_bit % 8;
+    while(remaining > 0) {
+      const uint8_t take  = remaining < msb + 1 ? remaining : (uint8_t)(msb + 1);
+      const uint8_t shift = (uint8_t)(msb + 1 - take);
+      const uint8_t mask  = (uint8_t)(bit_mask(take) << shift);
+      remaining -= take;
+      const uint8_t bits = (uint8_t)(raw >> remaining);
+      data[byte]         = (uint8_t)((data[byte] & ~mask) | ((uint8_t)(bits << shift) & mask));
+      msb                = 7;
+      byte++;
+    }
+  }
+
+  [[nodiscard]] constexpr uint64_t raw_mask() const {
+    return length >= 64 ? ~0ULL : (1ULL << length) - 1;
+  }
+
+  static constexpr uint8_t bit_mask(uint8_t bits) {
+    return bits >= 8 ? 0xffu : (uint8_t)((1u << bits) - 1);
+  }
+};
+
+namespace internall {
+
+/// @brief Part of the signal in a single byte of the frame.
+struct CanSignalStep {
+  /// @brief byte of the frame
+  uint16_t byte;
+  /// @brief position of the part in the byte
+  uint8_t shift;
+  /// @brief mask of the part, not shifted
+  uint8_t mask;
+  /// @brief position of the part in the raw value
+  uint8_t position;
+};
+
+/// @brief Number of the bytes the signal touches.
+constexpr size_t can_signal_step_count(const CanSignal &signal) {
+  return signal.min_size() - signal.start_bit / 8;
+}
+
+/// @brief Part of the signal in its n-th byte, the same walk as CanSignal::extract.
+constexpr CanSignalStep can_signal_step(const CanSignal &signal, size_t n) {
+  uint8_t remaining = signal.length;
+  uint8_t msb       = signal.start_bit % 8;
+  uint8_t lsb       = signal.start_bit % 8;
+  CanSignalStep step{};
+  for(size_t i = 0; i <= n; i++) {
+    uint8_t take;
+    if(signal.byte_order == CanByteOrder::LITTLE_ENDIAN_ORDER) {
+      take          = remaining < 8 - lsb ? remaining : (uint8_t)(8 - lsb);
+      step.shift    = lsb;
+      step.position = (uint8_t)(signal.length - remaining);
+      lsb           = 0;
+    } else {
+      take          = remaining < msb + 1 ? remaining : (uint8_t)(msb + 1);
+      step.shift    = (uint8_t)(msb + 1 - take);
+      step.position = (uint8_t)(remaining - take);
+      msb           = 7;
+    }
+    step.byte = (uint16_t)(signal.start_bit / 8 + i);
+    step.mask = take >= 8 ? 0xffu : (uint8_t)((1u << take) - 1);
+    remaining -= take;
+  }
+  return step;
+}
+
+/// @brief Steps of the signal evaluated at compile time.
+template <CanSignal signal, size_t n>
+inline constexpr CanSignalStep can_signal_step_v = can_signal_step(signal, n);
+
+/// @brief Raw bits of the signal, the loop over the bytes unrolled at compile time.
+template <CanSignal signal, typename T, size_t... n>
+constexpr T can_signal_extract(const uint8_t *data, std::index_sequence<n...>) {
+  return (T{ 0 } | ... |
+          ((T)((data[can_signal_step_v<signal, n>.byte] >> can_signal_step_v<signal, n>.shift) &
+               can_signal_step_v<signal, n>.mask)
+           << can_signal_step_v<signal, n>.position));
+}
+
+/// @brief Write the raw bits of the signal, the loop over the bytes unrolled at compile time.
+template <CanSignal signal, typename T, size_t... n>
+constexpr void can_signal_insert(uint8_t *data, T raw, std::index_sequence<n...>) {
+  ((data[can_signal_step_v<signal, n>.byte] =
+    (uint8_t)((data[can_signal_step_v<signal, n>.byte] &
+               ~(can_signal_step_v<signal, n>.mask << can_signal_step_v<signal, n>.shift)) |
+              (((uint8_t)(raw >> can_signal_step_v<signal, n>.position) & can_signal_step_v<signal, n>.mask)
+               << can_signal_step_v<signal, n>.shift))),
+   ...);
+}
+
+/// @brief 32 bit raw value for the short signals, it is much cheaper on the 32 bit cores.
+template <CanSignal signal>
+using can_signal_raw_t = std::conditional_t<(signal.length <= 32), uint32_t, uint64_t>;
+
+template <CanSignal signal>
+using can_signal_steps = std::make_index_sequence<can_signal_step_count(signal)>;
+
+/// @brief Number of the unused bits above the signal in can_signal_raw_t.
+template <CanSignal signal>
+inline constexpr uint8_t can_signal_unused_v =
+(uint8_t)(sizeof(can_signal_raw_t<signal>) * 8 - signal.length);
+
+/// @brief Raw bits of the signal shifted to the top of can_signal_raw_t, ready for the sign extension.
+template <CanSignal signal> constexpr can_signal_raw_t<signal> can_signal_extract_top(const uint8_t *data) {
+  return can_signal_extract<signal, can_signal_raw_t<signal>>(data, can_signal_steps<signal>{})
+         << can_signal_unused_v<signal>;
+}
+
+} // namespace internall
+
+/// @brief Physical value of the signal known at compile time.
+template <CanSignal signal> constexpr float can_signal_decode(const uint8_t *data) {
+  static_assert(signal.length >= 1 && signal.length <= 64, "CanSignal length has to be 1-64");
+  static_assert(signal.scale != 0.0f, "CanSignal scale can't be 0");
+  using T                  = internall::can_signal_raw_t<signal>;
+  constexpr uint8_t unused = internall::can_signal_unused_v<signal>;
+  const T raw              = internall::can_signal_extract_top<signal>(data);
+  if constexpr(!signal.is_signed)
+    return (float)(raw >> unused) * signal.scale + signal.offset;
+  else
+    return (float)((std::make_signed_t<T>)raw >> unused) * signal.scale + signal.offset;
+}
+
+/// @brief Raw value of the signal known at compile time.
+template <CanSignal signal> constexpr int64_t can_signal_decode_raw(const uint8_t *data) {
+  static_assert(signal.length >= 1 && signal.length <= 64, "CanSignal length has to be 1-64");
+  using T                  = internall::can_signal_raw_t<signal>;
+  constexpr uint8_t unused = internall::can_signal_unused_v<signal>;
+  const T raw              = internall::can_signal_extract_top<signal>(data);
+  if constexpr(!signal.is_signed)
+    return (int64_t)(raw >> unused);
+  else
+    return (int64_t)((std::make_signed_t<T>)raw >> unused);
+}
+
+/// @brief Write the raw value of the signal known at compile time, saturated to the range of the signal.
+template <CanSignal signal> constexpr void can_signal_encode_raw(uint8_t *data, int64_t raw) {
+  static_assert(signal.length >= 1 && signal.length <= 64, "CanSignal length has to be 1-64");
+  if(raw < signal.raw_min())
+    raw = signal.raw_min();
+  if(raw > signal.raw_max())
+    raw = signal.raw_max();
+  internall::can_signal_insert<signal>(data, (internall::can_signal_raw_t<signal>)raw,
+                                       internall::can_signal_steps<signal>{});
+}
+
+/// @brief Write the physical value of the signal known at compile time, rounded to the nearest raw value
+/// and saturated to the range of the signal.
+template <CanSignal signal> constexpr void can_signal_encode(uint8_t *data, float value) {
+  static_assert(signal.length >= 1 && signal.length <= 64, "CanSignal length has to be 1-64");
+  static_assert(signal.scale != 0.0f, "CanSignal scale can't be 0");
+  using T               = internall::can_signal_raw_t<signal>;
+  const float raw       = (value - signal.offset) / signal.scale;
+  const float rounded   = raw < 0.0f ? raw - 0.5f : raw + 0.5f;
+  constexpr float min_f = (float)signal.raw_min();
+  constexpr float max_f = (float)signal.raw_max();
+  // saturate in float first, the conversion of the out of range float is undefined
+  T bits;
+  if(rounded <= min_f)
+    bits = (T)signal.raw_min();
+  else if(rounded >= max_f)
+    bits = (T)signal.raw_max();
+  else if constexpr(signal.is_signed)
+    bits = (T)(std::make_signed_t<T>)rounded;
+  else
+    bits = (T)rounded;
+  internall::can_signal_insert<signal>(data, bits, internall::can_signal_steps<signal>{});
+}
+
+/// @brief Big endian signal aligned to the bytes, the layout of most of the hand-made protocols (VESC).
+/// @param byte_offset first byte of the signal
+/// @param bytes size of the signal in bytes
+constexpr CanSignal
+can_signal_be_bytes(uint8_t byte_offset, uint8_t bytes, bool is_signed, float scale = 1.0f) {
+  return CanSignal{ (uint16_t)(byte_offset * 8 + 7), (uint8_t)(bytes * 8), CanByteOrder::BIG_ENDIAN_ORDER,
+                    is_signed, scale, 0.0f };
+}
+
+} // namespace stmepic
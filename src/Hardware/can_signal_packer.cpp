@@ -0,0 +1,258 @@
+#include "can_signal_packer.hpp"
+#include <cstring>
+
+using namespace stmepic;
+
+Result<std::shared_ptr<CanSignalPacker>> CanSignalPacker::Make(std::shared_ptr<CanBase> can,
+                                                               uint32_t frame_id,
+                                                               uint8_t max_frame_size,
+                                                               bool extended_id) {
+  if(can == nullptr)
+    return Status::Invalid("CAN is nullptr");
+  if(max_frame_size <= CAN_SIGNAL_RECORD_HEADER || can_fd_round_data_size(max_frame_size) != max_frame_size)
+    return Status::Invalid("CanSignalPacker: max_frame_size has to be 3-8 or valid CAN FD length");
+  auto packer = std::shared_ptr<CanSignalPacker>(
+  new CanSignalPacker(can, frame_id, max_frame_size, extended_id));
+  return Result<decltype(packer)>::OK(std::move(packer));
+}
+
+CanSignalPacker::CanSignalPacker(std::shared_ptr<CanBase> _can,
+                                 uint32_t frame_id,
+                                 uint8_t _max_frame_size,
+                                 bool extended_id)
+: can(_can), max_frame_size(_max_frame_size), started(false), frames_sent(0), signals_sent(0),
+  signals_dropped(0) {
+  frame.frame_id       = frame_id;
+  frame.extended_id    = extended_id;
+  frame.fdcan_frame    = max_frame_size > 8;
+  frame.remote_request = false;
+  task.task_init(handle, this, 1, nullptr, 300, tskIDLE_PRIORITY + 3, "CanSignalPacker");
+}
+
+CanSignalPacker::~CanSignalPacker() {
+  (void)task.task_stop();
+}
+
+Status CanSignalPacker::add_signal(uint8_t signal_id, uint8_t size) {
+  if(started)
+    return Status::ExecutionError("CanSignalPacker: signals can't be added while the packer is running");
+  if(signal_id == 0)
+    return Status::Invalid("CanSignalPacker: signal_id 0 is reserved for the padding");
+  if(size == 0 || size > max_frame_size - CAN_SIGNAL_RECORD_HEADER)
+    return Status::Invalid("CanSignalPacker: signal doesn't fit in the frame");
+  for(const auto &signal : signals)
+    if(signal.signal_id == signal_id)
+      return Status::AlreadyExists("CanSignalPacker: signal already exists");
+
+  Signal signal;
+  signal.signal_id = signal_id;
+  signal.size      = size;
+  signal.pending   = false;
+  signal.offset    = (uint16_t)values.size();
+  values.resize(values.size() + size, 0);
+  signals.push_back(signal);
+  return Status::OK();
+}
+
+Status CanSignalPacker::set_signal(uint8_t signal_id, const uint8_t *data) {
+  if(data == nullptr)
+    return Status::Invalid("CanSignalPacker: data is nullptr");
+  for(auto &signal : signals) {
+    if(signal.signal_id != signal_id)
+      continue;
+    vPortEnterCritical();
+    if(signal.pending)
+      signals_dropped++;
+    std::memcpy(&values[signal.offset], data, signal.size);
+    signal.pending = true;
+    vPortExitCritical();
+    return Status::OK();
+  }
+  return Status::KeyError("CanSignalPacker: signal is not registered");
+}
+
+Status CanSignalPacker::flush() {
+  Status status          = Status::OK();
+  uint8_t used           = 0;
+  uint32_t frame_signals = 0;
+  for(auto &signal : signals) {
+    if(!signal.pending)
+      continue;
+    const uint8_t record = CAN_SIGNAL_RECORD_HEADER + signal.size;
+    if(used + record > max_frame_size) {
+      Status write_status = write_frame(used, frame_signals);
+      if(!write_status.ok())
+        status = write_status;
+      used          = 0;
+      frame_signals = 0;
+    }
+    frame.data[used]     = signal.signal_id;
+    frame.data[used + 1] = signal.size;
+    vPortEnterCritical();
+    std::memcpy(&frame.data[used + CAN_SIGNAL_RECORD_HEADER], &values[signal.offset], signal.size);
+    signal.pending = false;
+    vPortExitCritical();
+    used += record;
+    frame_signals++;
+  }
+  if(used > 0) {
+    Status write_status = write_frame(used, frame_signals);
+    if(!write_status.ok())
+      status = write_status;
+  }
+  return status;
+}
+
+Status CanSignalPacker::write_frame(uint8_t used, uint32_t frame_signals) {
+  // zero padding up to the DLC length, reads as the end of the records
+  const uint8_t length = frame.fdcan_frame ? can_fd_round_data_size(used) : used;
+  std::memset(&frame.data[used], 0, length - used);
+  frame.data_size = length;
+  Status status   = can->write(frame);
+  if(status.ok()) {
+    frames_sent++;
+    signals_sent += frame_signals;
+  } else {
+    signals_dropped += frame_signals;
+  }
+  return status;
+}
+
+Status CanSignalPacker::start(uint32_t period_ms) {
+  if(started)
+    return Status::AlreadyExists("CanSignalPacker: packer is already running");
+  if(period_ms == 0)
+    return Status::Invalid("CanSignalPacker: period can't be 0");
+  task.task_set_period(period_ms);
+  STMEPIC_RETURN_ON_ERROR(task.task_run());
+  started = true;
+  return Status::OK();
+}
+
+Status CanSignalPacker::stop() {
+  started = false;
+  return task.task_stop();
+}
+
+uint32_t CanSignalPacker::get_frames_sent() const {
+  return frames_sent;
+}
+
+uint32_t CanSignalPacker::get_signals_sent() const {
+  return signals_sent;
+}
+
+uint32_t CanSignalPacker::get_signals_dropped() const {
+  return signals_dropped;
+}
+
+void CanSignalPacker::reset_counters() {
+  vPortEnterCritical();
+  frames_sent     = 0;
+  signals_sent    = 0;
+  signals_dropped = 0;
+  vPortExitCritical();
+}
+
+Status CanSignalPacker::handle(SimpleTask &task, void *args) {
+  (void)task;
+  auto *packer = static_cast<CanSignalPacker *>(args);
+  if(packer == nullptr)
+    return Status::Invalid("CanSignalPacker::handle: args is nullptr");
+  return packer->flush();
+}
+
+Result<std::shared_ptr<CanSignalUnpacker>>
+CanSignalUnpacker::Make(std::shared_ptr<CanBase> can, uint32_t frame_id) {
+  if(can == nullptr)
+    return Status::Invalid("CAN is nullptr");
+  auto unpacker = std::shared_ptr<CanSignalUnpacker>(new CanSignalUnpacker(can, frame_id));
+  STMEPIC_RETURN_ON_ERROR(can->add_callback(frame_id, can_callback, unpacker.get()));
+  return Result<decltype(unpacker)>::OK(std::move(unpacker));
+}
+
+CanSignalUnpacker::CanSignalUnpacker(std::shared_ptr<CanBase> _can, uint32_t _frame_id)
+: can(_can), frame_id(_frame_id), frames_received(0), signals_received(0), malformed_frames(0) {
+}
+
+CanSignalUnpacker::~CanSignalUnpacker() {
+  (void)can->remove_callback(frame_id);
+}
+
+Status CanSignalUnpacker::add_signal_callback(uint8_t signal_id, can_signal_callback callback, void *args) {
+  if(callback == nullptr)
+    return Status::Invalid("CanSignalUnpacker: callback is nullptr");
+  SignalCallback entry = { signal_id, callback, args };
+  vPortEnterCritical();
+  for(const auto &existing : callbacks) {
+    if(existing.signal_id == signal_id) {
+      vPortExitCritical();
+      return Status::AlreadyExists("CanSignalUnpacker: signal already has a callback");
+    }
+  }
+  callbacks.push_back(entry);
+  vPortExitCritical();
+  return Status::OK();
+}
+
+Status CanSignalUnpacker::remove_signal_callback(uint8_t signal_id) {
+  vPortEnterCritical();
+  for(auto it = callbacks.begin(); it != callbacks.end(); ++it) {
+    if(it->signal_id != signal_id)
+      continue;
+    callbacks.erase(it);
+    vPortExitCritical();
+    return Status::OK();
+  }
+  vPortExitCritical();
+  return Status::KeyError("CanSignalUnpacker: signal has no callback");
+}
+
+uint32_t CanSignalUnpacker::get_frames_received() const {
+  return frames_received;
+}
+
+uint32_t CanSignalUnpacker::get_signals_received() const {
+  return signals_received;
+}
+
+uint32_t CanSignalUnpacker::get_malformed_frames() const {
+  return malformed_frames;
+}
+
+void CanSignalUnpacker::unpack(const CanDataFrame &frame) {
+  frames_received++;
+  uint32_t position = 0;
+  while(position + CAN_SIGNAL_RECORD_HEADER <= frame.data_size) {
+    const uint8_t signal_id = frame.data[position];
+    const uint8_t size      = frame.data[position + 1];
+    // padding, no more records
+    if(signal_id == 0)
+      return;
+    if(position + CAN_SIGNAL_RECORD_HEADER + size > frame.data_size) {
+      malformed_frames++;
+      return;
+    }
+    signals_received++;
+    const uint8_t *data = &frame.data[position + CAN_SIGNAL_RECORD_HEADER];
+    // the lookup is guarded the same way as the registration, the callback runs outside of it
+    SignalCallback callback = { signal_id, nullptr, nullptr };
+    vPortEnterCritical();
+    for(const auto &entry : callbacks) {
+      if(entry.signal_id == signal_id) {
+        callback = entry;
+        break;
+      }
+    }
+    vPortExitCritical();
+    if(callback.callback != nullptr)
+      callback.callback(*this, signal_id, data, size, callback.args);
+    position += CAN_SIGNAL_RECORD_HEADER + size;
+  }
+}
+
+void CanSignalUnpacker::can_callback(CanBase &can, CanDataFrame &frame, void *args) {
+  (void)can;
+  auto unpacker = static_cast<CanSignalUnpacker *>(args);
+  unpacker->unpack(frame);
+}
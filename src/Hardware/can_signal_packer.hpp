@@ -0,0 +1,180 @@
+#pragma once
+
+#include "stmepic.hpp"
+#include "can.hpp"
+#include "simple_task.hpp"
+#include <functional>
+#include <memory>
+#include <vector>
+
+/**
+ * @defgroup hardware Hardware
+ * @{
+ */
+
+/**
+ * @file can_signal_packer.hpp
+ * @brief Packing of multiple small periodic signals into a single (CAN FD) frame.
+ *
+ * Packed frame is a sequence of records [signal_id, size, data...], the rest of the frame
+ * up to the DLC length is padded with zeros, signal_id 0 is reserved for the padding.
+ * On the FD bus with bitrate switching a single 64 byte frame replaces up to 16 classic frames
+ * with 2 byte signals and pays the arbitration and the header only once.
+ */
+
+namespace stmepic {
+
+class CanSignalUnpacker;
+
+/// @brief Size of the record header (signal_id, size) in the packed frame.
+static constexpr uint8_t CAN_SIGNAL_RECORD_HEADER = 2;
+
+/// @brief Callback of the received signal.
+/// @param CanSignalUnpacker the unpacker that received the signal
+/// @param uint8_t signal_id of the signal
+/// @param const uint8_t* data of the signal, valid only during the callback
+/// @param uint8_t size of the data
+/// @param void* args provided by the user
+using can_signal_callback =
+std::function<void(CanSignalUnpacker &, uint8_t, const uint8_t *, uint8_t, void *)>;
+
+/**
+ * @class CanSignalPacker
+ * @brief Collects the latest values of the registered signals and writes them packed in as few frames
+ * as possible.
+ *
+ * Signals are registered once with their size, then any task can update their value with set_signal().
+ * flush(), called by the user or by the packer task with the given period, packs all signals updated
+ * since the last flush in the registration order, starts a new frame when the next signal doesn't fit
+ * and rounds the length of each frame up to the nearest CAN FD DLC length.
+ * Signal updated twice before the flush is sent once with the newer value (counted as overwritten).
+ */
+class CanSignalPacker {
+public:
+  /**
+   * @brief Make new packer.
+   * @param can CAN interface the packed frames are written to
+   * @param frame_id id of the packed frames
+   * @param max_frame_size max size of the packed frames, 64 for the FD bus, 8 for the classic bus
+   * @param extended_id send the packed frames with the extended id
+   */
+  static Result<std::shared_ptr<CanSignalPacker>> Make(std::shared_ptr<CanBase> can,
+                                                      uint32_t frame_id,
+                                                      uint8_t max_frame_size = 64,
+                                                      bool extended_id       = false);
+
+  ~CanSignalPacker();
+  CanSignalPacker(const CanSignalPacker &)            = delete;
+  CanSignalPacker &operator=(const CanSignalPacker &) = delete;
+
+  /// @brief Register the signal, only before the packer is started.
+  /// @param signal_id id of the signal 1-255
+  /// @param size size of the signal, at most max_frame_size - CAN_SIGNAL_RECORD_HEADER
+  Status add_signal(uint8_t signal_id, uint8_t size);
+
+  /// @brief Update the value of the signal, sent with the next flush.
+  /// @param signal_id id of the registered signal
+  /// @param data value of the signal, size of the registered signal
+  Status set_signal(uint8_t signal_id, const uint8_t *data);
+
+  /// @brief Pack all updated signals and write them to the CAN interface.
+  /// @return last error of CanBase::write, the following frames are still written
+  Status flush();
+
+  /// @brief Start the task that flushes the signals with the given period.
+  Status start(uint32_t period_ms);
+
+  /// @brief Stop the flush task.
+  Status stop();
+
+  /// @brief Number of the packed frames written to the interface.
+  [[nodiscard]] uint32_t get_frames_sent() const;
+
+  /// @brief Number of the signals written to the interface.
+  [[nodiscard]] uint32_t get_signals_sent() const;
+
+  /// @brief Number of the signals overwritten before the flush or lost with the rejected frames.
+  [[nodiscard]] uint32_t get_signals_dropped() const;
+
+  /// @brief Reset all counters.
+  void reset_counters();
+
+private:
+  struct Signal {
+    uint8_t signal_id;
+    uint8_t size;
+    bool pending;
+    /// @brief offset of the value in the values buffer
+    uint16_t offset;
+  };
+
+  CanSignalPacker(std::shared_ptr<CanBase> can, uint32_t frame_id, uint8_t max_frame_size, bool extended_id);
+
+  std::shared_ptr<CanBase> can;
+  uint8_t max_frame_size;
+  bool started;
+  std::vector<Signal> signals;
+  std::vector<uint8_t> values;
+  CanDataFrame frame;
+  SimpleTask task;
+  uint32_t frames_sent;
+  uint32_t signals_sent;
+  uint32_t signals_dropped;
+
+  Status write_frame(uint8_t used, uint32_t frame_signals);
+  static Status handle(SimpleTask &task, void *args);
+};
+
+/**
+ * @class CanSignalUnpacker
+ * @brief Splits the packed frames back to the signals and calls the callback of each signal.
+ *
+ * The callbacks run in the RX task of the CAN interface, signals without the callback are skipped.
+ */
+class CanSignalUnpacker {
+public:
+  /// @brief Make new unpacker and register its callback for the frame_id on the CAN interface.
+  static Result<std::shared_ptr<CanSignalUnpacker>> Make(std::shared_ptr<CanBase> can, uint32_t frame_id);
+
+  ~CanSignalUnpacker();
+  CanSignalUnpacker(const CanSignalUnpacker &)            = delete;
+  CanSignalUnpacker &operator=(const CanSignalUnpacker &) = delete;
+
+  /// @brief Add the callback of the signal.
+  /// @return AlreadyExists if the signal already has a callback
+  Status add_signal_callback(uint8_t signal_id, can_signal_callback callback, void *args = nullptr);
+
+  /// @brief Remove the callback of the signal.
+  /// @note The callback looked up by the RX task just before the removal still runs once.
+  Status remove_signal_callback(uint8_t signal_id);
+
+  /// @brief Number of the packed frames received.
+  [[nodiscard]] uint32_t get_frames_received() const;
+
+  /// @brief Number of the signals received, including the signals without the callback.
+  [[nodiscard]] uint32_t get_signals_received() const;
+
+  /// @brief Number of the frames with the record that doesn't fit in the frame.
+  [[nodiscard]] uint32_t get_malformed_frames() const;
+
+private:
+  struct SignalCallback {
+    uint8_t signal_id;
+    can_signal_callback callback;
+    void *args;
+  };
+
+  CanSignalUnpacker(std::shared_ptr<CanBase> can, uint32_t frame_id);
+
+  std::shared_ptr<CanBase> can;
+  uint32_t frame_id;
+  std::vector<SignalCallback> callbacks;
+  uint32_t frames_received;
+  uint32_t signals_received;
+  uint32_t malformed_frames;
+
+  void unpack(const CanDataFrame &frame);
+  static void can_callback(CanBase &can, CanDataFrame &frame, void *args);
+};
+
+} // namespace stmepic
@@ -0,0 +1,215 @@
+#include "can_statistics.hpp"
+#include "can.hpp"
+#include "logger.hpp"
+
+using namespace stmepic;
+using namespace stmepic::internall;
+
+namespace {
+// bits after the CRC: CRC delimiter, ACK slot and delimiter, end of frame and interframe space
+constexpr uint32_t CAN_FRAME_TAIL_BITS = 1 + 2 + 7 + 3;
+// stuffed part of the classic frame without data: SOF..DLC and CRC
+constexpr uint32_t CAN_STD_STUFFED_BITS = 34;
+constexpr uint32_t CAN_EXT_STUFFED_BITS = 54;
+// dynamically stuffed part of the FD frame without data: SOF..DLC
+constexpr uint32_t CANFD_STD_HEADER_BITS = 22;
+constexpr uint32_t CANFD_EXT_HEADER_BITS = 41;
+// stuff count field of the FD frame
+constexpr uint32_t CANFD_STUFF_COUNT_BITS = 4;
+} // namespace
+
+uint32_t stmepic::can_frame_bits(bool extended_id, bool fdcan_frame, bool remote_request, uint8_t data_size) {
+  if(data_size > 64)
+    data_size = 64;
+  const uint32_t data_bits = remote_request ? 0 : 8u * data_size;
+
+  if(!fdcan_frame) {
+    // worst case one stuff bit after every 4 bits of the stuffed part
+    const uint32_t stuffed = (extended_id ? CAN_EXT_STUFFED_BITS : CAN_STD_STUFFED_BITS) + data_bits;
+    return stuffed + (stuffed - 1) / 4 + CAN_FRAME_TAIL_BITS;
+  }
+
+  // FD frames stuff the header and data dynamically, stuff count and CRC have fixed stuff bit every 4 bits
+  const uint32_t dynamic = (extended_id ? CANFD_EXT_HEADER_BITS : CANFD_STD_HEADER_BITS) + data_bits;
+  const uint32_t crc     = CANFD_STUFF_COUNT_BITS + (data_size > 16 ? 21 : 17);
+  return dynamic + (dynamic - 1) / 4 + crc + (crc + 3) / 4 + CAN_FRAME_TAIL_BITS;
+}
+
+uint32_t stmepic::can_frame_bits(const CanDataFrame &frame) {
+  return can_frame_bits(frame.extended_id, frame.fdcan_frame, frame.remote_request, frame.data_size);
+}
+
+CanStatisticsCollector::CanStatisticsCollector() : log_period_us(0), last_log_us(0) {
+  statistics.bus_bitrate = 0;
+  reset();
+}
+
+void CanStatisticsCollector::reset() {
+  const uint32_t bitrate = statistics.bus_bitrate;
+  statistics             = CanStatistics{};
+  statistics.bus_bitrate = bitrate;
+  reset_latency(statistics.rx_latency);
+  reset_latency(statistics.tx_queue_wait);
+  window_rx_frames = 0;
+  window_rx_bits   = 0;
+  window_tx_frames = 0;
+  window_tx_bits   = 0;
+  window_start_us  = 0;
+  window_started   = false;
+}
+
+void CanStatisticsCollector::set_bus_bitrate(uint32_t bitrate) {
+  statistics.bus_bitrate = bitrate;
+}
+
+void CanStatisticsCollector::set_log_period(uint32_t period_ms) {
+  log_period_us = period_ms * 1000;
+}
+
+void CanStatisticsCollector::rx_isr(uint32_t queue_level, bool dropped) {
+  if(dropped)
+    statistics.rx.dropped++;
+  if(queue_level > statistics.rx_queue_high_water)
+    statistics.rx_queue_high_water = queue_level;
+}
+
+void CanStatisticsCollector::rx_interrupt(uint32_t frames) {
+  statistics.rx_interrupts++;
+  statistics.rx_interrupt_frames += frames;
+  if(frames > statistics.rx_interrupt_max_frames)
+    statistics.rx_interrupt_max_frames = frames;
+}
+
+void CanStatisticsCollector::rx_frame(const CanDataFrame &frame, uint32_t latency_us) {
+  const uint32_t bits = can_frame_bits(frame);
+  statistics.rx.frames++;
+  statistics.rx.bits += bits;
+  window_rx_frames++;
+  window_rx_bits += bits;
+  add_sample(statistics.rx_latency, latency_us);
+
+  for(uint32_t i = 0; i < statistics.rx_ids_used; i++) {
+    if(statistics.rx_ids[i].frame_id == frame.frame_id) {
+      statistics.rx_ids[i].count++;
+      return;
+    }
+  }
+  if(statistics.rx_ids_used < CAN_STATISTICS_MAX_IDS) {
+    statistics.rx_ids[statistics.rx_ids_used] = { frame.frame_id, 1 };
+    statistics.rx_ids_used++;
+  } else {
+    statistics.rx_ids_overflow++;
+  }
+}
+
+void CanStatisticsCollector::tx_frame(const CanDataFrame &frame, uint32_t queue_wait_us) {
+  const uint32_t bits = can_frame_bits(frame);
+  statistics.tx.frames++;
+  statistics.tx.bits += bits;
+  window_tx_frames++;
+  window_tx_bits += bits;
+  add_sample(statistics.tx_queue_wait, queue_wait_us);
+}
+
+void CanStatisticsCollector::tx_dropped() {
+  statistics.tx.dropped++;
+}
+
+void CanStatisticsCollector::set_error_state(uint32_t hal_error,
+                                             uint32_t tx_error_counter,
+                                             uint32_t rx_error_counter) {
+  statistics.hal_error        = hal_error;
+  statistics.tx_error_counter = tx_error_counter;
+  statistics.rx_error_counter = rx_error_counter;
+}
+
+void CanStatisticsCollector::periodic(uint32_t now_us, const char *name) {
+  if(!window_started) {
+    window_start_us = now_us;
+    last_log_us     = now_us;
+    window_started  = true;
+    return;
+  }
+
+  const uint32_t window_us = now_us - window_start_us;
+  if(window_us >= 1000000) {
+    const float seconds             = (float)window_us * 0.000001f;
+    statistics.rx.frames_per_second = (float)window_rx_frames / seconds;
+    statistics.rx.bits_per_second   = (float)window_rx_bits / seconds;
+    statistics.tx.frames_per_second = (float)window_tx_frames / seconds;
+    statistics.tx.bits_per_second   = (float)window_tx_bits / seconds;
+
+    const float bits_per_second = statistics.rx.bits_per_second + statistics.tx.bits_per_second;
+    statistics.bus_load = statistics.bus_bitrate ? bits_per_second / (float)statistics.bus_bitrate : 0.0f;
+
+    window_rx_frames = 0;
+    window_rx_bits   = 0;
+    window_tx_frames = 0;
+    window_tx_bits   = 0;
+    window_start_us  = now_us;
+  }
+
+  if(log_period_us != 0 && now_us - last_log_us >= log_period_us) {
+    last_log_us = now_us;
+    Logger::get_instance().info(Logger::parse_to_json_format("interface", name) + to_string());
+  }
+}
+
+const CanStatistics &CanStatisticsCollector::get() const {
+  return statistics;
+}
+
+std::string CanStatisticsCollector::to_string() const {
+  std::string str = "\"can_stats\":{ ";
+  str += Logger::parse_to_json_format("rx_fps", statistics.rx.frames_per_second);
+  str += Logger::parse_to_json_format("rx_bps", statistics.rx.bits_per_second);
+  str += Logger::parse_to_json_format("rx_frames", statistics.rx.frames);
+  str += Logger::parse_to_json_format("rx_dropped", statistics.rx.dropped);
+  str += Logger::parse_to_json_format("tx_fps", statistics.tx.frames_per_second);
+  str += Logger::parse_to_json_format("tx_bps", statistics.tx.bits_per_second);
+  str += Logger::parse_to_json_format("tx_frames", statistics.tx.frames);
+  str += Logger::parse_to_json_format("tx_dropped", statistics.tx.dropped);
+  str += Logger::parse_to_json_format("bus_load", statistics.bus_load);
+  str += Logger::parse_to_json_format("rx_queue_high_water", statistics.rx_queue_high_water);
+  if(statistics.rx_interrupts != 0) {
+    str += Logger::parse_to_json_format("rx_irq", statistics.rx_interrupts);
+    str += Logger::parse_to_json_format(
+    "rx_frames_per_irq", (float)statistics.rx_interrupt_frames / (float)statistics.rx_interrupts);
+    str += Logger::parse_to_json_format("rx_frames_per_irq_max", statistics.rx_interrupt_max_frames);
+  }
+  str += Logger::parse_to_json_format("rx_latency_avg_us", statistics.rx_latency.average_us());
+  str += Logger::parse_to_json_format("rx_latency_max_us", statistics.rx_latency.max_us);
+  str += Logger::parse_to_json_format("tx_wait_avg_us", statistics.tx_queue_wait.average_us());
+  str += Logger::parse_to_json_format("tx_wait_max_us", statistics.tx_queue_wait.max_us);
+  str += Logger::parse_to_json_format("hal_error", statistics.hal_error);
+  str += Logger::parse_to_json_format("tec", statistics.tx_error_counter);
+  str += Logger::parse_to_json_format("rec", statistics.rx_error_counter);
+  str += Logger::parse_to_json_format("ids_overflow", statistics.rx_ids_overflow);
+  str += "\"rx_ids\": [";
+  for(uint32_t i = 0; i < statistics.rx_ids_used; i++) {
+    const auto &id = statistics.rx_ids[i];
+    str += "[" + std::to_string(id.frame_id) + "," + std::to_string(id.count) + "]";
+    if(i + 1 < statistics.rx_ids_used)
+      str += ",";
+  }
+  str += "]}";
+  return str;
+}
+
+void CanStatisticsCollector::add_sample(CanLatencyStatistics &latency, uint32_t value_us) {
+  latency.last_us = value_us;
+  if(value_us < latency.min_us)
+    latency.min_us = value_us;
+  if(value_us > latency.max_us)
+    latency.max_us = value_us;
+  latency.sum_us += value_us;
+  latency.samples++;
+}
+
+void CanStatisticsCollector::reset_latency(CanLatencyStatistics &latency) {
+  latency.last_us = 0;
+  latency.min_us  = UINT32_MAX;
+  latency.max_us  = 0;
+  latency.samples = 0;
+  latency.sum_us  = 0;
+}
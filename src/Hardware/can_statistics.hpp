@@ -0,0 +1,179 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * @defgroup hardware Hardware
+ * @{
+ */
+
+/**
+ * @file can_statistics.hpp
+ * @brief Bus load, traffic and latency statistics of the CAN interfaces.
+ */
+
+namespace stmepic {
+
+struct CanDataFrame;
+
+/// @brief Number of distinct frame ids counted by the per ID RX statistics.
+static constexpr size_t CAN_STATISTICS_MAX_IDS = 32;
+
+/// @brief Traffic in one direction of the interface.
+struct CanDirectionStatistics {
+  /// @brief total number of frames
+  uint32_t frames;
+  /// @brief total number of bits on the bus, estimated with the worst case bit stuffing
+  uint32_t bits;
+  /// @brief frames that were lost because the queue was full or HAL refused them
+  uint32_t dropped;
+  /// @brief frames per second over the last rate window
+  float frames_per_second;
+  /// @brief bits per second over the last rate window
+  float bits_per_second;
+};
+
+/// @brief Time statistics in microseconds.
+struct CanLatencyStatistics {
+  uint32_t last_us;
+  uint32_t min_us;
+  uint32_t max_us;
+  uint32_t samples;
+  uint64_t sum_us;
+
+  /// @brief Average of all samples in microseconds
+  [[nodiscard]] float average_us() const {
+    return samples ? (float)sum_us / (float)samples : 0.0f;
+  }
+};
+
+/// @brief Number of received frames of a single frame id.
+struct CanIdCount {
+  uint32_t frame_id;
+  uint32_t count;
+};
+
+/// @brief All statistics of a CAN interface.
+struct CanStatistics {
+  CanDirectionStatistics rx;
+  CanDirectionStatistics tx;
+
+  /// @brief received frames per id, the first rx_ids_used entries are valid
+  std::array<CanIdCount, CAN_STATISTICS_MAX_IDS> rx_ids;
+  uint32_t rx_ids_used;
+  /// @brief frames of ids that didn't fit in the rx_ids table
+  uint32_t rx_ids_overflow;
+
+  /// @brief highest number of frames waiting in the RX queue
+  uint32_t rx_queue_high_water;
+  /// @brief RX interrupts of the drivers that drain the whole RX FIFO per interrupt (FDCAN)
+  uint32_t rx_interrupts;
+  /// @brief frames drained by all counted RX interrupts
+  uint32_t rx_interrupt_frames;
+  /// @brief most frames drained by a single RX interrupt
+  uint32_t rx_interrupt_max_frames;
+  /// @brief time from the RX interrupt to the start of the frame callback
+  CanLatencyStatistics rx_latency;
+  /// @brief time the frame waited in the TX queue before it was handed to the peripheral
+  CanLatencyStatistics tx_queue_wait;
+
+  /// @brief last error code returned by HAL_CAN_GetError / HAL_FDCAN_GetError
+  uint32_t hal_error;
+  /// @brief transmit error counter of the peripheral
+  uint32_t tx_error_counter;
+  /// @brief receive error counter of the peripheral
+  uint32_t rx_error_counter;
+
+  /// @brief bus bitrate set by the user, 0 if unknown
+  uint32_t bus_bitrate;
+  /// @brief (rx + tx) bits per second / bus_bitrate, 0 if the bitrate is unknown
+  float bus_load;
+};
+
+/**
+ * @brief Estimate the number of bits a frame takes on the bus, including the worst case stuff bits
+ * and the interframe space.
+ * @note For CAN FD frames the data phase is counted at the nominal bitrate (bitrate switching is ignored).
+ */
+uint32_t can_frame_bits(bool extended_id, bool fdcan_frame, bool remote_request, uint8_t data_size);
+
+/// @brief Same as can_frame_bits for the data frame.
+uint32_t can_frame_bits(const CanDataFrame &frame);
+
+namespace internall {
+
+/**
+ * @class CanStatisticsCollector
+ * @brief Accumulates the CAN statistics, used by the CAN drivers.
+ *
+ * The RX and TX methods are called from the RX and TX tasks, the ISR methods from the interrupts.
+ * The rates are recalculated by periodic() once per second, which also dumps the statistics
+ * to the logger when the log period is set. Nothing is allocated when counting.
+ */
+class CanStatisticsCollector {
+public:
+  CanStatisticsCollector();
+
+  /// @brief Reset all counters, keeps the bitrate and the log period.
+  void reset();
+
+  /// @brief Set the bus bitrate used to calculate the bus load.
+  void set_bus_bitrate(uint32_t bitrate);
+
+  /// @brief Set the period of the logger dump, 0 disables it.
+  void set_log_period(uint32_t period_ms);
+
+  /// @brief Frame was put (or not) to the RX queue in the interrupt.
+  /// @param queue_level number of frames in the queue after the insert
+  /// @param dropped true if the queue was full
+  void rx_isr(uint32_t queue_level, bool dropped);
+
+  /// @brief RX interrupt drained the RX FIFO.
+  /// @param frames number of frames read by the interrupt
+  void rx_interrupt(uint32_t frames);
+
+  /// @brief Frame was taken from the RX queue by the RX task.
+  /// @param latency_us time since the RX interrupt
+  void rx_frame(const CanDataFrame &frame, uint32_t latency_us);
+
+  /// @brief Frame was handed to the peripheral by the TX task.
+  /// @param queue_wait_us time the frame waited in the TX queue
+  void tx_frame(const CanDataFrame &frame, uint32_t queue_wait_us);
+
+  /// @brief Frame was not sent because the TX queue was full or HAL refused it.
+  void tx_dropped();
+
+  /// @brief Update the error state read from the peripheral.
+  void set_error_state(uint32_t hal_error, uint32_t tx_error_counter, uint32_t rx_error_counter);
+
+  /// @brief Recalculate the rates once per second and dump the statistics to the logger when due.
+  /// @param now_us current time from the Ticker
+  /// @param name name of the interface used in the log
+  void periodic(uint32_t now_us, const char *name);
+
+  [[nodiscard]] const CanStatistics &get() const;
+
+  /// @brief Statistics in the JSON like format used by the logger.
+  [[nodiscard]] std::string to_string() const;
+
+private:
+  CanStatistics statistics;
+  uint32_t window_start_us;
+  uint32_t window_rx_frames;
+  uint32_t window_rx_bits;
+  uint32_t window_tx_frames;
+  uint32_t window_tx_bits;
+  uint32_t log_period_us;
+  uint32_t last_log_us;
+  bool window_started;
+
+  static void add_sample(CanLatencyStatistics &latency, uint32_t value_us);
+  static void reset_latency(CanLatencyStatistics &latency);
+};
+
+} // namespace internall
+
+} // namespace stmepic
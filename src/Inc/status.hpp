@@ -3,6 +3,7 @@
 #include "stmepic.hpp"
 #include <string>
 #include <optional>
+#include <cstdlib>
 
 /**
  * @file status.hpp
@@ -20,6 +21,16 @@ namespace stmepic {
 
 class Status;
 
+/**
+ * @brief Reset of the device used by the *_OR_HRESET macros.
+ * The FreeRTOS POSIX port builds (STMEPIC_POSIX) have no device to reset, the process is aborted instead.
+ */
+#ifndef STMEPIC_POSIX
+#define STMEPIC_SYSTEM_RESET() HAL_NVIC_SystemReset()
+#else
+#define STMEPIC_SYSTEM_RESET() std::abort()
+#endif
+
 /**
  * @brief Macro for returning on error in a single line.
  *
@@ -65,7 +76,7 @@ class Status;
   auto _xsar##assign = result;                   \
   do {                                           \
     if(!_xsar##assign.ok())                      \
-      HAL_NVIC_SystemReset();                    \
+      STMEPIC_SYSTEM_RESET();                    \
   } while(false);                                \
   auto assign = std::move(_xsar##assign.valueOrDie());
 
@@ -77,7 +88,7 @@ class Status;
   do {                                              \
     auto _xsar##assign = result;                    \
     if(!_xsar##assign.ok())                         \
-      HAL_NVIC_SystemReset();                       \
+      STMEPIC_SYSTEM_RESET();                       \
     assign = std::move(_xsar##assign.valueOrDie()); \
   } while(false)
 
@@ -89,7 +100,7 @@ class Status;
   do {                                    \
     stmepic::Status _x = result.status(); \
     if(!_x.ok())                          \
-      HAL_NVIC_SystemReset();             \
+      STMEPIC_SYSTEM_RESET();             \
   } while(false);
 
 extern "C" {
@@ -205,6 +216,7 @@ class Status {
 public:
   Status(const Status &status) = default;
 
+#ifndef STMEPIC_POSIX
   Status(HAL_StatusTypeDef status) : _message(nullptr) {
     switch(status) {
     case HAL_OK:
@@ -229,6 +241,7 @@ public:
       break;
     }
   }
+#endif
 
   [[nodiscard]] static Status OK() {
     return Status(StatusCode::OK, nullptr, "OK");
@@ -1,6 +1,8 @@
 #pragma once
 
+#ifndef STMEPIC_POSIX
 #include "main.h" // HAVE TO BE FIRST since it includes STM32 HAL and CMSIS
+#endif
 #include "status.hpp"
 #include "FreeRTOS.h"
 #include "task.h"
@@ -8,8 +10,11 @@
 #include "timers.h"
 #include "semphr.h"
 #include "list.h"
+// the FreeRTOS POSIX port builds (STMEPIC_POSIX) have only the HAL independent parts of the library
+#ifndef STMEPIC_POSIX
 #include "Timing.hpp"
 #include "gpio.hpp"
+#endif
 
 
 /// @brief stmepic namespace
@@ -8,6 +8,17 @@ using namespace stmepic;
 
 extern "C" void initialise_monitor_handles(void);
 
+namespace {
+/// @brief time of the log [ms], the RTOS ticks on the FreeRTOS POSIX port builds
+uint32_t log_time_ms() {
+#ifndef STMEPIC_POSIX
+  return HAL_GetTick();
+#else
+  return xTaskGetTickCount() * portTICK_PERIOD_MS;
+#endif
+}
+} // namespace
+
 
 Logger::Logger() {
   log_level         = LOG_LEVEL::LOG_LEVEL_WARNING;
@@ -26,6 +37,7 @@ Status Logger::init(LOG_LEVEL level, bool _print_info, transmit_data_func _trans
   version           = _version;
   use_semihosting   = _use_semihosting;
 
+#ifndef STMEPIC_POSIX
   // Check if semihosting is enabled and if the debugger is connected. if not we can't use semihosting becouse the cpu will freeze
   use_semihosting = use_semihosting && (bool)(CoreDebug->DHCSR & CoreDebug_DHCSR_C_DEBUGEN_Msk);
 
@@ -33,6 +45,11 @@ Status Logger::init(LOG_LEVEL level, bool _print_info, transmit_data_func _trans
     initialise_monitor_handles();
     transmit_function = nullptr;
   }
+#else
+  // on the FreeRTOS POSIX port the semihosting prints to the stdout of the process
+  if(use_semihosting)
+    transmit_function = nullptr;
+#endif
   return Status::OK();
 }
 
@@ -65,7 +82,7 @@ void Logger::transmit(std::string msg, std::string prefix, const char *file, con
     std::string debug_info = "";
     if(file != nullptr && function_name != nullptr)
       debug_info = "," + key_value_to_json("file", file) + "," + key_value_to_json("fun", function_name);
-    msg = "{\"time\":\"" + std::to_string(HAL_GetTick()) + "\",\"level\":\"" + prefix + "\",\"ver\":\"" +
+    msg = "{\"time\":\"" + std::to_string(log_time_ms()) + "\",\"level\":\"" + prefix + "\",\"ver\":\"" +
           version + "\"" + debug_info + ",\"msg\":{" + msg + "}}\n";
   } else {
     msg += "\n";
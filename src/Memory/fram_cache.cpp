@@ -0,0 +1,309 @@
+#include "fram_cache.hpp"
+#include "stmepic.hpp"
+#include "status.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+using namespace stmepic::memory;
+using namespace stmepic;
+
+
+Result<std::shared_ptr<FramCache>> FramCache::Make(std::shared_ptr<FRAM> fram,
+                                                   uint32_t begin_address,
+                                                   uint32_t size,
+                                                   uint16_t max_dirty_ranges) {
+  if(fram == nullptr)
+    return Status::Invalid("FramCache, FRAM is not initialized");
+  if(size == 0)
+    return Status::Invalid("FramCache, Size of the cached region is 0");
+  if(begin_address + size < begin_address)
+    return Status::Invalid("FramCache, Region is out of the address range");
+  if(max_dirty_ranges == 0)
+    return Status::Invalid("FramCache, Max dirty ranges is 0");
+  auto cache = std::shared_ptr<FramCache>(new FramCache(fram, begin_address, size, max_dirty_ranges));
+  if(cache->mutex == nullptr)
+    return Status::OutOfMemory("FramCache, Could not create the mutex");
+  return Result<std::shared_ptr<FramCache>>::OK(std::move(cache));
+}
+
+FramCache::FramCache(std::shared_ptr<FRAM> fram,
+                     uint32_t begin_address,
+                     uint32_t size,
+                     uint16_t max_dirty_ranges)
+: fram(fram), begin_address(begin_address), size(size), max_dirty_ranges(max_dirty_ranges), started(false),
+  mirror(size, 0), loaded_pages((size + page_size * 32 - 1) / (page_size * 32), 0),
+  mutex(xSemaphoreCreateMutex()) {
+  // one more for the new range before the oldest range is written back, no allocation after this
+  dirty.reserve(max_dirty_ranges + 1);
+  task.task_init(handle, this, 1, nullptr, 300, tskIDLE_PRIORITY + 1, "FramCache");
+}
+
+FramCache::~FramCache() {
+  if(started)
+    (void)stop();
+  if(mutex != nullptr) {
+    (void)flush();
+    vSemaphoreDelete(mutex);
+  }
+}
+
+Status FramCache::write_raw(uint32_t address, uint8_t *data, size_t length) {
+  if(length == 0)
+    return Status::OK();
+  if(address + length < address)
+    return Status::Invalid("FramCache, Address is out of range");
+  uint32_t end = address + length;
+
+  if(address < begin_address) {
+    uint32_t direct = std::min(end, begin_address) - address;
+    STMEPIC_RETURN_ON_ERROR(fram->write_raw(address, data, direct));
+    data += direct;
+    address += direct;
+  }
+  if(end > begin_address + size) {
+    uint32_t direct_begin = std::max(address, begin_address + size);
+    uint8_t *direct_data = data + (direct_begin - address);
+    STMEPIC_RETURN_ON_ERROR(fram->write_raw(direct_begin, direct_data, end - direct_begin));
+    end = direct_begin;
+  }
+  if(address >= end)
+    return Status::OK();
+
+  uint32_t begin = address - begin_address;
+  end -= begin_address;
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  // the ranges left over by the failed write back of the previous write
+  Status status = write_back_oldest();
+  if(status.ok())
+    status = write_back_overlapped(begin, end);
+  // only the pages written partially have to be loaded, the rest is overwritten
+  if(status.ok() && begin % page_size != 0)
+    status = load(begin, begin + 1);
+  if(status.ok() && end % page_size != 0)
+    status = load(end - 1, end);
+  if(status.ok()) {
+    std::memcpy(mirror.data() + begin, data, end - begin);
+    set_loaded(begin / page_size, (end - 1) / page_size);
+    mark_dirty(begin, end);
+    status = write_back_oldest();
+  }
+  xSemaphoreGive(mutex);
+  return status;
+}
+
+Status FramCache::read_raw(uint32_t address, uint8_t *data, size_t length) {
+  if(length == 0)
+    return Status::OK();
+  if(address + length < address)
+    return Status::Invalid("FramCache, Address is out of range");
+  uint32_t end = address + length;
+
+  if(address < begin_address) {
+    uint32_t direct = std::min(end, begin_address) - address;
+    STMEPIC_RETURN_ON_ERROR(fram->read_raw(address, data, direct));
+    data += direct;
+    address += direct;
+  }
+  if(end > begin_address + size) {
+    uint32_t direct_begin = std::max(address, begin_address + size);
+    uint8_t *direct_data = data + (direct_begin - address);
+    STMEPIC_RETURN_ON_ERROR(fram->read_raw(direct_begin, direct_data, end - direct_begin));
+    end = direct_begin;
+  }
+  if(address >= end)
+    return Status::OK();
+
+  uint32_t begin = address - begin_address;
+  end -= begin_address;
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  Status status = load(begin, end);
+  if(status.ok())
+    std::memcpy(data, mirror.data() + begin, end - begin);
+  xSemaphoreGive(mutex);
+  return status;
+}
+
+Status FramCache::flush() {
+  // the mutex is released between the ranges so the writers wait for at most one transfer
+  for(;;) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    if(dirty.empty()) {
+      xSemaphoreGive(mutex);
+      return Status::OK();
+    }
+    Range range   = dirty.front();
+    Status status = write_back(range);
+    if(status.ok())
+      dirty.erase(dirty.begin());
+    xSemaphoreGive(mutex);
+    STMEPIC_RETURN_ON_ERROR(status);
+  }
+}
+
+Status FramCache::preload() {
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  Status status = load(0, size);
+  xSemaphoreGive(mutex);
+  return status;
+}
+
+Status FramCache::start(uint32_t period_ms) {
+  if(started)
+    return Status::AlreadyExists("FramCache, Flush task is already running");
+  if(period_ms == 0)
+    return Status::Invalid("FramCache, Period can't be 0");
+  task.task_set_period(period_ms);
+  STMEPIC_RETURN_ON_ERROR(task.task_run());
+  started = true;
+  return Status::OK();
+}
+
+Status FramCache::stop() {
+  // the task is not deleted in the middle of the transfer with the mutex taken
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  started       = false;
+  Status status = task.task_stop();
+  xSemaphoreGive(mutex);
+  return status;
+}
+
+uint32_t FramCache::get_dirty_bytes() const {
+  uint32_t bytes = 0;
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  for(const auto &range : dirty)
+    bytes += range.end - range.begin;
+  xSemaphoreGive(mutex);
+  return bytes;
+}
+
+uint16_t FramCache::get_dirty_range_count() const {
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  uint16_t count = (uint16_t)dirty.size();
+  xSemaphoreGive(mutex);
+  return count;
+}
+
+Result<bool> FramCache::device_is_connected() {
+  return fram->device_is_connected();
+}
+
+bool FramCache::device_ok() {
+  return fram->device_ok();
+}
+
+Status FramCache::device_get_status() {
+  return fram->device_get_status();
+}
+
+Status FramCache::device_reset() {
+  return fram->device_reset();
+}
+
+Status FramCache::device_start() {
+  return fram->device_start();
+}
+
+Status FramCache::device_stop() {
+  STMEPIC_RETURN_ON_ERROR(flush());
+  return fram->device_stop();
+}
+
+Status FramCache::device_set_settings(const DeviceSettings &settings) {
+  return fram->device_set_settings(settings);
+}
+
+bool FramCache::is_loaded(uint32_t page) const {
+  return (loaded_pages[page / 32] >> (page % 32)) & 1;
+}
+
+void FramCache::set_loaded(uint32_t first_page, uint32_t last_page) {
+  for(uint32_t page = first_page; page <= last_page; page++)
+    loaded_pages[page / 32] |= 1u << (page % 32);
+}
+
+Status FramCache::load(uint32_t begin, uint32_t end) {
+  uint32_t last_page = (end - 1) / page_size;
+  uint32_t page      = begin / page_size;
+  while(page <= last_page) {
+    if(is_loaded(page)) {
+      page++;
+      continue;
+    }
+    // the consecutive missing pages are loaded in a single transfer
+    uint32_t run_end = page + 1;
+    while(run_end <= last_page && !is_loaded(run_end) && (run_end - page) * page_size < max_transfer_size)
+      run_end++;
+    uint32_t run_begin_address = page * page_size;
+    uint32_t run_end_address   = std::min(run_end * page_size, size);
+    STMEPIC_RETURN_ON_ERROR(fram->read_raw(begin_address + run_begin_address,
+                                           mirror.data() + run_begin_address,
+                                           run_end_address - run_begin_address));
+    set_loaded(page, run_end - 1);
+    page = run_end;
+  }
+  return Status::OK();
+}
+
+void FramCache::mark_dirty(uint32_t begin, uint32_t end) {
+  // write_back_overlapped left only the newest range overlapping the write, the write is merged into it
+  if(!dirty.empty()) {
+    Range &newest = dirty.back();
+    if(newest.begin < end && newest.end > begin) {
+      newest.begin = std::min(newest.begin, begin);
+      newest.end   = std::max(newest.end, end);
+      return;
+    }
+    // the write close after the end of the newest range extends it, the range is written
+    // in the ascending order so the bytes of the write still reach the device last
+    auto in_gap = [&](const Range &range) { return range.end > newest.end && range.begin < begin; };
+    if(newest.end <= begin && begin - newest.end <= merge_gap &&
+       std::none_of(dirty.begin(), dirty.end() - 1, in_gap)) {
+      newest.end = end;
+      return;
+    }
+  }
+  dirty.push_back(Range{ begin, end });
+}
+
+Status FramCache::write_back_overlapped(uint32_t begin, uint32_t end) {
+  // the bytes of an older range overwritten now would reach the device after the ranges written
+  // since then, the ranges up to the overlapped one are written back before the write
+  size_t count = 0;
+  for(size_t i = 0; i + 1 < dirty.size(); i++)
+    if(dirty[i].begin < end && dirty[i].end > begin)
+      count = i + 1;
+  for(; count > 0; count--) {
+    STMEPIC_RETURN_ON_ERROR(write_back(dirty.front()));
+    dirty.erase(dirty.begin());
+  }
+  return Status::OK();
+}
+
+Status FramCache::write_back_oldest() {
+  // merging the ranges would break the order of the writes, the oldest one is written instead
+  while(dirty.size() > max_dirty_ranges) {
+    STMEPIC_RETURN_ON_ERROR(write_back(dirty.front()));
+    dirty.erase(dirty.begin());
+  }
+  return Status::OK();
+}
+
+Status FramCache::write_back(const Range &range) {
+  // the merged ranges can cover the clean bytes of the pages that were never loaded
+  STMEPIC_RETURN_ON_ERROR(load(range.begin, range.end));
+  for(uint32_t position = range.begin; position < range.end;) {
+    uint32_t length = std::min<uint32_t>(range.end - position, max_transfer_size);
+    STMEPIC_RETURN_ON_ERROR(fram->write_raw(begin_address + position, mirror.data() + position, length));
+    position += length;
+  }
+  return Status::OK();
+}
+
+Status FramCache::handle(SimpleTask &task, void *args) {
+  (void)task;
+  auto *cache = static_cast<FramCache *>(args);
+  if(cache == nullptr)
+    return Status::Invalid("FramCache::handle: args is nullptr");
+  return cache->flush();
+}
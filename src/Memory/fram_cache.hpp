@@ -0,0 +1,149 @@
+#pragma once
+
+#include "memory_fram.hpp"
+#include "simple_task.hpp"
+#include "stmepic.hpp"
+#include "status.hpp"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+
+/**
+ * @file fram_cache.hpp
+ * @brief Write-back RAM cache of a region of the FRAM device.
+ */
+
+/**
+ * @defgroup Memory
+ * @{
+ */
+
+namespace stmepic::memory {
+
+/**
+ * @class FramCache
+ * @brief FRAM device that keeps a RAM mirror of a region of the other FRAM device.
+ *
+ * The cache is a FRAM itself, so write, writeStruct, readStruct, the vectors and the FramKvStore work
+ * on top of it without any change and the data in the FRAM has exactly the same format.
+ *
+ * Reads of the region are served from the mirror, the pages that were not read yet are loaded
+ * from the device first (read-through). Writes of the region only update the mirror and mark the range
+ * as dirty, a struct written many times between the flushes costs a single transfer.
+ * The dirty ranges are written to the device by flush(), called by the user or by the flush task
+ * started with start(). The data written since the last flush is lost on the power loss,
+ * reads and writes outside of the region go directly to the device.
+ *
+ * The dirty ranges are written in the order of the writes, so the order the FramKvStore relies on
+ * (data before the slot header, end marker before the record header) holds on the device during the flush.
+ * The ranges are never merged out of this order: only the newest range absorbs the writes overlapping it
+ * or following it closely, a write overlapping an older range first writes back the ranges up to that one
+ * and when there are too many ranges the oldest one is written by the write that adds the new one.
+ *
+ * The device shouldn't be written by anything else than the cache while the cache is used.
+ */
+class FramCache : public FRAM {
+public:
+  /**
+   * @brief Make new cache of the FRAM device.
+   * @param fram the FRAM device that is cached
+   * @param begin_address the first address of the cached region
+   * @param size the size of the cached region, the mirror of this size is allocated in RAM
+   * @param max_dirty_ranges the maximum number of the separate dirty ranges,
+   * the oldest ranges are written to the device when there are more
+   */
+  static Result<std::shared_ptr<FramCache>>
+  Make(std::shared_ptr<FRAM> fram, uint32_t begin_address, uint32_t size, uint16_t max_dirty_ranges = 16);
+
+  virtual ~FramCache();
+  FramCache(const FramCache &)            = delete;
+  FramCache &operator=(const FramCache &) = delete;
+
+  /// @brief Write data to the mirror, the data is written to the device with the next flush
+  /// @return the error of the device when the oldest dirty range couldn't be written back,
+  /// the data is kept in the mirror and stays dirty
+  virtual Status write_raw(uint32_t address, uint8_t *data, size_t length) override;
+
+  /// @brief Read data from the mirror, the missing pages are loaded from the device
+  virtual Status read_raw(uint32_t address, uint8_t *data, size_t length) override;
+
+  /// @brief Write all dirty ranges to the device in the order of the writes.
+  /// @return the error of the device, the ranges that were not written stay dirty
+  Status flush();
+
+  /// @brief Load the whole region from the device, so all following reads are served from RAM.
+  Status preload();
+
+  /// @brief Start the task that flushes the dirty ranges with the given period,
+  /// the task has a low priority so it doesn't delay the tasks writing the data.
+  Status start(uint32_t period_ms);
+
+  /// @brief Stop the flush task, the dirty ranges are not flushed.
+  Status stop();
+
+  /// @brief Number of the bytes waiting for the flush.
+  [[nodiscard]] uint32_t get_dirty_bytes() const;
+
+  /// @brief Number of the separate dirty ranges, the number of the transfers of the next flush.
+  [[nodiscard]] uint16_t get_dirty_range_count() const;
+
+  Result<bool> device_is_connected() override;
+  bool device_ok() override;
+  Status device_get_status() override;
+  Status device_reset() override;
+  Status device_start() override;
+  /// @brief Flushes the cache before the device is stopped.
+  Status device_stop() override;
+  Status device_set_settings(const DeviceSettings &settings) override;
+
+private:
+  /// @brief Range of the mirror, relative to the begin_address, end is exclusive.
+  struct Range {
+    uint32_t begin;
+    uint32_t end;
+  };
+
+  FramCache(std::shared_ptr<FRAM> fram, uint32_t begin_address, uint32_t size, uint16_t max_dirty_ranges);
+
+  std::shared_ptr<FRAM> fram;
+  uint32_t begin_address;
+  uint32_t size;
+  uint16_t max_dirty_ranges;
+  bool started;
+  std::vector<uint8_t> mirror;
+  /// @brief bit per page of the mirror, set when the page was loaded from the device or fully written
+  std::vector<uint32_t> loaded_pages;
+  /// @brief dirty ranges in the order of the writes, not overlapping
+  std::vector<Range> dirty;
+  SemaphoreHandle_t mutex;
+  SimpleTask task;
+
+  /// @brief the granularity of the read-through loading
+  static constexpr uint32_t page_size = 32;
+  /// @brief the write closer than this after the newest dirty range extends it, rewriting a few clean
+  /// bytes is cheaper than the address and the start of the next transfer
+  static constexpr uint32_t merge_gap = 8;
+
+  bool is_loaded(uint32_t page) const;
+  void set_loaded(uint32_t first_page, uint32_t last_page);
+
+  /// @brief Load the pages of the range of the mirror that were not loaded yet.
+  Status load(uint32_t begin, uint32_t end);
+
+  /// @brief Merge the range into the newest dirty range or add it as the new newest one.
+  void mark_dirty(uint32_t begin, uint32_t end);
+
+  /// @brief Write back the dirty ranges up to the last one overlapping the range, except the newest one.
+  Status write_back_overlapped(uint32_t begin, uint32_t end);
+
+  /// @brief Write back the oldest dirty ranges until there are at most max_dirty_ranges.
+  Status write_back_oldest();
+
+  /// @brief Write the range of the mirror to the device.
+  Status write_back(const Range &range);
+
+  static Status handle(SimpleTask &task, void *args);
+};
+
+} // namespace stmepic::memory
@@ -0,0 +1,399 @@
+#include "fram_kv_store.hpp"
+#include "crc16.hpp"
+#include "stmepic.hpp"
+#include "status.hpp"
+#include <cstdint>
+
+using namespace stmepic::memory;
+using namespace stmepic;
+
+namespace {
+
+void write_be16(uint8_t *data, uint16_t value) {
+  data[0] = (value >> 8) & 0xFF;
+  data[1] = value & 0xFF;
+}
+
+void write_be32(uint8_t *data, uint32_t value) {
+  data[0] = (value >> 24) & 0xFF;
+  data[1] = (value >> 16) & 0xFF;
+  data[2] = (value >> 8) & 0xFF;
+  data[3] = value & 0xFF;
+}
+
+uint16_t read_be16(const uint8_t *data) {
+  return (uint16_t)(data[0] << 8) | data[1];
+}
+
+uint32_t read_be32(const uint8_t *data) {
+  return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+}
+
+uint16_t checksum(const uint8_t *data, size_t length) {
+  return algorithm::CRC16::get_instance().crc16(data, length);
+}
+
+/// @brief Position of the key in the index of the given size (power of 2).
+size_t index_home(uint32_t key, size_t index_size) {
+  uint32_t hash = key * 2654435761u;
+  hash ^= hash >> 16;
+  return hash & (index_size - 1);
+}
+
+/// @brief Index with at most 2/3 of the positions used, so there is always an empty position.
+size_t index_size_for(uint16_t max_keys) {
+  size_t index_size = 4;
+  while(index_size < (size_t)max_keys + max_keys / 2 + 1)
+    index_size <<= 1;
+  return index_size;
+}
+
+/// @brief Sequence a is newer than b, the sequence numbers wrap around.
+bool sequence_newer(uint32_t a, uint32_t b) {
+  return (int32_t)(a - b) > 0;
+}
+
+} // namespace
+
+Result<std::shared_ptr<FramKvStore>>
+FramKvStore::Make(std::shared_ptr<FRAM> fram, uint32_t begin_address, uint32_t size, uint16_t max_keys) {
+  if(fram == nullptr)
+    return Status::Invalid("FramKvStore, FRAM is not initialized");
+  if(size < record_size(1))
+    return Status::CapacityError("FramKvStore, Region is too small for a single record");
+  if(begin_address + size < begin_address)
+    return Status::Invalid("FramKvStore, Region is out of the address range");
+  if(max_keys == 0)
+    return Status::Invalid("FramKvStore, Max keys is 0");
+  auto store = std::shared_ptr<FramKvStore>(new FramKvStore(fram, begin_address, size, max_keys));
+  if(store->mutex == nullptr)
+    return Status::OutOfMemory("FramKvStore, Could not create the mutex");
+  return Result<std::shared_ptr<FramKvStore>>::OK(std::move(store));
+}
+
+FramKvStore::FramKvStore(std::shared_ptr<FRAM> fram, uint32_t begin_address, uint32_t size, uint16_t max_keys)
+: fram(fram), begin_address(begin_address), size(size), max_keys(max_keys), mounted(false), key_count(0),
+  end_address(0), index(index_size_for(max_keys), IndexEntry{}), mutex(xSemaphoreCreateMutex()) {
+}
+
+FramKvStore::~FramKvStore() {
+  if(mutex != nullptr)
+    vSemaphoreDelete(mutex);
+}
+
+Status FramKvStore::mount() {
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  for(auto &entry : index)
+    entry.flags = 0;
+  key_count = 0;
+  mounted   = false;
+
+  // each record is a single read of its headers, the first invalid record ends the store
+  Status status    = Status::OK();
+  uint32_t address = 0;
+  uint8_t header[record_header_size];
+  while(address + record_header_size <= size) {
+    status = fram->read_raw(begin_address + address, header, record_header_size);
+    if(!status.ok())
+      break;
+    IndexEntry entry;
+    bool removed;
+    if(!parse_record(header, address, entry, removed) || address + record_size(entry.capacity) > size)
+      break;
+    if(!removed) {
+      status = index_insert(entry);
+      if(!status.ok())
+        break;
+    }
+    address += record_size(entry.capacity);
+  }
+  end_address = address;
+  mounted     = status.ok();
+  xSemaphoreGive(mutex);
+  return status;
+}
+
+Status FramKvStore::format() {
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  Status status = write_end_marker(0);
+  if(status.ok()) {
+    for(auto &entry : index)
+      entry.flags = 0;
+    key_count   = 0;
+    end_address = 0;
+    mounted     = true;
+  }
+  xSemaphoreGive(mutex);
+  return status;
+}
+
+Status FramKvStore::create(uint32_t key, uint16_t capacity, bool fixed_size) {
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  Status status = create_locked(key, capacity, fixed_size);
+  xSemaphoreGive(mutex);
+  return status;
+}
+
+Status FramKvStore::put(uint32_t key, std::span<const uint8_t> value) {
+  return put_value(key, value, false);
+}
+
+Status FramKvStore::put_value(uint32_t key, std::span<const uint8_t> value, bool fixed_size) {
+  if(value.size() > UINT16_MAX)
+    return Status::CapacityError("FramKvStore, Value is bigger than 65535");
+  if(value.size() != 0 && value.data() == nullptr)
+    return Status::Invalid("FramKvStore, Value is null");
+
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  Status status   = Status::OK();
+  size_t position = find(key);
+  if(!(index[position].flags & index_flag_used)) {
+    status   = create_locked(key, (uint16_t)value.size(), fixed_size);
+    position = find(key);
+  }
+  IndexEntry &entry = index[position];
+  if(status.ok() && (entry.flags & record_flag_fixed) && value.size() != entry.capacity)
+    status = Status::Invalid("FramKvStore, Value size is not the size of the fixed size key");
+  if(status.ok() && value.size() > entry.capacity)
+    status = Status::CapacityError("FramKvStore, Value is bigger than the capacity of the key");
+  if(!status.ok()) {
+    xSemaphoreGive(mutex);
+    return status;
+  }
+
+  // the new value goes to the slot with the older value, data first and the slot header last
+  const bool slot_b = (entry.flags & index_flag_value) && !(entry.flags & index_flag_slot_b);
+  const uint32_t slot_offset   = entry_header_size + (slot_b ? slot_header_size : 0);
+  const uint32_t slot_address  = begin_address + entry.address + slot_offset;
+  const uint32_t data_address  = slot_data_address(entry, slot_b);
+  const uint32_t sequence      = entry.sequence + 1;
+  const uint16_t data_checksum = checksum(value.data(), value.size());
+  // write_raw doesn't modify the data, only the HAL API isn't const
+  if(value.size() != 0)
+    status = fram->write_raw(data_address, const_cast<uint8_t *>(value.data()), value.size());
+
+  uint8_t header[slot_header_size];
+  write_be32(header, sequence);
+  write_be16(header + 4, (uint16_t)value.size());
+  write_be16(header + 6, data_checksum);
+  write_be16(header + 8, checksum(header, 8));
+  if(status.ok())
+    status = fram->write_raw(slot_address, header, slot_header_size);
+  if(status.ok()) {
+    entry.sequence      = sequence;
+    entry.size          = (uint16_t)value.size();
+    entry.data_checksum = data_checksum;
+    entry.flags         = (uint8_t)((entry.flags & ~index_flag_slot_b) | index_flag_value);
+    if(slot_b)
+      entry.flags |= index_flag_slot_b;
+  }
+  xSemaphoreGive(mutex);
+  return status;
+}
+
+Result<size_t> FramKvStore::get(uint32_t key, std::span<uint8_t> value) {
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  const IndexEntry &entry = index[find(key)];
+  Status status           = Status::OK();
+  if(!(entry.flags & index_flag_used))
+    status = Status::KeyError("FramKvStore, Key doesn't exist");
+  else if(!(entry.flags & index_flag_value))
+    status = Status::KeyError("FramKvStore, Key has no value");
+  else if(entry.size > value.size())
+    status = Status::CapacityError("FramKvStore, Value doesn't fit in the buffer");
+  else if(entry.size != 0 && value.data() == nullptr)
+    status = Status::Invalid("FramKvStore, Buffer for the value is null");
+
+  const bool slot_b           = entry.flags & index_flag_slot_b;
+  const uint32_t data_address = slot_data_address(entry, slot_b);
+  const uint16_t value_size   = entry.size;
+  if(status.ok() && value_size != 0)
+    status = fram->read_raw(data_address, value.data(), value_size);
+  if(status.ok() && checksum(value.data(), value_size) != entry.data_checksum)
+    status = Status::Invalid("FramKvStore, Checksum is not correct");
+  xSemaphoreGive(mutex);
+  if(!status.ok())
+    return status;
+  return Result<size_t>::OK((size_t)value_size);
+}
+
+Status FramKvStore::remove(uint32_t key) {
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  Status status   = Status::OK();
+  size_t position = find(key);
+  if(!(index[position].flags & index_flag_used)) {
+    status = Status::KeyError("FramKvStore, Key doesn't exist");
+  } else {
+    // single byte write, the record is either removed or not
+    uint8_t magic = removed_record_magic;
+    status        = fram->write_raw(begin_address + index[position].address, &magic, 1);
+    if(status.ok())
+      index_remove(position);
+  }
+  xSemaphoreGive(mutex);
+  return status;
+}
+
+bool FramKvStore::contains(uint32_t key) {
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  bool exists = index[find(key)].flags & index_flag_used;
+  xSemaphoreGive(mutex);
+  return exists;
+}
+
+Result<uint16_t> FramKvStore::get_value_size(uint32_t key) {
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  const IndexEntry entry = index[find(key)];
+  xSemaphoreGive(mutex);
+  if(!(entry.flags & index_flag_used))
+    return Status::KeyError("FramKvStore, Key doesn't exist");
+  if(!(entry.flags & index_flag_value))
+    return Status::KeyError("FramKvStore, Key has no value");
+  return Result<uint16_t>::OK((uint16_t)entry.size);
+}
+
+uint32_t FramKvStore::get_key_count() const {
+  return key_count;
+}
+
+uint32_t FramKvStore::get_used_bytes() const {
+  return end_address;
+}
+
+uint32_t FramKvStore::get_free_bytes() const {
+  return size - end_address;
+}
+
+bool FramKvStore::is_mounted() const {
+  return mounted;
+}
+
+size_t FramKvStore::find(uint32_t key) const {
+  const size_t mask = index.size() - 1;
+  size_t position   = index_home(key, index.size());
+  while((index[position].flags & index_flag_used) && index[position].key != key)
+    position = (position + 1) & mask;
+  return position;
+}
+
+Status FramKvStore::index_insert(const IndexEntry &entry) {
+  size_t position = find(entry.key);
+  if(!(index[position].flags & index_flag_used)) {
+    if(key_count >= max_keys)
+      return Status::CapacityError("FramKvStore, Store has more keys than max_keys");
+    key_count++;
+  }
+  index[position] = entry;
+  index[position].flags |= index_flag_used;
+  return Status::OK();
+}
+
+void FramKvStore::index_remove(size_t position) {
+  // backward shift deletion, keeps the probe sequences without the tombstones
+  const size_t mask = index.size() - 1;
+  size_t hole       = position;
+  size_t next       = (position + 1) & mask;
+  while(index[next].flags & index_flag_used) {
+    size_t home = index_home(index[next].key, index.size());
+    if(((next - home) & mask) >= ((next - hole) & mask)) {
+      index[hole] = index[next];
+      hole        = next;
+    }
+    next = (next + 1) & mask;
+  }
+  index[hole].flags = 0;
+  key_count--;
+}
+
+bool FramKvStore::parse_record(const uint8_t *header, uint32_t address, IndexEntry &entry, bool &removed) {
+  if(header[0] != record_magic && header[0] != removed_record_magic)
+    return false;
+  if(checksum(header + 1, 7) != read_be16(header + 8))
+    return false;
+  removed             = header[0] == removed_record_magic;
+  entry.key           = read_be32(header + 2);
+  entry.address       = address;
+  entry.capacity      = read_be16(header + 6);
+  entry.flags         = header[1] & record_flag_fixed;
+  entry.sequence      = 0;
+  entry.size          = 0;
+  entry.data_checksum = 0;
+
+  uint32_t sequence_a, sequence_b;
+  uint16_t size_a, size_b, checksum_a, checksum_b;
+  bool valid_a = parse_slot(header + entry_header_size, sequence_a, size_a, checksum_a);
+  bool valid_b = parse_slot(header + entry_header_size + slot_header_size, sequence_b, size_b, checksum_b);
+  valid_a      = valid_a && size_a <= entry.capacity;
+  valid_b      = valid_b && size_b <= entry.capacity;
+  if(valid_b && (!valid_a || sequence_newer(sequence_b, sequence_a))) {
+    entry.sequence      = sequence_b;
+    entry.size          = size_b;
+    entry.data_checksum = checksum_b;
+    entry.flags |= index_flag_value | index_flag_slot_b;
+  } else if(valid_a) {
+    entry.sequence      = sequence_a;
+    entry.size          = size_a;
+    entry.data_checksum = checksum_a;
+    entry.flags |= index_flag_value;
+  }
+  return true;
+}
+
+bool FramKvStore::parse_slot(const uint8_t *header,
+                             uint32_t &sequence,
+                             uint16_t &size,
+                             uint16_t &data_checksum) {
+  if(checksum(header, 8) != read_be16(header + 8))
+    return false;
+  sequence      = read_be32(header);
+  size          = read_be16(header + 4);
+  data_checksum = read_be16(header + 6);
+  return true;
+}
+
+uint32_t FramKvStore::slot_data_address(const IndexEntry &entry, bool slot_b) const {
+  return begin_address + entry.address + record_header_size + (slot_b ? entry.capacity : 0);
+}
+
+Status FramKvStore::write_end_marker(uint32_t address) {
+  if(address >= size)
+    return Status::OK();
+  uint8_t magic = end_magic;
+  return fram->write_raw(begin_address + address, &magic, 1);
+}
+
+Status FramKvStore::create_locked(uint32_t key, uint16_t capacity, bool fixed_size) {
+  if(!mounted)
+    return Status::Invalid("FramKvStore, Store is not mounted");
+  if(index[find(key)].flags & index_flag_used)
+    return Status::AlreadyExists("FramKvStore, Key already exists");
+  if(key_count >= max_keys)
+    return Status::CapacityError("FramKvStore, Max keys reached");
+  if(end_address + record_size(capacity) > size)
+    return Status::CapacityError("FramKvStore, No space left for the key");
+
+  // the old data after the new record could look like the records, the end marker goes first,
+  // then the invalid slot headers and the record header is written last
+  const uint32_t address = end_address;
+  uint8_t header[record_header_size] = {};
+  header[0]                          = record_magic;
+  header[1]                          = fixed_size ? record_flag_fixed : 0;
+  write_be32(header + 2, key);
+  write_be16(header + 6, capacity);
+  write_be16(header + 8, checksum(header + 1, 7));
+  // zeroed slot headers are invalid, their checksum is not 0
+  STMEPIC_RETURN_ON_ERROR(write_end_marker(address + record_size(capacity)));
+  uint8_t *slot_headers = header + entry_header_size;
+  STMEPIC_RETURN_ON_ERROR(
+  fram->write_raw(begin_address + address + entry_header_size, slot_headers, 2 * slot_header_size));
+  STMEPIC_RETURN_ON_ERROR(fram->write_raw(begin_address + address, header, entry_header_size));
+
+  IndexEntry entry{};
+  entry.key      = key;
+  entry.address  = address;
+  entry.capacity = capacity;
+  entry.flags    = fixed_size ? record_flag_fixed : 0;
+  STMEPIC_RETURN_ON_ERROR(index_insert(entry));
+  end_address = address + record_size(capacity);
+  return Status::OK();
+}
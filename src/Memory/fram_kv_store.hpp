@@ -0,0 +1,229 @@
+#pragma once
+
+#include "memory_fram.hpp"
+#include "stmepic.hpp"
+#include "status.hpp"
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+
+/**
+ * @file fram_kv_store.hpp
+ * @brief Key-value store on top of the FRAM device with the index of the keys kept in RAM.
+ */
+
+/**
+ * @defgroup Memory
+ * @{
+ */
+
+namespace stmepic::memory {
+
+/**
+ *
+ *  KEY-VALUE STORE DATA STRUCTURE
+ *  the store is a sequence of records, each record holds a single key with two slots for its value.
+ *  the first byte is MSB for all fields.
+ *  \verbatim
+ *  | Byte Offset | Field Name       | Size (bytes) | Description                          |
+ *  |-------------|------------------|--------------|--------------------------------------|
+ *  | 0           | Magic Number     | 1            | Record, removed record or end        |
+ *  | 1           | Flags            | 1            | Fixed size value                     |
+ *  | 2           | Key              | 4            | The key of the record                |
+ *  | 6           | Capacity         | 2            | The size of each slot                |
+ *  | 8           | Checksum         | 2            | A checksum of the bytes 1-7          |
+ *  | 10          | Slot A Header    | 10           | Header of the slot A                 |
+ *  | 20          | Slot B Header    | 10           | Header of the slot B                 |
+ *  | 30          | Slot A Data      | C            | The value in the slot A              |
+ *  | 30+C        | Slot B Data      | C            | The value in the slot B              |
+ *  |-------------|------------------|--------------|--------------------------------------|
+ *  |             | Total            | 30+2C        | Total size of the record             |
+ *  \endverbatim
+ *
+ *  SLOT HEADER
+ *  \verbatim
+ *  | Byte Offset | Field Name       | Size (bytes) | Description                          |
+ *  |-------------|------------------|--------------|--------------------------------------|
+ *  | 0           | Sequence         | 4            | Incremented with each write of value |
+ *  | 4           | Size             | 2            | The size of the value                |
+ *  | 6           | Data Checksum    | 2            | A checksum of the value              |
+ *  | 8           | Checksum         | 2            | A checksum of the bytes 0-7          |
+ *  \endverbatim
+ **/
+
+/**
+ * @class FramKvStore
+ * @brief Key-value store in a region of the FRAM device.
+ *
+ * Each key owns a record with two slots. The new value is written to the slot with the older
+ * sequence number, data first and the slot header last, so the power loss during the write leaves
+ * the previous value intact. Removing a key is a single byte write of the magic number.
+ *
+ * The index of the keys (open addressing hash table) is allocated once in Make and rebuilt by mount(),
+ * which reads only the 30 bytes of the record and slot headers of each record in a single transfer,
+ * so the mount time depends on the number of records, not on the size of the values.
+ * Lookups don't touch the FRAM, reads and writes of the values are a single transfer of the data.
+ *
+ * The store uses read_raw/write_raw, the values are not encrypted.
+ * The space of the removed keys is reclaimed only by format().
+ */
+class FramKvStore {
+public:
+  /**
+   * @brief Make new key-value store, the store has to be mounted or formatted before use.
+   * @param fram the FRAM device
+   * @param begin_address the first address of the region used by the store
+   * @param size the size of the region used by the store
+   * @param max_keys the maximum number of the keys, sets the size of the index in RAM
+   */
+  static Result<std::shared_ptr<FramKvStore>>
+  Make(std::shared_ptr<FRAM> fram, uint32_t begin_address, uint32_t size, uint16_t max_keys = 64);
+
+  ~FramKvStore();
+  FramKvStore(const FramKvStore &)            = delete;
+  FramKvStore &operator=(const FramKvStore &) = delete;
+
+  /// @brief Rebuild the index by scanning the record headers of the region.
+  /// @return CapacityError if the region holds more keys than max_keys
+  Status mount();
+
+  /// @brief Erase the store, all keys are removed and the space is reclaimed.
+  Status format();
+
+  /**
+   * @brief Create the record of the key.
+   * @param key the key
+   * @param capacity the maximum size of the value
+   * @param fixed_size the value has to have exactly the capacity size
+   * @return AlreadyExists if the key exists, CapacityError if there is no space left
+   */
+  Status create(uint32_t key, uint16_t capacity, bool fixed_size = false);
+
+  /// @brief Write the value of the key,
+  /// the key is created with the capacity of the value if it doesn't exist.
+  Status put(uint32_t key, std::span<const uint8_t> value);
+
+  /// @brief Read the value of the key to the buffer.
+  /// @return the size of the value, KeyError if the key doesn't exist or has no value yet
+  Result<size_t> get(uint32_t key, std::span<uint8_t> value);
+
+  /// @brief Remove the key.
+  Status remove(uint32_t key);
+
+  /// @brief Check if the key exists.
+  bool contains(uint32_t key);
+
+  /// @brief Size of the current value of the key.
+  Result<uint16_t> get_value_size(uint32_t key);
+
+  /// @brief Write a struct as a fixed size value of the key
+  /// the structure should't have pointers or any other dynamic data
+  template <typename T> Status put_struct(uint32_t key, const T &value) {
+    static_assert(sizeof(T) <= UINT16_MAX, "Value is too big");
+    auto buffer = std::span<const uint8_t>(reinterpret_cast<const uint8_t *>(&value), sizeof(T));
+    return put_value(key, buffer, true);
+  }
+
+  /// @brief Read a struct written with put_struct
+  template <typename T> Result<T> get_struct(uint32_t key) {
+    T value;
+    auto buffer = std::span<uint8_t>(reinterpret_cast<uint8_t *>(&value), sizeof(T));
+    STMEPIC_ASSING_OR_RETURN(size, get(key, buffer));
+    if(size != sizeof(T))
+      return Status::CapacityError("FramKvStore, Value size is not the same as the struct size");
+    return Result<T>::OK(std::move(value));
+  }
+
+  /// @brief Number of the keys in the store.
+  [[nodiscard]] uint32_t get_key_count() const;
+
+  /// @brief Bytes used by the records, including the removed ones.
+  [[nodiscard]] uint32_t get_used_bytes() const;
+
+  /// @brief Bytes left for the new records.
+  [[nodiscard]] uint32_t get_free_bytes() const;
+
+  [[nodiscard]] bool is_mounted() const;
+
+  /// @brief Size of the record in the FRAM for the value capacity.
+  static constexpr uint32_t record_size(uint16_t capacity) {
+    return record_header_size + 2 * (uint32_t)capacity;
+  }
+
+  /// @brief Key from the name (FNV-1a), can be evaluated at compile time.
+  static constexpr uint32_t key_from_name(const char *name) {
+    uint32_t hash = 2166136261u;
+    while(*name != '\0')
+      hash = (hash ^ (uint8_t)*name++) * 16777619u;
+    return hash;
+  }
+
+private:
+  /// @brief Entry of the index, location and the current value of the key.
+  struct IndexEntry {
+    uint32_t key;
+    /// @brief address of the record relative to the begin_address
+    uint32_t address;
+    uint32_t sequence;
+    uint16_t capacity;
+    uint16_t size;
+    uint16_t data_checksum;
+    uint8_t flags;
+  };
+
+  FramKvStore(std::shared_ptr<FRAM> fram, uint32_t begin_address, uint32_t size, uint16_t max_keys);
+
+  std::shared_ptr<FRAM> fram;
+  uint32_t begin_address;
+  uint32_t size;
+  uint16_t max_keys;
+  bool mounted;
+  uint32_t key_count;
+  /// @brief end of the last record relative to the begin_address
+  uint32_t end_address;
+  std::vector<IndexEntry> index;
+  SemaphoreHandle_t mutex;
+
+  static constexpr uint8_t record_magic         = 0xC3;
+  static constexpr uint8_t removed_record_magic = 0x3C;
+  static constexpr uint8_t end_magic            = 0x00;
+  static constexpr uint8_t record_flag_fixed    = 0x01;
+  static constexpr uint8_t index_flag_used      = 0x10;
+  static constexpr uint8_t index_flag_value     = 0x20;
+  static constexpr uint8_t index_flag_slot_b    = 0x40;
+  static constexpr uint16_t entry_header_size   = 10;
+  static constexpr uint16_t slot_header_size    = 10;
+  static constexpr uint16_t record_header_size  = entry_header_size + 2 * slot_header_size;
+
+  /// @brief Position of the key in the index, or the empty position where it would be inserted.
+  size_t find(uint32_t key) const;
+
+  /// @brief Insert or replace the entry of the key in the index.
+  Status index_insert(const IndexEntry &entry);
+
+  /// @brief Remove the entry from the index, the following entries are shifted back.
+  void index_remove(size_t position);
+
+  /// @brief Parse the record and slot headers of the record, read during mount.
+  /// @return false if the record header is not valid
+  static bool parse_record(const uint8_t *header, uint32_t address, IndexEntry &entry, bool &removed);
+
+  /// @brief Parse a slot header.
+  /// @return false if the slot header is not valid
+  static bool parse_slot(const uint8_t *header, uint32_t &sequence, uint16_t &size, uint16_t &data_checksum);
+
+  /// @brief Address of the value in the slot.
+  uint32_t slot_data_address(const IndexEntry &entry, bool slot_b) const;
+
+  /// @brief Write the end marker after the last record if there is space for it.
+  Status write_end_marker(uint32_t address);
+
+  Status create_locked(uint32_t key, uint16_t capacity, bool fixed_size);
+
+  /// @brief Write the value, the key is created with the capacity of the value if it doesn't exist.
+  Status put_value(uint32_t key, std::span<const uint8_t> value, bool fixed_size);
+};
+
+} // namespace stmepic::memory
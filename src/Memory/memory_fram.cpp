@@ -1,87 +1,331 @@
 #include "memory_fram.hpp"
+#include "crc16.hpp"
 #include "device.hpp"
 #include "sha256.hpp"
 #include "stmepic.hpp"
 #include "status.hpp"
+#include <algorithm>
 #include <cstdint>
 #include <cstdlib>
 
 using namespace stmepic::memory;
 using namespace stmepic;
 
+namespace {
+
+void write_be32(uint8_t *data, uint32_t value) {
+  data[0] = (value >> 24) & 0xFF;
+  data[1] = (value >> 16) & 0xFF;
+  data[2] = (value >> 8) & 0xFF;
+  data[3] = value & 0xFF;
+}
+
+uint32_t read_be32(const uint8_t *data) {
+  return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+}
+
+} // namespace
+
 
 Status FRAM::write(uint32_t address, uint8_t *data, size_t length) {
   if(data == nullptr)
     return Status::Invalid("FRAM, Data to write is null");
-  if(length == 0)
-    return Status::CapacityError("FRAM, length of data to write is 0");
+  return write(address, std::span<const uint8_t>(data, length));
+}
 
-  std::unique_ptr<uint8_t[]> data_ptr(new uint8_t[length + data_frame_size]);
-  if(data_ptr == nullptr)
-    return Status::OutOfMemory("FRAM, Could not allocate memory for encoding of data ");
+Status FRAM::write(uint32_t address, std::span<const uint8_t> data) {
+  if(data.data() == nullptr)
+    return Status::Invalid("FRAM, Data to write is null");
+  if(data.size() == 0)
+    return Status::CapacityError("FRAM, length of data to write is 0");
+  if(data.size() > UINT16_MAX)
+    return Status::CapacityError("FRAM, length of data to write is bigger than 65535");
 
-  STMEPIC_RETURN_ON_ERROR(encode_data(data, length, data_ptr.get()));
-  return write_raw(address, data_ptr.get(), length + data_frame_size);
+  uint8_t header[data_frame_size];
+  uint8_t key_stream[algorithm::SHA256::SHA256_OUTPUT_SIZE];
+  uint16_t checksum = calculate_checksum(data.data(), data.size());
+  STMEPIC_RETURN_ON_ERROR(encode_header(checksum, (uint16_t)data.size(), magic_number_2, header, key_stream));
+  STMEPIC_RETURN_ON_ERROR(write_raw(address, header, data_frame_size));
+  const uint8_t *key = encryption_key == FRAM::base_encryption_key ? nullptr : key_stream;
+  return write_payload(address + data_frame_size, data, key, 0);
 }
 
 Result<std::pair<std::shared_ptr<uint8_t[]>, size_t>> FRAM::read(uint32_t address) {
-  // read the frame size first to know how much data to read
+  // read the header first to know how much data to read
   uint8_t frame_data_ptr[data_frame_size];
-  // read size of the data
-  STMEPIC_RETURN_ON_ERROR(read_raw(address, frame_data_ptr, data_frame_size));
-  size_t size = frame_data_ptr[frame_offset_size] | (frame_data_ptr[frame_offset_size + 1] << 8);
-  if(size == 0)
-    return Status::CapacityError("FRAM, Size of the data to read is 0");
+  STMEPIC_ASSING_OR_RETURN(size, read_header(address, frame_data_ptr));
   std::shared_ptr<uint8_t[]> data_ptr(new uint8_t[size]);
   if(data_ptr == nullptr)
     return Status::OutOfMemory("FRAM, Could not allocate memory for decoding of data ");
   // read the data
-  STMEPIC_RETURN_ON_ERROR(read_raw(address, data_ptr.get(), size));
+  STMEPIC_RETURN_ON_ERROR(read_raw(address + data_frame_size, data_ptr.get(), size));
   // decode the data
   STMEPIC_RETURN_ON_ERROR(decode_data(frame_data_ptr, data_ptr.get(), size));
-  return Result<std::pair<std::shared_ptr<uint8_t[]>, size_t>>::OK(std::make_pair(std::move(data_ptr), size));
+  return Result<std::pair<std::shared_ptr<uint8_t[]>, size_t>>::OK(
+  std::make_pair(std::move(data_ptr), (size_t)size));
 }
 
+Result<size_t> FRAM::read_into(uint32_t address, std::span<uint8_t> data) {
+  if(data.data() == nullptr)
+    return Status::Invalid("FRAM, Buffer for the data is null");
+  uint8_t frame_data_ptr[data_frame_size];
+  STMEPIC_ASSING_OR_RETURN(size, read_header(address, frame_data_ptr));
+  if(size > data.size())
+    return Status::CapacityError("FRAM, Data doesn't fit in the buffer");
+  STMEPIC_RETURN_ON_ERROR(read_raw(address + data_frame_size, data.data(), size));
+  STMEPIC_RETURN_ON_ERROR(decode_data(frame_data_ptr, data.data(), size));
+  return Result<size_t>::OK((size_t)size);
+}
 
-Status FRAM::encode_data(const uint8_t *data_src, size_t length, uint8_t *data_dest) {
-  if(length == 0)
-    return Status::CapacityError("Size of the data is 0");
-  if(data_dest == nullptr)
-    return Status::Invalid("Destination data pointer is null");
-  if(data_src == nullptr)
-    return Status::Invalid("Data to encode is null");
+Status FRAM::write_vector(uint32_t address, std::span<const uint8_t> data, uint16_t element_size) {
+  if(element_size == 0)
+    return Status::Invalid("FRAM, Element size is 0");
+  if(data.size() % element_size != 0)
+    return Status::Invalid("FRAM, Vector size is not a multiple of the element size");
+  if(data.size() != 0 && data.data() == nullptr)
+    return Status::Invalid("FRAM, Data to write is null");
+  if(data.size() / element_size > UINT32_MAX)
+    return Status::CapacityError("FRAM, Vector has too many elements");
+
+  uint8_t header[vector_frame_size];
+  uint8_t key_stream[algorithm::SHA256::SHA256_OUTPUT_SIZE];
+  const uint32_t count = (uint32_t)(data.size() / element_size);
+  uint16_t checksum    = calculate_checksum(data.data(), data.size());
+  STMEPIC_RETURN_ON_ERROR(encode_header(checksum, element_size, vector_magic_number_2, header, key_stream));
+  write_be32(header + data_frame_size, count);
+  STMEPIC_RETURN_ON_ERROR(write_raw(address, header, vector_frame_size));
+  const uint8_t *key = encryption_key == FRAM::base_encryption_key ? nullptr : key_stream;
+  return write_payload(address + vector_frame_size, data, key, 0);
+}
+
+Status FRAM::write_vector_chunked(uint32_t address,
+                                  uint16_t element_size,
+                                  uint32_t count,
+                                  std::span<uint8_t> buffer,
+                                  const fram_vector_writer &fill) {
+  if(element_size == 0)
+    return Status::Invalid("FRAM, Element size is 0");
+  if(buffer.data() == nullptr || buffer.size() < element_size)
+    return Status::CapacityError("FRAM, Buffer doesn't hold a single element");
+  if(!fill)
+    return Status::Invalid("FRAM, Fill callback is not set");
+
+  // the key stream is known from the header, the checksum is filled in after the last chunk
+  uint8_t header[vector_frame_size];
+  uint8_t key_stream[algorithm::SHA256::SHA256_OUTPUT_SIZE];
+  STMEPIC_RETURN_ON_ERROR(encode_header(0, element_size, vector_magic_number_2, header, key_stream));
+  write_be32(header + data_frame_size, count);
+  const bool encrypted     = encryption_key != FRAM::base_encryption_key;
+  const uint32_t per_chunk = (uint32_t)std::min<size_t>(buffer.size() / element_size, UINT32_MAX);
+
+  uint16_t checksum = algorithm::CRC16::CRC16_INIT;
+  size_t offset     = 0;
+  for(uint32_t index = 0; index < count;) {
+    const uint32_t elements = std::min(per_chunk, count - index);
+    auto chunk              = buffer.first((size_t)elements * element_size);
+    STMEPIC_RETURN_ON_ERROR(fill(chunk, index));
+    checksum = calculate_checksum(chunk.data(), chunk.size(), checksum);
+    // the buffer belongs to the writer, so it is encrypted in place and written in one transfer
+    if(encrypted)
+      for(size_t i = 0; i < chunk.size(); i++)
+        chunk[i] ^= key_stream[(offset + i) % algorithm::SHA256::SHA256_OUTPUT_SIZE];
+    STMEPIC_RETURN_ON_ERROR(write_payload(address + vector_frame_size + offset, chunk, nullptr, 0));
+    offset += chunk.size();
+    index += elements;
+  }
+  header[1] = (checksum >> 8) & 0xFF;
+  header[2] = checksum & 0xFF;
+  return write_raw(address, header, vector_frame_size);
+}
+
+Result<FramVectorInfo> FRAM::read_vector_info(uint32_t address) {
+  uint8_t header[vector_frame_size];
+  STMEPIC_RETURN_ON_ERROR(read_raw(address, header, vector_frame_size));
+  if(header[0] != magic_number_1)
+    return Status::Invalid("FRAM, No vector at the address");
+
+  FramVectorInfo info;
+  if(header[data_frame_size - 1] == vector_magic_number_2) {
+    info.element_size = (uint16_t)(header[7] << 8) | header[8];
+    info.count        = read_be32(header + data_frame_size);
+    info.legacy       = false;
+    return Result<FramVectorInfo>::OK(std::move(info));
+  }
+
+  // the old format starts with the record of the uint32_t count, it takes exactly vector_frame_size bytes
+  uint16_t size = (uint16_t)(header[frame_offset_size] << 8) | header[frame_offset_size + 1];
+  if(header[data_frame_size - 1] != magic_number_2 || size != sizeof(uint32_t))
+    return Status::Invalid("FRAM, No vector at the address");
+  STMEPIC_RETURN_ON_ERROR(decode_data(header, header + data_frame_size, sizeof(uint32_t)));
+  uint32_t count;
+  std::memcpy(&count, header + data_frame_size, sizeof(count));
+  info.element_size = 0;
+  info.count        = count;
+  info.legacy       = true;
+  return Result<FramVectorInfo>::OK(std::move(info));
+}
+
+Result<uint32_t> FRAM::read_vector_into(uint32_t address, std::span<uint8_t> data, uint16_t element_size) {
+  uint8_t header[vector_frame_size];
+  STMEPIC_ASSING_OR_RETURN(info, read_vector_header(address, header));
+  if(info.element_size != element_size)
+    return Status::Invalid("FRAM, Element size of the vector is not correct");
+  const size_t size = (size_t)info.count * info.element_size;
+  if(size > data.size())
+    return Status::CapacityError("FRAM, Vector doesn't fit in the buffer");
+  if(size != 0 && data.data() == nullptr)
+    return Status::Invalid("FRAM, Buffer for the data is null");
+
+  uint8_t key_stream[algorithm::SHA256::SHA256_OUTPUT_SIZE];
+  const uint8_t *key = decode_key_stream(header, key_stream) ? key_stream : nullptr;
+  STMEPIC_RETURN_ON_ERROR(read_payload(address + vector_frame_size, data.first(size), key, 0));
+  uint16_t checksum = (uint16_t)(header[1] << 8) | header[2];
+  if(calculate_checksum(data.data(), size) != checksum)
+    return Status::Invalid("Checksum is not correct");
+  return Result<uint32_t>::OK(std::move(info.count));
+}
+
+Status FRAM::read_vector_chunked(uint32_t address,
+                                 uint16_t element_size,
+                                 std::span<uint8_t> buffer,
+                                 const fram_vector_reader &consume) {
+  if(buffer.data() == nullptr || buffer.size() < element_size || element_size == 0)
+    return Status::CapacityError("FRAM, Buffer doesn't hold a single element");
+  if(!consume)
+    return Status::Invalid("FRAM, Consume callback is not set");
+  uint8_t header[vector_frame_size];
+  STMEPIC_ASSING_OR_RETURN(info, read_vector_header(address, header));
+  if(info.element_size != element_size)
+    return Status::Invalid("FRAM, Element size of the vector is not correct");
+
+  uint8_t key_stream[algorithm::SHA256::SHA256_OUTPUT_SIZE];
+  const uint8_t *key       = decode_key_stream(header, key_stream) ? key_stream : nullptr;
+  const uint32_t per_chunk = (uint32_t)std::min<size_t>(buffer.size() / element_size, UINT32_MAX);
+
+  uint16_t checksum = algorithm::CRC16::CRC16_INIT;
+  size_t offset     = 0;
+  for(uint32_t index = 0; index < info.count;) {
+    const uint32_t elements = std::min(per_chunk, info.count - index);
+    auto chunk              = buffer.first((size_t)elements * element_size);
+    STMEPIC_RETURN_ON_ERROR(read_payload(address + vector_frame_size + offset, chunk, key, offset));
+    checksum = calculate_checksum(chunk.data(), chunk.size(), checksum);
+    STMEPIC_RETURN_ON_ERROR(consume(chunk, index));
+    offset += chunk.size();
+    index += elements;
+  }
+  if(checksum != ((uint16_t)(header[1] << 8) | header[2]))
+    return Status::Invalid("Checksum is not correct");
+  return Status::OK();
+}
+
+Result<uint16_t> FRAM::read_header(uint32_t address, uint8_t *header) {
+  STMEPIC_RETURN_ON_ERROR(read_raw(address, header, data_frame_size));
+  if(header[0] != magic_number_1 || header[data_frame_size - 1] != magic_number_2)
+    return Status::Invalid("FRAM, No data structure at the address");
+  uint16_t size = (uint16_t)(header[frame_offset_size] << 8) | header[frame_offset_size + 1];
+  if(size == 0)
+    return Status::CapacityError("FRAM, Size of the data to read is 0");
+  return Result<uint16_t>::OK(std::move(size));
+}
+
+Result<FramVectorInfo> FRAM::read_vector_header(uint32_t address, uint8_t *header) {
+  STMEPIC_RETURN_ON_ERROR(read_raw(address, header, vector_frame_size));
+  if(header[0] != magic_number_1 || header[data_frame_size - 1] != vector_magic_number_2)
+    return Status::Invalid("FRAM, No vector at the address");
+  FramVectorInfo info;
+  info.element_size = (uint16_t)(header[7] << 8) | header[8];
+  info.count        = read_be32(header + data_frame_size);
+  info.legacy       = false;
+  if(info.element_size == 0)
+    return Status::Invalid("FRAM, Element size of the vector is 0");
+  return Result<FramVectorInfo>::OK(std::move(info));
+}
+
+Status FRAM::write_payload(uint32_t address,
+                           std::span<const uint8_t> data,
+                           const uint8_t *key_stream,
+                           size_t key_offset) {
+  // if encryption is disabled the payload goes directly from the caller's memory,
+  // write_raw doesn't modify the data, only the HAL API isn't const
+  if(key_stream == nullptr) {
+    for(size_t offset = 0; offset < data.size(); offset += max_transfer_size) {
+      const size_t size = std::min(max_transfer_size, data.size() - offset);
+      auto *chunk       = const_cast<uint8_t *>(data.data() + offset);
+      STMEPIC_RETURN_ON_ERROR(write_raw(address + offset, chunk, size));
+    }
+    return Status::OK();
+  }
 
+  // encrypted payload is written in chunks of the key stream size
+  uint8_t chunk[algorithm::SHA256::SHA256_OUTPUT_SIZE];
+  for(size_t offset = 0; offset < data.size(); offset += sizeof(chunk)) {
+    const size_t chunk_size = std::min(sizeof(chunk), data.size() - offset);
+    for(size_t i = 0; i < chunk_size; i++)
+      chunk[i] = data[offset + i] ^ key_stream[(key_offset + offset + i) % sizeof(chunk)];
+    STMEPIC_RETURN_ON_ERROR(write_raw(address + offset, chunk, chunk_size));
+  }
+  return Status::OK();
+}
+
+Status
+FRAM::read_payload(uint32_t address, std::span<uint8_t> data, const uint8_t *key_stream, size_t key_offset) {
+  for(size_t offset = 0; offset < data.size(); offset += max_transfer_size) {
+    const size_t size = std::min(max_transfer_size, data.size() - offset);
+    STMEPIC_RETURN_ON_ERROR(read_raw(address + offset, data.data() + offset, size));
+  }
+  if(key_stream != nullptr)
+    for(size_t i = 0; i < data.size(); i++)
+      data[i] ^= key_stream[(key_offset + i) % algorithm::SHA256::SHA256_OUTPUT_SIZE];
+  return Status::OK();
+}
+
+
+Status
+FRAM::encode_header(uint16_t checksum, uint16_t size, uint8_t magic, uint8_t *header, uint8_t *key_stream) {
+  if(header == nullptr || key_stream == nullptr)
+    return Status::Invalid("Destination data pointer is null");
 
-  uint16_t checksum = calculate_checksum(data_src, length);
-  data_dest[0]      = magic_number_1;
-  data_dest[1]      = (checksum >> 8) & 0xFF;
-  data_dest[2]      = checksum & 0xFF;
-  data_dest[7]      = (length >> 8) & 0xFF;
-  data_dest[8]      = length & 0xFF;
-  data_dest[9]      = magic_number_2;
+  header[0] = magic_number_1;
+  header[1] = (checksum >> 8) & 0xFF;
+  header[2] = checksum & 0xFF;
+  header[7] = (size >> 8) & 0xFF;
+  header[8] = size & 0xFF;
+  header[9] = magic;
 
   // if encryption is disabled
   if(encryption_key == FRAM::base_encryption_key) {
-    data_dest[3] = 0;
-    data_dest[4] = 0;
-    data_dest[5] = 0;
-    data_dest[6] = 0;
-    std::memcpy(data_dest + data_frame_size, data_src, length);
+    header[3] = 0;
+    header[4] = 0;
+    header[5] = 0;
+    header[6] = 0;
     return Status::OK();
   }
 
   uint32_t encres = stmepic::Ticker::get_instance().get_micros();
-  data_dest[3]    = (encres >> 24) & 0xFF;
-  data_dest[4]    = (encres >> 16) & 0xFF;
-  data_dest[5]    = (encres >> 8) & 0xFF;
-  data_dest[6]    = encres & 0xFF;
-  STMEPIC_RETURN_ON_ERROR(encrypt_data(data_dest + 3, 4, encryption_key));
-  std::string key = std::to_string(encres) + encryption_key;
-  std::memcpy(data_dest + data_frame_size, data_src, length);
-  STMEPIC_RETURN_ON_ERROR(encrypt_data(data_dest + data_frame_size, length, key));
+  header[3]       = (encres >> 24) & 0xFF;
+  header[4]       = (encres >> 16) & 0xFF;
+  header[5]       = (encres >> 8) & 0xFF;
+  header[6]       = encres & 0xFF;
+  STMEPIC_RETURN_ON_ERROR(encrypt_data(header + 3, 4, encryption_key));
+  make_key_stream(encres, key_stream);
   return Status::OK();
 }
 
+bool FRAM::decode_key_stream(uint8_t *header, uint8_t *key_stream) {
+  if(encryption_key == FRAM::base_encryption_key)
+    return false;
+  (void)decrypt_data(header + 3, 4, encryption_key);
+  uint32_t encres = read_be32(header + 3);
+  make_key_stream(encres, key_stream);
+  return true;
+}
+
+void FRAM::make_key_stream(uint32_t encres, uint8_t *key_stream) {
+  // the same key stream as encrypt_data with the per write key
+  std::string key = std::to_string(encres) + encryption_key;
+  algorithm::SHA256::get_instance().sha256((uint8_t *)(key.c_str()), key.size(), key_stream);
+}
+
 Status FRAM::decode_data(uint8_t *frame_data_ptr, uint8_t *data_src, size_t length) {
   if(length == 0)
     return Status::CapacityError("Size of the data is 0");
@@ -118,18 +362,8 @@ Status FRAM::decode_data(uint8_t *frame_data_ptr, uint8_t *data_src, size_t leng
   return Status::OK();
 }
 
-uint16_t FRAM::calculate_checksum(const uint8_t *data_src, size_t length) {
-  uint16_t crc = 0xFFFF;
-  for(size_t i = 0; i < length; i++) {
-    crc ^= (uint16_t)data_src[i] << 8;
-    for(int i = 0; i < 8; ++i) {
-      if(crc & 0x8000)
-        crc = (crc << 1) ^ 0x1021;
-      else
-        crc <<= 1;
-    }
-  }
-  return crc;
+uint16_t FRAM::calculate_checksum(const uint8_t *data_src, size_t length, uint16_t crc) {
+  return algorithm::CRC16::get_instance().crc16(data_src, length, crc);
 }
 
 Status FRAM::encrypt_data(uint8_t *data_src, size_t length, std::string key) {
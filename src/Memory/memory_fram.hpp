@@ -4,6 +4,7 @@
 #include <Timing.hpp>
 #include <cstdint>
 #include <cstring>
+#include <functional>
 #include <etl/platform.h>
 #include <etl/vector.h>
 #include <stmepic.hpp>
@@ -48,10 +49,46 @@ namespace stmepic::memory {
  *  |             | Total            | 10+N         | Total size of the data structure   |
  *  \endverbatim
  *
+ *  VECTOR DATA STRUCTURE
+ *  the whole vector is a single block with one header and one checksum.
+ *  \verbatim
+ *  | Byte Offset | Field Name       | Size (bytes) | Description                        |
+ *  |-------------|------------------|--------------|------------------------------------|
+ *  | 0           | Magic Number 1   | 1            | A unique identifier of all data    |
+ *  | 1           | Checksum         | 2            | A checksum of all elements         |
+ *  | 3           | Encryption Res   | 4            | A data used for encryption algo    |
+ *  | 7           | Element Size     | 2            | The size of a single element       |
+ *  | 9           | Magic Number 2   | 1            | A unique identifier for the vector |
+ *  | 10          | Element Count    | 4            | The number of the elements         |
+ *  | 14          | Data             | S*C          | The elements                       |
+ *  |-------------|------------------|--------------|------------------------------------|
+ *  |             | Total            | 14+S*C       | Total size of the data structure   |
+ *  \endverbatim
+ *
  *  // the actual size of the key used for encryption is 64 bits
  *  // however the key used by the user is 32 bits
  **/
 
+/// @brief Description of the vector stored in the FRAM
+struct FramVectorInfo {
+  /// @brief the size of a single element
+  uint16_t element_size;
+  /// @brief the number of the elements
+  uint32_t count;
+  /// @brief the vector is stored in the old format, a record with the count followed by a record per element
+  bool legacy;
+};
+
+/// @brief Callback that fills the next chunk of the vector written with FRAM::write_vector_chunked
+/// @param std::span<uint8_t> the chunk that has to be filled, whole elements
+/// @param uint32_t the index of the first element in the chunk
+using fram_vector_writer = std::function<Status(std::span<uint8_t>, uint32_t)>;
+
+/// @brief Callback that receives the next chunk of the vector read with FRAM::read_vector_chunked
+/// @param std::span<const uint8_t> the chunk, whole elements
+/// @param uint32_t the index of the first element in the chunk
+using fram_vector_reader = std::function<Status(std::span<const uint8_t>, uint32_t)>;
+
 /// @brief The fram module to save data to the fram devices
 class FRAM : public DeviceBase {
 
@@ -64,11 +101,27 @@ public:
   /// @return the status of the write operation
   Status write(uint32_t address, uint8_t *data, size_t length);
 
+  /// @brief Write data to the FRAM device, with encoding crc check and encryption if enabled.
+  /// The header is encoded on the stack and written as the first segment, the payload is written
+  /// directly from the data as the second segment, no heap allocation is made unless the encryption
+  /// is enabled.
+  /// @param address the address where the data will be written
+  /// @param data the data that will be written, at most 65535 bytes
+  /// @return the status of the write operation
+  Status write(uint32_t address, std::span<const uint8_t> data);
+
   /// @brief Read data from the FRAM device, with decoding crc check and decryption if enabled
   /// @param address the address where the data will be read
   /// @return the data that was read or error if the data was not read
   Result<std::pair<std::shared_ptr<uint8_t[]>, size_t>> read(uint32_t address);
 
+  /// @brief Read data from the FRAM device directly to the provided buffer, with decoding crc check and
+  /// decryption if enabled, no heap allocation is made unless the encryption is enabled.
+  /// @param address the address where the data will be read
+  /// @param data the buffer for the data, can be bigger than the data
+  /// @return the size of the data that was read or CapacityError if the data doesn't fit in the buffer
+  Result<size_t> read_into(uint32_t address, std::span<uint8_t> data);
+
   /// @brief writes the raw data to the FRAM device without any encoding
   /// @param address the address where the data will be written
   /// @param data the data that will be written
@@ -90,11 +143,11 @@ public:
   /// @param address the address where the struct will be read from
   /// @return the struct that was read or error if the struct was not read
   template <typename T> Result<T> readStruct(uint32_t address) {
-    STMEPIC_ASSING_OR_RETURN(decoded_data, read(address));
-    if(decoded_data.second != sizeof(T))
-      return Status::CapacityError("Data size is not the same as the struct size");
     T value;
-    std::memcpy(&value, decoded_data.first.get(), sizeof(T));
+    auto buffer = std::span<uint8_t>(reinterpret_cast<uint8_t *>(&value), sizeof(T));
+    STMEPIC_ASSING_OR_RETURN(size, read_into(address, buffer));
+    if(size != sizeof(T))
+      return Status::CapacityError("Data size is not the same as the struct size");
     return Result<T>::OK(std::move(value));
   }
 
@@ -103,48 +156,101 @@ public:
   /// if the struct has pointers or dynamic data it will cause a memory leak if read
   /// @param address the address where the struct will be written
   /// @param data the struct that will be written
-  template <typename T> Status writeStruct(uint32_t address, T &data) {
-    uint8_t data_temp[sizeof(T)];
-    std::memcpy(data_temp, &data, sizeof(T));
-    return write(address, data_temp, sizeof(T));
+  template <typename T> Status writeStruct(uint32_t address, const T &data) {
+    return write(address, std::span<const uint8_t>(reinterpret_cast<const uint8_t *>(&data), sizeof(T)));
   }
 
-  /// @brief Write a vector of structs to the FRAM
+  /// @brief Write a vector of structs to the FRAM as a single vector record
   /// the structure should't have pointers or any other dynamic data
   /// the vector can be any size
   /// @param address the address where the vector will be written
   /// @param data the vector that will be written
   /// @return the status of the write operation
   template <typename T> Status writeVector(uint32_t address, const std::vector<T> &data) {
-    std::vector<uint8_t> data_vec;
-    uint32_t vector_size = (uint32_t)data.size();
-    STMEPIC_RETURN_ON_ERROR(writeStruct(address, vector_size));
-    address += sizeof(uint32_t) + data_frame_size;
-    for(auto &d : data) {
-      STMEPIC_RETURN_ON_ERROR(writeStruct(address, d));
-      address += sizeof(T) + data_frame_size;
-    }
-    return Status::OK();
+    static_assert(sizeof(T) <= UINT16_MAX, "Element of the vector is too big");
+    auto bytes =
+    std::span<const uint8_t>(reinterpret_cast<const uint8_t *>(data.data()), data.size() * sizeof(T));
+    return write_vector(address, bytes, sizeof(T));
   }
 
   /// @brief Read a vector of structs from the FRAM
   /// the structure should't have pointers or any other dynamic data
   /// the vector can be any size and the size of the vector will be read from the FRAM
+  /// the vectors written in the old format (record per element) are still read
   /// @param address the address where the vector will be read
   /// @return the vector that was read or error if the vector was not read
   template <typename T> Result<std::vector<T>> readVector(uint32_t address) {
-    STMEPIC_ASSING_OR_RETURN(size, readStruct<uint32_t>(address));
+    STMEPIC_ASSING_OR_RETURN(info, read_vector_info(address));
     std::vector<T> data;
-    data.resize(size);
-    address += sizeof(uint32_t) + data_frame_size;
-    for(size_t i = 0; i < size; i++) {
-      STMEPIC_ASSING_OR_RETURN(str, readStruct<T>(address));
-      data[i] = str;
-      address += sizeof(T) + data_frame_size;
+    data.resize(info.count);
+    if(info.legacy) {
+      address += sizeof(uint32_t) + data_frame_size;
+      for(size_t i = 0; i < info.count; i++) {
+        STMEPIC_ASSING_OR_RETURN(str, readStruct<T>(address));
+        data[i] = str;
+        address += sizeof(T) + data_frame_size;
+      }
+      return Result<std::vector<T>>::OK(std::move(data));
     }
-    return Result<std::vector<T>>::OK(data);
+    auto bytes = std::span<uint8_t>(reinterpret_cast<uint8_t *>(data.data()), data.size() * sizeof(T));
+    STMEPIC_RETURN_ON_ERROR(read_vector_into(address, bytes, sizeof(T)));
+    return Result<std::vector<T>>::OK(std::move(data));
   }
 
+  /// @brief Write the elements as a single vector record: one header, one checksum and one transfer
+  /// of the data directly from the caller's memory.
+  /// With the encryption enabled the data goes through a small stack buffer in many short transfers,
+  /// write_vector_chunked encrypts its buffer in place and keeps the transfers long.
+  /// @param address the address where the vector will be written
+  /// @param data the elements, the size has to be a multiple of the element_size
+  /// @param element_size the size of a single element
+  /// @return the status of the write operation
+  Status write_vector(uint32_t address, std::span<const uint8_t> data, uint16_t element_size);
+
+  /// @brief Write the vector record in chunks, for the vectors that don't fit in RAM.
+  /// The fill callback fills the buffer with the next elements, each chunk is written when filled
+  /// and the header with the checksum is written after the last chunk.
+  /// @param address the address where the vector will be written
+  /// @param element_size the size of a single element
+  /// @param count the number of the elements
+  /// @param buffer the buffer for the chunks, it has to hold at least one element
+  /// @param fill the callback that fills the chunks, the error returned by it stops the write
+  /// @return the status of the write operation
+  Status write_vector_chunked(uint32_t address,
+                              uint16_t element_size,
+                              uint32_t count,
+                              std::span<uint8_t> buffer,
+                              const fram_vector_writer &fill);
+
+  /// @brief Read the header of the vector stored at the address.
+  /// @param address the address of the vector
+  /// @return the description of the vector or error if there is no vector at the address
+  Result<FramVectorInfo> read_vector_info(uint32_t address);
+
+  /// @brief Read the whole vector record directly to the provided buffer in a single transfer.
+  /// @param address the address of the vector
+  /// @param data the buffer for the elements, can be bigger than the vector
+  /// @param element_size the expected size of a single element
+  /// @return the number of the elements that were read
+  Result<uint32_t> read_vector_into(uint32_t address, std::span<uint8_t> data, uint16_t element_size);
+
+  /// @brief Read the vector record in chunks, for the vectors that don't fit in RAM.
+  /// The chunks are passed to the callback before the checksum of the whole vector is known,
+  /// the data can be used only if the function returns OK.
+  /// @param address the address of the vector
+  /// @param element_size the expected size of a single element
+  /// @param buffer the buffer for the chunks, it has to hold at least one element
+  /// @param consume the callback that receives the chunks, the error returned by it stops the read
+  /// @return the status of the read operation, Invalid if the checksum is not correct
+  Status read_vector_chunked(uint32_t address,
+                             uint16_t element_size,
+                             std::span<uint8_t> buffer,
+                             const fram_vector_reader &consume);
+
+  /// @brief The size the vector record takes in the FRAM
+  static constexpr uint32_t vector_record_size(uint16_t element_size, uint32_t count) {
+    return vector_frame_size + (uint32_t)element_size * count;
+  }
 
   /// @brief Set the encryption key
   /// @param key the key that will be used for encrypting data
@@ -168,15 +274,59 @@ protected:
   static constexpr const uint8_t magic_number_1 = 0x96;
   /// @brief the magic numbers that are used to identify the data structure
   static constexpr const uint8_t magic_number_2 = 0x69;
+  /// @brief the magic numbers that are used to identify the vector data structure
+  static constexpr const uint8_t vector_magic_number_2 = 0xA5;
+  /// @brief size of the vector frame structure
+  static constexpr const uint16_t vector_frame_size = 14;
+  /// @brief the biggest single transfer of write_raw/read_raw, the I2C HAL size is 16 bit
+  static constexpr const size_t max_transfer_size = 0x8000;
 
 
 private:
-  /// @brief encodes the data to be written to the FRAM device
-  /// @param data the data that will be encoded
-  /// @param length the length of the data to be encoded
-  /// @param dest_data the destination where the encoded data will be stored the size have to be size(data) + frame_size
-  /// @return the encoded data with additional parameters from the FRAM data structure
-  Status encode_data(const uint8_t *data_src, size_t length, uint8_t *data_dest);
+  /// @brief encodes the header of the FRAM data structure
+  /// @param checksum the checksum of the data
+  /// @param size the size field of the header, the data size or the element size of the vectors
+  /// @param magic the magic number 2 of the header
+  /// @param header the destination of the header, data_frame_size bytes
+  /// @param key_stream the key stream the data has to be encrypted with if the encryption is enabled,
+  /// algorithm::SHA256::SHA256_OUTPUT_SIZE bytes
+  /// @return the status of the encoding
+  Status encode_header(uint16_t checksum, uint16_t size, uint8_t magic, uint8_t *header, uint8_t *key_stream);
+
+  /// @brief decrypts the encryption field of the header and generates the key stream of the data
+  /// @param header the header read from the FRAM
+  /// @param key_stream the destination of the key stream, algorithm::SHA256::SHA256_OUTPUT_SIZE bytes
+  /// @return true if the data is encrypted
+  bool decode_key_stream(uint8_t *header, uint8_t *key_stream);
+
+  /// @brief generates the key stream of the data from the encryption field
+  void make_key_stream(uint32_t encres, uint8_t *key_stream);
+
+  /// @brief reads and checks the header of the FRAM data structure
+  /// @param address the address of the data structure
+  /// @param header the destination of the header, data_frame_size bytes
+  /// @return the size of the data stored after the header
+  Result<uint16_t> read_header(uint32_t address, uint8_t *header);
+
+  /// @brief reads and checks the header of the vector data structure
+  /// @param address the address of the data structure
+  /// @param header the destination of the header, vector_frame_size bytes
+  /// @return the description of the vector
+  Result<FramVectorInfo> read_vector_header(uint32_t address, uint8_t *header);
+
+  /// @brief writes the data split to the transfers of at most max_transfer_size
+  /// @param key_stream the key stream the data is encrypted with, nullptr if the encryption is disabled
+  /// @param key_offset the position of the data in the encrypted block
+  Status write_payload(uint32_t address,
+                       std::span<const uint8_t> data,
+                       const uint8_t *key_stream,
+                       size_t key_offset);
+
+  /// @brief reads the data split to the transfers of at most max_transfer_size
+  /// @param key_stream the key stream the data is decrypted with, nullptr if the encryption is disabled
+  /// @param key_offset the position of the data in the encrypted block
+  Status
+  read_payload(uint32_t address, std::span<uint8_t> data, const uint8_t *key_stream, size_t key_offset);
 
   /// @brief decodes the data that expects FRAM data structure
   /// @param data the data that will be decoded should be in FRAM data structure format
@@ -185,7 +335,7 @@ private:
   /// @return the decoded data only the Data part of the FRAM data structure
   Status decode_data(uint8_t *frame_data_ptr, uint8_t *data_src, size_t length);
 
-  uint16_t calculate_checksum(const uint8_t *data_src, size_t length);
+  uint16_t calculate_checksum(const uint8_t *data_src, size_t length, uint16_t crc = 0xFFFF);
   Status encrypt_data(uint8_t *data_src, size_t length, std::string key);
   Status decrypt_data(uint8_t *data_src, size_t length, std::string key);
   // uint8_t encryption_key[encryption_key_size];
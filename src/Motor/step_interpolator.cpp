@@ -0,0 +1,195 @@
+#include "step_interpolator.hpp"
+#include "timer_config.hpp"
+#include <algorithm>
+#include <cmath>
+
+using namespace stmepic::motor;
+using namespace stmepic;
+
+std::vector<StepInterpolator *> StepInterpolator::instances;
+
+StepInterpolator::StepInterpolator()
+: axes{}, axes_count(0), htim(nullptr), tick_frequency(0), phase_scale(0), acceleration(0), rate_step(0),
+  min_rate(0), active(false), major_steps(0), major_done(0), phase(0), rate(0), target_rate(0),
+  direction_mask(0), pulse_mask(0), stop_requested(false) {
+}
+
+StepInterpolator::~StepInterpolator() {
+  if(htim != nullptr)
+    (void)HAL_TIM_Base_Stop_IT(htim);
+  auto it = std::find(instances.begin(), instances.end(), this);
+  if(it != instances.end())
+    instances.erase(it);
+}
+
+Status StepInterpolator::add_axis(GpioPin &step_pin, GpioPin &direction_pin, bool reverse) {
+  if(axes_count >= MAX_AXES)
+    return Status::CapacityError("StepInterpolator: too many axes");
+  Axis &axis         = axes[axes_count];
+  axis               = Axis{};
+  axis.step_pin      = &step_pin;
+  axis.direction_pin = &direction_pin;
+  axis.reverse       = reverse;
+  axis.direction     = 1;
+  axes_count++;
+  return Status::OK();
+}
+
+Status StepInterpolator::init(TIM_HandleTypeDef &_htim, float _tick_frequency) {
+  STMEPIC_ASSING_OR_RETURN(config, timer_config_solve(_htim, _tick_frequency));
+  STMEPIC_RETURN_ON_ERROR(timer_config_apply(_htim, config));
+  set_tick_frequency((float)config.frequency);
+  htim = &_htim;
+  if(std::find(instances.begin(), instances.end(), this) == instances.end())
+    instances.push_back(this);
+  if(HAL_TIM_Base_Start_IT(htim) != HAL_OK)
+    return Status::HalError("StepInterpolator: failed to start the timer");
+  return Status::OK();
+}
+
+void StepInterpolator::set_tick_frequency(float _tick_frequency) {
+  tick_frequency = _tick_frequency;
+  // phase accumulator overflows once per step, 2^32 / tick_frequency per step/s
+  phase_scale = 4294967296.0f / tick_frequency;
+  set_acceleration(acceleration);
+}
+
+void StepInterpolator::set_acceleration(float _acceleration) {
+  acceleration = std::abs(_acceleration);
+  if(tick_frequency <= 0)
+    return;
+  rate_step = acceleration / tick_frequency;
+  // lowest rate of the ramp, speed after half a step from rest so the move never stops before the end
+  min_rate = std::sqrt(acceleration);
+}
+
+Status StepInterpolator::queue_move(const StepMove &move) {
+  if(!queue.push(move))
+    return Status::CapacityError("StepInterpolator: move queue is full");
+  return Status::OK();
+}
+
+void StepInterpolator::stop() {
+  stop_requested = true;
+}
+
+bool StepInterpolator::is_idle() const {
+  return !active && queue.empty();
+}
+
+size_t StepInterpolator::get_free_space() const {
+  return queue.capacity() - queue.size();
+}
+
+int32_t StepInterpolator::get_position(size_t axis) const {
+  if(axis >= axes_count)
+    return 0;
+  return axes[axis].position;
+}
+
+uint32_t StepInterpolator::get_direction_mask() const {
+  return direction_mask;
+}
+
+bool StepInterpolator::load_move() {
+  StepMove move;
+  if(!queue.pop(move))
+    return false;
+
+  major_steps    = 0;
+  direction_mask = 0;
+  for(size_t i = 0; i < axes_count; i++) {
+    Axis &axis     = axes[i];
+    axis.delta     = (uint32_t)std::abs(move.steps[i]);
+    axis.direction = move.steps[i] >= 0 ? 1 : -1;
+    if(axis.direction > 0)
+      direction_mask |= 1u << i;
+    major_steps = std::max(major_steps, axis.delta);
+  }
+  if(major_steps == 0 || move.step_rate <= 0)
+    return true;
+
+  for(size_t i = 0; i < axes_count; i++)
+    axes[i].error = (int32_t)(major_steps / 2);
+
+  // one tick for the step pulse and one for the pause
+  target_rate = std::min(move.step_rate, tick_frequency * 0.5f);
+  rate        = acceleration > 0 ? std::min(min_rate, target_rate) : target_rate;
+  major_done  = 0;
+  phase       = 0;
+  active      = true;
+  return true;
+}
+
+uint32_t StepInterpolator::tick() {
+  if(stop_requested.exchange(false)) {
+    queue.clear();
+    active = false;
+  }
+
+  if(!active) {
+    // directions are changed in a tick without steps to give the drivers setup time
+    (void)load_move();
+    return 0;
+  }
+
+  if(acceleration > 0) {
+    // decelerate when the remaining steps are just enough to stop, v^2 = 2 a s
+    float remaining = (float)(major_steps - major_done);
+    if(rate * rate >= 2.0f * acceleration * remaining)
+      rate = std::max(rate - rate_step, min_rate);
+    else if(rate < target_rate)
+      rate = std::min(rate + rate_step, target_rate);
+  }
+
+  uint32_t previous = phase;
+  phase += (uint32_t)(rate * phase_scale);
+  if(phase >= previous)
+    return 0;
+
+  uint32_t mask = 0;
+  for(size_t i = 0; i < axes_count; i++) {
+    Axis &axis = axes[i];
+    axis.error -= (int32_t)axis.delta;
+    if(axis.error < 0) {
+      axis.error += (int32_t)major_steps;
+      axis.position += axis.direction;
+      mask |= 1u << i;
+    }
+  }
+
+  major_done++;
+  if(major_done >= major_steps)
+    active = false;
+  return mask;
+}
+
+void StepInterpolator::irq_handler() {
+  // end the pulses started in the previous tick
+  for(size_t i = 0; i < axes_count; i++)
+    if(pulse_mask & (1u << i))
+      axes[i].step_pin->port.BSRR = (uint32_t)axes[i].step_pin->pin << 16;
+
+  bool was_active = active;
+  pulse_mask      = tick();
+
+  if(!was_active && active) {
+    for(size_t i = 0; i < axes_count; i++) {
+      bool forward = (direction_mask & (1u << i)) != 0;
+      axes[i].direction_pin->write(forward != axes[i].reverse);
+    }
+  }
+
+  for(size_t i = 0; i < axes_count; i++)
+    if(pulse_mask & (1u << i))
+      axes[i].step_pin->port.BSRR = axes[i].step_pin->pin;
+}
+
+void StepInterpolator::run_irq_from_isr(TIM_HandleTypeDef *_htim) {
+  for(auto interpolator : instances) {
+    if(interpolator->htim != nullptr && interpolator->htim->Instance == _htim->Instance) {
+      interpolator->irq_handler();
+      break;
+    }
+  }
+}
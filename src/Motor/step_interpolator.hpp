@@ -0,0 +1,154 @@
+#pragma once
+
+#include "gpio.hpp"
+#include "spsc_queue.hpp"
+#include "stmepic.hpp"
+#include <array>
+#include <atomic>
+#include <vector>
+
+/**
+ * @file step_interpolator.hpp
+ * @brief Coordinated step generation for several steper motors from single timer interrupt.
+ *
+ */
+
+/**
+ * @defgroup Motor
+ * @{
+ */
+
+/**
+ * @defgroup SteperMotor_Motor SteperMotor
+ * @{
+ */
+
+namespace stmepic::motor {
+
+/// @brief Max number of axes handled by single StepInterpolator
+constexpr size_t STEP_INTERPOLATOR_MAX_AXES = 6;
+
+/**
+ * @struct StepMove
+ * @brief Linear move of all axes of StepInterpolator.
+ */
+struct StepMove {
+  /// @brief Number of steps of each axis, negative values move the axis backwards
+  std::array<int32_t, STEP_INTERPOLATOR_MAX_AXES> steps;
+  /// @brief Step rate of the axis with the most steps in steps/s, the other axes are scaled
+  float step_rate;
+};
+
+/**
+ * @class StepInterpolator
+ * @brief Drives the step pins of several steper motors from one fixed rate timer interrupt.
+ *
+ * Each move is a straight line in the step space. The axis with the most steps (major axis) is
+ * stepped by a phase accumulator (DDA) running at the rate of the move and the other axes follow
+ * it with Bresenham error terms, so every axis makes exactly the requested number of steps and
+ * all axes start and end every move on the same tick. The step pins are written directly through
+ * BSRR, the pulse is one tick long so the max step rate is half of the tick frequency.
+ *
+ * Moves are pushed to lock-free queue from single task. With the acceleration set the rate of
+ * the major axis ramps up and down in every move (trapezoidal profile), each move starts and ends
+ * at rest.
+ *
+ * tick() contains the whole step logic without touching the hardware so it can be run on the host
+ * to simulate and verify the step sequences.
+ */
+class StepInterpolator {
+public:
+  static constexpr size_t MAX_AXES   = STEP_INTERPOLATOR_MAX_AXES;
+  static constexpr size_t QUEUE_SIZE = 16;
+
+  StepInterpolator();
+  ~StepInterpolator();
+
+  /// @brief Add axis, has to be called before init.
+  /// @param step_pin step pin of the driver
+  /// @param direction_pin direction pin of the driver
+  /// @param reverse true to reverse the direction of the axis
+  /// @return Status::CapacityError if there are already MAX_AXES axes
+  Status add_axis(GpioPin &step_pin, GpioPin &direction_pin, bool reverse = false);
+
+  /// @brief Configure the timer to the tick frequency and start its update interrupt.
+  /// run_irq_from_isr has to be called from HAL_TIM_PeriodElapsedCallback.
+  /// @param htim timer used to generate the ticks
+  /// @param tick_frequency frequency of the ticks in Hz
+  Status init(TIM_HandleTypeDef &htim, float tick_frequency);
+
+  /// @brief Set the tick frequency without the timer, used by init and by host simulations.
+  void set_tick_frequency(float tick_frequency);
+
+  /// @brief Set acceleration of the major axis in steps/s^2, 0 disables ramps
+  void set_acceleration(float acceleration);
+
+  /// @brief Add move to the queue, can be called only from single task.
+  /// @return Status::CapacityError if the queue is full
+  Status queue_move(const StepMove &move);
+
+  /// @brief Drop all queued moves and stop immediately.
+  void stop();
+
+  /// @brief True if there is no move being executed and the queue is empty
+  [[nodiscard]] bool is_idle() const;
+
+  /// @brief Get number of moves that can still be queued
+  [[nodiscard]] size_t get_free_space() const;
+
+  /// @brief Get the position of the axis in steps
+  [[nodiscard]] int32_t get_position(size_t axis) const;
+
+  /// @brief Advance the interpolator by one tick, doesn't touch the hardware.
+  /// @return bit mask of the axes that make a step in this tick
+  uint32_t tick();
+
+  /// @brief Direction of the axes of the current move, bit set means forward
+  [[nodiscard]] uint32_t get_direction_mask() const;
+
+  /// @brief Handle the tick interrupt, ends the pulses from the previous tick and starts new ones.
+  void irq_handler();
+
+  /// @brief Run the interpolators from the timer interrupt.
+  /// @param htim timer handle that triggered the interrupt
+  static void run_irq_from_isr(TIM_HandleTypeDef *htim);
+
+private:
+  struct Axis {
+    GpioPin *step_pin;
+    GpioPin *direction_pin;
+    bool reverse;
+    uint32_t delta;
+    int32_t error;
+    int32_t direction;
+    int32_t position;
+  };
+
+  std::array<Axis, MAX_AXES> axes;
+  size_t axes_count;
+  algorithm::SpscQueue<StepMove, QUEUE_SIZE> queue;
+  TIM_HandleTypeDef *htim;
+
+  float tick_frequency;
+  float phase_scale;
+  float acceleration;
+  float rate_step;
+  float min_rate;
+
+  bool active;
+  uint32_t major_steps;
+  uint32_t major_done;
+  uint32_t phase;
+  float rate;
+  float target_rate;
+  uint32_t direction_mask;
+  uint32_t pulse_mask;
+  std::atomic<bool> stop_requested;
+
+  /// @brief  List of all initialized interpolators
+  static std::vector<StepInterpolator *> instances;
+
+  bool load_move();
+};
+
+} // namespace stmepic::motor
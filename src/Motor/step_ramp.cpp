@@ -0,0 +1,189 @@
+#include "step_ramp.hpp"
+#include <cmath>
+
+using namespace stmepic;
+using namespace stmepic::motor;
+
+
+StepRampTable::StepRampTable()
+: count_frequency(0), step_acceleration(0), max_step_rate(0), max_period(0xFFFF) {
+}
+
+Status StepRampTable::build(float _count_frequency,
+                            float _step_acceleration,
+                            float _max_step_rate,
+                            uint32_t _max_period,
+                            size_t max_size) {
+  if(_count_frequency <= 0 || _step_acceleration <= 0 || _max_step_rate <= 0 || _max_period == 0)
+    return Status::Invalid("StepRampTable: all parameters have to be greater than 0");
+
+  count_frequency   = _count_frequency;
+  step_acceleration = _step_acceleration;
+  max_step_rate     = _max_step_rate;
+  max_period        = _max_period > 0xFFFF ? 0xFFFF : _max_period;
+  table.clear();
+
+  // double is used only here, the table is built once
+  const double min_interval = 1.0 / (double)max_step_rate;
+  const double two_over_a   = 2.0 / (double)step_acceleration;
+  double previous_time      = 0;
+  for(size_t n = 0;; n++) {
+    double time     = std::sqrt(two_over_a * (double)(n + 1));
+    double interval = time - previous_time;
+    previous_time   = time;
+    if(interval <= min_interval)
+      break;
+    if(table.size() >= max_size) {
+      table.clear();
+      return Status::CapacityError("StepRampTable: ramp is too long, increase the acceleration or max_size");
+    }
+    double counts = std::round(interval * (double)count_frequency);
+    if(counts > (double)max_period + 1)
+      counts = (double)max_period + 1;
+    if(counts < 2)
+      counts = 2;
+    table.push_back((uint16_t)(counts - 1));
+  }
+  return Status::OK();
+}
+
+size_t StepRampTable::size() const {
+  return table.size();
+}
+
+uint32_t StepRampTable::get_period(size_t index) const {
+  return table[index];
+}
+
+uint32_t StepRampTable::rate_to_period(float step_rate) const {
+  if(step_rate <= 0)
+    return max_period;
+  float counts = std::round(count_frequency / step_rate);
+  if(counts > (float)max_period + 1)
+    return max_period;
+  if(counts < 2)
+    return 1;
+  return (uint32_t)counts - 1;
+}
+
+size_t StepRampTable::rate_to_level(float step_rate) const {
+  // speed after n steps from rest is sqrt(2 a n)
+  float level = step_rate * step_rate / (2.0f * step_acceleration);
+  if(level >= (float)table.size())
+    return table.size();
+  return (size_t)level;
+}
+
+float StepRampTable::get_max_step_rate() const {
+  return max_step_rate;
+}
+
+
+StepSequence::StepSequence()
+: ramp(nullptr), mode(Mode::IDLE), level(0), target_level(0), remaining(0), cruise_period(0) {
+}
+
+void StepSequence::set_ramp(const StepRampTable *_ramp) {
+  ramp  = _ramp;
+  mode  = Mode::IDLE;
+  level = 0;
+}
+
+void StepSequence::move(uint32_t steps) {
+  if(ramp == nullptr)
+    return;
+  remaining     = steps;
+  cruise_period = ramp->rate_to_period(ramp->get_max_step_rate());
+  mode          = Mode::MOVE;
+}
+
+void StepSequence::run(float step_rate) {
+  if(ramp == nullptr)
+    return;
+  if(step_rate <= 0) {
+    stop();
+    return;
+  }
+  if(step_rate > ramp->get_max_step_rate())
+    step_rate = ramp->get_max_step_rate();
+  target_level  = ramp->rate_to_level(step_rate);
+  cruise_period = ramp->rate_to_period(step_rate);
+  mode          = Mode::RUN;
+}
+
+void StepSequence::stop() {
+  if(mode != Mode::IDLE)
+    mode = Mode::STOP;
+}
+
+void StepSequence::abort() {
+  mode  = Mode::IDLE;
+  level = 0;
+}
+
+bool StepSequence::next(uint32_t &period) {
+  const size_t max_level = ramp != nullptr ? ramp->size() : 0;
+  switch(mode) {
+  case Mode::IDLE: return false;
+  case Mode::MOVE:
+    if(remaining == 0) {
+      // target was moved closer than the stopping distance
+      mode = Mode::STOP;
+      return next(period);
+    }
+    remaining--;
+    // after this step there have to be enough steps left to decelerate
+    if(level < max_level && remaining >= level + 1) {
+      period = ramp->get_period(level);
+      level++;
+    } else if(remaining >= level) {
+      if(level == max_level)
+        period = cruise_period;
+      else
+        period = ramp->get_period(level == 0 ? 0 : level - 1);
+    } else {
+      period = ramp->get_period(level - 1);
+      level--;
+    }
+    if(remaining == 0 && level == 0)
+      mode = Mode::IDLE;
+    return true;
+  case Mode::RUN:
+    if(level < target_level) {
+      period = ramp->get_period(level);
+      level++;
+    } else if(level > target_level) {
+      period = ramp->get_period(level - 1);
+      level--;
+    } else {
+      period = cruise_period;
+    }
+    return true;
+  case Mode::STOP:
+    if(level == 0) {
+      mode = Mode::IDLE;
+      return false;
+    }
+    period = ramp->get_period(level - 1);
+    level--;
+    if(level == 0)
+      mode = Mode::IDLE;
+    return true;
+  }
+  return false;
+}
+
+size_t StepSequence::fill(uint32_t *buffer, size_t count) {
+  size_t written = 0;
+  while(written < count && next(buffer[written]))
+    written++;
+  return written;
+}
+
+bool StepSequence::is_running() const {
+  return mode != Mode::IDLE;
+}
+
+size_t StepSequence::get_level() const {
+  return level;
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "stmepic.hpp"
+#include "status.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @file step_ramp.hpp
+ * @brief Precomputed acceleration ramps for step generation with a timer.
+ *
+ */
+
+/**
+ * @defgroup Motor
+ * @{
+ */
+
+/**
+ * @defgroup SteperMotor_Motor SteperMotor
+ * @{
+ */
+
+namespace stmepic::motor {
+
+/**
+ * @class StepRampTable
+ * @brief Table of timer periods (ARR values) for each step of constant acceleration from rest.
+ *
+ * Entry n is the period between step n and n+1 when accelerating from rest with constant
+ * acceleration, computed exactly from t_n = sqrt(2n/a) when the table is built, so there is no
+ * per step math when generating the steps. Speed after n steps of acceleration is called level n,
+ * decelerating from level n to rest takes exactly n steps using the same entries in reverse order.
+ */
+class StepRampTable {
+public:
+  StepRampTable();
+
+  /// @brief Build the table.
+  /// @param count_frequency frequency of single timer count in Hz
+  /// @param step_acceleration acceleration in steps/s^2
+  /// @param max_step_rate max step rate in steps/s, the table ends when this rate is reached
+  /// @param max_period max ARR value of the timer, slower steps are clamped to it
+  /// @param max_size max number of entries in the table
+  /// @return Status::Invalid for wrong arguments, Status::CapacityError if the ramp needs more than max_size entries
+  Status build(float count_frequency,
+               float step_acceleration,
+               float max_step_rate,
+               uint32_t max_period = 0xFFFF,
+               size_t max_size     = 4096);
+
+  /// @brief Number of entries which is also the highest level of the ramp
+  [[nodiscard]] size_t size() const;
+
+  /// @brief Get the period (ARR value) of the step at the level
+  [[nodiscard]] uint32_t get_period(size_t index) const;
+
+  /// @brief Get the period (ARR value) for constant step rate
+  [[nodiscard]] uint32_t rate_to_period(float step_rate) const;
+
+  /// @brief Get the highest level with speed not higher than the step rate
+  [[nodiscard]] size_t rate_to_level(float step_rate) const;
+
+  /// @brief Get the max step rate in steps/s
+  [[nodiscard]] float get_max_step_rate() const;
+
+private:
+  std::vector<uint16_t> table;
+  float count_frequency;
+  float step_acceleration;
+  float max_step_rate;
+  uint32_t max_period;
+};
+
+/**
+ * @class StepSequence
+ * @brief Generates timer periods for the steps of a move from StepRampTable.
+ *
+ * The sequence keeps only the current level and the number of remaining steps so new targets
+ * can be applied while moving. All functions are O(1) per step and don't allocate so they
+ * can be called from an interrupt.
+ */
+class StepSequence {
+public:
+  StepSequence();
+
+  /// @brief Set the ramp table used by the sequence, the table has to outlive the sequence
+  void set_ramp(const StepRampTable *ramp);
+
+  /// @brief Move exactly steps steps and stop, keeps the current speed level.
+  /// If the number of steps is too small to stop from the current speed the sequence
+  /// decelerates as fast as the ramp allows and makes more steps.
+  void move(uint32_t steps);
+
+  /// @brief Run continuously with the step rate, 0 stops the sequence.
+  void run(float step_rate);
+
+  /// @brief Decelerate to rest as fast as the ramp allows.
+  void stop();
+
+  /// @brief Drop the sequence immediately without deceleration.
+  void abort();
+
+  /// @brief Get the period of the next step.
+  /// @param period ARR value of the next step
+  /// @return false if the sequence is finished
+  bool next(uint32_t &period);
+
+  /// @brief Fill the buffer with the periods of the next steps.
+  /// @return number of periods written, less than count if the sequence has finished
+  size_t fill(uint32_t *buffer, size_t count);
+
+  /// @brief True if there are still steps to generate
+  [[nodiscard]] bool is_running() const;
+
+  /// @brief Get the current speed level
+  [[nodiscard]] size_t get_level() const;
+
+private:
+  enum class Mode { IDLE, MOVE, RUN, STOP };
+
+  const StepRampTable *ramp;
+  Mode mode;
+  size_t level;
+  size_t target_level;
+  uint32_t remaining;
+  uint32_t cruise_period;
+};
+
+} // namespace stmepic::motor
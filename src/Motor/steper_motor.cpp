@@ -2,6 +2,8 @@
 #include "steper_motor.hpp"
 #include "stmepic.hpp"
 #include "status.hpp"
+#include "timer_config.hpp"
+#include <algorithm>
 #include <cmath>
 #include <cstdint>
 
@@ -26,14 +28,60 @@ SteperMotorStepDir::SteperMotorStepDir(TIM_HandleTypeDef &_htim, unsigned int _t
   this->reverse              = false;
   this->enable_reversed      = false;
   this->current_state        = movement::MovementState{ 0, 0, 0 };
+  this->step_buffer_counts   = { 0, 0 };
+  this->step_active_buffer   = 0;
+  this->step_dma_words       = 0;
+  this->step_pad_period      = 0;
+  this->step_engine_enabled  = false;
+  this->step_engine_running  = false;
+  this->step_engine_ending   = false;
+  this->step_position_mode   = false;
+  this->step_direction       = 1;
+  this->step_generated       = 0;
+  this->step_target          = 0;
+  this->step_run_rate        = 0;
+  this->step_run_direction   = 1;
+  this->step_pulse_counts    = 1;
+  this->step_counter_htim    = nullptr;
+  this->step_counted_base    = 0;
+  this->step_counter_base    = 0;
 }
 
-void SteperMotorStepDir::set_velocity(float velocity) {
+SteperMotorStepDir::~SteperMotorStepDir() {
+  // the DMA interrupt iterates the instances, the transfer is stopped and the motor removed
+  // before the interrupt can run again
+  vPortEnterCritical();
+  auto it = std::find(step_engine_instances.begin(), step_engine_instances.end(), this);
+  if(it != step_engine_instances.end()) {
+    __HAL_TIM_DISABLE_DMA(&htim, TIM_DMA_UPDATE);
+    (void)HAL_DMA_Abort(htim.hdma[TIM_DMA_ID_UPDATE]);
+    (void)HAL_TIM_PWM_Stop(&htim, static_cast<uint32_t>(timer_channel));
+    step_engine_running = false;
+    step_engine_instances.erase(it);
+  }
+  vPortExitCritical();
+}
 
+std::vector<SteperMotorStepDir *> SteperMotorStepDir::step_engine_instances;
 
+void SteperMotorStepDir::set_velocity(float velocity) {
   if(std::abs(velocity) > this->max_velocity)
     velocity = sgn(velocity) * this->max_velocity;
-  else if(std::abs(velocity) < this->min_velocity) {
+
+  if(step_engine_enabled) {
+    current_state.velocity = velocity;
+    if(std::abs(velocity) < this->min_velocity)
+      velocity = 0;
+    vPortEnterCritical();
+    step_position_mode = false;
+    step_run_rate      = std::abs(velocity) * steps_per_radian();
+    step_run_direction = velocity >= 0 ? 1 : -1;
+    step_engine_request();
+    vPortExitCritical();
+    return;
+  }
+
+  if(std::abs(velocity) < this->min_velocity) {
     // htim.Instance->CCR1 = 0;
     __HAL_TIM_SET_COMPARE(&htim, static_cast<uint32_t>(timer_channel), 0);
     return;
@@ -68,8 +116,15 @@ void SteperMotorStepDir::set_torque(float torque) {
 }
 
 void SteperMotorStepDir::set_position(float position) {
-  // not implemented
+  // without the step engine the position is not implemented
   current_state.position = position;
+  if(!step_engine_enabled)
+    return;
+  vPortEnterCritical();
+  step_position_mode = true;
+  step_target        = (int32_t)std::lround(position * steps_per_radian());
+  step_engine_request();
+  vPortExitCritical();
 }
 
 float SteperMotorStepDir::get_velocity() const {
@@ -82,13 +137,14 @@ float SteperMotorStepDir::get_torque() const {
 }
 
 float SteperMotorStepDir::get_position() const {
+  if(step_engine_enabled)
+    return (float)step_engine_counted() / steps_per_radian();
   // not implemented
   return current_state.position;
 }
 
 float SteperMotorStepDir::get_absolute_position() const {
-  // not implemented
-  return current_state.position;
+  return get_position();
 }
 
 void SteperMotorStepDir::set_enable(bool enable) {
@@ -146,13 +202,13 @@ Status SteperMotorStepDir::device_reset() {
 }
 
 Status SteperMotorStepDir::device_start() {
-  auto core_freq = (float)HAL_RCC_GetHCLKFreq();
-  auto prescaler = (float)htim.Instance->PSC;
+  // timer counts per second with the current prescaler, uses the real timer clock not HCLK
+  float count_freq = get_timer_count_frequency(htim);
 
   // equaions to get frequency that will give us desired velocity
   // base frequency
   // frequency = velocity * steps_pre_revolutions * gear_ratio
-  this->radians_to_frequency = core_freq / prescaler / ((this->steps_per_revolution * this->gear_ratio) / PIM2);
+  this->radians_to_frequency = count_freq / ((this->steps_per_revolution * this->gear_ratio) / PIM2);
   return Status::OK();
 }
 
@@ -163,4 +219,242 @@ Status SteperMotorStepDir::device_stop() {
 Status SteperMotorStepDir::device_set_settings(const DeviceSettings &settings) {
   (void)settings;
   return Status::OK();
-}
\ No newline at end of file
+}
+float SteperMotorStepDir::steps_per_radian() const {
+  return (steps_per_revolution * gear_ratio) / PIM2;
+}
+
+Status SteperMotorStepDir::set_step_engine(float acceleration, float pulse_width_us) {
+  DMA_HandleTypeDef *hdma = htim.hdma[TIM_DMA_ID_UPDATE];
+  if(hdma == nullptr)
+    return Status::Invalid("SteperMotorStepDir: update DMA is not linked to the timer");
+  if(hdma->Init.Mode != DMA_CIRCULAR)
+    return Status::Invalid("SteperMotorStepDir: update DMA has to be in the circular mode");
+  if(timer_channel > TIM_CHANNEL_4)
+    return Status::Invalid("SteperMotorStepDir: step engine supports only the channels 1-4");
+
+  float count_freq    = get_timer_count_frequency(htim);
+  float steps_rad     = steps_per_radian();
+  uint32_t pulse      = (uint32_t)std::ceil(pulse_width_us * 1e-6f * count_freq);
+  pulse               = pulse < 1 ? 1 : pulse;
+  step_engine_enabled = false;
+  STMEPIC_RETURN_ON_ERROR(step_ramp.build(count_freq, std::abs(acceleration) * steps_rad, max_velocity * steps_rad));
+  if(step_ramp.rate_to_period(step_ramp.get_max_step_rate()) <= pulse)
+    return Status::Invalid("SteperMotorStepDir: step pulse is too long for the max velocity");
+
+  vPortEnterCritical();
+  step_sequence.set_ramp(&step_ramp);
+  step_pulse_counts   = pulse;
+  step_pad_period     = step_ramp.rate_to_period(step_ramp.get_max_step_rate());
+  step_engine_running = false;
+  step_target         = step_generated;
+  // burst from ARR to the compare register of the channel, the registers in between are written
+  // with their current values
+  step_dma_words          = (uint8_t)(3 + timer_channel / 4);
+  volatile uint32_t *regs = &htim.Instance->ARR;
+  for(size_t i = 0; i < step_buffer.size(); i++)
+    step_buffer[i] = regs[i % step_dma_words];
+  // ARR is written by DMA right after the update so it has to take effect immediately,
+  // CCR is preloaded so the last pulse isn't cut when the output is turned off
+  CLEAR_BIT(htim.Instance->CR1, TIM_CR1_ARPE);
+  __HAL_TIM_ENABLE_OCxPRELOAD(&htim, timer_channel);
+  __HAL_TIM_SET_COMPARE(&htim, static_cast<uint32_t>(timer_channel), 0);
+  htim.Instance->EGR         = TIM_EGR_UG;
+  htim.Instance->DCR         = TIM_DMABASE_ARR | ((uint32_t)(step_dma_words - 1) << TIM_DCR_DBL_Pos);
+  hdma->XferCpltCallback     = run_dma_callbacks_from_isr;
+  hdma->XferHalfCpltCallback = run_dma_half_callbacks_from_isr;
+  if(std::find(step_engine_instances.begin(), step_engine_instances.end(), this) == step_engine_instances.end())
+    step_engine_instances.push_back(this);
+  vPortExitCritical();
+
+  if(HAL_TIM_PWM_Start(&htim, static_cast<uint32_t>(timer_channel)) != HAL_OK)
+    return Status::HalError("SteperMotorStepDir: failed to start PWM");
+  step_engine_enabled = true;
+  return Status::OK();
+}
+
+void SteperMotorStepDir::set_pulse_counter(TIM_HandleTypeDef &counter_htim) {
+  vPortEnterCritical();
+  step_counted_base = step_engine_counted();
+  step_counter_htim = &counter_htim;
+  step_counter_base = (uint16_t)__HAL_TIM_GET_COUNTER(step_counter_htim);
+  vPortExitCritical();
+}
+
+int32_t SteperMotorStepDir::get_position_steps() const {
+  return step_engine_counted();
+}
+
+void SteperMotorStepDir::sync_position(float position) {
+  if(!step_engine_enabled) {
+    current_state.position = position;
+    return;
+  }
+  vPortEnterCritical();
+  // the offset is measured against the emitted steps, the steps still in the DMA buffers will be
+  // emitted anyway so they stay in step_generated and the engine counts them towards the target
+  int32_t delta = (int32_t)std::lround(position * steps_per_radian()) - step_engine_counted();
+  step_generated += delta;
+  if(step_counter_htim != nullptr)
+    step_counted_base += delta;
+  vPortExitCritical();
+}
+
+bool SteperMotorStepDir::is_step_engine_enabled() const {
+  return step_engine_enabled;
+}
+
+int32_t SteperMotorStepDir::step_engine_emitted() const {
+  if(!step_engine_running)
+    return step_generated;
+  // the steps still waiting in the DMA buffer are already counted in step_generated,
+  // the step of the entry the DMA is writing now has already started
+  vPortEnterCritical();
+  const uint32_t words  = 2 * STEP_DMA_BLOCK_SIZE * step_dma_words;
+  const uint32_t loaded = words - __HAL_DMA_GET_COUNTER(htim.hdma[TIM_DMA_ID_UPDATE]);
+  const uint32_t next   = (loaded + step_dma_words - 1) / step_dma_words % (2 * STEP_DMA_BLOCK_SIZE);
+  const uint8_t half    = (uint8_t)(next / STEP_DMA_BLOCK_SIZE);
+  const size_t position = next % STEP_DMA_BLOCK_SIZE;
+  uint32_t pending      = step_buffer_counts[half] > position ? step_buffer_counts[half] - position : 0;
+  // the other half is queued only after its interrupt refilled it
+  if(half == step_active_buffer)
+    pending += step_buffer_counts[half ^ 1];
+  int32_t emitted = step_generated - step_direction * (int32_t)pending;
+  vPortExitCritical();
+  return emitted;
+}
+
+int32_t SteperMotorStepDir::step_engine_counted() const {
+  if(step_counter_htim == nullptr)
+    return step_engine_emitted();
+  // the counter only counts up, the direction is taken from the last move
+  uint16_t counted = (uint16_t)__HAL_TIM_GET_COUNTER(step_counter_htim) - step_counter_base;
+  return step_counted_base + step_direction * (int32_t)counted;
+}
+
+void SteperMotorStepDir::step_engine_update_counted() {
+  if(step_counter_htim == nullptr)
+    return;
+  step_counted_base = step_engine_counted();
+  step_counter_base = (uint16_t)__HAL_TIM_GET_COUNTER(step_counter_htim);
+}
+
+void SteperMotorStepDir::step_engine_request() {
+  if(step_engine_running) {
+    // the last steps are already in the DMA buffer, the new move starts after them
+    if(step_engine_ending)
+      return;
+    // while moving only the not generated steps can be changed, turning back needs a stop first
+    int32_t error = step_target - step_generated;
+    if(step_position_mode && error != 0 && (error > 0) == (step_direction > 0))
+      step_sequence.move((uint32_t)std::abs(error));
+    else if(!step_position_mode && step_run_rate > 0 && step_run_direction == step_direction)
+      step_sequence.run(step_run_rate);
+    else
+      step_sequence.stop();
+    return;
+  }
+
+  // the last step period has to end before the timer is restarted
+  if(!__HAL_TIM_GET_FLAG(&htim, TIM_FLAG_UPDATE))
+    return;
+
+  if(step_position_mode) {
+    int32_t error = step_target - step_generated;
+    if(error == 0)
+      return;
+    step_sequence.move((uint32_t)std::abs(error));
+    step_engine_start(error > 0 ? 1 : -1);
+  } else {
+    if(step_run_rate <= 0)
+      return;
+    step_sequence.run(step_run_rate);
+    step_engine_start(step_run_direction);
+  }
+}
+
+void SteperMotorStepDir::step_engine_start(int8_t direction) {
+  step_engine_update_counted();
+  step_direction     = direction;
+  step_engine_ending = false;
+  step_engine_fill(0);
+  step_engine_fill(1);
+  if(step_buffer_counts[0] == 0)
+    return;
+
+  direction_pin.write(direction > 0 ? !reverse : reverse);
+
+  // first period has no pulse and gives the driver time to see the new direction,
+  // each update loads the period of the next step from DMA and the step pulse is at its start
+  DMA_HandleTypeDef *hdma = htim.hdma[TIM_DMA_ID_UPDATE];
+  CLEAR_BIT(htim.Instance->CR1, TIM_CR1_CEN);
+  __HAL_TIM_DISABLE_DMA(&htim, TIM_DMA_UPDATE);
+  // the circular transfer of the last move is still enabled
+  if(hdma->State == HAL_DMA_STATE_BUSY)
+    (void)HAL_DMA_Abort(hdma);
+  __HAL_TIM_SET_COUNTER(&htim, 0);
+  __HAL_TIM_SET_AUTORELOAD(&htim, step_pulse_counts);
+  __HAL_TIM_SET_COMPARE(&htim, static_cast<uint32_t>(timer_channel), 0);
+  htim.Instance->EGR = TIM_EGR_UG;
+  __HAL_TIM_SET_COMPARE(&htim, static_cast<uint32_t>(timer_channel), step_pulse_counts);
+  __HAL_TIM_CLEAR_FLAG(&htim, TIM_FLAG_UPDATE);
+
+  step_active_buffer  = 0;
+  step_engine_running = true;
+  (void)HAL_DMA_Start_IT(hdma, (uint32_t)(uintptr_t)step_buffer.data(),
+                         (uint32_t)(uintptr_t)&htim.Instance->DMAR, 2 * STEP_DMA_BLOCK_SIZE * step_dma_words);
+  __HAL_TIM_ENABLE_DMA(&htim, TIM_DMA_UPDATE);
+  SET_BIT(htim.Instance->CR1, TIM_CR1_CEN);
+}
+
+void SteperMotorStepDir::step_engine_fill(uint8_t half) {
+  std::array<uint32_t, STEP_DMA_BLOCK_SIZE> periods;
+  const size_t count = step_engine_ending ? 0 : step_sequence.fill(periods.data(), STEP_DMA_BLOCK_SIZE);
+  const bool more    = count == STEP_DMA_BLOCK_SIZE && step_sequence.is_running();
+  const size_t ccr   = step_dma_words - 1U;
+  // the compare value is preloaded, the entry of a step sets the pulse of the step after it
+  uint32_t *entry = step_buffer.data() + half * STEP_DMA_BLOCK_SIZE * step_dma_words;
+  for(size_t i = 0; i < STEP_DMA_BLOCK_SIZE; i++, entry += step_dma_words) {
+    entry[0]   = i < count ? periods[i] : step_pad_period;
+    entry[ccr] = i + 1 < count || (i + 1 == count && more) ? step_pulse_counts : 0;
+  }
+  // the sequence ended right after the queued half (stopped or aborted), its last step has no pulse after it
+  if(count == 0)
+    step_buffer[((half ^ 1U) + 1) * STEP_DMA_BLOCK_SIZE * step_dma_words - 1] = 0;
+  step_engine_ending       = step_engine_ending || !more;
+  step_buffer_counts[half] = count;
+  step_generated += step_direction * (int32_t)count;
+}
+
+void SteperMotorStepDir::step_engine_dma_complete(uint8_t done) {
+  // the late interrupt of the other half after the engine has stopped
+  if(!step_engine_running)
+    return;
+  step_engine_update_counted();
+  step_active_buffer = done ^ 1;
+  if(step_engine_ending && step_buffer_counts[done] < STEP_DMA_BLOCK_SIZE) {
+    // the DMA loaded a pad entry, the last step period has ended and the pads have no pulse,
+    // the timer keeps running without the DMA until the next start
+    __HAL_TIM_DISABLE_DMA(&htim, TIM_DMA_UPDATE);
+    step_engine_running = false;
+    return;
+  }
+  step_engine_fill(done);
+}
+
+void SteperMotorStepDir::run_dma_callbacks_from_isr(DMA_HandleTypeDef *hdma, uint8_t done) {
+  for(auto motor : step_engine_instances) {
+    if(motor->htim.hdma[TIM_DMA_ID_UPDATE] == hdma) {
+      motor->step_engine_dma_complete(done);
+      break;
+    }
+  }
+}
+
+void SteperMotorStepDir::run_dma_callbacks_from_isr(DMA_HandleTypeDef *hdma) {
+  run_dma_callbacks_from_isr(hdma, 1);
+}
+
+void SteperMotorStepDir::run_dma_half_callbacks_from_isr(DMA_HandleTypeDef *hdma) {
+  run_dma_callbacks_from_isr(hdma, 0);
+}
@@ -6,6 +6,9 @@
 #include "movement_controler.hpp"
 #include "gpio.hpp"
 #include "stmepic.hpp"
+#include "step_ramp.hpp"
+#include <array>
+#include <vector>
 
 /**
  * @file steper_motor.hpp
@@ -33,12 +36,26 @@ namespace stmepic::motor {
  * This class allows to control the SteperMotor with simple control interface like step,
  * direction and pulse Mostly used with steper motor drivers like A4988, DRV8825, etc.
  *
+ * By default velocity changes are applied immediately by changing the timer period.
+ * After set_step_engine is called the steps are generated by the DMA step engine:
+ * periods of the steps are taken from precomputed acceleration ramp and streamed by circular DMA
+ * (burst to ARR and the compare register of the channel) on each timer update, so velocity changes
+ * are ramped and there is no CPU work per step, only per half of the DMA buffer. One half is refilled
+ * while the other one is played, the interrupt can be late by a whole half without stalling the steps.
+ * The entries after the last step have no pulse, so the end of the move doesn't depend on the interrupt
+ * latency either. The position is then tracked and set_position moves the motor
+ * by the exact number of steps. With set_pulse_counter the position is read from a slave timer
+ * counting the step pulses, otherwise from the number of steps sent to the timer minus the steps
+ * still waiting in the DMA buffers, which is exact to a single step.
+ *
  */
 class SteperMotorStepDir : public MotorBase {
 public:
   /// @brief Constructor for the SteperMotorStepDir class
   SteperMotorStepDir(TIM_HandleTypeDef &htim, unsigned int timer_channel, GpioPin &direction_pin, GpioPin &enable_pin);
 
+  ~SteperMotorStepDir();
+
   /// @brief Set the current speed of the SteperMotor
   /// @param speed The speed in radians per second, can be negative or positive to change the direction
   void set_velocity(float speed) override;
@@ -78,6 +95,47 @@ public:
   /// if not set the prescaler will be the same as the timer
   void set_prescaler(uint32_t prescaler);
 
+  /// @brief Enable the DMA step engine with acceleration ramps.
+  /// The update DMA of the timer has to be linked to the timer handle (htim.hdma[TIM_DMA_ID_UPDATE])
+  /// and configured as memory to peripheral, word size, memory increment, circular mode with the interrupt
+  /// enabled. Only the channels 1-4 are supported. The DMA burst writes ARR, RCR and CCR1 up to the
+  /// compare register of the channel, the registers in between keep their values from this call.
+  /// Should be called after the steps per revolution, gear ratio, max velocity and prescaler are set.
+  /// Pending direction changes and corrections are applied on the next set_position or set_velocity
+  /// call so they should be called periodically like MovementControler does.
+  /// @param acceleration acceleration of the motor in rad/s^2
+  /// @param pulse_width_us width of the step pulse in microseconds
+  /// @return Status::Invalid if the timer can't generate the pulses with the settings
+  Status set_step_engine(float acceleration, float pulse_width_us = 2.0f);
+
+  /// @brief Set timer that counts the step pulses, used to track the position by the step engine.
+  /// The timer should be configured as a slave of the step timer (external clock mode triggered
+  /// by the step timer TRGO) and started before the motor.
+  /// @param counter_htim timer counting the step pulses
+  void set_pulse_counter(TIM_HandleTypeDef &counter_htim);
+
+  /// @brief Get the position of the motor in steps, counted by the step engine
+  [[nodiscard]] int32_t get_position_steps() const;
+
+  /// @brief Overwrite the tracked position without moving the motor, used to correct lost steps.
+  /// The position target stays the same so the step engine moves the missing steps on the next request,
+  /// the steps already in the DMA buffers are still emitted and counted towards the target.
+  /// @param position real position of the motor in radians
+  void sync_position(float position);
+
+  /// @brief True if the step engine is enabled
+  [[nodiscard]] bool is_step_engine_enabled() const;
+
+  /// @brief Run the step engine DMA callbacks from the DMA interrupt.
+  /// Set automatically as the DMA transfer complete callback by set_step_engine.
+  /// @param hdma DMA handle that triggered the interrupt
+  static void run_dma_callbacks_from_isr(DMA_HandleTypeDef *hdma);
+
+  /// @brief Run the step engine DMA callbacks from the DMA half transfer interrupt.
+  /// Set automatically as the DMA half transfer callback by set_step_engine.
+  /// @param hdma DMA handle that triggered the interrupt
+  static void run_dma_half_callbacks_from_isr(DMA_HandleTypeDef *hdma);
+
   /// @brief Get the gear ratio of the SteperMotor
   float get_gear_ratio() const override;
 
@@ -128,6 +186,54 @@ private:
   bool enable_reversed;
 
   movement::MovementState current_state;
+
+  /// @brief steps in one half of the circular DMA buffer
+  static constexpr size_t STEP_DMA_BLOCK_SIZE = 16;
+  /// @brief max words of the DMA burst of one step: ARR, RCR and CCR1 up to CCR4
+  static constexpr size_t STEP_DMA_MAX_WORDS = 6;
+
+  // step engine state, shared with the DMA interrupt
+  StepRampTable step_ramp;
+  StepSequence step_sequence;
+  /// @brief both halves of the circular DMA buffer, step_dma_words words per step
+  std::array<uint32_t, 2 * STEP_DMA_BLOCK_SIZE * STEP_DMA_MAX_WORDS> step_buffer;
+  /// @brief steps in each half, the rest of the half are the pad entries without the pulse
+  std::array<size_t, 2> step_buffer_counts;
+  /// @brief half the DMA plays according to the interrupts, the other one is queued after it
+  uint8_t step_active_buffer;
+  uint8_t step_dma_words;
+  /// @brief period of the pad entries
+  uint32_t step_pad_period;
+  bool step_engine_enabled;
+  volatile bool step_engine_running;
+  /// @brief the sequence has ended, the halves are refilled only with the pad entries
+  bool step_engine_ending;
+  bool step_position_mode;
+  int8_t step_direction;
+  int32_t step_generated;
+  int32_t step_target;
+  float step_run_rate;
+  uint32_t step_pulse_counts;
+  int8_t step_run_direction;
+  TIM_HandleTypeDef *step_counter_htim;
+  int32_t step_counted_base;
+  uint16_t step_counter_base;
+
+  /// @brief  List of all steper motors with the step engine enabled
+  static std::vector<SteperMotorStepDir *> step_engine_instances;
+
+  [[nodiscard]] float steps_per_radian() const;
+  void step_engine_request();
+  void step_engine_start(int8_t direction);
+  /// @brief Fill the half of the DMA buffer with the next steps of the sequence.
+  void step_engine_fill(uint8_t half);
+  /// @brief DMA finished the half, refill it or stop the engine after the last step.
+  void step_engine_dma_complete(uint8_t done);
+  static void run_dma_callbacks_from_isr(DMA_HandleTypeDef *hdma, uint8_t done);
+  void step_engine_update_counted();
+  /// @brief Steps generated by the timer, without the steps still waiting in the DMA buffer
+  [[nodiscard]] int32_t step_engine_emitted() const;
+  [[nodiscard]] int32_t step_engine_counted() const;
 };
 
 } // namespace stmepic::motor
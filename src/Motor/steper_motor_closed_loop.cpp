@@ -0,0 +1,196 @@
+#include "steper_motor_closed_loop.hpp"
+#include "Timing.hpp"
+#include <cmath>
+
+using namespace stmepic::motor;
+using namespace stmepic;
+
+
+SteperMotorClosedLoop::SteperMotorClosedLoop(SteperMotorStepDir &_motor, std::shared_ptr<encoders::EncoderBase> _encoder)
+: motor(_motor), encoder(_encoder), target_position(0), target_velocity(0), position_mode(true),
+  step_loss_threshold(0.1f), max_corrections(5), stall_window_us(500000), window_start_us(0),
+  window_corrections(0), corrections_count(0), position_error(0), stalled(false), started(false) {
+  task.task_init(handle, this, 1, nullptr, 300, tskIDLE_PRIORITY + 3, "SteperClosedLoop");
+}
+
+SteperMotorClosedLoop::~SteperMotorClosedLoop() {
+  (void)task.task_stop();
+}
+
+float SteperMotorClosedLoop::get_velocity() const {
+  return encoder->get_velocity();
+}
+
+float SteperMotorClosedLoop::get_torque() const {
+  return motor.get_torque();
+}
+
+float SteperMotorClosedLoop::get_position() const {
+  return encoder->get_absoulute_angle();
+}
+
+float SteperMotorClosedLoop::get_absolute_position() const {
+  return encoder->get_absoulute_angle();
+}
+
+float SteperMotorClosedLoop::get_gear_ratio() const {
+  return motor.get_gear_ratio();
+}
+
+void SteperMotorClosedLoop::set_velocity(float speed) {
+  // commands are passed to the motor by the loop
+  position_mode   = false;
+  target_velocity = speed;
+}
+
+void SteperMotorClosedLoop::set_torque(float torque) {
+  motor.set_torque(torque);
+}
+
+void SteperMotorClosedLoop::set_position(float position) {
+  position_mode   = true;
+  target_position = position;
+}
+
+void SteperMotorClosedLoop::set_enable(bool enable) {
+  motor.set_enable(enable);
+}
+
+void SteperMotorClosedLoop::set_gear_ratio(float gear_ratio) {
+  motor.set_gear_ratio(gear_ratio);
+}
+
+void SteperMotorClosedLoop::set_max_velocity(float max_velocity) {
+  motor.set_max_velocity(max_velocity);
+}
+
+void SteperMotorClosedLoop::set_min_velocity(float min_velocity) {
+  motor.set_min_velocity(min_velocity);
+}
+
+void SteperMotorClosedLoop::set_reverse(bool reverse) {
+  motor.set_reverse(reverse);
+}
+
+void SteperMotorClosedLoop::set_step_loss_threshold(float threshold) {
+  step_loss_threshold = std::abs(threshold);
+}
+
+void SteperMotorClosedLoop::set_stall_detection(uint32_t _max_corrections, uint32_t window_ms) {
+  max_corrections = _max_corrections;
+  stall_window_us = window_ms * 1000;
+}
+
+void SteperMotorClosedLoop::set_loop_period(uint32_t period_ms) {
+  task.task_set_period(period_ms);
+}
+
+uint32_t SteperMotorClosedLoop::get_corrections_count() const {
+  return corrections_count;
+}
+
+float SteperMotorClosedLoop::get_position_error() const {
+  return position_error;
+}
+
+bool SteperMotorClosedLoop::is_stalled() const {
+  return stalled;
+}
+
+void SteperMotorClosedLoop::handle_internal() {
+  if(!started || stalled)
+    return;
+
+  uint32_t now_us = Ticker::get_instance().get_micros();
+  float measured  = encoder->get_absoulute_angle();
+  position_error  = motor.get_position() - measured;
+
+  if(window_corrections > 0 && now_us - window_start_us > stall_window_us)
+    window_corrections = 0;
+
+  if(std::abs(position_error) > step_loss_threshold) {
+    // steps were lost or the motor was pushed, continue from the real position
+    motor.sync_position(measured);
+    corrections_count++;
+    if(window_corrections == 0)
+      window_start_us = now_us;
+    window_corrections++;
+
+    if(window_corrections > max_corrections) {
+      // the motor can't follow, stop where it is
+      stalled = true;
+      if(position_mode)
+        motor.set_position(measured);
+      else
+        motor.set_velocity(0);
+      return;
+    }
+  }
+
+  // called every loop so the step engine applies the corrections and pending direction changes
+  if(position_mode)
+    motor.set_position(target_position);
+  else
+    motor.set_velocity(target_velocity);
+}
+
+Status SteperMotorClosedLoop::handle(SimpleTask &task, void *args) {
+  (void)task;
+  if(args == nullptr)
+    return Status::Invalid("SteperMotorClosedLoop::handle: args is nullptr");
+  auto motor = static_cast<SteperMotorClosedLoop *>(args);
+  motor->handle_internal();
+  return Status::OK();
+}
+
+Result<bool> SteperMotorClosedLoop::device_is_connected() {
+  STMEPIC_RETURN_ON_ERROR(encoder->device_is_connected());
+  return motor.device_is_connected();
+}
+
+bool SteperMotorClosedLoop::device_ok() {
+  return !stalled && encoder->device_ok() && motor.device_ok();
+}
+
+Status SteperMotorClosedLoop::device_get_status() {
+  if(stalled)
+    return Status::ExecutionError("SteperMotorClosedLoop: motor stalled");
+  STMEPIC_RETURN_ON_ERROR(encoder->device_get_status());
+  return motor.device_get_status();
+}
+
+Status SteperMotorClosedLoop::device_reset() {
+  STMEPIC_RETURN_ON_ERROR(device_stop());
+  return device_start();
+}
+
+Status SteperMotorClosedLoop::device_start() {
+  if(encoder == nullptr)
+    return Status::Invalid("SteperMotorClosedLoop: encoder is nullptr");
+  if(!motor.is_step_engine_enabled())
+    return Status::Invalid("SteperMotorClosedLoop: step engine of the motor is not enabled");
+  STMEPIC_RETURN_ON_ERROR(motor.device_start());
+
+  // start from the encoder position and hold it
+  float measured     = encoder->get_absoulute_angle();
+  motor.sync_position(measured);
+  target_position    = measured;
+  target_velocity    = 0;
+  position_mode      = true;
+  window_corrections = 0;
+  position_error     = 0;
+  stalled            = false;
+  started            = true;
+  return task.task_run();
+}
+
+Status SteperMotorClosedLoop::device_stop() {
+  started = false;
+  (void)task.task_stop();
+  motor.set_velocity(0);
+  return motor.device_stop();
+}
+
+Status SteperMotorClosedLoop::device_set_settings(const DeviceSettings &settings) {
+  return motor.device_set_settings(settings);
+}
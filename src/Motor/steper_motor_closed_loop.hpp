@@ -0,0 +1,140 @@
+#pragma once
+
+#include "encoder.hpp"
+#include "motor.hpp"
+#include "simple_task.hpp"
+#include "steper_motor.hpp"
+#include "stmepic.hpp"
+#include <memory>
+
+/**
+ * @file steper_motor_closed_loop.hpp
+ * @brief Closed loop position control of the steper motor with encoder feedback.
+ *
+ */
+
+/**
+ * @defgroup Motor
+ * @{
+ */
+
+/**
+ * @defgroup SteperMotor_Motor SteperMotor
+ * @{
+ */
+
+namespace stmepic::motor {
+
+/**
+ * @class SteperMotorClosedLoop
+ * @brief Steper motor with step loss correction, stall detection and position hold.
+ *
+ * Runs a single loop task that compares the position counted by the step engine of the
+ * SteperMotorStepDir with the position read from the encoder (for example EncoderAbsoluteMagnetic).
+ * When they differ by more than the step loss threshold the steps were lost, so the tracked
+ * position is corrected to the encoder position and in the position mode the step engine moves
+ * the missing steps again. The same mechanism holds the position when the motor is pushed away
+ * from the target while standing. If the correction is needed more than max_corrections times within
+ * the stall window the motor is considered stalled, it is stopped where it is and
+ * device_get_status returns an error until device_reset is called.
+ *
+ * The encoder has to measure the same position as the motor returns from get_position
+ * (use the encoder ratio for gears). The position of the motor is the emitted steps (pulse counter
+ * or the generated steps without the ones still in the DMA buffers), so the error has no lag
+ * that depends on the velocity apart from the encoder itself. The loop doesn't allocate memory.
+ */
+class SteperMotorClosedLoop : public MotorBase {
+public:
+  /// @brief Constructor for the SteperMotorClosedLoop class
+  /// @param motor steper motor with the step engine enabled (see SteperMotorStepDir::set_step_engine)
+  /// @param encoder encoder measuring the position of the motor
+  SteperMotorClosedLoop(SteperMotorStepDir &motor, std::shared_ptr<encoders::EncoderBase> encoder);
+
+  ~SteperMotorClosedLoop();
+
+  [[nodiscard]] float get_velocity() const override;
+
+  [[nodiscard]] float get_torque() const override;
+
+  [[nodiscard]] float get_position() const override;
+
+  [[nodiscard]] float get_absolute_position() const override;
+
+  [[nodiscard]] float get_gear_ratio() const override;
+
+  void set_velocity(float speed) override;
+
+  void set_torque(float torque) override;
+
+  void set_position(float position) override;
+
+  void set_enable(bool enable) override;
+
+  void set_gear_ratio(float gear_ratio) override;
+
+  void set_max_velocity(float max_velocity) override;
+
+  void set_min_velocity(float min_velocity) override;
+
+  void set_reverse(bool reverse) override;
+
+  /// @brief Set the difference between the counted and the encoder position above which
+  /// the steps are considered lost, should be larger than the encoder noise and the lag
+  /// of the encoder reading at the max velocity.
+  /// @param threshold threshold in radians
+  void set_step_loss_threshold(float threshold);
+
+  /// @brief Set the stall detection
+  /// @param max_corrections number of corrections within the window after which the motor is stalled
+  /// @param window_ms length of the window in milliseconds
+  void set_stall_detection(uint32_t max_corrections, uint32_t window_ms);
+
+  /// @brief Set the period of the control loop, 1 ms by default
+  void set_loop_period(uint32_t period_ms);
+
+  /// @brief Get the number of corrections of lost steps since start
+  [[nodiscard]] uint32_t get_corrections_count() const;
+
+  /// @brief Get the last position error between the counted and the encoder position in radians
+  [[nodiscard]] float get_position_error() const;
+
+  /// @brief True if the motor has stalled, cleared by device_reset
+  [[nodiscard]] bool is_stalled() const;
+
+  Result<bool> device_is_connected() override;
+
+  bool device_ok() override;
+
+  Status device_get_status() override;
+
+  Status device_reset() override;
+
+  Status device_start() override;
+
+  Status device_stop() override;
+
+  Status device_set_settings(const DeviceSettings &settings) override;
+
+private:
+  SteperMotorStepDir &motor;
+  std::shared_ptr<encoders::EncoderBase> encoder;
+  SimpleTask task;
+
+  float target_position;
+  float target_velocity;
+  bool position_mode;
+  float step_loss_threshold;
+  uint32_t max_corrections;
+  uint32_t stall_window_us;
+  uint32_t window_start_us;
+  uint32_t window_corrections;
+  uint32_t corrections_count;
+  float position_error;
+  bool stalled;
+  bool started;
+
+  void handle_internal();
+  static Status handle(SimpleTask &task, void *args);
+};
+
+} // namespace stmepic::motor
@@ -1,23 +1,120 @@
 #include "vesc_bldc.hpp"
 #include "status.hpp"
+#include "vesc_group.hpp"
+#include "can_signal.hpp"
+#include <cmath>
+#include <cstring>
 
 using namespace stmepic::motor;
 using namespace stmepic;
 
+namespace {
+
+/// @brief Field of a status frame, decoded to the VescParams member.
+struct VescStatusField {
+  CanSignal signal;
+  float VescParams::*param;
+};
+
+/// @brief Decode all fields of the frame, the signals are known at compile time so each frame gets
+/// its own unrolled decode function.
+template <VescStatusField... fields> void decode_fields(const uint8_t *data, VescParams &params) {
+  ((params.*fields.param = can_signal_decode<fields.signal>(data)), ...);
+}
+
+/// @brief Size of the frame that holds all fields.
+template <VescStatusField... fields> constexpr uint8_t fields_min_size() {
+  uint8_t size = 0;
+  ((size = fields.signal.min_size() > size ? fields.signal.min_size() : size), ...);
+  return size;
+}
+
+/// @brief Layout of one VESC status frame.
+struct VescStatusDecoder {
+  VescCommand command;
+  uint8_t frame_flag;
+  uint8_t min_size;
+  void (*decode)(const uint8_t *data, VescParams &params);
+};
+
+/// @brief Big endian signed field of the status frame.
+constexpr VescStatusField vesc_field(uint8_t offset, uint8_t size, float scale, float VescParams::*param) {
+  return { can_signal_be_bytes(offset, size, true, scale), param };
+}
+
+template <VescCommand command, uint8_t frame_flag, VescStatusField... fields>
+constexpr VescStatusDecoder make_status_decoder() {
+  return { command, frame_flag, fields_min_size<fields...>(), &decode_fields<fields...> };
+}
+
+// all VESC fields are big endian signed integers aligned to the bytes,
+// scales follow the status broadcast of the VESC firmware (comm_can.c)
+constexpr VescStatusDecoder vesc_status_decoders[] = {
+  make_status_decoder<VescCommand::STATUS_1,
+                      VESC_STATUS_1,
+                      vesc_field(0, 4, 1.0f, &VescParams::erpm),
+                      vesc_field(4, 2, 0.1f, &VescParams::current),
+                      vesc_field(6, 2, 0.001f, &VescParams::duty_cycle)>(),
+  make_status_decoder<VescCommand::STATUS_2,
+                      VESC_STATUS_2,
+                      vesc_field(0, 4, 0.0001f, &VescParams::amd_hours),
+                      vesc_field(4, 4, 0.0001f, &VescParams::amd_hours_charged)>(),
+  make_status_decoder<VescCommand::STATUS_3,
+                      VESC_STATUS_3,
+                      vesc_field(0, 4, 0.0001f, &VescParams::watt_hours),
+                      vesc_field(4, 4, 0.0001f, &VescParams::watt_hours_charged)>(),
+  make_status_decoder<VescCommand::STATUS_4,
+                      VESC_STATUS_4,
+                      vesc_field(0, 2, 0.1f, &VescParams::temperature_mosfet),
+                      vesc_field(2, 2, 0.1f, &VescParams::temperature_motor),
+                      vesc_field(4, 2, 0.1f, &VescParams::current_in),
+                      vesc_field(6, 2, 0.02f, &VescParams::pid_pos)>(),
+  make_status_decoder<VescCommand::STATUS_5,
+                      VESC_STATUS_5,
+                      vesc_field(0, 4, 1.0f, &VescParams::tachometer),
+                      vesc_field(4, 2, 0.1f, &VescParams::voltage)>(),
+  make_status_decoder<VescCommand::STATUS_6,
+                      VESC_STATUS_6,
+                      vesc_field(0, 2, 0.001f, &VescParams::adc1),
+                      vesc_field(2, 2, 0.001f, &VescParams::adc2),
+                      vesc_field(4, 2, 0.001f, &VescParams::adc3),
+                      vesc_field(6, 2, 0.001f, &VescParams::ppm)>(),
+};
+
+// setpoints: rpm in erpm, position and current scaled by 1000
+constexpr CanSignal VESC_SET_RPM     = can_signal_be_bytes(0, 4, true, 1.0f);
+constexpr CanSignal VESC_SET_POS     = can_signal_be_bytes(0, 4, true, 0.001f);
+constexpr CanSignal VESC_SET_CURRENT = can_signal_be_bytes(0, 4, true, 0.001f);
+constexpr uint8_t VESC_SETPOINT_SIZE = VESC_SET_RPM.min_size();
+
+const VescStatusDecoder *find_status_decoder(uint8_t command) {
+  for(const auto &decoder : vesc_status_decoders)
+    if(static_cast<uint8_t>(decoder.command) == command)
+      return &decoder;
+  return nullptr;
+}
+
+uint32_t vesc_frame_id(VescCommand command, uint32_t base_address) {
+  return (static_cast<uint32_t>(command) << 8) | (base_address & 0xffu);
+}
+
+} // namespace
+
 Result<std::shared_ptr<VescMotor>> VescMotor::Make(const std::shared_ptr<CanBase> can, std::shared_ptr<Timer> timer) {
   if(can == nullptr)
     return Status::Invalid("CAN is not nullptr");
   if(timer == nullptr)
     STMEPIC_ASSING_TO_OR_RETURN(timer, Timer::Make(100000, false, nullptr, Ticker::get_instance()));
   auto res = std::shared_ptr<VescMotor>(new VescMotor(can, timer));
-  return Result<decltype(res)>::OK(res);
+  return Result<decltype(res)>::OK(std::move(res));
 }
 
 VescMotor::VescMotor(const std::shared_ptr<CanBase> _can, const std::shared_ptr<Timer> _timer)
 : can(_can), timer(_timer), steps_per_revolution(400), max_velocity(0), min_velocity(0), reverse(false),
   enabled(false), control_mode(movement::MovementControlMode::VELOCITY),
   target_control_mode(movement::MovementControlMode::VELOCITY),
-  status(Status::ExecutionError("VescMotor not initialized")) {
+  status(Status::ExecutionError("VescMotor not initialized")), vesc_params{}, last_setpoint_time(0),
+  setpoint_sent(false), group(nullptr) {
   VescMotorSettings s;
   s.base_address      = 0x14;
   s.gear_ratio        = 1.0;
@@ -97,7 +194,7 @@ bool VescMotor::device_ok() {
 
 Result<bool> VescMotor::device_is_connected() {
   if(timer->triggered()) {
-    return Result<bool>(Status::TimeOut("Vesc timeout - status frame 1 not received"));
+    return Result<bool>(Status::TimeOut("Vesc timeout - no status frame received"));
   }
   return Result<bool>::OK(true);
 }
@@ -124,36 +221,21 @@ Status VescMotor::device_set_settings(const DeviceSettings &_settings) {
 
 Status VescMotor::init() {
   timer->timer_reset();
-  status = Status::OK();
-
-  const uint32_t st1_id = (CAN_VESC_FLEFT_STATUS_1_FRAME_ID & 0xffffff00) | settings.base_address;
-  const uint32_t st2_id = (CAN_VESC_FLEFT_STATUS_2_FRAME_ID & 0xffffff00) | settings.base_address;
-  const uint32_t st3_id = (CAN_VESC_FLEFT_STATUS_3_FRAME_ID & 0xffffff00) | settings.base_address;
-  const uint32_t st4_id = (CAN_VESC_FLEFT_STATUS_4_FRAME_ID & 0xffffff00) | settings.base_address;
-  const uint32_t st5_id = (CAN_VESC_FLEFT_STATUS_5_FRAME_ID & 0xffffff00) | settings.base_address;
-  const uint32_t st6_id = (CAN_VESC_FLEFT_STATUS_6_FRAME_ID & 0xffffff00) | settings.base_address;
-  can->add_callback(st1_id, can_callback_status_1, this);
-  can->add_callback(st2_id, can_callback_status_2, this);
-  can->add_callback(st3_id, can_callback_status_3, this);
-  can->add_callback(st4_id, can_callback_status_4, this);
-  can->add_callback(st5_id, can_callback_status_5, this);
-  can->add_callback(st6_id, can_callback_status_6, this);
+  status        = Status::OK();
+  setpoint_sent = false;
+
+  for(const auto &decoder : vesc_status_decoders) {
+    if((settings.status_frames & decoder.frame_flag) == 0)
+      continue;
+    STMEPIC_RETURN_ON_ERROR(
+    can->add_callback(vesc_frame_id(decoder.command, settings.base_address), can_callback_status, this));
+  }
   return Status::OK();
 }
 
 Status VescMotor::stop() {
-  const uint32_t st1_id = (CAN_VESC_FLEFT_STATUS_1_FRAME_ID & 0xffffff00) | settings.base_address;
-  const uint32_t st2_id = (CAN_VESC_FLEFT_STATUS_2_FRAME_ID & 0xffffff00) | settings.base_address;
-  const uint32_t st3_id = (CAN_VESC_FLEFT_STATUS_3_FRAME_ID & 0xffffff00) | settings.base_address;
-  const uint32_t st4_id = (CAN_VESC_FLEFT_STATUS_4_FRAME_ID & 0xffffff00) | settings.base_address;
-  const uint32_t st5_id = (CAN_VESC_FLEFT_STATUS_5_FRAME_ID & 0xffffff00) | settings.base_address;
-  const uint32_t st6_id = (CAN_VESC_FLEFT_STATUS_6_FRAME_ID & 0xffffff00) | settings.base_address;
-  can->remove_callback(st1_id);
-  can->remove_callback(st2_id);
-  can->remove_callback(st3_id);
-  can->remove_callback(st4_id);
-  can->remove_callback(st5_id);
-  can->remove_callback(st6_id);
+  for(const auto &decoder : vesc_status_decoders)
+    (void)can->remove_callback(vesc_frame_id(decoder.command, settings.base_address));
   return Status::OK();
 }
 
@@ -190,346 +272,68 @@ Status VescMotor::handle() {
   }
   switch(control_mode) {
   case movement::MovementControlMode::VELOCITY: {
-    can_vesc_fleft_set_rpm_t str;
-    double rpm     = target_state.velocity * 60.0 / (2.0 * M_PI) * settings.gear_ratio * settings.polar_pairs;
-    str.rpm        = (int32_t)rpm;
-    frame.frame_id = (CAN_VESC_FLEFT_SET_RPM_FRAME_ID & 0xffffff00) | settings.base_address;
-    frame.data_size   = CAN_VESC_FLEFT_SET_RPM_LENGTH;
-    frame.extended_id = CAN_VESC_FLEFT_SET_RPM_IS_EXTENDED;
-    can_vesc_fleft_set_rpm_pack(frame.data, &str, frame.data_size);
+    float rpm = target_state.velocity * 60.0f / (2.0f * (float)M_PI) * settings.gear_ratio * settings.polar_pairs;
+    frame.frame_id = vesc_frame_id(VescCommand::SET_RPM, settings.base_address);
+    can_signal_encode<VESC_SET_RPM>(frame.data, rpm);
     break;
   }
   case movement::MovementControlMode::POSITION: {
-    can_vesc_fleft_set_pos_t str;
-    double pos        = target_state.position * 1000.0 * settings.gear_ratio;
-    str.position      = (int32_t)pos;
-    frame.frame_id    = (CAN_VESC_FLEFT_SET_POS_FRAME_ID & 0xffffff00) | settings.base_address;
-    frame.data_size   = CAN_VESC_FLEFT_SET_POS_LENGTH;
-    frame.extended_id = CAN_VESC_FLEFT_SET_POS_IS_EXTENDED;
-    can_vesc_fleft_set_pos_pack(frame.data, &str, frame.data_size);
+    frame.frame_id = vesc_frame_id(VescCommand::SET_POS, settings.base_address);
+    can_signal_encode<VESC_SET_POS>(frame.data, target_state.position * settings.gear_ratio);
     break;
   }
   case movement::MovementControlMode::TORQUE: {
-    can_vesc_fleft_set_current_t str;
-    double current    = target_state.torque / settings.current_to_torque * 1000.0 / settings.gear_ratio;
-    str.current       = (int32_t)current;
-    frame.frame_id    = (CAN_VESC_FLEFT_SET_CURRENT_FRAME_ID & 0xffffff00) | settings.base_address;
-    frame.data_size   = CAN_VESC_FLEFT_SET_CURRENT_LENGTH;
-    frame.extended_id = CAN_VESC_FLEFT_SET_CURRENT_IS_EXTENDED;
-    can_vesc_fleft_set_current_pack(frame.data, &str, frame.data_size);
+    float current  = target_state.torque / settings.current_to_torque / settings.gear_ratio;
+    frame.frame_id = vesc_frame_id(VescCommand::SET_CURRENT, settings.base_address);
+    can_signal_encode<VESC_SET_CURRENT>(frame.data, current);
     break;
   }
   default: status = Status::ExecutionError("Unknown control mode"); return status;
   }
-  can->write(frame);
-
+  frame.data_size   = VESC_SETPOINT_SIZE;
+  frame.extended_id = true;
+
+  // the VESC holds the last setpoint until its timeout, unchanged frames are only repeated as keep-alive
+  const uint32_t now = Ticker::get_instance().get_micros();
+  const bool changed = !setpoint_sent || frame.frame_id != last_setpoint.frame_id ||
+                       std::memcmp(frame.data, last_setpoint.data, frame.data_size) != 0;
+  if(!changed && (now - last_setpoint_time) < settings.keep_alive_ms * 1000u)
+    return Status::OK();
+
+  // motors in a group are sent together in the burst of the group
+  if(group != nullptr)
+    STMEPIC_RETURN_ON_ERROR(group->submit(this, frame));
+  else
+    STMEPIC_RETURN_ON_ERROR(can->write(frame));
+  last_setpoint      = frame;
+  last_setpoint_time = now;
+  setpoint_sent      = true;
   return Status::OK();
 }
 
-void inline VescMotor::can_callback_status_1(CanBase &can, CanDataFrame &msg, void *args) {
+void VescMotor::can_callback_status(CanBase &can, CanDataFrame &msg, void *args) {
   (void)can;
-  auto *motor = static_cast<VescMotor *>(args);
-  can_vesc_fleft_status_1_t status;
-
-  motor->timer->timer_reset();
-
-  if(can_vesc_fleft_status_1_unpack(&status, msg.data, msg.data_size)) {
-    motor->status = Status::ExecutionError("Failed to unpack VESC status 1");
-    return;
-  }
-
-  motor->vesc_params.current    = static_cast<float>(status.current);
-  motor->vesc_params.duty_cycle = static_cast<float>(status.duty);
-  motor->vesc_params.erpm = static_cast<float>(status.erpm) * motor->settings.gear_ratio * motor->settings.polar_pairs;
-  motor->current_state.velocity = (static_cast<float>(status.erpm) / 60.0f) * (2.0f * static_cast<float>(M_PI)) /
-                                  (motor->settings.gear_ratio * motor->settings.polar_pairs);
-  motor->current_state.torque = motor->vesc_params.current * motor->settings.current_to_torque;
-}
-
-void inline VescMotor::can_callback_status_2(CanBase &can, CanDataFrame &msg, void *args) {
-  (void)can;
-  auto *motor = static_cast<VescMotor *>(args);
-  can_vesc_fleft_status_2_t status;
-
-  if(can_vesc_fleft_status_2_unpack(&status, msg.data, msg.data_size)) {
-    motor->status = Status::ExecutionError("Failed to unpack VESC status 2");
-    return;
-  }
-  motor->vesc_params.amd_hours         = (double)status.amp_hours * 1000;
-  motor->vesc_params.amd_hours_charged = (double)status.amp_hours_chg * 1000;
-}
-
-void inline VescMotor::can_callback_status_3(CanBase &can, CanDataFrame &msg, void *args) {
-  (void)can;
-  auto *motor = static_cast<VescMotor *>(args);
-  can_vesc_fleft_status_3_t status;
-
-  if(can_vesc_fleft_status_3_unpack(&status, msg.data, msg.data_size)) {
-    motor->status = Status::ExecutionError("Failed to unpack VESC status 3");
-    return;
-  }
-  motor->vesc_params.watt_hours         = (double)status.wat_hours * 1000;
-  motor->vesc_params.watt_hours_charged = (double)status.wat_hours_chg * 1000;
-}
-
-void inline VescMotor::can_callback_status_4(CanBase &can, CanDataFrame &msg, void *args) {
-  (void)can;
-  auto *motor = static_cast<VescMotor *>(args);
-  can_vesc_fleft_status_4_t status;
-
-  if(can_vesc_fleft_status_4_unpack(&status, msg.data, msg.data_size)) {
-    motor->status = Status::ExecutionError("Failed to unpack VESC status 4");
-    return;
-  }
-  motor->vesc_params.current_in         = (double)status.current_in;
-  motor->vesc_params.pid_pos            = (double)status.pid_pos;
-  motor->vesc_params.temperature_mosfet = (double)status.temp_mosfet;
-  motor->vesc_params.temperature_motor  = (double)status.temp_motor;
+  static_cast<VescMotor *>(args)->decode_status(msg);
 }
 
-void inline VescMotor::can_callback_status_5(CanBase &can, CanDataFrame &msg, void *args) {
-  (void)can;
-  auto *motor = static_cast<VescMotor *>(args);
-  can_vesc_fleft_status_5_t status;
-
-  if(can_vesc_fleft_status_5_unpack(&status, msg.data, msg.data_size)) {
-    motor->status = Status::ExecutionError("Failed to unpack VESC status 5");
+void VescMotor::decode_status(const CanDataFrame &msg) {
+  const auto *decoder = find_status_decoder(static_cast<uint8_t>(msg.frame_id >> 8));
+  if(decoder == nullptr)
     return;
-  }
-  double scale_for_tachometer   = 4.0 * M_PI / 360.0; //  2 * 2 * M_PI = 360 deg
-  motor->current_state.position = (double)status.tachometer * scale_for_tachometer;
-  motor->vesc_params.voltage    = (double)status.volts_in * 0.1;
-}
-
-void inline VescMotor::can_callback_status_6(CanBase &can, CanDataFrame &msg, void *args) {
-  (void)can;
-  auto *motor = static_cast<VescMotor *>(args);
-  can_vesc_fleft_status_6_t status;
-
-  if(can_vesc_fleft_status_6_unpack(&status, msg.data, msg.data_size)) {
-    motor->status = Status::ExecutionError("Failed to unpack VESC status 6");
+  if(msg.data_size < decoder->min_size) {
+    status = Status::ExecutionError("Failed to unpack VESC status frame");
     return;
   }
-  motor->vesc_params.adc1 = (double)status.adc1 * 1000;
-  motor->vesc_params.adc2 = (double)status.adc2 * 1000;
-  motor->vesc_params.adc3 = (double)status.adc3 * 1000;
-  motor->vesc_params.ppm  = (double)status.ppm * 1000;
-}
-
-uint16_t VescMotor::unpack_left_shift_u16(uint8_t value, uint8_t shift, uint8_t mask) {
-  return (uint16_t)((uint16_t)(value & mask) << shift);
-}
-
-uint32_t VescMotor::unpack_left_shift_u32(uint8_t value, uint8_t shift, uint8_t mask) {
-  return ((uint32_t)(value & mask) << shift);
-}
-
-uint16_t VescMotor::unpack_right_shift_u16(uint8_t value, uint8_t shift, uint8_t mask) {
-  return (uint16_t)((uint16_t)(value & mask) >> shift);
-}
-
-uint32_t VescMotor::unpack_right_shift_u32(uint8_t value, uint8_t shift, uint8_t mask) {
-  return ((uint32_t)(value & mask) >> shift);
-}
-
-uint8_t VescMotor::pack_left_shift_u32(uint32_t value, uint8_t shift, uint8_t mask) {
-  return (uint8_t)((uint8_t)(value << shift) & mask);
-}
-
-uint8_t VescMotor::pack_right_shift_u32(uint32_t value, uint8_t shift, uint8_t mask) {
-  return (uint8_t)((uint8_t)(value >> shift) & mask);
-}
-
-int VescMotor::can_vesc_fleft_status_1_unpack(struct can_vesc_fleft_status_1_t *dst_p, const uint8_t *src_p, size_t size) {
-  uint16_t current;
-  uint16_t duty;
-  uint32_t erpm;
-
-  if(size < 8u) {
-    return (-EINVAL);
-  }
-
-  erpm = unpack_left_shift_u32(src_p[0], 24u, 0xffu);
-  erpm |= unpack_left_shift_u32(src_p[1], 16u, 0xffu);
-  erpm |= unpack_left_shift_u32(src_p[2], 8u, 0xffu);
-  erpm |= unpack_right_shift_u32(src_p[3], 0u, 0xffu);
-  dst_p->erpm = (int32_t)erpm;
-  current     = unpack_left_shift_u16(src_p[4], 8u, 0xffu);
-  current |= unpack_right_shift_u16(src_p[5], 0u, 0xffu);
-  dst_p->current = (int16_t)current;
-  duty           = unpack_left_shift_u16(src_p[6], 8u, 0xffu);
-  duty |= unpack_right_shift_u16(src_p[7], 0u, 0xffu);
-  dst_p->duty = (int16_t)duty;
 
-  return (0);
-}
-
-int VescMotor::can_vesc_fleft_status_2_unpack(struct can_vesc_fleft_status_2_t *dst_p, const uint8_t *src_p, size_t size) {
-  uint32_t amp_hours;
-  uint32_t amp_hours_chg;
-
-  if(size < 8u) {
-    return (-EINVAL);
-  }
-
-  amp_hours = unpack_left_shift_u32(src_p[0], 24u, 0xffu);
-  amp_hours |= unpack_left_shift_u32(src_p[1], 16u, 0xffu);
-  amp_hours |= unpack_left_shift_u32(src_p[2], 8u, 0xffu);
-  amp_hours |= unpack_right_shift_u32(src_p[3], 0u, 0xffu);
-  dst_p->amp_hours = (int32_t)amp_hours;
-  amp_hours_chg    = unpack_left_shift_u32(src_p[4], 24u, 0xffu);
-  amp_hours_chg |= unpack_left_shift_u32(src_p[5], 16u, 0xffu);
-  amp_hours_chg |= unpack_left_shift_u32(src_p[6], 8u, 0xffu);
-  amp_hours_chg |= unpack_right_shift_u32(src_p[7], 0u, 0xffu);
-  dst_p->amp_hours_chg = (int32_t)amp_hours_chg;
-
-  return (0);
-}
-
-int VescMotor::can_vesc_fleft_status_3_unpack(struct can_vesc_fleft_status_3_t *dst_p, const uint8_t *src_p, size_t size) {
-  uint32_t wat_hours;
-  uint32_t wat_hours_chg;
-
-  if(size < 8u) {
-    return (-EINVAL);
-  }
-
-  wat_hours = unpack_left_shift_u32(src_p[0], 24u, 0xffu);
-  wat_hours |= unpack_left_shift_u32(src_p[1], 16u, 0xffu);
-  wat_hours |= unpack_left_shift_u32(src_p[2], 8u, 0xffu);
-  wat_hours |= unpack_right_shift_u32(src_p[3], 0u, 0xffu);
-  dst_p->wat_hours = (int32_t)wat_hours;
-  wat_hours_chg    = unpack_left_shift_u32(src_p[4], 24u, 0xffu);
-  wat_hours_chg |= unpack_left_shift_u32(src_p[5], 16u, 0xffu);
-  wat_hours_chg |= unpack_left_shift_u32(src_p[6], 8u, 0xffu);
-  wat_hours_chg |= unpack_right_shift_u32(src_p[7], 0u, 0xffu);
-  dst_p->wat_hours_chg = (int32_t)wat_hours_chg;
-
-  return (0);
-}
-
-int VescMotor::can_vesc_fleft_status_4_unpack(struct can_vesc_fleft_status_4_t *dst_p, const uint8_t *src_p, size_t size) {
-  uint16_t current_in;
-  uint16_t pid_pos;
-  uint16_t temp_mosfet;
-  uint16_t temp_motor;
-
-  if(size < 8u) {
-    return (-EINVAL);
-  }
-
-  temp_mosfet = unpack_left_shift_u16(src_p[0], 8u, 0xffu);
-  temp_mosfet |= unpack_right_shift_u16(src_p[1], 0u, 0xffu);
-  dst_p->temp_mosfet = (int16_t)temp_mosfet;
-  temp_motor         = unpack_left_shift_u16(src_p[2], 8u, 0xffu);
-  temp_motor |= unpack_right_shift_u16(src_p[3], 0u, 0xffu);
-  dst_p->temp_motor = (int16_t)temp_motor;
-  current_in        = unpack_left_shift_u16(src_p[4], 8u, 0xffu);
-  current_in |= unpack_right_shift_u16(src_p[5], 0u, 0xffu);
-  dst_p->current_in = (int16_t)current_in;
-  pid_pos           = unpack_left_shift_u16(src_p[6], 8u, 0xffu);
-  pid_pos |= unpack_right_shift_u16(src_p[7], 0u, 0xffu);
-  dst_p->pid_pos = (int16_t)pid_pos;
-
-  return (0);
-}
-
-int VescMotor::can_vesc_fleft_status_5_unpack(struct can_vesc_fleft_status_5_t *dst_p, const uint8_t *src_p, size_t size) {
-  uint16_t volts_in;
-  uint32_t tachometer;
-
-  if(size < 6u) {
-    return (-EINVAL);
-  }
-
-  tachometer = unpack_left_shift_u32(src_p[0], 24u, 0xffu);
-  tachometer |= unpack_left_shift_u32(src_p[1], 16u, 0xffu);
-  tachometer |= unpack_left_shift_u32(src_p[2], 8u, 0xffu);
-  tachometer |= unpack_right_shift_u32(src_p[3], 0u, 0xffu);
-  dst_p->tachometer = (int32_t)tachometer;
-  volts_in          = unpack_left_shift_u16(src_p[4], 8u, 0xffu);
-  volts_in |= unpack_right_shift_u16(src_p[5], 0u, 0xffu);
-  dst_p->volts_in = (int16_t)volts_in;
-
-  return (0);
-}
-
-int VescMotor::can_vesc_fleft_status_6_unpack(struct can_vesc_fleft_status_6_t *dst_p, const uint8_t *src_p, size_t size) {
-  uint16_t adc1;
-  uint16_t adc2;
-  uint16_t adc3;
-  uint16_t ppm;
-
-  if(size < 8u) {
-    return (-EINVAL);
-  }
-
-  adc1 = unpack_left_shift_u16(src_p[0], 8u, 0xffu);
-  adc1 |= unpack_right_shift_u16(src_p[1], 0u, 0xffu);
-  dst_p->adc1 = (int16_t)adc1;
-  adc2        = unpack_left_shift_u16(src_p[2], 8u, 0xffu);
-  adc2 |= unpack_right_shift_u16(src_p[3], 0u, 0xffu);
-  dst_p->adc2 = (int16_t)adc2;
-  adc3        = unpack_left_shift_u16(src_p[4], 8u, 0xffu);
-  adc3 |= unpack_right_shift_u16(src_p[5], 0u, 0xffu);
-  dst_p->adc3 = (int16_t)adc3;
-  ppm         = unpack_left_shift_u16(src_p[6], 8u, 0xffu);
-  ppm |= unpack_right_shift_u16(src_p[7], 0u, 0xffu);
-  dst_p->ppm = (int16_t)ppm;
-
-  return (0);
-}
-
-int VescMotor::can_vesc_fleft_set_rpm_pack(uint8_t *dst_p, const struct can_vesc_fleft_set_rpm_t *src_p, size_t size) {
-  uint32_t rpm;
-
-  if(size < 4u) {
-    return (-EINVAL);
-  }
-
-  memset(&dst_p[0], 0, 4);
-
-  rpm = (uint32_t)src_p->rpm;
-  dst_p[0] |= pack_right_shift_u32(rpm, 24u, 0xffu);
-  dst_p[1] |= pack_right_shift_u32(rpm, 16u, 0xffu);
-  dst_p[2] |= pack_right_shift_u32(rpm, 8u, 0xffu);
-  dst_p[3] |= pack_left_shift_u32(rpm, 0u, 0xffu);
-
-  return (4);
+  timer->timer_reset();
+  decoder->decode(msg.data, vesc_params);
+  update_state();
 }
 
-int VescMotor::can_vesc_fleft_set_pos_pack(uint8_t *dst_p, const struct can_vesc_fleft_set_pos_t *src_p, size_t size) {
-  uint32_t position;
-
-  if(size < 4u) {
-    return (-EINVAL);
-  }
-
-  memset(&dst_p[0], 0, 4);
-
-  position = (uint32_t)src_p->position;
-  dst_p[0] |= pack_right_shift_u32(position, 24u, 0xffu);
-  dst_p[1] |= pack_right_shift_u32(position, 16u, 0xffu);
-  dst_p[2] |= pack_right_shift_u32(position, 8u, 0xffu);
-  dst_p[3] |= pack_left_shift_u32(position, 0u, 0xffu);
-
-  return (4);
+void VescMotor::update_state() {
+  const float electrical_ratio     = settings.gear_ratio * (float)settings.polar_pairs;
+  const float scale_for_tachometer = 4.0f * (float)M_PI / 360.0f; //  2 * 2 * M_PI = 360 deg
+  current_state.velocity           = vesc_params.erpm / 60.0f * (2.0f * (float)M_PI) / electrical_ratio;
+  current_state.torque             = vesc_params.current * settings.current_to_torque;
+  current_state.position           = vesc_params.tachometer * scale_for_tachometer;
 }
-
-int VescMotor::can_vesc_fleft_set_current_pack(uint8_t *dst_p, const struct can_vesc_fleft_set_current_t *src_p, size_t size) {
-  uint32_t current;
-
-  if(size < 4u) {
-    return (-EINVAL);
-  }
-
-  memset(&dst_p[0], 0, 4);
-
-  current = (uint32_t)src_p->current;
-  dst_p[0] |= pack_right_shift_u32(current, 24u, 0xffu);
-  dst_p[1] |= pack_right_shift_u32(current, 16u, 0xffu);
-  dst_p[2] |= pack_right_shift_u32(current, 8u, 0xffu);
-  dst_p[3] |= pack_left_shift_u32(current, 0u, 0xffu);
-
-  return (4);
-}
\ No newline at end of file
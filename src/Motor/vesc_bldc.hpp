@@ -4,12 +4,59 @@
 #include <can.hpp>
 #include <movement_controler.hpp>
 
+/**
+ * @file vesc_bldc.hpp
+ * @brief VESC BLDC controller driven over the CAN bus.
+ */
+
+/**
+ * @defgroup Motor
+ * @{
+ */
+
 namespace stmepic::motor {
+
+class VescGroup;
+
+/// @brief VESC CAN commands, the extended frame id is (command << 8) | controller id.
+enum class VescCommand : uint8_t {
+  SET_CURRENT = 1,
+  SET_RPM     = 3,
+  SET_POS     = 4,
+  STATUS_1    = 9,
+  STATUS_2    = 14,
+  STATUS_3    = 15,
+  STATUS_4    = 16,
+  STATUS_5    = 27,
+  STATUS_6    = 28,
+};
+
+/// @brief Flags selecting the status frames the driver subscribes to and decodes.
+enum VescStatusFrames : uint8_t {
+  VESC_STATUS_1   = 1u << 0, ///< erpm, current, duty cycle (velocity and torque feedback)
+  VESC_STATUS_2   = 1u << 1, ///< amp hours
+  VESC_STATUS_3   = 1u << 2, ///< watt hours
+  VESC_STATUS_4   = 1u << 3, ///< temperatures, input current, pid position
+  VESC_STATUS_5   = 1u << 4, ///< tachometer (position feedback), input voltage
+  VESC_STATUS_6   = 1u << 5, ///< adc inputs, ppm
+  VESC_STATUS_ALL = 0x3Fu,
+};
+
 struct VescMotorSettings : DeviceSettings {
   uint32_t base_address;
   float gear_ratio;
   float current_to_torque;
   uint16_t polar_pairs;
+
+  /// @brief Status frames decoded by the driver, combination of VescStatusFrames.
+  /// Frames that are not selected are not subscribed to, the connection timeout is reset by any decoded frame.
+  /// @note The VESC broadcast rate of each frame is set in the VESC app config, disable the unused ones there
+  /// as well to take them off the bus.
+  uint8_t status_frames = VESC_STATUS_ALL;
+
+  /// @brief The setpoint is sent only when it changes or when this time passed since the last send [ms].
+  /// Keep it well below the VESC timeout, 0 sends the setpoint every task period.
+  uint32_t keep_alive_ms = 100;
 };
 
 
@@ -25,6 +72,7 @@ struct VescParams {
   float temperature_motor;
   float current_in;
   float pid_pos;
+  float tachometer;
   float voltage;
   float adc1;
   float adc2;
@@ -59,6 +107,8 @@ public:
   Status device_set_settings(const DeviceSettings &settings) override;
 
 private:
+  friend class VescGroup;
+
   VescMotor(std::shared_ptr<CanBase> can, std::shared_ptr<Timer> timer);
 
   Status do_device_task_start() override;
@@ -67,6 +117,8 @@ private:
 
   Status init();
   Status stop();
+  void decode_status(const CanDataFrame &msg);
+  void update_state();
 
   static Status task_before(SimpleTask &handler, void *arg);
   static Status task(SimpleTask &handler, void *arg);
@@ -92,94 +144,12 @@ private:
   movement::MovementState target_state;
   VescParams vesc_params;
 
-  static void inline can_callback_status_1(CanBase &can, CanDataFrame &msg, void *args);
-  static void inline can_callback_status_2(CanBase &can, CanDataFrame &msg, void *args);
-  static void inline can_callback_status_3(CanBase &can, CanDataFrame &msg, void *args);
-  static void inline can_callback_status_4(CanBase &can, CanDataFrame &msg, void *args);
-  static void inline can_callback_status_5(CanBase &can, CanDataFrame &msg, void *args);
-  static void inline can_callback_status_6(CanBase &can, CanDataFrame &msg, void *args);
-
-  static constexpr uint32_t CAN_VESC_FLEFT_STATUS_1_FRAME_ID       = 0x914u;
-  static constexpr uint32_t CAN_VESC_FLEFT_STATUS_2_FRAME_ID       = 0xE14u;
-  static constexpr uint32_t CAN_VESC_FLEFT_STATUS_3_FRAME_ID       = 0xF14u;
-  static constexpr uint32_t CAN_VESC_FLEFT_STATUS_4_FRAME_ID       = 0x1014u;
-  static constexpr uint32_t CAN_VESC_FLEFT_STATUS_5_FRAME_ID       = 0x1B14u;
-  static constexpr uint32_t CAN_VESC_FLEFT_STATUS_6_FRAME_ID       = 0x1C14u;
-  static constexpr uint32_t CAN_VESC_FLEFT_SET_RPM_FRAME_ID        = 0x314u;
-  static constexpr uint32_t CAN_VESC_FLEFT_SET_RPM_LENGTH          = 4u;
-  static constexpr uint32_t CAN_VESC_FLEFT_SET_RPM_IS_EXTENDED     = 1;
-  static constexpr uint32_t CAN_VESC_FLEFT_SET_POS_FRAME_ID        = 0x414u;
-  static constexpr uint32_t CAN_VESC_FLEFT_SET_POS_LENGTH          = 4u;
-  static constexpr uint32_t CAN_VESC_FLEFT_SET_POS_IS_EXTENDED     = 1;
-  static constexpr uint32_t CAN_VESC_FLEFT_SET_CURRENT_FRAME_ID    = 0x114u;
-  static constexpr uint32_t CAN_VESC_FLEFT_SET_CURRENT_LENGTH      = 4u;
-  static constexpr uint32_t CAN_VESC_FLEFT_SET_CURRENT_IS_EXTENDED = 1;
-
-  struct can_vesc_fleft_status_1_t {
-    int32_t erpm;
-    int16_t current;
-    int16_t duty;
-  };
-
-  struct can_vesc_fleft_status_2_t {
-    int32_t amp_hours;
-    int32_t amp_hours_chg;
-  };
-
-  struct can_vesc_fleft_status_3_t {
-    int32_t wat_hours;
-    int32_t wat_hours_chg;
-  };
-
-  struct can_vesc_fleft_status_4_t {
-    int16_t temp_mosfet;
-    int16_t temp_motor;
-    int16_t current_in;
-    int16_t pid_pos;
-  };
-
-  struct can_vesc_fleft_status_5_t {
-    int32_t tachometer;
-    int16_t volts_in;
-  };
-
-  struct can_vesc_fleft_status_6_t {
-    int16_t adc1;
-    int16_t adc2;
-    int16_t adc3;
-    int16_t ppm;
-  };
-
-  struct can_vesc_fleft_set_rpm_t {
-    int32_t rpm;
-  };
-
-  struct can_vesc_fleft_set_pos_t {
-    int32_t position;
-  };
-
-  struct can_vesc_fleft_set_current_t {
-    int32_t current;
-  };
-
-
-  static uint16_t unpack_left_shift_u16(uint8_t value, uint8_t shift, uint8_t mask);
-  static uint32_t unpack_left_shift_u32(uint8_t value, uint8_t shift, uint8_t mask);
-  static uint16_t unpack_right_shift_u16(uint8_t value, uint8_t shift, uint8_t mask);
-  static uint32_t unpack_right_shift_u32(uint8_t value, uint8_t shift, uint8_t mask);
-  static uint8_t pack_left_shift_u32(uint32_t value, uint8_t shift, uint8_t mask);
-  static uint8_t pack_right_shift_u32(uint32_t value, uint8_t shift, uint8_t mask);
-
-  static int can_vesc_fleft_status_1_unpack(struct can_vesc_fleft_status_1_t *dst_p, const uint8_t *src_p, size_t size);
-  static int can_vesc_fleft_status_2_unpack(struct can_vesc_fleft_status_2_t *dst_p, const uint8_t *src_p, size_t size);
-  static int can_vesc_fleft_status_3_unpack(struct can_vesc_fleft_status_3_t *dst_p, const uint8_t *src_p, size_t size);
-  static int can_vesc_fleft_status_4_unpack(struct can_vesc_fleft_status_4_t *dst_p, const uint8_t *src_p, size_t size);
-  static int can_vesc_fleft_status_5_unpack(struct can_vesc_fleft_status_5_t *dst_p, const uint8_t *src_p, size_t size);
-  static int can_vesc_fleft_status_6_unpack(struct can_vesc_fleft_status_6_t *dst_p, const uint8_t *src_p, size_t size);
-
-  static int can_vesc_fleft_set_rpm_pack(uint8_t *dst_p, const struct can_vesc_fleft_set_rpm_t *src_p, size_t size);
-  static int can_vesc_fleft_set_pos_pack(uint8_t *dst_p, const struct can_vesc_fleft_set_pos_t *src_p, size_t size);
-  static int can_vesc_fleft_set_current_pack(uint8_t *dst_p, const struct can_vesc_fleft_set_current_t *src_p, size_t size);
+  CanDataFrame last_setpoint;
+  uint32_t last_setpoint_time;
+  bool setpoint_sent;
+  VescGroup *group;
+
+  static void can_callback_status(CanBase &can, CanDataFrame &msg, void *args);
 };
 
 } // namespace stmepic::motor
\ No newline at end of file
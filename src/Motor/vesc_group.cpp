@@ -0,0 +1,151 @@
+#include "vesc_group.hpp"
+#include "Timing.hpp"
+#include <algorithm>
+
+using namespace stmepic::motor;
+using namespace stmepic;
+
+
+VescGroup::VescGroup(std::shared_ptr<CanBase> _can)
+: can(_can), period_us(1000), stagger_us(0), next_burst_us(0), started(false), running(false), sent_count(0),
+  dropped_count(0), late_count(0) {
+  task.task_init(handle, this, 1, nullptr, 300, tskIDLE_PRIORITY + 3, "VescGroup");
+}
+
+VescGroup::~VescGroup() {
+  (void)task.task_stop();
+  for(auto &member : members)
+    member.motor->group = nullptr;
+}
+
+Status VescGroup::add_motor(std::shared_ptr<VescMotor> motor, uint8_t priority) {
+  if(motor == nullptr)
+    return Status::Invalid("VescGroup: motor is nullptr");
+  if(started)
+    return Status::ExecutionError("VescGroup: motors can't be added while the group is running");
+  if(motor->group != nullptr)
+    return Status::AlreadyExists("VescGroup: motor is already in a group");
+
+  Member member;
+  member.motor    = motor;
+  member.priority = priority;
+  member.pending  = false;
+
+  // keep the members in the burst order so the burst doesn't have to be sorted
+  auto position = std::upper_bound(members.begin(), members.end(), member, [](const Member &a, const Member &b) {
+    if(a.priority != b.priority)
+      return a.priority < b.priority;
+    return a.motor->settings.base_address < b.motor->settings.base_address;
+  });
+  members.insert(position, member);
+  motor->group = this;
+  return Status::OK();
+}
+
+Status VescGroup::start(uint32_t period_ms, uint32_t _stagger_us) {
+  if(started)
+    return Status::AlreadyExists("VescGroup: group is already running");
+  if(period_ms == 0)
+    return Status::Invalid("VescGroup: period can't be 0");
+  burst.reserve(members.size());
+  period_us  = period_ms * 1000;
+  stagger_us = _stagger_us;
+  running    = false;
+  task.task_set_period(period_ms);
+  STMEPIC_RETURN_ON_ERROR(task.task_run());
+  started = true;
+  return Status::OK();
+}
+
+Status VescGroup::stop() {
+  started = false;
+  (void)task.task_stop();
+  vPortEnterCritical();
+  for(auto &member : members)
+    member.pending = false;
+  vPortExitCritical();
+  return Status::OK();
+}
+
+void VescGroup::set_stagger(uint32_t _stagger_us) {
+  stagger_us = _stagger_us;
+}
+
+uint32_t VescGroup::get_sent_count() const {
+  return sent_count;
+}
+
+uint32_t VescGroup::get_dropped_count() const {
+  return dropped_count;
+}
+
+uint32_t VescGroup::get_late_count() const {
+  return late_count;
+}
+
+void VescGroup::reset_counters() {
+  vPortEnterCritical();
+  sent_count    = 0;
+  dropped_count = 0;
+  late_count    = 0;
+  vPortExitCritical();
+}
+
+Status VescGroup::submit(const VescMotor *motor, const CanDataFrame &frame) {
+  if(!started)
+    return Status::Cancelled("VescGroup: group is not running");
+  for(auto &member : members) {
+    if(member.motor.get() != motor)
+      continue;
+    vPortEnterCritical();
+    if(member.pending)
+      dropped_count++;
+    member.frame   = frame;
+    member.pending = true;
+    vPortExitCritical();
+    return Status::OK();
+  }
+  return Status::Invalid("VescGroup: motor is not in the group");
+}
+
+void VescGroup::handle_internal() {
+  const uint32_t now = Ticker::get_instance().get_micros();
+  if(!running) {
+    next_burst_us = now;
+    running       = true;
+  } else if((int32_t)(now - next_burst_us) > (int32_t)(period_us / 2)) {
+    // resynchronize so a single overrun doesn't mark every following burst as late
+    late_count++;
+    next_burst_us = now;
+  }
+  next_burst_us += period_us;
+
+  burst.clear();
+  vPortEnterCritical();
+  for(auto &member : members) {
+    if(!member.pending)
+      continue;
+    burst.push_back(member.frame);
+    member.pending = false;
+  }
+  vPortExitCritical();
+
+  // the TX task holds each frame until its release time, the group task doesn't wait for the bus
+  const uint64_t burst_start_us = Ticker::get_instance().get_micros64();
+  for(size_t i = 0; i < burst.size(); i++) {
+    burst[i].release_us = (i > 0 && stagger_us > 0) ? burst_start_us + (uint64_t)i * stagger_us : 0;
+    if(can->write(burst[i]).ok())
+      sent_count++;
+    else
+      dropped_count++;
+  }
+}
+
+Status VescGroup::handle(SimpleTask &task, void *args) {
+  (void)task;
+  auto *group = static_cast<VescGroup *>(args);
+  if(group == nullptr)
+    return Status::Invalid("VescGroup::handle: args is nullptr");
+  group->handle_internal();
+  return Status::OK();
+}
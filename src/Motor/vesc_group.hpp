@@ -0,0 +1,113 @@
+#pragma once
+
+#include "can.hpp"
+#include "simple_task.hpp"
+#include "stmepic.hpp"
+#include "vesc_bldc.hpp"
+#include <memory>
+#include <vector>
+
+/**
+ * @file vesc_group.hpp
+ * @brief Batching of the setpoint frames of multiple VESC motors into a single burst.
+ *
+ */
+
+/**
+ * @defgroup Motor
+ * @{
+ */
+
+namespace stmepic::motor {
+
+/**
+ * @class VescGroup
+ * @brief Collects the setpoints of multiple VescMotor instances and writes them to the CAN as one burst.
+ *
+ * Motors added to the group don't write their setpoint frames on their own, VescMotor::handle
+ * places the frame in the group slot of the motor instead. The group task runs with the control
+ * period and writes all pending frames back to back, ordered by the priority of the motor
+ * (lower value first) and then by the VESC controller id, so all motors get their setpoint at
+ * the same phase of the control cycle. Optionally the frames are staggered by a fixed time so the status
+ * frames the VESCs send in response don't collide on the bus, the stagger is applied by the CAN TX task
+ * through the release time of the frame (CanDataFrame::release_us).
+ *
+ * Counters:
+ * - dropped - frame overwritten by a newer setpoint before the burst or rejected by the CAN TX queue,
+ * - late - burst started later than half of the period after the scheduled time.
+ */
+class VescGroup {
+public:
+  /// @brief Constructor for the VescGroup class
+  /// @param can CAN interface the burst is written to, the same the motors use
+  explicit VescGroup(std::shared_ptr<CanBase> can);
+
+  ~VescGroup();
+  VescGroup(const VescGroup &)            = delete;
+  VescGroup &operator=(const VescGroup &) = delete;
+
+  /// @brief Add motor to the group, only before the group is started.
+  /// @param motor motor which setpoints will be sent by the group
+  /// @param priority lower values are sent first in the burst
+  /// @return AlreadyExists if the motor is already in some group
+  Status add_motor(std::shared_ptr<VescMotor> motor, uint8_t priority = 0);
+
+  /// @brief Start the burst task.
+  /// @param period_ms period of the control cycle, usually the same as the period of the motor tasks
+  /// @param stagger_us delay between consecutive frames of the burst, 0 sends them back to back
+  Status start(uint32_t period_ms, uint32_t stagger_us = 0);
+
+  /// @brief Stop the burst task, motors keep their slots and will send nothing until restart.
+  Status stop();
+
+  /// @brief Set the delay between consecutive frames of the burst in microseconds.
+  /// @note The frames are held by the CAN TX task with the resolution of the RTOS tick, the stagger
+  /// should be a multiple of the tick period (the frames released within one tick are sent together).
+  /// The stagger of the whole burst is limited to internall::CAN_TX_MAX_RELEASE_DELAY_US and to
+  /// internall::CAN_TX_HOLD_SIZE held frames, the rest is sent immediately.
+  void set_stagger(uint32_t stagger_us);
+
+  /// @brief Number of the frames written to the CAN interface.
+  [[nodiscard]] uint32_t get_sent_count() const;
+
+  /// @brief Number of the frames overwritten before the burst or rejected by the CAN interface.
+  [[nodiscard]] uint32_t get_dropped_count() const;
+
+  /// @brief Number of bursts started too late.
+  [[nodiscard]] uint32_t get_late_count() const;
+
+  /// @brief Reset all counters.
+  void reset_counters();
+
+private:
+  friend class VescMotor;
+
+  struct Member {
+    std::shared_ptr<VescMotor> motor;
+    uint8_t priority;
+    bool pending;
+    CanDataFrame frame;
+  };
+
+  std::shared_ptr<CanBase> can;
+  std::vector<Member> members;
+  std::vector<CanDataFrame> burst;
+  SimpleTask task;
+  uint32_t period_us;
+  uint32_t stagger_us;
+  uint32_t next_burst_us;
+  bool started;
+  bool running;
+  uint32_t sent_count;
+  uint32_t dropped_count;
+  uint32_t late_count;
+
+  /// @brief Place the setpoint frame of the motor in its slot, called from VescMotor::handle.
+  /// @return Cancelled if the group is not running, the motor should then retry with the next period
+  Status submit(const VescMotor *motor, const CanDataFrame &frame);
+
+  void handle_internal();
+  static Status handle(SimpleTask &task, void *args);
+};
+
+} // namespace stmepic::motor
@@ -0,0 +1,93 @@
+#include "controler_cascade.hpp"
+#include "Timing.hpp"
+
+using namespace stmepic;
+using namespace stmepic::movement;
+
+
+CascadeController::CascadeController()
+: MovementEquation(), torque_feedforward(false), previous_time(0), previous_mode(MovementControlMode::POSITION) {
+  position_stage.decimation = 1;
+  velocity_stage.decimation = 1;
+  reset_stage(position_stage);
+  reset_stage(velocity_stage);
+}
+
+void CascadeController::set_position_stage(const stmepic::controller::PidConfig &cfg, uint16_t decimation) {
+  position_stage.pid.setConfig(cfg);
+  position_stage.decimation = decimation == 0 ? 1 : decimation;
+  reset_stage(position_stage);
+}
+
+void CascadeController::set_velocity_stage(const stmepic::controller::PidConfig &cfg, uint16_t decimation) {
+  velocity_stage.pid.setConfig(cfg);
+  velocity_stage.decimation = decimation == 0 ? 1 : decimation;
+  reset_stage(velocity_stage);
+}
+
+void CascadeController::set_torque_feedforward(bool enable) {
+  torque_feedforward = enable;
+}
+
+void CascadeController::reset_stage(Stage &stage) {
+  stage.pid.reset();
+  // so the stage runs on the first call after reset
+  stage.counter = stage.decimation - 1;
+  stage.elapsed = 0;
+  stage.output  = 0;
+}
+
+float CascadeController::step_stage(Stage &stage, float actual, float setpoint) {
+  if(++stage.counter < stage.decimation)
+    return stage.output;
+  stage.counter = 0;
+  stage.output  = (float)stage.pid.getOutput(actual, setpoint, stage.elapsed);
+  stage.elapsed = 0;
+  return stage.output;
+}
+
+MovementState CascadeController::calculate(MovementState current_state, MovementState target_state) {
+  const float current_time = Ticker::get_instance().get_seconds();
+  float dt                 = current_time - previous_time;
+  if(dt <= 0)
+    dt = 1e-6f;
+  previous_time = current_time;
+
+  // stages that were not running in the previous mode have stale state
+  if(target_state.mode != previous_mode) {
+    reset_stage(position_stage);
+    reset_stage(velocity_stage);
+    previous_mode = target_state.mode;
+  }
+  position_stage.elapsed += dt;
+  velocity_stage.elapsed += dt;
+
+  MovementState out_state = current_state;
+  switch(target_state.mode) {
+  case MovementControlMode::POSITION:
+    out_state.position = target_state.position;
+    out_state.velocity = step_stage(position_stage, current_state.position, target_state.position);
+    out_state.torque   = step_stage(velocity_stage, current_state.velocity, out_state.velocity);
+    break;
+  case MovementControlMode::VELOCITY:
+    out_state.velocity = target_state.velocity;
+    out_state.torque   = step_stage(velocity_stage, current_state.velocity, target_state.velocity);
+    break;
+  case MovementControlMode::TORQUE:
+    // torque control, nothing to cascade
+    out_state.torque = target_state.torque;
+    return out_state;
+  default: break;
+  }
+
+  if(torque_feedforward)
+    out_state.torque += target_state.torque;
+  return out_state;
+}
+
+void CascadeController::begin_state(MovementState current_state, float current_time) {
+  (void)current_state;
+  previous_time = current_time;
+  reset_stage(position_stage);
+  reset_stage(velocity_stage);
+}
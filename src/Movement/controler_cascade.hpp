@@ -0,0 +1,86 @@
+#pragma once
+#include "movement_controler.hpp"
+#include "pid.hpp"
+
+/**
+ * @file controler_cascade.hpp
+ * @brief Cascaded position/velocity controller with per-stage decimation.
+ *
+ */
+
+/**
+ * @defgroup Movement
+ * @{
+ */
+
+
+/**
+ * @defgroup Movement_Controller Controllers
+ * @{
+ */
+
+
+/**
+ * @defgroup Cascade_Controller Cascade
+ * @brief Cascaded position -> velocity -> torque controller.
+ * @{
+ */
+
+namespace stmepic::movement {
+
+/**
+ * @class CascadeController
+ * @brief Cascade of PID stages for stiff joints.
+ *
+ * The outer position stage produces the velocity setpoint for the inner velocity stage which
+ * produces the torque command, optionally with the target torque added as feedforward.
+ * Each stage runs every N-th call of calculate() (decimation), so the inner loop can run at the
+ * rate of the MovementControler task while the outer loop runs slower. Every stage integrates
+ * over the real time elapsed since its previous run using the time-aware Pid API.
+ * Everything is stored in place, no allocation happens in calculate().
+ *
+ * The returned MovementState holds the velocity command in velocity and the torque command in
+ * torque, so the MovementControler can drive the motor either in VELOCITY mode (motor closes
+ * its own velocity loop) or in TORQUE mode.
+ */
+class CascadeController : public MovementEquation {
+public:
+  CascadeController();
+
+  void begin_state(MovementState current_state, float current_time) override;
+  [[nodiscard]] MovementState calculate(MovementState current_state, MovementState target_state) override;
+
+  /// @brief Configure the outer position stage.
+  /// @param cfg PID configuration, output is the velocity setpoint in rad/s
+  /// @param decimation the stage runs every decimation-th call of calculate, minimum 1
+  void set_position_stage(const stmepic::controller::PidConfig &cfg, uint16_t decimation = 1);
+
+  /// @brief Configure the inner velocity stage.
+  /// @param cfg PID configuration, output is the torque command in Nm
+  /// @param decimation the stage runs every decimation-th call of calculate, minimum 1
+  void set_velocity_stage(const stmepic::controller::PidConfig &cfg, uint16_t decimation = 1);
+
+  /// @brief Add the target torque to the velocity stage output as feedforward.
+  /// @param enable true to add target_state.torque to the torque command
+  void set_torque_feedforward(bool enable);
+
+private:
+  struct Stage {
+    stmepic::controller::Pid pid;
+    uint16_t decimation;
+    uint16_t counter;
+    float elapsed;
+    float output;
+  };
+
+  Stage position_stage;
+  Stage velocity_stage;
+  bool torque_feedforward;
+  float previous_time;
+  MovementControlMode previous_mode;
+
+  static void reset_stage(Stage &stage);
+  static float step_stage(Stage &stage, float actual, float setpoint);
+};
+
+} // namespace stmepic::movement
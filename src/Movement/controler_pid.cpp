@@ -34,15 +34,12 @@ MovementState PIDController::calculate(MovementState current_state, MovementStat
   switch(target_state.mode) {
   case MovementControlMode::POSITION:
     // position control
-    position_pid.setSetpoint(target_state.position);
-    out_state.velocity = position_pid.getOutput(current_state.position, dt);
-    velocity_pid.setSetpoint(out_state.velocity);
-    out_state.torque = velocity_pid.getOutput(current_state.velocity, dt);
+    out_state.velocity = position_pid.getOutput(current_state.position, target_state.position, dt);
+    out_state.torque   = velocity_pid.getOutput(current_state.velocity, out_state.velocity, dt);
     break;
   case MovementControlMode::VELOCITY:
     // velocity control
-    velocity_pid.setSetpoint(target_state.velocity);
-    out_state.torque = velocity_pid.getOutput(current_state.velocity, dt);
+    out_state.torque = velocity_pid.getOutput(current_state.velocity, target_state.velocity, dt);
     break;
   case MovementControlMode::TORQUE:
     // torque control
@@ -0,0 +1,219 @@
+#include "controler_scurve.hpp"
+#include "Timing.hpp"
+#include <cmath>
+
+using namespace stmepic;
+using namespace stmepic::movement;
+
+namespace {
+// iterations of the peak velocity search, float has 24 bit mantissa so more doesn't help
+constexpr int PEAK_VELOCITY_ITERATIONS = 24;
+} // namespace
+
+SCurveProfile::SCurveProfile()
+: max_velocity(0), max_acceleration(0), max_jerk(0), segments{}, segment_count(0), current_segment(0),
+  duration(0), target(0), plan_position(0), plan_velocity(0), plan_acceleration(0) {
+}
+
+void SCurveProfile::set_limits(float max_velocity, float max_acceleration, float max_jerk) {
+  this->max_velocity     = std::abs(max_velocity);
+  this->max_acceleration = std::abs(max_acceleration);
+  this->max_jerk         = std::abs(max_jerk);
+}
+
+float SCurveProfile::velocity_change_time(float v_start, float v_end) const {
+  // time of the whole jerk up, constant acceleration, jerk down sequence
+  float dv          = std::abs(v_end - v_start);
+  float jerk_time_a = max_acceleration / max_jerk;
+  if(dv >= max_acceleration * jerk_time_a)
+    return dv / max_acceleration + jerk_time_a;
+  return 2.0f * std::sqrt(dv / max_jerk);
+}
+
+float SCurveProfile::velocity_change_distance(float v_start, float v_end) const {
+  // acceleration profile is symmetric so the mean velocity is the mean of the end velocities
+  return 0.5f * (v_start + v_end) * velocity_change_time(v_start, v_end);
+}
+
+float SCurveProfile::move_distance(float v_start, float v_peak) const {
+  return velocity_change_distance(v_start, v_peak) + velocity_change_distance(v_peak, 0.0f);
+}
+
+void SCurveProfile::push_segment(float segment_duration, float jerk) {
+  if(segment_duration <= 0.0f || segment_count >= MAX_SEGMENTS)
+    return;
+  segments[segment_count] = Segment{ duration, plan_position, plan_velocity, plan_acceleration, jerk };
+  segment_count++;
+
+  float t  = segment_duration;
+  float t2 = t * t;
+  plan_position += plan_velocity * t + plan_acceleration * t2 * 0.5f + jerk * t2 * t / 6.0f;
+  plan_velocity += plan_acceleration * t + jerk * t2 * 0.5f;
+  plan_acceleration += jerk * t;
+  duration += t;
+}
+
+void SCurveProfile::push_velocity_change(float target_velocity) {
+  float dv         = target_velocity - plan_velocity;
+  float sign       = dv >= 0.0f ? 1.0f : -1.0f;
+  dv               = std::abs(dv);
+  float jerk_time  = max_acceleration / max_jerk;
+  float accel_time = 0.0f;
+  if(dv >= max_acceleration * jerk_time)
+    accel_time = dv / max_acceleration - jerk_time;
+  else
+    jerk_time = std::sqrt(dv / max_jerk);
+
+  push_segment(jerk_time, sign * max_jerk);
+  push_segment(accel_time, 0.0f);
+  push_segment(jerk_time, -sign * max_jerk);
+  // remove the rounding error so the next segments start from exact values
+  plan_velocity     = target_velocity;
+  plan_acceleration = 0.0f;
+}
+
+Status SCurveProfile::plan(float start_position,
+                          float start_velocity,
+                          float target_position,
+                          float start_acceleration) {
+  if(max_velocity <= 0.0f || max_acceleration <= 0.0f || max_jerk <= 0.0f)
+    return Status::Invalid("S-curve limits have to be greater than 0");
+
+  segment_count     = 0;
+  current_segment   = 0;
+  duration          = 0.0f;
+  target            = target_position;
+  plan_position     = start_position;
+  plan_velocity     = start_velocity;
+  plan_acceleration = start_acceleration;
+
+  // ramp the start acceleration to 0 first, the rest of the planning expects to start without it
+  if(plan_acceleration != 0.0f) {
+    float sign = plan_acceleration > 0.0f ? 1.0f : -1.0f;
+    push_segment(std::abs(plan_acceleration) / max_jerk, -sign * max_jerk);
+    plan_acceleration = 0.0f;
+  }
+
+  float distance  = target_position - plan_position;
+  float direction = distance >= 0.0f ? 1.0f : -1.0f;
+  float v_start   = plan_velocity * direction;
+
+  // moving away from the target or too fast to stop before it, stop first and come back
+  if(v_start < 0.0f || velocity_change_distance(v_start, 0.0f) > std::abs(distance)) {
+    push_velocity_change(0.0f);
+    distance  = target_position - plan_position;
+    direction = distance >= 0.0f ? 1.0f : -1.0f;
+    v_start   = 0.0f;
+  }
+  distance = std::abs(distance);
+
+  float v_peak      = max_velocity;
+  float cruise_time = 0.0f;
+  if(move_distance(v_start, v_peak) <= distance) {
+    cruise_time = (distance - move_distance(v_start, v_peak)) / v_peak;
+  } else {
+    // the max velocity can't be reached, find the peak velocity where the axis
+    // stops exactly at the target, move_distance(v_start) <= distance is guaranteed above
+    float low  = v_start;
+    float high = max_velocity;
+    for(int i = 0; i < PEAK_VELOCITY_ITERATIONS; i++) {
+      float mid = 0.5f * (low + high);
+      if(move_distance(v_start, mid) > distance)
+        high = mid;
+      else
+        low = mid;
+    }
+    v_peak = low;
+  }
+
+  push_velocity_change(direction * v_peak);
+  push_segment(cruise_time, 0.0f);
+  push_velocity_change(0.0f);
+  return Status::OK();
+}
+
+SCurvePoint SCurveProfile::evaluate(float time) {
+  if(segment_count == 0 || time >= duration)
+    return SCurvePoint{ target, 0.0f, 0.0f };
+  if(time < 0.0f)
+    time = 0.0f;
+
+  // time mostly moves forward so the search continues from the last segment
+  if(time < segments[current_segment].start_time)
+    current_segment = 0;
+  while(current_segment + 1 < segment_count && time >= segments[current_segment + 1].start_time)
+    current_segment++;
+
+  const Segment &seg = segments[current_segment];
+  float t            = time - seg.start_time;
+  float t2           = t * t;
+  SCurvePoint point;
+  point.position     = seg.position + seg.velocity * t + seg.acceleration * t2 * 0.5f + seg.jerk * t2 * t / 6.0f;
+  point.velocity     = seg.velocity + seg.acceleration * t + seg.jerk * t2 * 0.5f;
+  point.acceleration = seg.acceleration + seg.jerk * t;
+  return point;
+}
+
+float SCurveProfile::get_duration() const {
+  return duration;
+}
+
+float SCurveProfile::get_target() const {
+  return target;
+}
+
+SCurvePosControler::SCurvePosControler() : MovementEquation() {
+  setpoint         = SCurvePoint{ 0, 0, 0 };
+  max_acceleration = 0;
+  max_jerk         = 0;
+  planned_target   = 0;
+  planned_velocity = 0;
+  plan_start_time  = 0;
+  planned          = false;
+}
+
+void SCurvePosControler::begin_state(MovementState current_state, float current_time) {
+  setpoint        = SCurvePoint{ current_state.position, current_state.velocity, 0 };
+  plan_start_time = current_time;
+  planned         = false;
+}
+
+MovementState SCurvePosControler::calculate(MovementState current_state, MovementState target_state) {
+  float current_time = Ticker::get_instance().get_seconds();
+  float max_velocity = std::abs(target_state.velocity);
+
+  if(!planned || target_state.position != planned_target || max_velocity != planned_velocity) {
+    // start from the previous setpoint so the profile stays continuous
+    float start_position = planned ? setpoint.position : current_state.position;
+    float start_velocity     = planned ? setpoint.velocity : current_state.velocity;
+    float start_acceleration = planned ? setpoint.acceleration : 0.0f;
+    profile.set_limits(max_velocity, max_acceleration, max_jerk);
+    planned =
+    profile.plan(start_position, start_velocity, target_state.position, start_acceleration).ok();
+    planned_target   = target_state.position;
+    planned_velocity = max_velocity;
+    plan_start_time  = current_time;
+    if(!planned) {
+      setpoint               = SCurvePoint{ current_state.position, 0, 0 };
+      current_state.velocity = 0;
+      return current_state;
+    }
+  }
+
+  setpoint               = profile.evaluate(current_time - plan_start_time);
+  current_state.position = setpoint.position;
+  current_state.velocity = setpoint.velocity;
+  return current_state;
+}
+
+void SCurvePosControler::set_max_acceleration(float max_acceleration) {
+  this->max_acceleration = max_acceleration;
+}
+
+void SCurvePosControler::set_max_jerk(float max_jerk) {
+  this->max_jerk = max_jerk;
+}
+
+const SCurvePoint &SCurvePosControler::get_setpoint() const {
+  return setpoint;
+}
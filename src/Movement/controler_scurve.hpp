@@ -0,0 +1,155 @@
+#pragma once
+#include "movement_controler.hpp"
+#include <array>
+#include <cstddef>
+
+
+/**
+ * @file controler_scurve.hpp
+ * @brief Jerk-limited (S-curve) trajectory generator for position control.
+ *
+ */
+
+/**
+ * @defgroup Movement
+ * @{
+ */
+
+/**
+ * @defgroup Movement_Controller Controllers
+ * @{
+ */
+
+
+/**
+ * @defgroup SCurve_Movement_Controller S-curve controller
+ * @brief Jerk-limited trajectory generator for position control.
+ * @{
+ */
+
+
+namespace stmepic::movement {
+
+/**
+ * @struct SCurvePoint
+ * @brief Single point of the S-curve profile.
+ */
+struct SCurvePoint {
+  float position;
+  float velocity;
+  float acceleration;
+};
+
+/**
+ * @class SCurveProfile
+ * @brief Precomputed jerk-limited motion profile.
+ *
+ * The profile is planned once by plan() as a list of constant-jerk segments:
+ * the classic 7 segments (jerk up, constant acceleration, jerk down, cruise and the same
+ * to stop) plus optional 3 segments in front of them when the profile starts with a velocity
+ * that would overshoot the target and the axis has to stop first. When the profile starts with
+ * non-zero acceleration (replanning while accelerating) the first segment ramps it to 0 with
+ * the max jerk, so the acceleration stays continuous.
+ * After planning the point at any time is evaluated in O(1) with closed-form polynomials.
+ */
+class SCurveProfile {
+public:
+  SCurveProfile();
+
+  /// @brief Set the limits of the profile
+  /// @param max_velocity maximum velocity in rad/s
+  /// @param max_acceleration maximum acceleration in rad/s^2
+  /// @param max_jerk maximum jerk in rad/s^3
+  void set_limits(float max_velocity, float max_acceleration, float max_jerk);
+
+  /// @brief Plan the profile from the start state to the target position where the axis stops.
+  /// @param start_position position at time 0 in rad
+  /// @param start_velocity velocity at time 0 in rad/s
+  /// @param target_position position where the profile ends in rad
+  /// @param start_acceleration acceleration at time 0 in rad/s^2
+  /// @return Status::Invalid if the limits are not set
+  Status
+  plan(float start_position, float start_velocity, float target_position, float start_acceleration = 0.0f);
+
+  /// @brief Evaluate the profile.
+  /// @param time time from the start of the profile in seconds
+  /// @return position, velocity and acceleration at the time, after the end it returns the target at rest
+  [[nodiscard]] SCurvePoint evaluate(float time);
+
+  /// @brief Get the total duration of the profile in seconds
+  [[nodiscard]] float get_duration() const;
+
+  /// @brief Get the target position of the profile in rad
+  [[nodiscard]] float get_target() const;
+
+private:
+  struct Segment {
+    float start_time;
+    float position;
+    float velocity;
+    float acceleration;
+    float jerk;
+  };
+
+  static constexpr size_t MAX_SEGMENTS = 11;
+
+  float max_velocity;
+  float max_acceleration;
+  float max_jerk;
+
+  std::array<Segment, MAX_SEGMENTS> segments;
+  size_t segment_count;
+  size_t current_segment;
+  float duration;
+  float target;
+
+  // state at the end of the planned segments, used while planning
+  float plan_position;
+  float plan_velocity;
+  float plan_acceleration;
+
+  void push_segment(float segment_duration, float jerk);
+  void push_velocity_change(float target_velocity);
+  [[nodiscard]] float velocity_change_time(float v_start, float v_end) const;
+  [[nodiscard]] float velocity_change_distance(float v_start, float v_end) const;
+  [[nodiscard]] float move_distance(float v_start, float v_peak) const;
+};
+
+/**
+ * @class SCurvePosControler
+ * @brief Position controler that follows jerk-limited S-curve profile.
+ *
+ * The profile is planned only when the target position or the velocity limit changes and is then
+ * evaluated from the time elapsed since planning, so the output doesn't depend on the jitter of
+ * the MovementControler task. New target while moving is planned from the current profile state
+ * so the velocity and the acceleration stay continuous. The max velocity is taken from
+ * the target_state.velocity same as in BasicLinearPosControler.
+ */
+class SCurvePosControler : public MovementEquation {
+public:
+  SCurvePosControler();
+
+  void begin_state(MovementState current_state, float current_time) override;
+  [[nodiscard]] MovementState calculate(MovementState current_state, MovementState target_state) override;
+
+  /// @brief Set the max acceleration in rad/s^2
+  void set_max_acceleration(float max_acceleration);
+
+  /// @brief Set the max jerk in rad/s^3
+  void set_max_jerk(float max_jerk);
+
+  /// @brief Get the last evaluated point of the profile including the acceleration
+  [[nodiscard]] const SCurvePoint &get_setpoint() const;
+
+private:
+  SCurveProfile profile;
+  SCurvePoint setpoint;
+  float max_acceleration;
+  float max_jerk;
+  float planned_target;
+  float planned_velocity;
+  float plan_start_time;
+  bool planned;
+};
+
+} // namespace stmepic::movement
@@ -0,0 +1,298 @@
+#include "trajectory_executor.hpp"
+#include "Timing.hpp"
+#include <algorithm>
+#include <cmath>
+
+using namespace stmepic;
+using namespace stmepic::movement;
+
+namespace {
+// the blended end velocities change with the segment time, the stretch is repeated until all axes fit
+constexpr size_t SEGMENT_STRETCH_ITERATIONS = 8;
+// small extra stretch so the iterations end within the limits instead of approaching them from above
+constexpr float SEGMENT_STRETCH_MARGIN = 1.01f;
+} // namespace
+
+
+TrajectoryExecutor::TrajectoryExecutor()
+: axes{}, axes_count(0), control_mode(MovementControlMode::POSITION), segment_start_time(0),
+  segment_duration(0), last_timestamp(0), stream_time(0), stream_base_time(0), segment_active(false), initialized(false),
+  enable(false), stop_requested(false) {
+  task.task_init(handle, this, 1, nullptr, 300, tskIDLE_PRIORITY + 2, "TrajectoryExecutor");
+}
+
+TrajectoryExecutor::~TrajectoryExecutor() {
+  (void)task.task_stop();
+  if(initialized)
+    for(size_t i = 0; i < axes_count; i++)
+      axes[i].motor->set_enable(false);
+}
+
+Status TrajectoryExecutor::add_axis(std::shared_ptr<motor::MotorBase> motor, float max_velocity, float max_acceleration) {
+  if(initialized)
+    return Status::Invalid("TrajectoryExecutor: axes can't be added after init");
+  if(motor == nullptr)
+    return Status::Invalid("TrajectoryExecutor: motor is nullptr");
+  if(axes_count >= MAX_AXES)
+    return Status::CapacityError("TrajectoryExecutor: too many axes");
+  Axis &axis            = axes[axes_count];
+  axis                  = Axis{};
+  axis.motor            = motor;
+  axis.max_velocity     = std::abs(max_velocity);
+  axis.max_acceleration = std::abs(max_acceleration);
+  axes_count++;
+  return Status::OK();
+}
+
+Status TrajectoryExecutor::init(MovementControlMode _control_mode, uint32_t period_ms) {
+  if(axes_count == 0)
+    return Status::Invalid("TrajectoryExecutor: no axes added");
+  if(_control_mode == MovementControlMode::TORQUE)
+    return Status::Invalid("TrajectoryExecutor: torque mode is not supported");
+  (void)task.task_stop();
+  control_mode = _control_mode;
+  for(size_t i = 0; i < axes_count; i++)
+    axes[i].position = axes[i].motor->get_absolute_position();
+  hold();
+  queue.clear();
+  segment_active = false;
+  last_timestamp   = 0;
+  stream_time      = 0;
+  stream_base_time = 0;
+  initialized      = true;
+  task.task_set_period(period_ms);
+  return task.task_run();
+}
+
+Status TrajectoryExecutor::push_waypoint(const TrajectoryPoint &point) {
+  if(!queue.push(point))
+    return Status::CapacityError("TrajectoryExecutor: lookahead queue is full");
+  return Status::OK();
+}
+
+void TrajectoryExecutor::stop() {
+  stop_requested = true;
+}
+
+void TrajectoryExecutor::set_enable(bool enable) {
+  this->enable = enable;
+}
+
+size_t TrajectoryExecutor::get_free_space() const {
+  return queue.capacity() - queue.size();
+}
+
+bool TrajectoryExecutor::is_idle() const {
+  return !segment_active && queue.empty();
+}
+
+float TrajectoryExecutor::get_setpoint(size_t axis) const {
+  if(axis >= axes_count)
+    return 0;
+  return axes[axis].position;
+}
+
+float TrajectoryExecutor::get_stream_time() const {
+  return stream_time;
+}
+
+float TrajectoryExecutor::axis_min_time(const Axis &axis, float distance) {
+  // cubic rest to rest move has peak velocity 1.5 d/T and peak acceleration 6 d/T^2,
+  // the segments with the blended velocities are checked by axis_stretch
+  distance   = std::abs(distance);
+  float time = 0;
+  if(axis.max_velocity > 0)
+    time = 1.5f * distance / axis.max_velocity;
+  if(axis.max_acceleration > 0)
+    time = std::max(time, std::sqrt(6.0f * distance / axis.max_acceleration));
+  return time;
+}
+
+float TrajectoryExecutor::axis_stretch(const Axis &axis, float duration) {
+  if(duration <= 0)
+    return 1;
+  // acceleration of the cubic Hermite curve is linear in s so it peaks at one of the ends,
+  // the velocity peaks at the end or where the acceleration crosses zero,
+  // the start velocity was already checked as the end velocity of the previous segment
+  const float T       = duration;
+  const float d       = axis.end_position - axis.start_position;
+  const float m0      = axis.start_velocity * T;
+  const float m1      = axis.end_velocity * T;
+  const float a0      = (6 * d - 4 * m0 - 2 * m1) / (T * T);
+  const float a1      = (-6 * d + 2 * m0 + 4 * m1) / (T * T);
+  float peak_velocity = std::abs(axis.end_velocity);
+  if(a0 * a1 < 0) {
+    const float s = a0 / (a0 - a1);
+    const float v = ((6 * s * s - 6 * s) * -d + (3 * s * s - 4 * s + 1) * m0 + (3 * s * s - 2 * s) * m1) / T;
+    peak_velocity = std::max(peak_velocity, std::abs(v));
+  }
+  // the distance terms shrink with T, the terms of the waypoint velocities don't (velocity)
+  // or only with 1/T (acceleration)
+  float stretch = 1;
+  if(axis.max_velocity > 0)
+    stretch = std::max(stretch, peak_velocity / axis.max_velocity);
+  if(axis.max_acceleration > 0 && std::max(std::abs(a0), std::abs(a1)) > axis.max_acceleration) {
+    // |6d| / T^2 + |velocity terms| / T <= max_acceleration bounds both ends,
+    // the blended end velocity only drops when T grows
+    const float c = 6 * std::abs(d);
+    const float b = std::max(std::abs(4 * axis.start_velocity + 2 * axis.end_velocity),
+                             std::abs(2 * axis.start_velocity + 4 * axis.end_velocity));
+    const float A = axis.max_acceleration;
+    stretch       = std::max(stretch, (b + std::sqrt(b * b + 4 * A * c)) / (2 * A * T));
+  }
+  return stretch;
+}
+
+void TrajectoryExecutor::blend_end_velocities(const TrajectoryPoint *next,
+                                              float duration,
+                                              float next_duration) {
+  for(size_t i = 0; i < axes_count; i++) {
+    Axis &axis        = axes[i];
+    axis.end_velocity = 0;
+    if(next == nullptr || duration + next_duration <= 0)
+      continue;
+    float current_distance = axis.end_position - axis.start_position;
+    float next_distance    = next->positions[i] - axis.end_position;
+    // keep moving through the waypoint only if the axis doesn't turn back there
+    if(current_distance * next_distance > 0)
+      axis.end_velocity = (next->positions[i] - axis.start_position) / (duration + next_duration);
+  }
+}
+
+void TrajectoryExecutor::hold() {
+  for(size_t i = 0; i < axes_count; i++) {
+    Axis &axis          = axes[i];
+    axis.start_position = axis.position;
+    axis.end_position   = axis.position;
+    axis.start_velocity = 0;
+    axis.end_velocity   = 0;
+    axis.velocity       = 0;
+  }
+}
+
+bool TrajectoryExecutor::start_segment(float start_time) {
+  TrajectoryPoint point;
+  if(!queue.pop(point))
+    return false;
+
+  float duration = point.timestamp - last_timestamp;
+  for(size_t i = 0; i < axes_count; i++)
+    duration = std::max(duration, axis_min_time(axes[i], point.positions[i] - axes[i].start_position));
+  last_timestamp = point.timestamp;
+
+  // lookahead, rest to rest time of the next segment, its own stretch is known only when it starts
+  const TrajectoryPoint *next = queue.peek();
+  float next_duration         = 0;
+  if(next != nullptr) {
+    next_duration = next->timestamp - point.timestamp;
+    for(size_t i = 0; i < axes_count; i++)
+      next_duration = std::max(next_duration, axis_min_time(axes[i], next->positions[i] - point.positions[i]));
+  }
+
+  for(size_t i = 0; i < axes_count; i++)
+    axes[i].end_position = point.positions[i];
+  blend_end_velocities(next, duration, next_duration);
+
+  // the rest to rest time doesn't cover the velocities at the waypoints, the curve with them can
+  // overshoot the limits, stretch the segment (which also lowers the blended end velocities)
+  for(size_t iteration = 0; iteration < SEGMENT_STRETCH_ITERATIONS; iteration++) {
+    float stretch = 1;
+    for(size_t i = 0; i < axes_count; i++)
+      stretch = std::max(stretch, axis_stretch(axes[i], duration));
+    if(stretch <= 1)
+      break;
+    duration *= stretch * SEGMENT_STRETCH_MARGIN;
+    blend_end_velocities(next, duration, next_duration);
+  }
+
+  segment_start_time = start_time;
+  segment_duration   = duration;
+  segment_active     = true;
+  return true;
+}
+
+void TrajectoryExecutor::step(float current_time) {
+  if(stop_requested.exchange(false)) {
+    queue.clear();
+    hold();
+    segment_active = false;
+  }
+
+  for(size_t i = 0; i < axes_count; i++) {
+    if(!axes[i].motor->device_get_status().ok()) {
+      // single failing axis would break the synchronization so all of them are stopped
+      enable = false;
+      queue.clear();
+      hold();
+      segment_active = false;
+      break;
+    }
+  }
+
+  if(!segment_active && !start_segment(current_time)) {
+    set_motors();
+    return;
+  }
+
+  float time = current_time - segment_start_time;
+  while(time >= segment_duration) {
+    // chain the segments on the planned time not on the task time so the axes don't drift
+    stream_base_time += segment_duration;
+    for(size_t i = 0; i < axes_count; i++) {
+      axes[i].start_position = axes[i].end_position;
+      axes[i].start_velocity = axes[i].end_velocity;
+      axes[i].position       = axes[i].end_position;
+      axes[i].velocity       = 0;
+    }
+    if(!start_segment(segment_start_time + segment_duration)) {
+      segment_active = false;
+      set_motors();
+      return;
+    }
+    time = current_time - segment_start_time;
+  }
+
+  // cubic Hermite curve between the waypoints
+  float T    = segment_duration;
+  float s    = time / T;
+  float s2   = s * s;
+  float s3   = s2 * s;
+  float h00  = 2 * s3 - 3 * s2 + 1;
+  float h10  = s3 - 2 * s2 + s;
+  float h01  = -2 * s3 + 3 * s2;
+  float h11  = s3 - s2;
+  float dh00 = 6 * s2 - 6 * s;
+  float dh10 = 3 * s2 - 4 * s + 1;
+  float dh11 = 3 * s2 - 2 * s;
+  for(size_t i = 0; i < axes_count; i++) {
+    Axis &axis    = axes[i];
+    float p0      = axis.start_position;
+    float p1      = axis.end_position;
+    float m0      = axis.start_velocity * T;
+    float m1      = axis.end_velocity * T;
+    axis.position = h00 * p0 + h10 * m0 + h01 * p1 + h11 * m1;
+    axis.velocity = (dh00 * (p0 - p1) + dh10 * m0 + dh11 * m1) / T;
+  }
+  stream_time = stream_base_time + time;
+  set_motors();
+}
+
+void TrajectoryExecutor::set_motors() {
+  for(size_t i = 0; i < axes_count; i++) {
+    Axis &axis = axes[i];
+    axis.motor->set_enable(enable);
+    if(control_mode == MovementControlMode::VELOCITY)
+      axis.motor->set_velocity(axis.velocity);
+    else
+      axis.motor->set_position(axis.position);
+  }
+}
+
+Status TrajectoryExecutor::handle(SimpleTask &task, void *args) {
+  (void)task;
+  if(args == nullptr)
+    return Status::Invalid("TrajectoryExecutor::handle: args is nullptr");
+  auto executor = static_cast<TrajectoryExecutor *>(args);
+  executor->step(Ticker::get_instance().get_seconds());
+  return Status::OK();
+}
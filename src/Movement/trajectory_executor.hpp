@@ -0,0 +1,148 @@
+#pragma once
+#include "movement_controler.hpp"
+#include "spsc_queue.hpp"
+#include <array>
+#include <atomic>
+#include <memory>
+
+
+/**
+ * @file trajectory_executor.hpp
+ * @brief Synchronized multi-axis trajectory executor with lookahead buffer.
+ *
+ */
+
+/**
+ * @defgroup Movement
+ * @{
+ */
+
+/**
+ * @defgroup Trajectory_Executor Trajectory executor
+ * @brief Streams waypoints to several motors and keeps the axes synchronized.
+ * @{
+ */
+
+
+namespace stmepic::movement {
+
+/// @brief Max number of axes handled by single TrajectoryExecutor
+constexpr size_t TRAJECTORY_MAX_AXES = 8;
+
+/**
+ * @struct TrajectoryPoint
+ * @brief Single waypoint of multi-axis trajectory.
+ */
+struct TrajectoryPoint {
+  /// @brief Time in seconds from the start of the stream when the axes should reach the waypoint.
+  /// If the axes can't make it in time because of their limits the segment is stretched and
+  /// the following waypoints are delayed by the same amount.
+  float timestamp;
+  /// @brief Target positions of the axes in rad, the order is the same as the order of add_axis calls.
+  std::array<float, TRAJECTORY_MAX_AXES> positions;
+};
+
+/**
+ * @class TrajectoryExecutor
+ * @brief Executes stream of waypoints on several motors from single task.
+ *
+ * Waypoints are pushed from any single task to a lock-free lookahead queue. The executor task
+ * takes them one by one, computes the segment time as the longest of the requested time and
+ * the minimal time of every axis (from its max velocity and acceleration, including the velocities
+ * at the waypoints) so all axes start and reach every waypoint together.
+ * Each axis follows cubic Hermite curve between the waypoints.
+ * When the next waypoint is already in the queue the velocity at the waypoint is blended from
+ * both segments so the motion doesn't stop at every waypoint, otherwise the axes stop there.
+ *
+ * Time is taken from the Ticker and the segment start times are accumulated not sampled,
+ * so jitter of the task doesn't drift the axes apart.
+ */
+class TrajectoryExecutor {
+public:
+  static constexpr size_t MAX_AXES       = TRAJECTORY_MAX_AXES;
+  static constexpr size_t LOOKAHEAD_SIZE = 16;
+
+  TrajectoryExecutor();
+  ~TrajectoryExecutor();
+
+  /// @brief Add axis to the executor, has to be called before init.
+  /// @param motor motor of the axis
+  /// @param max_velocity max velocity of the axis in rad/s used to stretch segments
+  /// @param max_acceleration max acceleration of the axis in rad/s^2 used to stretch segments
+  /// @return Status::CapacityError if there are already MAX_AXES axes, Status::Invalid if the executor is running
+  Status add_axis(std::shared_ptr<motor::MotorBase> motor, float max_velocity, float max_acceleration);
+
+  /// @brief Start the executor task, the axes hold their current positions until waypoints arrive.
+  /// @param control_mode POSITION sends positions to the motors, VELOCITY sends the trajectory velocity
+  /// @param period_ms period of the executor task
+  Status init(MovementControlMode control_mode, uint32_t period_ms = 1);
+
+  /// @brief Add waypoint to the lookahead queue, can be called only from single task.
+  /// @return Status::CapacityError if the queue is full
+  Status push_waypoint(const TrajectoryPoint &point);
+
+  /// @brief Drop all queued waypoints and stop the axes at the current positions.
+  void stop();
+
+  /// @brief Enable or disable all motors
+  void set_enable(bool enable);
+
+  /// @brief Get number of waypoints that can still be pushed
+  [[nodiscard]] size_t get_free_space() const;
+
+  /// @brief True if there is no segment being executed and the queue is empty
+  [[nodiscard]] bool is_idle() const;
+
+  /// @brief Get the position commanded to the axis in the last step
+  [[nodiscard]] float get_setpoint(size_t axis) const;
+
+  /// @brief Get the time of the stream in seconds, includes stretching of the segments.
+  [[nodiscard]] float get_stream_time() const;
+
+  /// @brief Make one step of the executor, called by the task. Exposed for custom scheduling.
+  /// @param current_time current time in seconds
+  void step(float current_time);
+
+private:
+  struct Axis {
+    std::shared_ptr<motor::MotorBase> motor;
+    float max_velocity;
+    float max_acceleration;
+    float start_position;
+    float end_position;
+    float start_velocity;
+    float end_velocity;
+    float position;
+    float velocity;
+  };
+
+  std::array<Axis, MAX_AXES> axes;
+  size_t axes_count;
+  algorithm::SpscQueue<TrajectoryPoint, LOOKAHEAD_SIZE> queue;
+  SimpleTask task;
+  MovementControlMode control_mode;
+
+  float segment_start_time;
+  float segment_duration;
+  float last_timestamp;
+  float stream_time;
+  float stream_base_time;
+  bool segment_active;
+  bool initialized;
+  bool enable;
+  std::atomic<bool> stop_requested;
+
+  /// @brief Min time of the rest to rest move of the axis over the distance.
+  [[nodiscard]] static float axis_min_time(const Axis &axis, float distance);
+  /// @brief Factor the segment has to be stretched by so the axis with its start and end velocities
+  /// stays within its limits, 1 if it already does.
+  [[nodiscard]] static float axis_stretch(const Axis &axis, float duration);
+  void blend_end_velocities(const TrajectoryPoint *next, float duration, float next_duration);
+  bool start_segment(float start_time);
+  void hold();
+  void set_motors();
+
+  static Status handle(SimpleTask &task, void *args);
+};
+
+} // namespace stmepic::movement
@@ -12,11 +12,13 @@ uint32_t stmepic::frequency_to_period_us(float frequency) {
   return (uint32_t)(1000000.0f / frequency);
 }
 
-Ticker::Ticker() : tick_millis(0), tick_micros(0), timer(nullptr), timer2(nullptr) {
+Ticker::Ticker() : tick_millis(0), tick_millis_overflows(0), tick_micros(0), timer(nullptr), timer2(nullptr) {
 }
 
 void Ticker::irq_update_ticker() {
   tick_millis++;
+  if(tick_millis == 0)
+    tick_millis_overflows++;
   tick_micros = tick_millis * 1000;
 }
 
@@ -29,10 +31,11 @@ Ticker &Ticker::get_instance() {
 }
 
 void Ticker::init(TIM_HandleTypeDef *_timer, TIM_HandleTypeDef *_timer2) {
-  timer       = _timer;
-  timer2      = _timer2;
-  tick_micros = 0;
-  tick_millis = 0;
+  timer                 = _timer;
+  timer2                = _timer2;
+  tick_micros           = 0;
+  tick_millis           = 0;
+  tick_millis_overflows = 0;
 
   //
 }
@@ -46,6 +49,35 @@ uint32_t Ticker::get_micros() {
   return mic;
 }
 
+uint32_t Ticker::get_micros_from_isr() {
+  if(timer == nullptr)
+    return 0;
+  UBaseType_t saved = taskENTER_CRITICAL_FROM_ISR();
+  uint32_t mic      = (uint32_t)timer->Instance->CNT + tick_micros;
+  taskEXIT_CRITICAL_FROM_ISR(saved);
+  return mic;
+}
+
+uint64_t Ticker::get_micros64() {
+  if(timer == nullptr)
+    return 0;
+  vPortEnterCritical();
+  const uint64_t millis = ((uint64_t)tick_millis_overflows << 32) | tick_millis;
+  uint64_t mic          = millis * 1000 + (uint32_t)timer->Instance->CNT;
+  vPortExitCritical();
+  return mic;
+}
+
+uint64_t Ticker::get_micros64_from_isr() {
+  if(timer == nullptr)
+    return 0;
+  UBaseType_t saved     = taskENTER_CRITICAL_FROM_ISR();
+  const uint64_t millis = ((uint64_t)tick_millis_overflows << 32) | tick_millis;
+  uint64_t mic          = millis * 1000 + (uint32_t)timer->Instance->CNT;
+  taskEXIT_CRITICAL_FROM_ISR(saved);
+  return mic;
+}
+
 uint32_t Ticker::get_millis() const {
   return tick_millis;
 }
@@ -58,6 +58,18 @@ public:
   /// @return  current time in microseconds [us]
   uint32_t get_micros();
 
+  /// @brief Get current time in microseconds, version safe to call from interrupts
+  /// @return  current time in microseconds [us]
+  uint32_t get_micros_from_isr();
+
+  /// @brief Get current time in microseconds as 64 bit value that doesn't overflow like get_micros
+  /// @return  current time in microseconds [us], the lower 32 bits are equal to get_micros
+  uint64_t get_micros64();
+
+  /// @brief Get current 64 bit time in microseconds, version safe to call from interrupts
+  /// @return  current time in microseconds [us]
+  uint64_t get_micros64_from_isr();
+
   /// @brief get time in milliseconds
   /// @return current time in milliseconds [ms]
   uint32_t get_millis() const;
@@ -81,6 +93,7 @@ public:
 
 private:
   uint32_t tick_millis;
+  uint32_t tick_millis_overflows;
   uint32_t tick_micros;
   TIM_HandleTypeDef *timer;
   TIM_HandleTypeDef *timer2;
@@ -0,0 +1,73 @@
+#include "timer_config.hpp"
+#include <utility>
+
+using namespace stmepic;
+
+namespace {
+/// TIMPRE set: timers get HCLK up to the APB prescaler 4 and 4 times the APB clock above it
+bool timer_prescaler_selection() {
+#if defined(RCC_CFGR_TIMPRE)
+  return (RCC->CFGR & RCC_CFGR_TIMPRE) != 0; // H7
+#elif defined(RCC_CFGR1_TIMPRE)
+  return (RCC->CFGR1 & RCC_CFGR1_TIMPRE) != 0; // H5
+#elif defined(RCC_DCKCFGR_TIMPRE)
+  return (RCC->DCKCFGR & RCC_DCKCFGR_TIMPRE) != 0; // F4 with the dedicated clock config
+#elif defined(RCC_DCKCFGR1_TIMPRE)
+  return (RCC->DCKCFGR1 & RCC_DCKCFGR1_TIMPRE) != 0; // F7
+#else
+  return false;
+#endif
+}
+
+bool timer_on_apb2(uintptr_t address) {
+  // TIM1, TIM8, TIM15.. are on the APB2 bus the rest on APB1, on H7 these are the D2 domain buses
+#if defined(D2_APB2PERIPH_BASE)
+  const uintptr_t base = D2_APB2PERIPH_BASE;
+#else
+  const uintptr_t base = APB2PERIPH_BASE;
+#endif
+#if defined(APB2PERIPH_BASE_S)
+  // secure alias of the peripherals on H5, U5
+  if(address >= APB2PERIPH_BASE_S && address < APB2PERIPH_BASE_S + 0x10000)
+    return true;
+#endif
+  return address >= base && address < base + 0x10000;
+}
+} // namespace
+
+uint32_t stmepic::get_timer_clock(const TIM_HandleTypeDef &htim) {
+  const bool apb2     = timer_on_apb2(reinterpret_cast<uintptr_t>(htim.Instance));
+  const uint32_t hclk = HAL_RCC_GetHCLKFreq();
+  const uint32_t pclk = apb2 ? HAL_RCC_GetPCLK2Freq() : HAL_RCC_GetPCLK1Freq();
+  if(pclk == 0)
+    return 0;
+  // the APB clock is HCLK divided by power of 2, the HAL takes it from the PPRE (D2PPRE on H7) bits
+  const uint32_t apb_divider = hclk / pclk;
+  if(timer_prescaler_selection())
+    return apb_divider <= 4 ? hclk : pclk * 4;
+  return apb_divider == 1 ? pclk : pclk * 2;
+}
+
+float stmepic::get_timer_count_frequency(const TIM_HandleTypeDef &htim) {
+  return (float)get_timer_clock(htim) / (float)(htim.Instance->PSC + 1);
+}
+
+Result<TimerConfig> stmepic::timer_config_solve(const TIM_HandleTypeDef &htim,
+                                                double frequency,
+                                                uint32_t max_period,
+                                                uint32_t min_period_counts) {
+  TimerConfig config = timer_config_from_frequency(get_timer_clock(htim), frequency, max_period, min_period_counts);
+  if(!config.valid)
+    return Status::Invalid("Timer frequency out of range for the timer clock");
+  return Result<TimerConfig>::OK(std::move(config));
+}
+
+Status stmepic::timer_config_apply(TIM_HandleTypeDef &htim, const TimerConfig &config) {
+  if(!config.valid)
+    return Status::Invalid("Timer config is not valid");
+  // Init is updated too so HAL_TIM_*_Init called later doesn't bring back the old values
+  htim.Init.Prescaler = config.prescaler;
+  __HAL_TIM_SET_PRESCALER(&htim, config.prescaler);
+  __HAL_TIM_SET_AUTORELOAD(&htim, config.period);
+  return Status::OK();
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "stmepic.hpp"
+#include "status.hpp"
+#include <cstdint>
+
+/**
+ * @file timer_config.hpp
+ * @brief Prescaler and period solver for the hardware timers.
+ *
+ */
+
+/**
+ * @defgroup Timing
+ * @{
+ */
+
+namespace stmepic {
+
+/// @brief Max period (ARR register value) of 16 bit timer
+constexpr uint32_t TIMER_MAX_PERIOD_16BIT = 0xFFFF;
+
+/// @brief Max period (ARR register value) of 32 bit timer
+constexpr uint32_t TIMER_MAX_PERIOD_32BIT = 0xFFFFFFFF;
+
+/// @brief Max prescaler (PSC register value) of the timers, the same for all timers
+constexpr uint32_t TIMER_MAX_PRESCALER = 0xFFFF;
+
+/**
+ * @struct TimerConfig
+ * @brief Prescaler and period of the timer.
+ *
+ * Values are the register values so the timer frequency is
+ * timer_clock / ((prescaler + 1) * (period + 1)).
+ */
+struct TimerConfig {
+  uint32_t prescaler; ///< PSC register value
+  uint32_t period;    ///< ARR register value
+  double frequency;   ///< frequency achieved with the prescaler and period in Hz
+  bool valid;         ///< false if the frequency can't be achieved with the timer
+};
+
+/**
+ * @brief Find the timer prescaler and period for the frequency.
+ *
+ * Solved in closed form, the prescaler is the smallest one for which the period fits into the
+ * timer, which gives the highest possible duty resolution, and the period is rounded to the closest
+ * value so the frequency error is at most half of the period count.
+ * Can be evaluated at compile time when the timer clock is known.
+ *
+ * @param timer_clock clock of the timer in Hz, see get_timer_clock
+ * @param frequency target frequency in Hz
+ * @param max_period max ARR value of the timer, can be lowered to limit the resolution
+ * @param min_period_counts min number of timer counts in one period (duty resolution), if it can't be
+ * achieved the config is not valid
+ * @return TimerConfig, TimerConfig::valid is false if the frequency is too high or too low for the timer
+ */
+constexpr TimerConfig timer_config_from_frequency(uint32_t timer_clock,
+                                                  double frequency,
+                                                  uint32_t max_period        = TIMER_MAX_PERIOD_16BIT,
+                                                  uint32_t min_period_counts = 1) {
+  TimerConfig config{ 0, 0, 0, false };
+  if(frequency <= 0 || timer_clock == 0 || max_period == 0)
+    return config;
+
+  // total number of timer clock cycles in one period
+  const uint64_t counts = static_cast<uint64_t>(static_cast<double>(timer_clock) / frequency + 0.5);
+  if(counts == 0)
+    return config;
+
+  const uint64_t max_counts = static_cast<uint64_t>(max_period) + 1;
+  const uint64_t divider    = (counts + max_counts - 1) / max_counts;
+  if(divider > static_cast<uint64_t>(TIMER_MAX_PRESCALER) + 1)
+    return config;
+
+  uint64_t period_counts = (counts + divider / 2) / divider;
+  if(period_counts > max_counts)
+    period_counts = max_counts;
+  if(period_counts < min_period_counts || period_counts == 0)
+    return config;
+
+  config.prescaler = static_cast<uint32_t>(divider - 1);
+  config.period    = static_cast<uint32_t>(period_counts - 1);
+  config.frequency = static_cast<double>(timer_clock) / static_cast<double>(divider * period_counts);
+  config.valid     = true;
+  return config;
+}
+
+/**
+ * @brief Get the clock of the timer.
+ *
+ * Timers are clocked from their APB bus clock (D2 domain APB on H7) which is multiplied by 2 when
+ * the APB prescaler is not 1, so it's not always the same as HCLK or SYSCLK. With the TIMPRE bit
+ * (F4, F7, H5, H7) the timers get HCLK up to the APB prescaler 4 and 4 times the APB clock above it.
+ * When the timer clock is known otherwise pass it directly to timer_config_from_frequency.
+ * @param htim timer handle
+ * @return clock of the timer in Hz
+ */
+uint32_t get_timer_clock(const TIM_HandleTypeDef &htim);
+
+/**
+ * @brief Get the frequency of the timer counter with the prescaler currently set in the timer.
+ * @param htim timer handle
+ * @return frequency of single timer count in Hz
+ */
+float get_timer_count_frequency(const TIM_HandleTypeDef &htim);
+
+/**
+ * @brief Find the timer prescaler and period for the frequency using the clock of the timer.
+ * @param htim timer handle
+ * @param frequency target frequency in Hz
+ * @param max_period max ARR value of the timer
+ * @param min_period_counts min number of timer counts in one period
+ * @return TimerConfig or Status::Invalid if the frequency can't be achieved
+ */
+Result<TimerConfig> timer_config_solve(const TIM_HandleTypeDef &htim,
+                                       double frequency,
+                                       uint32_t max_period        = TIMER_MAX_PERIOD_16BIT,
+                                       uint32_t min_period_counts = 1);
+
+/**
+ * @brief Write the prescaler and period to the timer.
+ * @param htim timer handle
+ * @param config valid config
+ */
+Status timer_config_apply(TIM_HandleTypeDef &htim, const TimerConfig &config);
+
+} // namespace stmepic
@@ -0,0 +1,130 @@
+#!/usr/bin/env python3
+"""Generate the CanSignal definitions (src/Hardware/can_signal.hpp) from a DBC file.
+
+Every message becomes a namespace with its frame id, length and one constexpr CanSignal per signal:
+
+    python3 tools/dbc2signals.py vesc.dbc -o vesc_signals.hpp -n vesc
+
+Multiplexed signals are generated as plain signals, the multiplexer value has to be checked by the user.
+"""
+
+import argparse
+import re
+import sys
+
+MESSAGE_RE = re.compile(r"^BO_\s+(\d+)\s+(\w+)\s*:\s*(\d+)\s+(\w+)")
+SIGNAL_RE = re.compile(
+    r"^SG_\s+(\w+)\s*(M|m\d+)?\s*:\s*(\d+)\|(\d+)@([01])([+-])\s*"
+    r"\(\s*([-+0-9.eE]+)\s*,\s*([-+0-9.eE]+)\s*\)\s*"
+    r"\[\s*([-+0-9.eE]+)\s*\|\s*([-+0-9.eE]+)\s*\]\s*\"([^\"]*)\""
+)
+
+# DBC marks the extended ids with the bit 31
+DBC_EXTENDED_FLAG = 0x80000000
+
+
+def parse_dbc(text):
+    messages = []
+    message = None
+    for line in text.splitlines():
+        line = line.strip()
+        match = MESSAGE_RE.match(line)
+        if match:
+            raw_id = int(match.group(1))
+            message = {
+                "name": match.group(2),
+                "frame_id": raw_id & ~DBC_EXTENDED_FLAG,
+                "extended": bool(raw_id & DBC_EXTENDED_FLAG),
+                "length": int(match.group(3)),
+                "signals": [],
+            }
+            messages.append(message)
+            continue
+        match = SIGNAL_RE.match(line)
+        if match and message is not None:
+            message["signals"].append({
+                "name": match.group(1),
+                "start_bit": int(match.group(3)),
+                "length": int(match.group(4)),
+                "big_endian": match.group(5) == "0",
+                "signed": match.group(6) == "-",
+                "scale": float(match.group(7)),
+                "offset": float(match.group(8)),
+                "minimum": match.group(9),
+                "maximum": match.group(10),
+                "unit": match.group(11),
+            })
+        elif not line.startswith("SG_"):
+            message = None
+    return messages
+
+
+def identifier(name):
+    name = re.sub(r"\W", "_", name)
+    return name if not name[0].isdigit() else "_" + name
+
+
+def float_literal(value):
+    text = repr(float(value))
+    if "e" not in text and "." not in text:
+        text += ".0"
+    return text + "f"
+
+
+def generate(messages, namespace, source):
+    out = []
+    out.append("#pragma once")
+    out.append("")
+    out.append('#include "can_signal.hpp"')
+    out.append("")
+    out.append("/**")
+    out.append(" * @file")
+    out.append(" * @brief CAN signals generated by tools/dbc2signals.py from %s, don't edit." % source)
+    out.append(" */")
+    out.append("")
+    out.append("namespace %s {" % namespace)
+    for message in messages:
+        out.append("")
+        out.append("/// @brief %s" % message["name"])
+        out.append("namespace %s {" % identifier(message["name"]))
+        out.append("constexpr uint32_t FRAME_ID = 0x%Xu;" % message["frame_id"])
+        out.append("constexpr bool EXTENDED_ID = %s;" % ("true" if message["extended"] else "false"))
+        out.append("constexpr uint8_t LENGTH = %d;" % message["length"])
+        for signal in message["signals"]:
+            order = "BIG_ENDIAN_ORDER" if signal["big_endian"] else "LITTLE_ENDIAN_ORDER"
+            comment = "[%s|%s]" % (signal["minimum"], signal["maximum"])
+            if signal["unit"]:
+                comment += " %s" % signal["unit"]
+            out.append("/// @brief %s" % comment)
+            out.append(
+                "constexpr stmepic::CanSignal %s = { %d, %d, stmepic::CanByteOrder::%s, %s, %s, %s };"
+                % (identifier(signal["name"]), signal["start_bit"], signal["length"], order,
+                   "true" if signal["signed"] else "false", float_literal(signal["scale"]),
+                   float_literal(signal["offset"])))
+        out.append("} // namespace %s" % identifier(message["name"]))
+    out.append("")
+    out.append("} // namespace %s" % namespace)
+    out.append("")
+    return "\n".join(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("dbc", help="input DBC file")
+    parser.add_argument("-o", "--output", help="output header, stdout if not set")
+    parser.add_argument("-n", "--namespace", default="can_signals", help="namespace of the generated signals")
+    args = parser.parse_args()
+
+    with open(args.dbc, encoding="latin-1") as file:
+        messages = parse_dbc(file.read())
+    header = generate(messages, args.namespace, args.dbc.split("/")[-1])
+    if args.output:
+        with open(args.output, "w", encoding="utf-8") as file:
+            file.write(header)
+    else:
+        sys.stdout.write(header)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())